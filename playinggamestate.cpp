@@ -58,6 +58,9 @@ const string music_key_combat_c = "combat_music";
 const string music_key_trade_c = "trade";
 const string music_key_game_over_c = "game_over";
 
+const int ai_think_interval_ms_c = 100; // how often the player, and NPCs near the player, think - see PlayingGamestate::updateAI()
+const int ai_default_budget_us_c = 2000; // time that each PlayingGamestate::updateAI() call may spend on NPCs
+
 PlayingGamestate *PlayingGamestate::playingGamestate = NULL;
 
 Direction directionFromVecDir(Vector2D dir) {
@@ -79,20 +82,66 @@ Direction directionFromVecDir(Vector2D dir) {
     return direction;
 }
 
-CharacterAction::CharacterAction(Type type, Character *source, Character *target_npc, float offset_y) : type(type), source(source), target_npc(target_npc), time_ms(0), duration_ms(0), offset_y(offset_y), hits(false), weapon_no_effect_magical(false), weapon_no_effect_holy(false), weapon_damage(0), spell(NULL), object(NULL) {
+CharacterAction::CharacterAction(Type type, Character *source, Character *target_npc, float offset_y) : object(NULL) {
+    this->init(type, source, target_npc, offset_y);
+}
+
+void CharacterAction::init(Type type, Character *source, Character *target_npc, float offset_y) {
+    // n.b., object must already have been released
+    ASSERT_LOGGER( this->object == NULL );
+    this->type = type;
+    this->source = CharacterHandle(source);
+    this->target_npc = CharacterHandle(target_npc);
+    this->duration_ms = 0;
+    this->offset_y = offset_y;
+    this->hits = false;
+    this->weapon_no_effect_magical = false;
+    this->weapon_no_effect_holy = false;
+    this->weapon_damage = 0;
+    this->spell = NULL;
+    this->projectile_key = Symbol();
     this->source_pos = source->getPos();
     this->dest_pos = target_npc->getPos();
     this->time_ms = game_g->getGameTimeTotalMS();
 }
 
+CharacterAction *CharacterAction::create(PlayingGamestate *playing_gamestate, Type type, Character *source, Character *target_npc, float offset_y) {
+    CharacterAction *character_action = playing_gamestate->reuseCharacterAction();
+    if( character_action == NULL ) {
+        character_action = new CharacterAction(type, source, target_npc, offset_y);
+    }
+    else {
+        character_action->init(type, source, target_npc, offset_y);
+    }
+    return character_action;
+}
+
 CharacterAction::~CharacterAction() {
     if( this->object != NULL ) {
         delete this->object;
     }
 }
 
+void CharacterAction::release(PlayingGamestate *playing_gamestate) {
+    // returns the action to the PlayingGamestate's pool, keeping projectile graphics for reuse
+    if( this->object != NULL ) {
+        if( !this->projectile_key.empty() ) {
+            playing_gamestate->freeProjectileObject(this->projectile_key, static_cast<AnimatedObject *>(this->object));
+        }
+        else {
+            delete this->object;
+        }
+        this->object = NULL;
+    }
+    this->source = CharacterHandle();
+    this->target_npc = CharacterHandle();
+    playing_gamestate->freeCharacterAction(this);
+}
+
 void CharacterAction::implement(PlayingGamestate *playing_gamestate) const {
     qDebug("CharacterAction::implement()");
+    Character *source = this->source.get();
+    Character *target_npc = this->target_npc.get();
     if( target_npc == NULL ) {
         // target no longer exists
         qDebug("target no longer exists");
@@ -111,9 +160,10 @@ void CharacterAction::implement(PlayingGamestate *playing_gamestate) const {
 }
 
 void CharacterAction::update() {
-    if( this->target_npc != NULL ) {
+    Character *target_npc = this->target_npc.get();
+    if( target_npc != NULL ) {
         // update destination
-        this->dest_pos = this->target_npc->getPos();
+        this->dest_pos = target_npc->getPos();
     }
     if( this->object != NULL ) {
         int diff_ms = game_g->getGameTimeTotalMS() - this->time_ms;
@@ -127,13 +177,6 @@ void CharacterAction::update() {
     }
 }
 
-void CharacterAction::notifyDead(const Character *character) {
-    if( character == this->source )
-        this->source = NULL;
-    if( character == this->target_npc )
-        this->target_npc = NULL;
-}
-
 bool CharacterAction::isExpired() const {
     if( game_g->getGameTimeTotalMS() >= time_ms + duration_ms ) {
         return true;
@@ -142,7 +185,7 @@ bool CharacterAction::isExpired() const {
 }
 
 CharacterAction *CharacterAction::createSpellAction(PlayingGamestate *playing_gamestate, Character *source, Character *target_npc, const Spell *spell) {
-    CharacterAction *character_action = new CharacterAction(CHARACTERACTION_SPELL, source, target_npc, -0.75f);
+    CharacterAction *character_action = CharacterAction::create(playing_gamestate, CHARACTERACTION_SPELL, source, target_npc, -0.75f);
     //character_action->duration_ms = 250;
     const float speed = 0.01f; // units per ms
     character_action->duration_ms = (int)((character_action->dest_pos - character_action->source_pos).magnitude() / speed);
@@ -153,7 +196,7 @@ CharacterAction *CharacterAction::createSpellAction(PlayingGamestate *playing_ga
 
 CharacterAction *CharacterAction::createProjectileAction(PlayingGamestate *playing_gamestate, Character *source, Character *target_npc, bool hits, bool weapon_no_effect_magical, bool weapon_no_effect_holy, int weapon_damage, const string &projectile_key, float icon_width) {
     qDebug("CharacterAction::createProjectileAction()");
-    CharacterAction *character_action = new CharacterAction(CHARACTERACTION_RANGED_WEAPON, source, target_npc, -0.75f);
+    CharacterAction *character_action = CharacterAction::create(playing_gamestate, CHARACTERACTION_RANGED_WEAPON, source, target_npc, -0.75f);
     //character_action->duration_ms = 250;
     const float speed = 0.02f; // units per ms
     character_action->duration_ms = (int)((character_action->dest_pos - character_action->source_pos).magnitude() / speed);
@@ -162,10 +205,19 @@ CharacterAction *CharacterAction::createProjectileAction(PlayingGamestate *playi
     character_action->weapon_no_effect_holy = weapon_no_effect_holy;
     character_action->weapon_damage = weapon_damage;
 
-    AnimatedObject *object = new AnimatedObject();
+    character_action->projectile_key = Symbol(projectile_key);
+    AnimatedObject *object = playing_gamestate->reuseProjectileObject(character_action->projectile_key);
+    if( object == NULL ) {
+        object = new AnimatedObject();
+        object->addAnimationLayer( playing_gamestate->getProjectileAnimationLayer(projectile_key) );
+        playing_gamestate->addGraphicsItem(object, icon_width, true);
+    }
+    else {
+        // n.b., still rescale, as the icon width may differ between items with the same projectile
+        playing_gamestate->scaleGraphicsItem(object, icon_width, true);
+        object->setVisible(true);
+    }
     character_action->object = object;
-    object->addAnimationLayer( playing_gamestate->getProjectileAnimationLayer(projectile_key) );
-    playing_gamestate->addGraphicsItem(object, icon_width, true);
 
     Vector2D dir = character_action->dest_pos - character_action->source_pos;
     Direction direction = directionFromVecDir(dir);
@@ -2005,7 +2057,8 @@ PlayingGamestate::PlayingGamestate(bool is_savegame, GameType gameType, const st
     difficulty(DIFFICULTY_MEDIUM), permadeath(permadeath), permadeath_has_savefilename(false), player(NULL), time_hours(1), c_quest_indx(0), c_location(NULL), quest(NULL), gameType(gameType),
     is_keyboard_moving(false),
     target_animation_layer(NULL), target_item(NULL),
-    time_last_complex_update_ms(0),
+    time_last_complex_update_ms(0), ai_budget_us(ai_default_budget_us_c),
+    dormancy_location(NULL), dormancy_player_region(-1), dormancy_boundaries_version(0),
     need_visibility_update(false),
     has_ingame_music(false),
     music_mode(MUSICMODE_SILENCE), time_combat_ended(-1),
@@ -2490,9 +2543,9 @@ PlayingGamestate::PlayingGamestate(bool is_savegame, GameType gameType, const st
                                 animation_layer_definition.push_back( AnimationLayerDefinition("", 0, 1, AnimationSet::ANIMATIONTYPE_SINGLE, 100) );
                             }
                             if( filename.length() > 0 )
-                                this->scenery_animation_layers[name.toStdString()] = new LazyAnimationLayer(filename.toStdString(), animation_layer_definition, clip, xpos, ypos, width, height, stride_x, stride_y, expected_width, 1);
+                                this->scenery_animation_layers[Symbol(name.toStdString())] = new LazyAnimationLayer(filename.toStdString(), animation_layer_definition, clip, xpos, ypos, width, height, stride_x, stride_y, expected_width, 1);
                             else
-                                this->scenery_animation_layers[name.toStdString()] = new LazyAnimationLayer(pixmap, animation_layer_definition, clip, xpos, ypos, width, height, stride_x, stride_y, expected_width, 1);
+                                this->scenery_animation_layers[Symbol(name.toStdString())] = new LazyAnimationLayer(pixmap, animation_layer_definition, clip, xpos, ypos, width, height, stride_x, stride_y, expected_width, 1);
                         }
                         else if( type == "npc" ) {
                             unsigned int n_dimensions = animation_layer_definition.size() > 0 ? N_DIRECTIONS : 1;
@@ -2500,9 +2553,9 @@ PlayingGamestate::PlayingGamestate(bool is_savegame, GameType gameType, const st
                                 animation_layer_definition.push_back( AnimationLayerDefinition("", 0, 1, AnimationSet::ANIMATIONTYPE_SINGLE, 100) );
                             }
                             if( filename.length() > 0 )
-                                this->animation_layers[name.toStdString()] = new LazyAnimationLayer(filename.toStdString(), animation_layer_definition, clip, xpos, ypos, width, height, stride_x, stride_y, expected_width, n_dimensions);
+                                this->animation_layers[Symbol(name.toStdString())] = new LazyAnimationLayer(filename.toStdString(), animation_layer_definition, clip, xpos, ypos, width, height, stride_x, stride_y, expected_width, n_dimensions);
                             else
-                                this->animation_layers[name.toStdString()] = new LazyAnimationLayer(pixmap, animation_layer_definition, clip, xpos, ypos, width, height, stride_x, stride_y, expected_width, n_dimensions);
+                                this->animation_layers[Symbol(name.toStdString())] = new LazyAnimationLayer(pixmap, animation_layer_definition, clip, xpos, ypos, width, height, stride_x, stride_y, expected_width, n_dimensions);
                         }
                         else {
                             LOG("error at line %d\n", reader.lineNumber());
@@ -2521,11 +2574,11 @@ PlayingGamestate::PlayingGamestate(bool is_savegame, GameType gameType, const st
 
         /*{
             // force all lazily loaded data to be loaded
-            for(map<string, LazyAnimationLayer *>::iterator iter = this->animation_layers.begin(); iter != this->animation_layers.end(); ++iter) {
+            for(map<Symbol, LazyAnimationLayer *>::iterator iter = this->animation_layers.begin(); iter != this->animation_layers.end(); ++iter) {
                 LazyAnimationLayer *animation_layer = (*iter).second;
                 animation_layer->getAnimationLayer();
             }
-            for(map<string, LazyAnimationLayer *>::iterator iter = this->scenery_animation_layers.begin(); iter != this->scenery_animation_layers.end(); ++iter) {
+            for(map<Symbol, LazyAnimationLayer *>::iterator iter = this->scenery_animation_layers.begin(); iter != this->scenery_animation_layers.end(); ++iter) {
                 LazyAnimationLayer *animation_layer = (*iter).second;
                 animation_layer->getAnimationLayer();
             }
@@ -3174,11 +3227,16 @@ void PlayingGamestate::cleanup() {
     delete quest;
     quest = NULL;
     c_location = NULL;
+    releaseSmallObjectChunks();
 
     for(vector<CharacterAction *>::iterator iter = this->character_actions.begin(); iter != this->character_actions.end(); ++iter) {
         CharacterAction *character_action = *iter;
         delete character_action;
     }
+    for(vector<CharacterAction *>::iterator iter = this->free_character_actions.begin(); iter != this->free_character_actions.end(); ++iter) {
+        CharacterAction *character_action = *iter;
+        delete character_action;
+    }
     if( this->target_animation_layer != NULL ) {
         delete this->target_animation_layer;
     }
@@ -3186,7 +3244,7 @@ void PlayingGamestate::cleanup() {
         AnimationLayer *animation_layer = (*iter).second;
         delete animation_layer;
     }*/
-    for(map<string, LazyAnimationLayer *>::iterator iter = this->animation_layers.begin(); iter != this->animation_layers.end(); ++iter) {
+    for(map<Symbol, LazyAnimationLayer *>::iterator iter = this->animation_layers.begin(); iter != this->animation_layers.end(); ++iter) {
         LazyAnimationLayer *animation_layer = (*iter).second;
         delete animation_layer;
     }
@@ -3194,7 +3252,7 @@ void PlayingGamestate::cleanup() {
         AnimationLayer *animation_layer = (*iter).second;
         delete animation_layer;
     }*/
-    for(map<string, LazyAnimationLayer *>::iterator iter = this->scenery_animation_layers.begin(); iter != this->scenery_animation_layers.end(); ++iter) {
+    for(map<Symbol, LazyAnimationLayer *>::iterator iter = this->scenery_animation_layers.begin(); iter != this->scenery_animation_layers.end(); ++iter) {
         LazyAnimationLayer *animation_layer = (*iter).second;
         delete animation_layer;
     }
@@ -3266,12 +3324,12 @@ void PlayingGamestate::loadPlayerAnimation() {
     }
     string player_folder = "gfx/textures/" + animation_folder + "/";
     LOG("player_folder: %s\n", player_folder.c_str());
-    this->animation_layers["player"] = new LazyAnimationLayer(AnimationLayer::create(string(DEPLOYMENT_PATH) + player_folder + "player.png", player_animation_layer_definition, true, off_x, off_y, width, height, expected_stride_x, expected_stride_y, expected_total_width, N_DIRECTIONS));
-    this->animation_layers["longsword"] = new LazyAnimationLayer(AnimationLayer::create(string(DEPLOYMENT_PATH) + player_folder + "longsword.png", player_animation_layer_definition, true, off_x, off_y, width, height, expected_stride_x, expected_stride_y, expected_total_width, N_DIRECTIONS));
-    this->animation_layers["sling"] = new LazyAnimationLayer(AnimationLayer::create(string(DEPLOYMENT_PATH) + player_folder + "sling.png", player_animation_layer_definition, true, off_x, off_y, width, height, expected_stride_x, expected_stride_y, expected_total_width, N_DIRECTIONS));
-    this->animation_layers["longbow"] = new LazyAnimationLayer(AnimationLayer::create(string(DEPLOYMENT_PATH) + player_folder + "longbow.png", player_animation_layer_definition, true, off_x, off_y, width, height, expected_stride_x, expected_stride_y, expected_total_width, N_DIRECTIONS));
-    this->animation_layers["dagger"] = new LazyAnimationLayer(AnimationLayer::create(string(DEPLOYMENT_PATH) + player_folder + "dagger.png", player_animation_layer_definition, true, off_x, off_y, width, height, expected_stride_x, expected_stride_y, expected_total_width, N_DIRECTIONS));
-    this->animation_layers["shield"] = new LazyAnimationLayer(AnimationLayer::create(string(DEPLOYMENT_PATH) + player_folder + "shield.png", player_animation_layer_definition, true, off_x, off_y, width, height, expected_stride_x, expected_stride_y, expected_total_width, N_DIRECTIONS));
+    this->animation_layers[Symbol("player")] = new LazyAnimationLayer(AnimationLayer::create(string(DEPLOYMENT_PATH) + player_folder + "player.png", player_animation_layer_definition, true, off_x, off_y, width, height, expected_stride_x, expected_stride_y, expected_total_width, N_DIRECTIONS));
+    this->animation_layers[Symbol("longsword")] = new LazyAnimationLayer(AnimationLayer::create(string(DEPLOYMENT_PATH) + player_folder + "longsword.png", player_animation_layer_definition, true, off_x, off_y, width, height, expected_stride_x, expected_stride_y, expected_total_width, N_DIRECTIONS));
+    this->animation_layers[Symbol("sling")] = new LazyAnimationLayer(AnimationLayer::create(string(DEPLOYMENT_PATH) + player_folder + "sling.png", player_animation_layer_definition, true, off_x, off_y, width, height, expected_stride_x, expected_stride_y, expected_total_width, N_DIRECTIONS));
+    this->animation_layers[Symbol("longbow")] = new LazyAnimationLayer(AnimationLayer::create(string(DEPLOYMENT_PATH) + player_folder + "longbow.png", player_animation_layer_definition, true, off_x, off_y, width, height, expected_stride_x, expected_stride_y, expected_total_width, N_DIRECTIONS));
+    this->animation_layers[Symbol("dagger")] = new LazyAnimationLayer(AnimationLayer::create(string(DEPLOYMENT_PATH) + player_folder + "dagger.png", player_animation_layer_definition, true, off_x, off_y, width, height, expected_stride_x, expected_stride_y, expected_total_width, N_DIRECTIONS));
+    this->animation_layers[Symbol("shield")] = new LazyAnimationLayer(AnimationLayer::create(string(DEPLOYMENT_PATH) + player_folder + "shield.png", player_animation_layer_definition, true, off_x, off_y, width, height, expected_stride_x, expected_stride_y, expected_total_width, N_DIRECTIONS));
 }
 
 float PlayingGamestate::getDifficultyModifier() const {
@@ -3329,21 +3387,21 @@ void PlayingGamestate::quickSave() {
     }
 }
 
-void PlayingGamestate::parseXMLItemProfileAttributeInt(Item *item, const QXmlStreamReader &reader, const string &key) const {
+void PlayingGamestate::parseXMLItemProfileAttributeInt(Profile *profile_bonus, const QXmlStreamReader &reader, const string &key) const {
     string attribute = "bonus_" + key;
     QStringRef attribute_sr = reader.attributes().value(attribute.c_str());
     if( attribute_sr.length() != 0 ) {
         int value = parseInt(attribute_sr.toString());
-        item->setProfileBonusIntProperty(key, value);
+        profile_bonus->setIntProperty(key, value);
     }
 }
 
-void PlayingGamestate::parseXMLItemProfileAttributeFloat(Item *item, const QXmlStreamReader &reader, const string &key) const {
+void PlayingGamestate::parseXMLItemProfileAttributeFloat(Profile *profile_bonus, const QXmlStreamReader &reader, const string &key) const {
     string attribute = "bonus_" + key;
     QStringRef attribute_sr = reader.attributes().value(attribute.c_str());
     if( attribute_sr.length() != 0 ) {
         float value = parseFloat(attribute_sr.toString());
-        item->setProfileBonusFloatProperty(key, value);
+        profile_bonus->setFloatProperty(key, value);
     }
 }
 
@@ -3371,14 +3429,13 @@ Item *PlayingGamestate::parseXMLItem(QXmlStreamReader &reader) const {
     QStringRef name_s = reader.attributes().value("name");
     QStringRef image_name_s = reader.attributes().value("image_name");
     QStringRef icon_width_s = reader.attributes().value("icon_width");
+    QStringRef use_s;
+    QStringRef use_verb_s;
 
     if( reader.name() == "item" ) {
-        QStringRef use_s = reader.attributes().value("use");
-        QStringRef use_verb_s = reader.attributes().value("use_verb");
+        use_s = reader.attributes().value("use");
+        use_verb_s = reader.attributes().value("use_verb");
         item = new Item(name_s.toString().toStdString(), image_name_s.toString().toStdString(), weight);
-        if( use_s.length() > 0 ) {
-            item->setUse(use_s.toString().toStdString(), use_verb_s.toString().toStdString());
-        }
     }
     else if( reader.name() == "weapon" ) {
         //qDebug("    weapon:");
@@ -3495,20 +3552,27 @@ Item *PlayingGamestate::parseXMLItem(QXmlStreamReader &reader) const {
         }
         item->setArg1(arg1);
         item->setArg2(arg2);
-        item->setArg1s(arg1_s.toStdString());
         item->setRating(rating);
         item->setMagical(magical);
-        item->setBaseTemplate(base_template.toStdString());
         item->setWorthBonus(worth_bonus);
 
-        this->parseXMLItemProfileAttributeInt(item, reader, profile_key_FP_c);
-        this->parseXMLItemProfileAttributeInt(item, reader, profile_key_BS_c);
-        this->parseXMLItemProfileAttributeInt(item, reader, profile_key_S_c);
-        this->parseXMLItemProfileAttributeInt(item, reader, profile_key_A_c);
-        this->parseXMLItemProfileAttributeInt(item, reader, profile_key_M_c);
-        this->parseXMLItemProfileAttributeInt(item, reader, profile_key_D_c);
-        this->parseXMLItemProfileAttributeInt(item, reader, profile_key_B_c);
-        this->parseXMLItemProfileAttributeFloat(item, reader, profile_key_Sp_c);
+        // fill in the template values, so that only one template is looked up for the item
+        ItemTemplate item_template(*item->getTemplate());
+        if( use_s.length() > 0 ) {
+            item_template.use = use_s.toString().toStdString();
+            item_template.use_verb = use_verb_s.toString().toStdString();
+        }
+        item_template.arg1_s = arg1_s.toStdString();
+        item_template.base_template = base_template.toStdString();
+
+        this->parseXMLItemProfileAttributeInt(&item_template.profile_bonus, reader, profile_key_FP_c);
+        this->parseXMLItemProfileAttributeInt(&item_template.profile_bonus, reader, profile_key_BS_c);
+        this->parseXMLItemProfileAttributeInt(&item_template.profile_bonus, reader, profile_key_S_c);
+        this->parseXMLItemProfileAttributeInt(&item_template.profile_bonus, reader, profile_key_A_c);
+        this->parseXMLItemProfileAttributeInt(&item_template.profile_bonus, reader, profile_key_M_c);
+        this->parseXMLItemProfileAttributeInt(&item_template.profile_bonus, reader, profile_key_D_c);
+        this->parseXMLItemProfileAttributeInt(&item_template.profile_bonus, reader, profile_key_B_c);
+        this->parseXMLItemProfileAttributeFloat(&item_template.profile_bonus, reader, profile_key_Sp_c);
 
         // must be done last - will read to the end element
         QString description = reader.readElementText(QXmlStreamReader::IncludeChildElements);
@@ -3516,7 +3580,8 @@ Item *PlayingGamestate::parseXMLItem(QXmlStreamReader &reader) const {
         while( description.length() > 0 && description.at(0).isSpace() ) {
             description = description.mid(1);
         }
-        item->setDescription(description.toStdString());
+        item_template.description = description.toStdString();
+        item->setTemplate(item_template);
     }
     return item;
 }
@@ -3533,7 +3598,7 @@ void PlayingGamestate::moveToLocation(Location *location, Vector2D pos) {
         this->player->getLocation()->removeCharacter(this->player);
         this->player->setListener(NULL, NULL);
     }
-    view->clear();
+    this->clearView();
     this->target_item = NULL;
     for(set<Character *>::iterator iter = c_location->charactersBegin(); iter != c_location->charactersEnd(); ++iter) {
         Character *character = *iter;
@@ -3876,8 +3941,8 @@ void PlayingGamestate::refreshDebugItems() {
             QGraphicsItem *item = scene->addEllipse(path_way_point.x - radius, path_way_point.y - radius, 2.0f*radius, 2.0f*radius, wall_pen);
             this->debug_items.push_back(item);
             // n.b., draws edges twice, but doesn't matter for debug purposes...
-            for(size_t j=0;j<vertex->getNNeighbours();j++) {
-                const GraphVertex *o_vertex = vertex->getNeighbour(distance_graph, j);
+            for(size_t j=0;j<distance_graph->getNNeighbours(i);j++) {
+                const GraphVertex *o_vertex = distance_graph->getVertex( distance_graph->getNeighbourId(i, j) );
                 Vector2D o_path_way_point = o_vertex->getPos();
                 float x1 = path_way_point.x;
                 float y1 = path_way_point.y;
@@ -4393,7 +4458,17 @@ Scenery *PlayingGamestate::loadScenery(QXmlStreamReader &reader) const {
 
     this->querySceneryImage(&size_w, &size_h, &visual_h, image_name_s.toString().toStdString(), has_size, size, size_w, size_h, has_visual_h, visual_h);
 
-    Scenery *scenery = new Scenery(name_s.toString().toStdString(), image_name_s.toString().toStdString(), size_w, size_h, visual_h, boundary_iso, boundary_iso_ratio);
+    // set all the template values up front, so only one template is looked up
+    SceneryTemplate scenery_template(name_s.toString().toStdString(), image_name_s.toString().toStdString(), size_w, size_h, visual_h, boundary_iso, boundary_iso_ratio);
+    scenery_template.big_image_name = big_image_name_s.toString().toStdString();
+    scenery_template.interact_type = interact_type_s.toString().toStdString();
+    scenery_template.requires_flag = requires_flag_s.toString().toStdString();
+    scenery_template.exit_location = exit_location_s.toString().toStdString();
+    scenery_template.locked_text = locked_text_s.toString().toStdString();
+    scenery_template.unlock_item_name = unlock_item_name_s.toString().toStdString();
+    scenery_template.unlock_text = unlock_text_s.toString().toStdString();
+    scenery_template.confirm_text = confirm_text_s.toString().toStdString();
+    Scenery *scenery = new Scenery(scenery_template);
 
     if( door && exit ) {
         LOG("error at line %d\n", reader.lineNumber());
@@ -4408,7 +4483,7 @@ Scenery *PlayingGamestate::loadScenery(QXmlStreamReader &reader) const {
         throw string("scenery can't be both an exit_location and a door");
     }
 
-    map<string, LazyAnimationLayer *>::const_iterator animation_iter = this->scenery_animation_layers.find(image_name_s.toString().toStdString());
+    map<Symbol, LazyAnimationLayer *>::const_iterator animation_iter = this->scenery_animation_layers.find(Symbol(image_name_s.toString().toStdString()));
     if( animation_iter == this->scenery_animation_layers.end() ) {
         LOG("failed to find image for scenery: %s\n", name_s.toString().toStdString().c_str());
         LOG("    image name: %s\n", image_name_s.toString().toStdString().c_str());
@@ -4419,9 +4494,6 @@ Scenery *PlayingGamestate::loadScenery(QXmlStreamReader &reader) const {
         scenery->setCanBeOpened(true);
     }
 
-    if( big_image_name_s.length() > 0 ) {
-        scenery->setBigImageName(big_image_name_s.toString().toStdString());
-    }
     scenery->setBlocking(blocking, block_visibility);
     if( is_opened && !scenery->canBeOpened() ) {
         qDebug("trying to set is_opened on scenery that can't be opened: %s at %f, %f", scenery->getName().c_str(), scenery->getX(), scenery->getY());
@@ -4472,16 +4544,10 @@ Scenery *PlayingGamestate::loadScenery(QXmlStreamReader &reader) const {
         int action_value = parseInt(action_value_s.toString());
         scenery->setActionValue(action_value);
     }
-    if( interact_type_s.length() > 0 ) {
-        scenery->setInteractType(interact_type_s.toString().toStdString());
-    }
     if( interact_state_s.length() > 0 ) {
         int interact_state = parseInt(interact_state_s.toString());
         scenery->setInteractState(interact_state);
     }
-    if( requires_flag_s.length() > 0 ) {
-        scenery->setRequiresFlag(requires_flag_s.toString().toStdString());
-    }
     scenery->setDoor(door);
     scenery->setExit(exit);
     if( exit_location_s.length() > 0 ) {
@@ -4495,25 +4561,12 @@ Scenery *PlayingGamestate::loadScenery(QXmlStreamReader &reader) const {
     }
     scenery->setLocked(locked);
     scenery->setLockedSilent(locked_silent);
-    if( locked_text_s.length() > 0 ) {
-        scenery->setLockedText(locked_text_s.toString().toStdString());
-    }
     scenery->setLockedUsedUp(locked_used_up);
     scenery->setKeyAlwaysNeeded(key_always_needed);
-    if( unlock_item_name_s.length() > 0 ) {
-        scenery->setUnlockItemName(unlock_item_name_s.toString().toStdString());
-    }
-    if( unlock_text_s.length() > 0 ) {
-        scenery->setUnlockText(unlock_text_s.toString().toStdString());
-    }
-
     if( unlock_xp_s.length() > 0 ) {
         int unlock_xp = parseInt(unlock_xp_s.toString());
         scenery->setUnlockXP(unlock_xp);
     }
-    if( confirm_text_s.length() > 0 ) {
-        scenery->setConfirmText(confirm_text_s.toString().toStdString());
-    }
 
     // now read remaining elements
     while( !reader.atEnd() && !reader.hasError() ) {
@@ -4803,7 +4856,7 @@ vector<RandomScenery> PlayingGamestate::loadRandomScenery(QXmlStreamReader &read
 
 void PlayingGamestate::querySceneryImage(float *ret_size_w, float *ret_size_h, float *ret_visual_h, const string &image_name, bool has_size, float size, float size_w, float size_h, bool has_visual_h, float visual_h) const {
     // side-effect: pre-loads any lazy images
-    map<string, LazyAnimationLayer *>::const_iterator animation_iter = this->scenery_animation_layers.find(image_name);
+    map<Symbol, LazyAnimationLayer *>::const_iterator animation_iter = this->scenery_animation_layers.find(Symbol(image_name));
     if( animation_iter == this->scenery_animation_layers.end() ) {
         LOG("failed to find image for scenery\n");
         LOG("    image name: %s\n", image_name.c_str());
@@ -4876,9 +4929,11 @@ void PlayingGamestate::loadQuest(const QString &filename, bool is_savegame, bool
     if( this->quest != NULL ) {
         qDebug("delete previous quest...\n");
         delete this->quest;
+        // don't keep the previous quest's peak memory use
+        releaseSmallObjectChunks();
     }
     // delete any items from previous quests
-    view->clear();
+    this->clearView();
     this->target_item = NULL;
     //this->closeAllSubWindows(); // just to be safe - e.g., when moving onto next quest from campaign window
 
@@ -5470,9 +5525,11 @@ void PlayingGamestate::createRandomQuest(bool force_start, bool passageway_start
     if( this->quest != NULL ) {
         qDebug("delete previous quest...\n");
         delete this->quest;
+        // don't keep the previous quest's peak memory use
+        releaseSmallObjectChunks();
     }
     // delete any items from previous quests
-    view->clear();
+    this->clearView();
     this->target_item = NULL;
     //this->closeAllSubWindows(); // just to be safe - e.g., when moving onto next quest from campaign window
 
@@ -5702,10 +5759,11 @@ void PlayingGamestate::processLocations(int progress_lo, int progress_hi) {
         loc->createBoundariesForFixedNPCs();
         loc->addSceneryToFloorRegions();
         loc->calculateDistanceGraph();
+        loc->calculatePVS();
         for(set<Character *>::iterator iter2 = loc->charactersBegin(); iter2 != loc->charactersEnd(); ++iter2) {
             Character *character = *iter2;
             if( character != player && !character->isStaticImage() ) {
-                map<string, LazyAnimationLayer *>::const_iterator iter3 = this->animation_layers.find( character->getAnimationName() );
+                map<Symbol, LazyAnimationLayer *>::const_iterator iter3 = this->animation_layers.find( character->getAnimationName() );
                 if( iter3 == this->animation_layers.end() ) {
                     LOG("can't find animation layer %s for %s\n", character->getAnimationName().c_str(), character->getName().c_str());
                     throw string("can't find animation layer");
@@ -5718,7 +5776,46 @@ void PlayingGamestate::processLocations(int progress_lo, int progress_hi) {
     gui_overlay->setProgress(progress_hi);
 }
 
-void PlayingGamestate::addGraphicsItem(QGraphicsItem *object, float width, bool undo_3d) {
+void PlayingGamestate::clearView() {
+    // the scene owns the graphics of actions in progress, and the hidden projectile graphics
+    for(vector<CharacterAction *>::iterator iter = this->character_actions.begin(); iter != this->character_actions.end(); ++iter) {
+        CharacterAction *character_action = *iter;
+        character_action->detachObject();
+    }
+    this->free_projectile_objects.clear();
+    view->clear();
+}
+
+CharacterAction *PlayingGamestate::reuseCharacterAction() {
+    if( this->free_character_actions.size() == 0 ) {
+        return NULL;
+    }
+    CharacterAction *character_action = this->free_character_actions.back();
+    this->free_character_actions.pop_back();
+    return character_action;
+}
+
+void PlayingGamestate::freeCharacterAction(CharacterAction *character_action) {
+    this->free_character_actions.push_back(character_action);
+}
+
+AnimatedObject *PlayingGamestate::reuseProjectileObject(Symbol projectile_key) {
+    map<Symbol, vector<AnimatedObject *> >::iterator iter = this->free_projectile_objects.find(projectile_key);
+    if( iter == this->free_projectile_objects.end() || iter->second.size() == 0 ) {
+        return NULL;
+    }
+    AnimatedObject *object = iter->second.back();
+    iter->second.pop_back();
+    return object;
+}
+
+void PlayingGamestate::freeProjectileObject(Symbol projectile_key, AnimatedObject *object) {
+    // keep in the scene, but hidden
+    object->setVisible(false);
+    this->free_projectile_objects[projectile_key].push_back(object);
+}
+
+void PlayingGamestate::scaleGraphicsItem(QGraphicsItem *object, float width, bool undo_3d) {
     float item_scale = width / object->boundingRect().width();
     if( this->view_transform_3d && undo_3d ) {
         // undo the 3D transform
@@ -5733,6 +5830,10 @@ void PlayingGamestate::addGraphicsItem(QGraphicsItem *object, float width, bool
         object->setTransformOriginPoint(-0.5f*object->boundingRect().width()*item_scale, -0.5f*object->boundingRect().height()*item_scale);
         object->setScale(item_scale);
     }
+}
+
+void PlayingGamestate::addGraphicsItem(QGraphicsItem *object, float width, bool undo_3d) {
+    this->scaleGraphicsItem(object, width, undo_3d);
     scene->addItem(object);
 }
 
@@ -5867,7 +5968,7 @@ void PlayingGamestate::locationUpdateScenery(Scenery *scenery) {
         AnimatedObject *object = static_cast<AnimatedObject *>(scenery->getUserGfxData(i));
         object->clearAnimationLayers();
         //qDebug("update scenery: %s", scenery->getName().c_str());
-        object->addAnimationLayer( this->scenery_animation_layers[scenery->getImageName()]->getAnimationLayer() );
+        object->addAnimationLayer( this->scenery_animation_layers[Symbol(scenery->getImageName())]->getAnimationLayer() );
         if( scenery->isOpened() ) {
             object->setAnimationSet("opened", true);
         }
@@ -5888,6 +5989,7 @@ void PlayingGamestate::locationAddCharacter(const Location *, Character *charact
     if( character != player ) {
         // default to invisible for NPCs, until set by testFogOfWar()
         object->setVisible(false);
+        character->clearVisibilityCache();
     }
     int character_size = std::max(object->getWidth(), object->getHeight());
     float ratio_w = object->getWidth()/(float)character_size;
@@ -6247,17 +6349,134 @@ void PlayingGamestate::quitGame() {
 }
 
 void PlayingGamestate::testFogOfWar() {
-    for(set<Character *>::iterator iter = c_location->charactersBegin(); iter != c_location->charactersEnd(); ++iter) {
+    Vector2D player_pos = player->getPos();
+    int boundaries_version = c_location->getBoundariesVersion();
+    int player_region = c_location->findFloorRegionIndexAt(player_pos);
+    // dormant NPCs are too far away to be visible, and were set as not visible before becoming dormant
+    for(set<Character *>::iterator iter = c_location->activeCharactersBegin(); iter != c_location->activeCharactersEnd(); ++iter) {
         Character *character = *iter;
         if( character != this->player ) {
-            bool is_visible = c_location->visibilityTest(player->getPos(), character->getPos());
+            if( character->isVisibilityCacheValid(player_pos, player_region, boundaries_version) ) {
+                // neither the player nor this NPC has moved far enough (or out of floor regions that can't see each other) to change the result
+                continue;
+            }
+            int region = c_location->findFloorRegionIndexAt(character->getPos());
+            bool is_visible = c_location->canFloorRegionsSee(player_region, region) && c_location->visibilityTest(player_pos, character->getPos());
             character->setVisible(is_visible);
+            character->setVisibilityCache(player_pos, region, player_region, boundaries_version);
             AnimatedObject *object = static_cast<AnimatedObject *>(character->getListenerData());
             object->setVisible(is_visible);
         }
     }
 }
 
+bool PlayingGamestate::canBeDormant(const Character *character, int player_region) const {
+    if( ( character->getPos() - player->getPos() ).square() <= npc_dormant_dist_c*npc_dormant_dist_c ) {
+        return false;
+    }
+    if( c_location->isPVSCalculated() && c_location->canFloorRegionsSee(player_region, c_location->findFloorRegionIndexAt(character->getPos())) ) {
+        return false;
+    }
+    return true;
+}
+
+void PlayingGamestate::updateDormancy() {
+    // NPCs that are far from the player, in floor regions that the player can't see into, and have nothing to do, become
+    // dormant, so that they aren't updated; they are woken when this no longer holds, when hearing combat (see
+    // Location::wakeCharacters()), or when damaged
+    Vector2D player_pos = player->getPos();
+    int player_region = c_location->findFloorRegionIndexAt(player_pos);
+    // dormant NPCs don't move, so can only need waking if the player comes near, or into a floor region that can see them
+    c_location->wakeCharacters(player_pos, npc_dormant_dist_c);
+    if( c_location != this->dormancy_location || player_region != this->dormancy_player_region || c_location->getBoundariesVersion() != this->dormancy_boundaries_version ) {
+        this->dormancy_location = c_location;
+        this->dormancy_player_region = player_region;
+        this->dormancy_boundaries_version = c_location->getBoundariesVersion();
+        for(set<Character *>::iterator iter = c_location->charactersBegin(); iter != c_location->charactersEnd(); ++iter) {
+            Character *character = *iter;
+            if( character->isDormant() && !this->canBeDormant(character, player_region) ) {
+                c_location->setCharacterDormant(character, false);
+            }
+        }
+    }
+
+    for(set<Character *>::iterator iter = c_location->activeCharactersBegin(); iter != c_location->activeCharactersEnd();) {
+        Character *character = *iter;
+        // n.b., advance first, as making the character dormant removes it from the active characters
+        ++iter;
+        if( character == player || character->isDead() || character->isVisible() ) {
+            continue;
+        }
+        bool is_idle = !character->isDoingAction() && !character->hasPath() && !character->hasPathRequest() && character->getTargetNPC() == NULL && !character->isFleeing();
+        if( is_idle && this->canBeDormant(character, player_region) ) {
+            c_location->setCharacterDormant(character, true);
+        }
+    }
+    //qDebug("%d / %d characters active", c_location->getNActiveCharacters(), c_location->getNCharacters());
+}
+
+int PlayingGamestate::getAIInterval(const Character *character) const {
+    // NPCs further from the player think less often
+    float dist2 = ( character->getPos() - player->getPos() ).square();
+    int interval_ms = ai_think_interval_ms_c;
+    if( dist2 > 4.0f*npc_visibility_c*npc_visibility_c ) {
+        interval_ms *= 4;
+    }
+    else if( dist2 > npc_visibility_c*npc_visibility_c ) {
+        interval_ms *= 2;
+    }
+    return interval_ms;
+}
+
+static bool compareAIDue(const pair<int, Character *> &a, const pair<int, Character *> &b) {
+    return a.first < b.first;
+}
+
+void PlayingGamestate::updateAI() {
+    // Characters think at their own intervals, rather than all at once. The player always thinks when due, but once
+    // ai_budget_us has been used, the remaining NPCs that are due are left until the next frame, most overdue first.
+    const int elapsed_ms = game_g->getGameTimeTotalMS();
+    this->ai_due_characters.clear();
+    for(set<Character *>::iterator iter = c_location->activeCharactersBegin(); iter != c_location->activeCharactersEnd(); ++iter) {
+        Character *character = *iter;
+        if( character->isDead() ) {
+            continue;
+        }
+        if( character->getTimeNextThinkMS() == -1 ) {
+            if( character == player ) {
+                character->setTimeNextThinkMS(elapsed_ms);
+            }
+            else {
+                // stagger, so that NPCs that arrive together don't always think in the same frame
+                character->setTimeNextThinkMS(elapsed_ms + rand() % this->getAIInterval(character));
+            }
+        }
+        if( character != player && elapsed_ms >= character->getTimeNextThinkMS() ) {
+            this->ai_due_characters.push_back( pair<int, Character *>(character->getTimeNextThinkMS(), character) );
+        }
+    }
+
+    if( !player->isDead() && elapsed_ms >= player->getTimeNextThinkMS() ) {
+        player->think(this);
+        player->setTimeNextThinkMS(elapsed_ms + ai_think_interval_ms_c);
+    }
+
+    std::stable_sort(this->ai_due_characters.begin(), this->ai_due_characters.end(), compareAIDue);
+    QElapsedTimer timer;
+    timer.start();
+    bool done_one = false;
+    for(vector< pair<int, Character *> >::iterator iter = this->ai_due_characters.begin(); iter != this->ai_due_characters.end(); ++iter) {
+        if( done_one && timer.nsecsElapsed() >= 1000 * (qint64)this->ai_budget_us ) {
+            //qDebug("AI budget used, %d NPCs left until next frame", this->ai_due_characters.end() - iter);
+            break;
+        }
+        Character *character = iter->second;
+        character->think(this);
+        character->setTimeNextThinkMS(elapsed_ms + this->getAIInterval(character));
+        done_one = true;
+    }
+}
+
 void PlayingGamestate::update() {
     //qDebug("PlayingGamestate::update()");
     // update target item
@@ -6338,7 +6557,8 @@ void PlayingGamestate::update() {
             }
         }
 
-        // we can get away with not updating this every call
+        // we can get away with not updating these every call
+        this->updateDormancy();
         this->testFogOfWar();
 
         if( this->need_visibility_update ) {
@@ -6348,10 +6568,10 @@ void PlayingGamestate::update() {
 
         for(set<Scenery *>::iterator iter = c_location->scenerysBegin(); iter != c_location->scenerysEnd(); ++iter) {
             Scenery *scenery = *iter;
-            if( scenery->getActionType().length() > 0 ) {
+            if( !scenery->getActionType().empty() ) {
                 if( elapsed_ms >= scenery->getActionLastTime() + scenery->getActionDelay() ) {
                     bool has_effect = false;
-                    if( scenery->getActionType() == "harm_player" ) {
+                    if( scenery->getActionType() == scenery_action_harm_player_c ) {
                         if( !player->isDead() && scenery->isOn(player) ) {
                             LOG("scenery %s harms player\n", scenery->getName().c_str());
                             has_effect = true;
@@ -6558,38 +6778,42 @@ void PlayingGamestate::update() {
 #endif
 
 
-    vector<CharacterAction *> delete_character_actions;
-    for(vector<CharacterAction *>::iterator iter = this->character_actions.begin(); iter != this->character_actions.end(); ++iter) {
-        CharacterAction *character_action = *iter;
+    // n.b., index based, as implementing an action may add new actions; these are added to the end, and aren't
+    // updated until the next frame
+    size_t n_actions = this->character_actions.size();
+    for(size_t i=0;i<n_actions;) {
+        CharacterAction *character_action = this->character_actions[i];
         if( character_action->isExpired() ) {
-            delete_character_actions.push_back(character_action);
+            // remove by moving the last of this frame's actions into its place, as the order doesn't matter; then
+            // the last action (which may have been added this frame) takes the place of that one
+            n_actions--;
+            this->character_actions[i] = this->character_actions[n_actions];
+            this->character_actions[n_actions] = this->character_actions.back();
+            this->character_actions.pop_back();
+            character_action->implement(this);
+            character_action->release(this);
         }
         else {
             character_action->update();
+            i++;
         }
     }
-    for(vector<CharacterAction *>::iterator iter = delete_character_actions.begin(); iter != delete_character_actions.end(); ++iter) {
-        CharacterAction *character_action = *iter;
-        for(vector<CharacterAction *>::iterator iter2 = this->character_actions.begin(); iter2 != this->character_actions.end(); ++iter2) {
-            CharacterAction *character_action2 = *iter2;
-            if( character_action2 == character_action ) {
-                this->character_actions.erase(iter2);
-                break;
-            }
-        }
-        character_action->implement(this);
-        delete character_action;
-    }
+
+    // run the AI for the characters that are due to think, within the AI time budget
+    this->updateAI();
+
+    // calculate the paths requested by characters, within the location's time budget
+    c_location->processPathRequests();
 
 #ifdef TIMING_INFO
     QElapsedTimer timer_cupdate;
     timer_cupdate.start();
 #endif
-    // Character::update() also handles movement, so need to do that with every update() call
-    // though we could split out the AI etc to a separate function, as that doesn't need to be done with every update() call
+    // Character::update() handles movement, so need to do that with every update() call (the AI is done by updateAI())
+    // dormant NPCs aren't updated, so this scales with the number of active characters
     vector<Character *> delete_characters;
     //LOG("update characters\n");
-    for(set<Character *>::iterator iter = c_location->charactersBegin(); iter != c_location->charactersEnd(); ++iter) {
+    for(set<Character *>::iterator iter = c_location->activeCharactersBegin(); iter != c_location->activeCharactersEnd(); ++iter) {
         Character *character = *iter;
         //LOG("update: %s\n", character->getName().c_str());
         if( character->update(this) ) {
@@ -6611,17 +6835,7 @@ void PlayingGamestate::update() {
         LOG("character has died: %s\n", character->getName().c_str());
         c_location->removeCharacter(character);
         //LOG("done removing character from location\n");
-
-        for(set<Character *>::iterator iter3 = c_location->charactersBegin(); iter3 != c_location->charactersEnd(); ++iter3) {
-            Character *ch = *iter3;
-            if( ch->getTargetNPC() == character ) {
-                ch->setTargetNPC(NULL);
-            }
-        }
-        for(vector<CharacterAction *>::iterator iter = this->character_actions.begin(); iter != this->character_actions.end(); ++iter) {
-            CharacterAction *character_action = *iter;
-            character_action->notifyDead(character);
-        }
+        // n.b., references to the character from other characters and actions are held by CharacterHandles, so they are cleared lazily once the character is deleted below
 
         if( character == this->player ) {
             //LOG("player has died\n");
@@ -6799,23 +7013,23 @@ void PlayingGamestate::characterUpdateGraphics(const Character *character, void
     }
     object->clearAnimationLayers();
     if( character == player ) {
-        LazyAnimationLayer *lazy_animation_layer = this->animation_layers["player"];
+        LazyAnimationLayer *lazy_animation_layer = this->animation_layers[Symbol("player")];
         if( lazy_animation_layer == NULL ) {
             throw string("can't find lazy_animation_layer for player");
         }
         AnimationLayer *animation_layer = lazy_animation_layer->getAnimationLayer();
         object->addAnimationLayer( animation_layer );
         if( character->getCurrentWeapon() != NULL && character->getCurrentWeapon()->getAnimationName().length() > 0 ) {
-            object->addAnimationLayer( this->animation_layers[ character->getCurrentWeapon()->getAnimationName() ]->getAnimationLayer() );
+            object->addAnimationLayer( this->animation_layers[ Symbol(character->getCurrentWeapon()->getAnimationName()) ]->getAnimationLayer() );
         }
         if( character->getCurrentShield() != NULL && character->getCurrentShield()->getAnimationName().length() > 0 ) {
-            object->addAnimationLayer( this->animation_layers[ character->getCurrentShield()->getAnimationName() ]->getAnimationLayer() );
+            object->addAnimationLayer( this->animation_layers[ Symbol(character->getCurrentShield()->getAnimationName()) ]->getAnimationLayer() );
         }
     }
     else {
         LazyAnimationLayer *lazy_animation_layer = this->animation_layers[character->getAnimationName()];
         if( lazy_animation_layer == NULL ) {
-            throw string("can't find lazy_animation_layer for: " + character->getAnimationName());
+            throw string("can't find lazy_animation_layer for: " + character->getAnimationName().str());
         }
         AnimationLayer *animation_layer = lazy_animation_layer->getAnimationLayer();
         object->addAnimationLayer( animation_layer );
@@ -6852,25 +7066,22 @@ void PlayingGamestate::characterMoved(Character *character, void *user_data) {
             // handle popup text
             Vector2D old_pos_v(old_pos.x(), old_pos.y());
             Vector2D new_pos_v = character->getPos();
-            for(set<Scenery *>::const_iterator iter = this->c_location->scenerysBegin(); iter != this->c_location->scenerysEnd(); ++iter) {
+            const float influence_radius_c = 3.0f;
+            vector<Scenery *> popup_scenerys;
+            this->c_location->findPopupScenery(&popup_scenerys, NULL, old_pos_v, new_pos_v, influence_radius_c);
+            for(vector<Scenery *>::const_iterator iter = popup_scenerys.begin(); iter != popup_scenerys.end(); ++iter) {
                 const Scenery *scenery = *iter;
-                if( scenery->getPopupText().length() > 0 ) {
-                    Vector2D scenery_pos = scenery->getPos();
-                    float old_dist = (scenery_pos - old_pos_v).magnitude();
-                    float new_dist = (scenery_pos - new_pos_v).magnitude();
-                    const float influence_radius_c = 3.0f;
-                    if( new_dist <= influence_radius_c && old_dist > influence_radius_c ) {
-                        qDebug("popup text: dists %f, %f ; at %f, %f", old_dist, new_dist, scenery->getX(), scenery->getY());
-                        this->addTextEffect(scenery->getPopupText(), scenery->getPos(), 2000);
-                    }
-                }
+                qDebug("popup text: at %f, %f", scenery->getX(), scenery->getY());
+                this->addTextEffect(scenery->getPopupText(), scenery->getPos(), 2000);
             }
         }
     }
     if( character == this->player ) {
         // handle traps
+        vector<Trap *> near_traps;
+        this->c_location->findTrapsNear(&near_traps, character->getPos());
         vector<Trap *> delete_traps;
-        for(set<Trap *>::iterator iter = this->c_location->trapsBegin(); iter != this->c_location->trapsEnd(); ++iter) {
+        for(vector<Trap *>::iterator iter = near_traps.begin(); iter != near_traps.end(); ++iter) {
             Trap *trap = *iter;
             if( trap->isSetOff(character) ) {
                 trap->setOff(this, character);
@@ -7360,7 +7571,10 @@ void PlayingGamestate::actionCommand(bool pickup_only) {
             }
             if( target_npc == NULL && player->getCurrentWeapon() != NULL && player->getCurrentWeapon()->isRangedOrThrown() ) {
                 // for ranged weapons, pick closest visible enemy to player in the direction the player is facing
-                for(set<Character *>::iterator iter = c_location->charactersBegin(); iter != c_location->charactersEnd(); ++iter) {
+                // visible characters are within npc_visibility_c, allowing for how far they may have moved since testFogOfWar()
+                vector<Character *> nearby_characters;
+                c_location->findNearestCharacters(&nearby_characters, player->getPos(), npc_visibility_c + 2.0f*fog_of_war_update_dist_c, 0);
+                for(vector<Character *>::iterator iter = nearby_characters.begin(); iter != nearby_characters.end() && target_npc == NULL; ++iter) {
                     Character *character = *iter;
                     if( character == player )
                         continue;
@@ -7369,14 +7583,11 @@ void PlayingGamestate::actionCommand(bool pickup_only) {
                     if( !character->isHostile() )
                         continue;
                     Vector2D diff = character->getPos() - player->getPos();
-                    float dist_from_player = diff.magnitude();
                     Vector2D player_dir = player->getDirection();
                     if( player_dir % diff >= -E_TOL_LINEAR ) {
-                        if( target_npc == NULL || dist_from_player < min_dist ) {
-                            done = true;
-                            target_npc = character;
-                            min_dist = dist_from_player;
-                        }
+                        // nearest first, so this is the closest
+                        done = true;
+                        target_npc = character;
                     }
                 }
             }
@@ -8048,7 +8259,7 @@ bool PlayingGamestate::saveGame(const QString &filename, bool already_fullpath)
                 //fprintf(file, " static_image=\"%s\"", character->isStaticImage() ? "true": "false");
                 stream << " static_image=\"" << (character->isStaticImage() ? "true": "false") << "\"";
             }
-            if( character->getType().length() > 0 ) {
+            if( !character->getType().empty() ) {
                 stream << " type=\"" << character->getType().c_str() << "\"";
             }
             if( character->getPortrait().length() > 0 ) {
@@ -8089,29 +8300,29 @@ bool PlayingGamestate::saveGame(const QString &filename, bool already_fullpath)
             stream << " health=\"" << character->getHealth() << "\"";
             //fprintf(file, " max_health=\"%d\"", character->getMaxHealth());
             stream << " max_health=\"" << character->getMaxHealth() << "\"";
-            for(map<string, int>::const_iterator iter = character->getBaseProfile()->intPropertiesBegin(); iter != character->getBaseProfile()->intPropertiesEnd(); ++iter) {
-                string key = iter->first;
-                int value = iter->second;
+            for(int i=0;i<N_PROFILE_INT_KEYS;i++) {
+                string key = getProfileIntKeyString((ProfileIntKey)i);
+                int value = character->getBaseProfile()->getIntProperty((ProfileIntKey)i);
                 //fprintf(file, " %s=\"%d\"", key.c_str(), value);
                 stream << " " << key.c_str() << "=\"" << value << "\"";
             }
-            for(map<string, float>::const_iterator iter = character->getBaseProfile()->floatPropertiesBegin(); iter != character->getBaseProfile()->floatPropertiesEnd(); ++iter) {
-                string key = iter->first;
-                float value = iter->second;
+            for(int i=0;i<N_PROFILE_FLOAT_KEYS;i++) {
+                string key = getProfileFloatKeyString((ProfileFloatKey)i);
+                float value = character->getBaseProfile()->getFloatProperty((ProfileFloatKey)i);
                 //fprintf(file, " %s=\"%f\"", key.c_str(), value);
                 stream << " " << key.c_str() << "=\"" << value << "\"";
             }
             if( character == this->getPlayer() ) {
                 // only care about initial stats for player for now
                 stream << " initial_level=\"" << character->getInitialLevel() << "\"";
-                for(map<string, int>::const_iterator iter = character->getInitialBaseProfile()->intPropertiesBegin(); iter != character->getInitialBaseProfile()->intPropertiesEnd(); ++iter) {
-                    string key = iter->first;
-                    int value = iter->second;
+                for(int i=0;i<N_PROFILE_INT_KEYS;i++) {
+                    string key = getProfileIntKeyString((ProfileIntKey)i);
+                    int value = character->getInitialBaseProfile()->getIntProperty((ProfileIntKey)i);
                     stream << " initial_" << key.c_str() << "=\"" << value << "\"";
                 }
-                for(map<string, float>::const_iterator iter = character->getInitialBaseProfile()->floatPropertiesBegin(); iter != character->getInitialBaseProfile()->floatPropertiesEnd(); ++iter) {
-                    string key = iter->first;
-                    float value = iter->second;
+                for(int i=0;i<N_PROFILE_FLOAT_KEYS;i++) {
+                    string key = getProfileFloatKeyString((ProfileFloatKey)i);
+                    float value = character->getInitialBaseProfile()->getFloatProperty((ProfileFloatKey)i);
                     stream << " initial_" << key.c_str() << "=\"" << value << "\"";
                 }
             }
@@ -8342,7 +8553,7 @@ bool PlayingGamestate::saveGame(const QString &filename, bool already_fullpath)
                 stream << " action_last_time=\"" << scenery->getActionLastTime() << "\"";*/
             if( scenery->getActionDelay() != 0 )
                 stream << " action_delay=\"" << scenery->getActionDelay() << "\"";
-            if( scenery->getActionType().length() > 0 )
+            if( !scenery->getActionType().empty() )
                 stream << " action_type=\"" << scenery->getActionType().c_str() << "\"";
             if( scenery->getActionValue() != 0 )
                 stream << " action_value=\"" << scenery->getActionValue() << "\"";
@@ -8814,7 +9025,7 @@ int PlayingGamestate::getImageMemorySize() const {
     int memory_size = 0;
 
     int animation_layers_memory_size = 0;
-    for(map<string, LazyAnimationLayer *>::const_iterator iter = this->animation_layers.begin(); iter != this->animation_layers.end(); ++iter) {
+    for(map<Symbol, LazyAnimationLayer *>::const_iterator iter = this->animation_layers.begin(); iter != this->animation_layers.end(); ++iter) {
         const LazyAnimationLayer *lazy_animation_layer = (*iter).second;
         animation_layers_memory_size += lazy_animation_layer->getMemorySize();
     }
@@ -8822,7 +9033,7 @@ int PlayingGamestate::getImageMemorySize() const {
     LOG("NPCs: %d\n", animation_layers_memory_size);
 
     int scenery_animation_layers_memory_size = 0;
-    for(map<string, LazyAnimationLayer *>::const_iterator iter = this->scenery_animation_layers.begin(); iter != this->scenery_animation_layers.end(); ++iter) {
+    for(map<Symbol, LazyAnimationLayer *>::const_iterator iter = this->scenery_animation_layers.begin(); iter != this->scenery_animation_layers.end(); ++iter) {
         const LazyAnimationLayer *lazy_animation_layer = (*iter).second;
         scenery_animation_layers_memory_size += lazy_animation_layer->getMemorySize();
     }
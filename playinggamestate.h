@@ -50,9 +50,9 @@ class CharacterAction {
     };
     Type type;
 
-    Character *source;
+    CharacterHandle source; // n.b., may have died since the action was created
     Vector2D source_pos;
-    Character *target_npc;
+    CharacterHandle target_npc;
     Vector2D dest_pos;
     int time_ms;
     int duration_ms;
@@ -66,15 +66,26 @@ class CharacterAction {
     const Spell *spell;
 
     QGraphicsItem *object;
+    Symbol projectile_key; // if set, object is a projectile graphic that can be reused by later actions with this key
 
     CharacterAction(Type type, Character *source, Character *target_npc, float offset_y);
+    void init(Type type, Character *source, Character *target_npc, float offset_y);
+    static CharacterAction *create(PlayingGamestate *playing_gamestate, Type type, Character *source, Character *target_npc, float offset_y);
 
 public:
     ~CharacterAction();
 
+    void release(PlayingGamestate *playing_gamestate);
+    void detachObject() {
+        // for when the scene, which owns the object, is cleared
+        this->object = NULL;
+    }
+    bool hasObject() const {
+        return this->object != NULL;
+    }
+
     void implement(PlayingGamestate *playing_gamestate) const;
     void update();
-    void notifyDead(const Character *character);
     bool isExpired() const;
 
     static CharacterAction *createSpellAction(PlayingGamestate *playing_gamestate, Character *source, Character *target_npc, const Spell *spell);
@@ -356,7 +367,9 @@ class PlayingGamestate : public Gamestate, CharacterListener, LocationListener {
     Quest *quest;
     GameType gameType;
 
-    vector<CharacterAction *> character_actions;
+    vector<CharacterAction *> character_actions; // unordered, so that expired actions can be removed by swapping with the last
+    vector<CharacterAction *> free_character_actions; // released actions, reused by CharacterAction::create()
+    map<Symbol, vector<AnimatedObject *> > free_projectile_objects; // hidden projectile graphics for reuse; owned by the scene, so must be cleared along with it
 
     bool is_keyboard_moving;
 
@@ -364,8 +377,8 @@ class PlayingGamestate : public Gamestate, CharacterListener, LocationListener {
     set<QGraphicsItem *> graphicsitems_characters;
 
     // data
-    map<string, LazyAnimationLayer *> animation_layers;
-    map<string, LazyAnimationLayer *> scenery_animation_layers;
+    map<Symbol, LazyAnimationLayer *> animation_layers;
+    map<Symbol, LazyAnimationLayer *> scenery_animation_layers;
     map<string, AnimationLayer *> projectile_animation_layers;
     map<string, Item *> standard_items;
     map<string, QPixmap> item_images;
@@ -381,6 +394,12 @@ class PlayingGamestate : public Gamestate, CharacterListener, LocationListener {
     QGraphicsItem *target_item;
 
     int time_last_complex_update_ms; // see update() for details
+    int ai_budget_us; // time that each updateAI() call may spend on NPCs
+    vector< pair<int, Character *> > ai_due_characters; // scratch state reused by updateAI()
+    // where the player was when dormant NPCs were last tested, see updateDormancy()
+    const Location *dormancy_location;
+    int dormancy_player_region;
+    int dormancy_boundaries_version;
 
     bool need_visibility_update;
 
@@ -405,6 +424,8 @@ class PlayingGamestate : public Gamestate, CharacterListener, LocationListener {
     bool clickedOnScenerys(bool *move, void **ignore, const vector<Scenery *> &clicked_scenerys);
     bool handleClickForScenerys(bool *move, void **ignore, Vector2D dest, bool is_click);
     void testFogOfWar();
+    bool canBeDormant(const Character *character, int player_region) const;
+    void updateDormancy();
     bool canSaveHere();
     int getRestTime() const;
 
@@ -414,8 +435,8 @@ class PlayingGamestate : public Gamestate, CharacterListener, LocationListener {
     void saveItem(QTextStream &stream, const Item *item, const Character *character) const;
     void saveTrap(QTextStream &stream, const Trap *trap) const;
 
-    void parseXMLItemProfileAttributeInt(Item *item, const QXmlStreamReader &reader, const string &key) const;
-    void parseXMLItemProfileAttributeFloat(Item *item, const QXmlStreamReader &reader, const string &key) const;
+    void parseXMLItemProfileAttributeInt(Profile *profile_bonus, const QXmlStreamReader &reader, const string &key) const;
+    void parseXMLItemProfileAttributeFloat(Profile *profile_bonus, const QXmlStreamReader &reader, const string &key) const;
     Item *parseXMLItem(QXmlStreamReader &reader) const;
     Character *loadNPC(bool *is_player, Vector2D *pos, QXmlStreamReader &reader) const;
     Item *loadItem(Vector2D *pos, QXmlStreamReader &reader, Scenery *scenery, Character *npc, bool start_bonus_item) const;
@@ -546,6 +567,19 @@ public:
     Location *getCLocation() const {
         return this->c_location;
     }
+    /** Runs think() for the characters in the current location that are due, see
+      * getAIInterval(). Called from update(); the player always thinks when due, but NPCs
+      * are only run until the budget set by setAIBudget() has been used, though always at
+      * least one.
+      */
+    void updateAI();
+    int getAIInterval(const Character *character) const;
+    void setAIBudget(int ai_budget_us) {
+        this->ai_budget_us = ai_budget_us;
+    }
+    int getAIBudget() const {
+        return this->ai_budget_us;
+    }
     MainGraphicsView *getView() {
         return this->view;
     }
@@ -553,9 +587,15 @@ public:
         return this->is_keyboard_moving;
     }
 
+    void clearView();
     void addCharacterAction(CharacterAction *character_action) {
         this->character_actions.push_back(character_action);
     }
+    CharacterAction *reuseCharacterAction();
+    void freeCharacterAction(CharacterAction *character_action);
+    AnimatedObject *reuseProjectileObject(Symbol projectile_key);
+    void freeProjectileObject(Symbol projectile_key, AnimatedObject *object);
+    void scaleGraphicsItem(QGraphicsItem *object, float width, bool undo_3d);
     void addGraphicsItem(QGraphicsItem *object, float width, bool undo_3d);
     QGraphicsItem *addPixmapGraphic(const QPixmap &pixmap, Vector2D pos, float width, bool undo_3d, bool on_ground);
     QGraphicsItem *addSpellGraphic(Vector2D pos);
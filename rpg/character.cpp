@@ -23,6 +23,60 @@ const int time_to_hit_c = 400;
 const int time_to_fire_c = 400;
 const int time_to_cast_c = 2000;
 
+class CharacterSlots {
+public:
+    vector<Character *> characters;
+    vector<unsigned int> generations;
+    vector<unsigned int> free_slots;
+};
+
+static CharacterSlots &getCharacterSlots() {
+    // n.b., a function static for the same reason as the Symbol table
+    static CharacterSlots character_slots;
+    return character_slots;
+}
+
+static unsigned int allocateCharacterSlot(Character *character) {
+    CharacterSlots &character_slots = getCharacterSlots();
+    if( character_slots.free_slots.size() > 0 ) {
+        unsigned int slot = character_slots.free_slots.back();
+        character_slots.free_slots.pop_back();
+        character_slots.characters[slot] = character;
+        return slot;
+    }
+    character_slots.characters.push_back(character);
+    character_slots.generations.push_back(1);
+    return static_cast<unsigned int>(character_slots.characters.size() - 1);
+}
+
+static void freeCharacterSlot(unsigned int slot) {
+    CharacterSlots &character_slots = getCharacterSlots();
+    character_slots.characters[slot] = NULL;
+    // invalidate existing handles; n.b., 0 is reserved for the null handle
+    if( ++character_slots.generations[slot] == 0 ) {
+        character_slots.generations[slot] = 1;
+    }
+    character_slots.free_slots.push_back(slot);
+}
+
+CharacterHandle::CharacterHandle(const Character *character) : slot(0), generation(0) {
+    if( character != NULL ) {
+        this->slot = character->handle_slot;
+        this->generation = getCharacterSlots().generations[this->slot];
+    }
+}
+
+Character *CharacterHandle::get() const {
+    if( this->generation == 0 ) {
+        return NULL;
+    }
+    const CharacterSlots &character_slots = getCharacterSlots();
+    if( character_slots.generations[this->slot] != this->generation ) {
+        return NULL;
+    }
+    return character_slots.characters[this->slot];
+}
+
 string getSkillLongString(const string &key) {
     if( key == skill_unarmed_combat_c )
         return "Unarmed Combat";
@@ -77,11 +131,11 @@ void Spell::castOn(PlayingGamestate *playing_gamestate, Character *source, Chara
     // source may be NULL, if caster is no longer alive
     // source may also equal the target, if casting on self
     // n.b., caller should have called useSpell()
-    if( this->type == "attack" ) {
+    if( this->type == spell_type_attack_c ) {
         bool success = true;
         if( mind_test ) {
-            int a_stat = source->getProfileIntProperty(profile_key_M_c);
-            int d_stat = target->getProfileIntProperty(profile_key_M_c);
+            int a_stat = source->getProfileIntProperty(PROFILE_KEY_M);
+            int d_stat = target->getProfileIntProperty(PROFILE_KEY_M);
             int mod_a_stat = source->modifyStatForDifficulty(playing_gamestate, a_stat);
             int mod_d_stat = target->modifyStatForDifficulty(playing_gamestate, d_stat);
 
@@ -115,7 +169,7 @@ void Spell::castOn(PlayingGamestate *playing_gamestate, Character *source, Chara
             }
         }
     }
-    else if( this->type == "heal" ) {
+    else if( this->type == spell_type_heal_c ) {
         int heal = rollDice(rollX, rollY, rollZ);
         if( heal > 0 ) {
             qDebug("cast heal spell: %d", heal);
@@ -175,15 +229,16 @@ Character::Character(const string &name, string animation_name, bool is_ai) :
     is_ai(is_ai), is_hostile(is_ai), // AI NPCs default to being hostile
     is_fixed(false),
     location(NULL), listener(NULL), listener_data(NULL),
-    is_dead(false), time_of_death_ms(0), direction(Vector2D(1.0f, 0.0f)), has_charge_pos(false), is_visible(false),
-    has_path(false),
-    target_npc(NULL), time_last_action_ms(0), action(ACTION_NONE), has_charged(false),
-    casting_spell(NULL), casting_spell_target(NULL),
-    time_last_complex_update_ms(0), time_last_regenerated_ms(0),
+    is_dead(false), time_of_death_ms(0), direction(Vector2D(1.0f, 0.0f)), has_charge_pos(false), is_visible(false), has_visibility_cache(false), visibility_cache_region(-1), visibility_cache_player_region(-1), visibility_cache_boundaries_version(0),
+    has_path(false), path_pos(0), path_requested(false),
+    time_last_action_ms(0), action(ACTION_NONE), has_charged(false),
+    casting_spell(NULL),
+    time_next_think_ms(-1), is_dormant(false), time_last_regenerated_ms(0),
     has_default_position(false), has_last_known_player_position(false),
     health(0), max_health(0),
     is_paralysed(false), paralysed_until(0),
     is_diseased(false),
+    has_stats_cache(false),
     initial_level(0),
     current_weapon(NULL), current_ammo(NULL), current_shield(NULL), current_armour(NULL), current_ring(NULL),
     gold(0),
@@ -191,6 +246,7 @@ Character::Character(const string &name, string animation_name, bool is_ai) :
     is_fleeing(false),
     can_talk(false), has_talked(false), interaction_xp(0), interaction_reward_gold(0), interaction_completed(false)
 {
+    this->handle_slot = allocateCharacterSlot(this);
     // ensure we always have default properties set
     this->initialiseProfile(1, 0, 0, 0, 0, 0, 0, 0, 0.0f);
 }
@@ -213,15 +269,16 @@ Character::Character(const string &name, bool is_ai, const CharacterTemplate &ch
     is_ai(is_ai), is_hostile(is_ai), // AI NPCs default to being hostile
     is_fixed(false),
     location(NULL), listener(NULL), listener_data(NULL),
-    is_dead(false), time_of_death_ms(0), direction(Vector2D(1.0f, 0.0f)), has_charge_pos(false), is_visible(false),
-    has_path(false),
-    target_npc(NULL), time_last_action_ms(0), action(ACTION_NONE), has_charged(false),
-    casting_spell(NULL), casting_spell_target(NULL),
-    time_last_complex_update_ms(0), time_last_regenerated_ms(0),
+    is_dead(false), time_of_death_ms(0), direction(Vector2D(1.0f, 0.0f)), has_charge_pos(false), is_visible(false), has_visibility_cache(false), visibility_cache_region(-1), visibility_cache_player_region(-1), visibility_cache_boundaries_version(0),
+    has_path(false), path_pos(0), path_requested(false),
+    time_last_action_ms(0), action(ACTION_NONE), has_charged(false),
+    casting_spell(NULL),
+    time_next_think_ms(-1), is_dormant(false), time_last_regenerated_ms(0),
     has_default_position(false), has_last_known_player_position(false),
     health(0), max_health(0),
     is_paralysed(false), paralysed_until(0),
     is_diseased(false),
+    has_stats_cache(false),
     initial_level(0),
     current_weapon(NULL), current_ammo(NULL), current_shield(NULL), current_armour(NULL), current_ring(NULL),
     gold(character_template.getTemplateGold()),
@@ -229,6 +286,7 @@ Character::Character(const string &name, bool is_ai, const CharacterTemplate &ch
     is_fleeing(false),
     can_talk(false), has_talked(false), interaction_xp(0), interaction_reward_gold(0), interaction_completed(false)
 {
+    this->handle_slot = allocateCharacterSlot(this);
     this->initialiseHealth( character_template.getTemplateHealth() );
     this->initial_level = this->level;
     this->initial_profile = this->profile;
@@ -239,6 +297,7 @@ Character::Character(const Character &character)
     qDebug("Character::Character(): copy constructor: %s", character.name.c_str());
     *this = character;
 
+    this->handle_slot = allocateCharacterSlot(this); // n.b., handles to the original don't refer to the copy
     this->listener = NULL;
     this->listener_data = NULL;
 
@@ -253,6 +312,7 @@ Character::Character(const Character &character)
         Item *item_copy = item->clone();
         this->items.insert(item_copy);
     }
+    this->invalidateStatsCache();
 }
 
 Character::~Character() {
@@ -264,6 +324,7 @@ Character::~Character() {
         Item *item = *iter;
         delete item;
     }
+    freeCharacterSlot(this->handle_slot);
 }
 
 Item *Character::findItem(const string &key) {
@@ -335,6 +396,7 @@ bool Character::useAmmo(Ammo *ammo) {
     }
     else {
         this->items.erase(ammo);
+        this->invalidateStatsCache();
         if( this->current_ammo == ammo ) {
             this->current_ammo = NULL;
         }
@@ -344,9 +406,35 @@ bool Character::useAmmo(Ammo *ammo) {
     return used_up;
 }
 
+void Character::updateStatsCache() const {
+    for(int i=0;i<N_PROFILE_INT_KEYS;i++) {
+        this->stats_cache_int[i] = this->calculateProfileIntProperty((ProfileIntKey)i);
+    }
+    for(int i=0;i<N_PROFILE_FLOAT_KEYS;i++) {
+        this->stats_cache_float[i] = this->calculateProfileFloatProperty((ProfileFloatKey)i);
+    }
+    this->has_stats_cache = true;
+}
+
 int Character::getProfileIntProperty(const string &key) const {
-    //qDebug("key: %s", key.c_str());
-    int value = this->getBaseProfileIntProperty(key);
+    int index = getProfileIntKeyIndex(key);
+    if( index == -1 ) {
+        return 0;
+    }
+    return this->getProfileIntProperty((ProfileIntKey)index);
+}
+
+float Character::getProfileFloatProperty(const string &key) const {
+    int index = getProfileFloatKeyIndex(key);
+    if( index == -1 ) {
+        return 0.0f;
+    }
+    return this->getProfileFloatProperty((ProfileFloatKey)index);
+}
+
+int Character::calculateProfileIntProperty(ProfileIntKey key) const {
+    //qDebug("key: %s", getProfileIntKeyString(key).c_str());
+    int value = this->profile.getIntProperty(key);
     // effects from profile bonues
     for(vector<ProfileEffect>::const_iterator iter = this->profile_effects.begin(); iter != this->profile_effects.end(); ++iter) {
         const ProfileEffect &profile_effect = *iter;
@@ -363,29 +451,29 @@ int Character::getProfileIntProperty(const string &key) const {
     }
     if( this->is_diseased ) {
         // effect of disease
-        if( key == profile_key_FP_c || key == profile_key_S_c ) {
+        if( key == PROFILE_KEY_FP || key == PROFILE_KEY_S ) {
             value--;
         }
     }
-    if( key == profile_key_FP_c && this->current_weapon == NULL && !this->is_hostile && !this->hasSkill(skill_unarmed_combat_c) ) {
+    if( key == PROFILE_KEY_FP && this->current_weapon == NULL && !this->is_hostile && !this->hasSkill(skill_unarmed_combat_c) ) {
         // modifier for player being unarmed
         value -= 2;
     }
-    if( key == profile_key_A_c && this->current_weapon != NULL && this->current_weapon->getWeaponClass() == "bow" && this->hasSkill(skill_fast_shooter_c) ) {
+    if( key == PROFILE_KEY_A && this->current_weapon != NULL && this->current_weapon->getWeaponClass() == "bow" && this->hasSkill(skill_fast_shooter_c) ) {
         value++;
     }
-    if( key == profile_key_A_c && this->current_weapon != NULL && this->current_weapon->getWeaponClass() == "sling" && this->hasSkill(skill_slingshot_c) ) {
+    if( key == PROFILE_KEY_A && this->current_weapon != NULL && this->current_weapon->getWeaponClass() == "sling" && this->hasSkill(skill_slingshot_c) ) {
         value++;
     }
-    if( key == profile_key_FP_c && this->current_shield != NULL && this->hasSkill(skill_shield_combat_c) ) {
+    if( key == PROFILE_KEY_FP && this->current_shield != NULL && this->hasSkill(skill_shield_combat_c) ) {
         value++;
     }
     //qDebug("value: %d", value);
     return value;
 }
 
-float Character::getProfileFloatProperty(const string &key) const {
-    float value = this->getBaseProfileFloatProperty(key);
+float Character::calculateProfileFloatProperty(ProfileFloatKey key) const {
+    float value = this->profile.getFloatProperty(key);
     for(vector<ProfileEffect>::const_iterator iter = this->profile_effects.begin(); iter != this->profile_effects.end(); ++iter) {
         const ProfileEffect &profile_effect = *iter;
         float effect_bonus = profile_effect.getProfile()->getFloatProperty(key);
@@ -396,7 +484,7 @@ float Character::getProfileFloatProperty(const string &key) const {
         float item_bonus = item->getProfileBonusFloatProperty(this, key);
         value += item_bonus;
     }
-    if( key == profile_key_Sp_c && this->hasSkill(skill_sprint_c) && this->location != NULL && this->location->getGeoType() == Location::GEOTYPE_OUTDOORS ) {
+    if( key == PROFILE_KEY_Sp && this->hasSkill(skill_sprint_c) && this->location != NULL && this->location->getGeoType() == Location::GEOTYPE_OUTDOORS ) {
         value += 0.2f;
     }
     return value;
@@ -431,6 +519,7 @@ bool Character::update(PlayingGamestate *playing_gamestate) {
         if( elapsed_ms >= profile_effect.getExpiresMS() ) {
             LOG("%s: effect %d expires: %d, %d\n", this->name.c_str(), i, profile_effect.getExpiresMS(), elapsed_ms);
             profile_effects.erase(profile_effects.begin() + i);
+            this->invalidateStatsCache();
         }
     }
 
@@ -450,376 +539,13 @@ bool Character::update(PlayingGamestate *playing_gamestate) {
         }
     }
 
-    if( elapsed_ms - this->time_last_complex_update_ms > 100 ) {
-        //qDebug("complex update for: %s", this->name.c_str());
-        this->time_last_complex_update_ms = elapsed_ms;
-
-        bool ai_try_moving = true;
-
-        bool are_enemies = false;
-        if( target_npc != NULL ) {
-            if( this == playing_gamestate->getPlayer() )
-                are_enemies = target_npc->isHostile();
-            else
-                are_enemies = this->isHostile();
-        }
-
-        //ASSERT_LOGGER( !( is_hitting && target_npc == NULL ) );
-        ASSERT_LOGGER( !( (action == ACTION_HITTING || action == ACTION_FIRING || action == ACTION_CASTING) && target_npc == NULL ) );
-        Character *target = action == ACTION_CASTING ? casting_spell_target : target_npc;
-        if( target != NULL && ( action == ACTION_CASTING || are_enemies ) ) {
-            enum HitState {
-                HITSTATE_HAS_HIT = 0,
-                HITSTATE_IS_HITTING = 1,
-                HITSTATE_IS_NOT_HITTING = 2
-            };
-            HitState hit_state = HITSTATE_IS_NOT_HITTING;
-            if( action == ACTION_HITTING || action == ACTION_FIRING || action == ACTION_CASTING ) {
-                hit_state = HITSTATE_IS_HITTING;
-                int action_delay = 0;
-                if( action == ACTION_HITTING ) {
-                    action_delay = time_to_hit_c;
-                }
-                else if( action == ACTION_FIRING ) {
-                    action_delay = time_to_fire_c;
-                }
-                else if( action == ACTION_CASTING ) {
-                    action_delay = time_to_cast_c;
-                }
-                else {
-                    ASSERT_LOGGER(false);
-                }
-                if( elapsed_ms > time_last_action_ms + action_delay ) {
-                    hit_state = HITSTATE_HAS_HIT;
-                }
-            }
-            //qDebug("action: %d", action);
-            //qDebug("hit_state: %d", hit_state);
-
-            if( hit_state == HITSTATE_HAS_HIT || ( hit_state == HITSTATE_IS_NOT_HITTING && !is_fleeing && !playing_gamestate->isKeyboardMoving() ) ) {
-                float dist = ( target->getPos() - this->getPos() ).magnitude();
-                bool is_ranged = false; // also includes thrown weapons, and spell attacks
-                const Spell *spell = NULL;
-                Character *spell_target = NULL;
-                if( hit_state == HITSTATE_HAS_HIT ) {
-                    is_ranged = action == ACTION_FIRING || action == ACTION_CASTING;
-                    if( action == ACTION_CASTING ) {
-                        spell = casting_spell;
-                        spell_target = casting_spell_target;
-                    }
-                }
-                else {
-                    if( is_ai ) {
-                        if( this->health < 0.5f*this->max_health ) {
-                            // try casting a healing spell
-                            for(map<string, int>::const_iterator iter = this->spells.begin(); iter != this->spells.end() && spell == NULL; ++iter) {
-                                if( iter->second > 0 ) {
-                                    string spell_name = iter->first;
-                                    const Spell *this_spell = playing_gamestate->findSpell(spell_name);
-                                    if( this_spell->getType() == "heal") {
-                                        spell = this_spell;
-                                        spell_target = this;
-                                    }
-                                }
-                            }
-                        }
-                        if( spell == NULL ) {
-                            // try casting an attack spell
-                            vector<const Spell *> candidate_spells;
-                            for(map<string, int>::const_iterator iter = this->spells.begin(); iter != this->spells.end() && spell == NULL; ++iter) {
-                                if( iter->second > 0 ) {
-                                    string spell_name = iter->first;
-                                    const Spell *this_spell = playing_gamestate->findSpell(spell_name);
-                                    if( this_spell->getType() == "attack") {
-                                        candidate_spells.push_back(this_spell);
-                                    }
-                                }
-                            }
-                            if( candidate_spells.size() > 0 ) {
-                                int r = rand() % candidate_spells.size();
-                                spell = candidate_spells.at(r);
-                                spell_target = target_npc;
-                            }
-                        }
-                    }
-                    is_ranged = spell != NULL || ( this->getCurrentWeapon() != NULL && this->getCurrentWeapon()->isRangedOrThrown() );
-                }
-                bool can_hit = false;
-                /* We could use the is_visible flag, but for future use we might want
-                   to cater for Enemy NPCs shooting friendly NPCs.
-                   This shouldn't be a performance issue, as this code is only
-                   executed when firing/hitting, and not every frame.
-                */
-                if( spell != NULL ) {
-                    if( spell_target == this || location->visibilityTest(this->pos, spell_target->getPos()) ) {
-                        can_hit = true;
-                    }
-                }
-                else if( is_ranged ) {
-                    if( location->visibilityTest(this->pos, target_npc->getPos()) ) {
-                        can_hit = true;
-                    }
-                }
-                else {
-                    can_hit = dist <= hit_range_c;
-                }
-
-                if( hit_state == HITSTATE_HAS_HIT ) {
-                    bool casting_on_self = spell != NULL && spell_target == this;
-                    if( can_hit && ( casting_on_self || !target_npc->is_dead ) ) {
-                        ai_try_moving = false; // no point trying to move, just wait to hit again
-                        if( action == ACTION_CASTING ) {
-                            // make sure we still have the spell
-                            ASSERT_LOGGER(casting_spell != NULL);
-                            ASSERT_LOGGER(casting_spell_target != NULL);
-                            if( this->getSpellCount(casting_spell->getName()) > 0 ) {
-                                stringstream str;
-                                str << "Casts ";
-                                str << casting_spell->getName();
-                                playing_gamestate->addTextEffect(str.str(), this->getPos(), 500);
-                                this->useSpell(spell->getName());
-                                if( this == casting_spell_target ) {
-                                    // can cast straight away
-                                    spell->castOn(playing_gamestate, this, casting_spell_target);
-                                }
-                                else {
-                                    // fire off an action
-                                    CharacterAction *action = CharacterAction::createSpellAction(playing_gamestate, this, casting_spell_target, casting_spell);
-                                    playing_gamestate->addCharacterAction(action);
-                                    playing_gamestate->playSound("spell_attack");
-                                }
-                            }
-                        }
-                        else {
-                            Ammo *ammo = NULL;
-                            if( this->getCurrentWeapon() != NULL && this->getCurrentWeapon()->getRequiresAmmo() ) {
-                                qDebug("obtain ammo");
-                                // obtain the ammo - and make sure we still have some!
-                                // note, it's better to use up the ammo now, rather than we first decide to fire, so that we still have the information on the ammo
-                                string ammo_key = this->getCurrentWeapon()->getAmmoKey();
-                                //Item *item = this->findItem(ammo_key);
-                                ammo = this->findAmmo(ammo_key);
-                                if( ammo == NULL ) {
-                                    // run out of ammo!
-                                    can_hit = false;
-                                    // no need to change weapon, this will happen when Character next tries to hit
-                                    qDebug("ran out of ammo");
-                                }
-                                /*else {
-                                    if( item->getType() != ITEMTYPE_AMMO ) {
-                                        LOG("required ammo type %s is not ammo\n", item->getName().c_str());
-                                        ASSERT_LOGGER( item->getType() == ITEMTYPE_AMMO );
-                                    }
-                                    ammo = static_cast<Ammo *>(item);
-                                }*/
-                            }
-
-                            if( can_hit ) {
-                                bool weapon_no_effect_magical = false;
-                                bool weapon_no_effect_holy = false;
-                                int weapon_damage = 0;
-                                bool hits = RPGEngine::combat(weapon_damage, weapon_no_effect_magical, weapon_no_effect_holy, playing_gamestate, this, target_npc, is_ranged, ammo, has_charged);
-
-                                if( is_ranged ) {
-                                    // fire off an action
-                                    qDebug("fire off an action for ranged combat");
-                                    string projectile_key;
-                                    float projectile_icon_width = 0.0f;
-                                    ASSERT_LOGGER( this->getCurrentWeapon() != NULL );
-                                    if( this->getCurrentWeapon()->getWeaponType() == Weapon::WEAPONTYPE_RANGED ) {
-                                        projectile_key = this->getCurrentWeapon()->getAmmoKey();
-                                        ASSERT_LOGGER( ammo != NULL );
-                                        projectile_icon_width = ammo->getIconWidth();
-                                    }
-                                    else {
-                                        projectile_key = this->getCurrentWeapon()->getKey();
-                                        projectile_icon_width = this->getCurrentWeapon()->getIconWidth();
-                                    }
-                                    CharacterAction *action = CharacterAction::createProjectileAction(playing_gamestate, this, target_npc, hits, weapon_no_effect_magical, weapon_no_effect_holy, weapon_damage, projectile_key, projectile_icon_width);
-                                    playing_gamestate->addCharacterAction(action);
-                                }
-                                else {
-                                    // do it straight away
-                                    if( hits ) {
-                                        playing_gamestate->hitEnemy(this, target_npc, is_ranged, weapon_no_effect_magical, weapon_no_effect_holy, weapon_damage);
-                                    }
-                                }
-
-                                if( this->getCurrentWeapon() != NULL && this->getCurrentWeapon()->getWeaponType() == Weapon::WEAPONTYPE_THROWN ) {
-                                    // use up the weapon itself!
-                                    Item *item = this->getCurrentWeapon();
-                                    this->takeItem( item );
-                                    delete item;
-                                }
-                                if( ammo != NULL ) {
-                                    if( this->useAmmo(ammo) ) {
-                                        ammo = NULL; // just to be safe, as pointer now deleted
-                                        string ammo_key = this->getCurrentWeapon()->getAmmoKey();
-                                        //if( this->findItem(ammo_key) == NULL && this == playing_gamestate->getPlayer() ) {
-                                        if( this->findAmmo(ammo_key) == NULL && this == playing_gamestate->getPlayer() ) {
-                                            // really has used up all available ammo
-                                            LOG("Character %s has run out of ammo: %s\n", this->getName().c_str(), ammo_key.c_str());
-                                            playing_gamestate->addTextEffect(PlayingGamestate::tr("Run out of").toStdString() + " " + ammo_key + "!", this->getPos(), 1000);
-                                            this->armWeapon(NULL); // disarm it
-                                        }
-                                    }
-                                }
-                            }
-                        }
-                    }
-                    this->setStateIdle();
-                }
-                else if( hit_state == HITSTATE_IS_NOT_HITTING ) {
-                    if( can_hit ) {
-                        ai_try_moving = false; // even if we can't hit yet, we should just wait until we can
-                        int time_turn = getTimeTurn(spell != NULL, is_ranged);
-                        if( elapsed_ms > time_last_action_ms + time_turn ) {
-                            if( spell != NULL ) {
-                                // cast spell!
-                                action = ACTION_CASTING;
-                                casting_spell = spell;
-                                casting_spell_target = spell_target;
-                                has_path = false;
-                                time_last_action_ms = elapsed_ms;
-                                if( this->listener != NULL ) {
-                                    // we don't have an animation specific for spell-casting, but should still explicitly set to the idle animation, in case previously set to something else
-                                    this->listener->characterSetAnimation(this, this->listener_data, "", false);
-                                }
-                            }
-                            else {
-                                // take a swing!
-                                bool can_hit = true;
-                                // make sure we have enough ammo (ammo is used up when we actually fire - see above)
-                                if( this->getCurrentWeapon() != NULL && this->getCurrentWeapon()->getRequiresAmmo() ) {
-                                    string ammo_key = this->getCurrentWeapon()->getAmmoKey();
-                                    //Item *item = this->findItem(ammo_key);
-                                    Ammo *item = this->findAmmo(ammo_key);
-                                    if( item == NULL ) {
-                                        if( this == playing_gamestate->getPlayer() ) {
-                                            // this case occurs if the player arms a ranged weapon without having any ammo (as opposed to the check below, where we check for running out of ammo after firing)
-                                            //LOG("Character %s has no ammo: %s\n", this->getName().c_str(), ammo_key.c_str());
-                                            playing_gamestate->addTextEffect(PlayingGamestate::tr("Run out of").toStdString() + " " + ammo_key + "!", this->getPos(), 1000);
-                                        }
-                                        // for NPCs, this shouldn't happen, but put this check just in case!
-                                        can_hit = false;
-                                        this->armWeapon(NULL); // disarm it
-                                    }
-                                }
-                                if( can_hit && this->tooWeakForWeapon() ) {
-                                    can_hit = false;
-                                    if( this == playing_gamestate->getPlayer() ) {
-                                        playing_gamestate->addTextEffect(PlayingGamestate::tr("You are not strong enough to use this weapon!").toStdString(), this->getPos(), 1000);
-                                        this->armWeapon(NULL); // disarm it
-                                    }
-                                }
-
-                                if( can_hit ) {
-                                    action = is_ranged ? ACTION_FIRING : ACTION_HITTING;
-                                    qDebug("action is now: %d", action);
-                                    has_path = false;
-                                    time_last_action_ms = elapsed_ms;
-                                    if( this->listener != NULL ) {
-                                        string anim = is_ranged ? "ranged" : "attack";
-                                        this->listener->characterSetAnimation(this, this->listener_data, anim, true);
-                                        Vector2D dir = target_npc->getPos() - this->getPos();
-                                        this->setDirection(dir);
-                                    }
-                                    playing_gamestate->playSound("swing");
-                                    if( !is_ranged && has_charge_pos && (charge_pos - pos).magnitude() > 1.0f && this->hasSkill(skill_charge_c) ) {
-                                        playing_gamestate->addTextEffect(PlayingGamestate::tr("Charge!").toStdString(), this->getPos(), 1000);
-                                        // weapon damage increased if/when we actually hit
-                                        has_charged = true;
-                                        qDebug("has_charged");
-                                        charge_pos = pos;
-                                    }
-                                    /*else {
-                                        qDebug("is_ranged? %d", is_ranged);
-                                        qDebug("has_charge_pos? %d", has_charge_pos);
-                                        qDebug("charge_pos? %f, %f", charge_pos.x, charge_pos.y);
-                                        qDebug("pos? %f, %f", pos.x, pos.y);
-                                        qDebug("dist %f", (charge_pos - pos).magnitude());
-                                    }*/
-                                }
-                            }
-                        }
-                    }
-                }
-            }
-        }
-
-        if( is_ai && action == ACTION_NONE && ai_try_moving ) {
-            bool done_target = false;
-            if( is_hostile && !is_fleeing && playing_gamestate->getPlayer() != NULL ) {
-                if( this->is_visible ) {
-                    this->setTargetNPC( playing_gamestate->getPlayer() );
-                    Vector2D dest = playing_gamestate->getPlayer()->getPos();
-                    this->setDestination(dest.x, dest.y, NULL);
-                    done_target = true;
-                    this->has_last_known_player_position = true;
-                    this->last_known_player_position = dest;
-                }
-            }
-
-            if( !done_target && is_fleeing ) {
-                // run away!
-                done_target = true;
-                if( playing_gamestate->getPlayer() != NULL && !has_path ) {
-                    /*Vector2D dir = this->getPos() - playing_gamestate->getPlayer()->getPos();
-                    if( dir.magnitude() > 0 ) {
-                        dir.normalise();
-                        Vector2D new_pos = this->pos + dir*1.0f;
-                        qDebug("### flee to %f, %f", new_pos.x, new_pos.y);
-                        this->setDestination(new_pos.x, new_pos.y, NULL);
-                        this->location->findFreeWayPoint()
-                    }*/
-                    Vector2D flee_pos;
-                    //qDebug("findFreePoint");
-                    if( this->location->findFleePoint(&flee_pos, this->pos, playing_gamestate->getPlayer()->getPos(), this->can_fly) ) {
-                        //qDebug("### flee to %f, %f", flee_pos.x, flee_pos.y);
-                        this->setDestination(flee_pos.x, flee_pos.y, NULL);
-                    }
-                    else {
-                        // can't run away, return to fighting
-                        this->is_fleeing = false;
-                    }
-                }
-            }
-
-            if( !done_target ) {
-                this->setTargetNPC(NULL);
-
-                if( this->has_last_known_player_position ) {
-                    if( this->last_known_player_position == this->pos ) {
-                        this->has_last_known_player_position = false;
-                    }
-                    else {
-                        // move to player's last known position
-                        this->setDestination(this->last_known_player_position.x, this->last_known_player_position.y, NULL);
-                        done_target = true;
-                    }
-                }
-            }
-
-            if( !done_target ) {
-                // return to default position
-                if( this->has_default_position && this->default_position != this->pos ) {
-                    this->setDestination(this->default_position.x, this->default_position.y, NULL);
-                    done_target = true;
-                }
-                else if( this->has_path ) {
-                    this->setStateIdle();
-                }
-            }
-        }
-    }
-
     //if( this->has_destination && !is_hitting ) {
     //if( this->has_path && !is_hitting ) {
     if( this->has_path && action == ACTION_NONE ) {
         //Vector2D diff = this->dest - this->pos;
-        if( this->path.size() == 0 ) {
+        if( this->path_pos >= this->path.size() ) {
             LOG("Character %s has path, but empty path vector\n", this->getName().c_str());
-            ASSERT_LOGGER( this->path.size() != 0 );
+            ASSERT_LOGGER( this->path_pos < this->path.size() );
         }
         if( !this->canMove() ) {
             // can't move!
@@ -827,13 +553,13 @@ bool Character::update(PlayingGamestate *playing_gamestate) {
                 this->listener->characterSetAnimation(this, this->listener_data, "", false);
             }
         }
-        else if( this->path.size() > 0 ) {
-            Vector2D dest = this->path.at(0);
+        else if( this->path_pos < this->path.size() ) {
+            Vector2D dest = this->path.at(this->path_pos);
             Vector2D diff = dest - this->pos;
             int time_ms = game_g->getGameTimeFrameMS();
             //float step = 0.002f * time_ms;
             //float step = (this->getSpeed() * time_ms)/1000.0f;
-            float step = (this->getProfileFloatProperty(profile_key_Sp_c) * time_ms)/1000.0f;
+            float step = (this->getProfileFloatProperty(PROFILE_KEY_Sp) * time_ms)/1000.0f;
             float dist = diff.magnitude();
             diff /= dist;
             Vector2D new_pos = pos;
@@ -849,7 +575,7 @@ bool Character::update(PlayingGamestate *playing_gamestate) {
             }
             if( location->collideWithTransient(this, new_pos) ) {
                 is_fleeing = false; // stop NPC getting trapped when trying to flee
-                if( this->path.size() == 1 && dist <= 2.0f*npc_radius_c + E_TOL_LINEAR ) {
+                if( this->path_pos+1 == this->path.size() && dist <= 2.0f*npc_radius_c + E_TOL_LINEAR ) {
                     // close enough, so stay where we are (to avoid aimlessly circling round a point that we can't reach
                     if( this->listener != NULL ) {
                         this->listener->characterSetAnimation(this, this->listener_data, "", false);
@@ -901,8 +627,8 @@ bool Character::update(PlayingGamestate *playing_gamestate) {
                 }
                 this->setPos(new_pos.x, new_pos.y);
                 if( next_seg ) {
-                    this->path.erase(this->path.begin());
-                    if( this->path.size() == 0 ) {
+                    this->path_pos++;
+                    if( this->path_pos == this->path.size() ) {
                         if( this == playing_gamestate->getPlayer() && playing_gamestate->isKeyboardMoving() ) {
                             // don't set to idle, as player is still requesting keyboard movement
                             this->has_path = false;
@@ -926,6 +652,382 @@ bool Character::update(PlayingGamestate *playing_gamestate) {
     return false;
 }
 
+void Character::think(PlayingGamestate *playing_gamestate) {
+    // the AI, run at intervals decided by PlayingGamestate::updateAI(), rather than every update()
+    if( this->location == NULL || is_dead || is_paralysed ) {
+        return;
+    }
+    int elapsed_ms = game_g->getGameTimeTotalMS();
+
+    //qDebug("complex update for: %s", this->name.c_str());
+
+    this->checkDeadTargets();
+    Character *target_npc = this->target_npc_handle.get();
+    Character *casting_spell_target = this->casting_spell_target_handle.get();
+
+    bool ai_try_moving = true;
+
+    bool are_enemies = false;
+    if( target_npc != NULL ) {
+        if( this == playing_gamestate->getPlayer() )
+            are_enemies = target_npc->isHostile();
+        else
+            are_enemies = this->isHostile();
+    }
+
+    //ASSERT_LOGGER( !( is_hitting && target_npc == NULL ) );
+    ASSERT_LOGGER( !( (action == ACTION_HITTING || action == ACTION_FIRING || action == ACTION_CASTING) && target_npc == NULL ) );
+    Character *target = action == ACTION_CASTING ? casting_spell_target : target_npc;
+    if( target != NULL && ( action == ACTION_CASTING || are_enemies ) ) {
+        enum HitState {
+            HITSTATE_HAS_HIT = 0,
+            HITSTATE_IS_HITTING = 1,
+            HITSTATE_IS_NOT_HITTING = 2
+        };
+        HitState hit_state = HITSTATE_IS_NOT_HITTING;
+        if( action == ACTION_HITTING || action == ACTION_FIRING || action == ACTION_CASTING ) {
+            hit_state = HITSTATE_IS_HITTING;
+            int action_delay = 0;
+            if( action == ACTION_HITTING ) {
+                action_delay = time_to_hit_c;
+            }
+            else if( action == ACTION_FIRING ) {
+                action_delay = time_to_fire_c;
+            }
+            else if( action == ACTION_CASTING ) {
+                action_delay = time_to_cast_c;
+            }
+            else {
+                ASSERT_LOGGER(false);
+            }
+            if( elapsed_ms > time_last_action_ms + action_delay ) {
+                hit_state = HITSTATE_HAS_HIT;
+            }
+        }
+        //qDebug("action: %d", action);
+        //qDebug("hit_state: %d", hit_state);
+
+        if( hit_state == HITSTATE_HAS_HIT || ( hit_state == HITSTATE_IS_NOT_HITTING && !is_fleeing && !playing_gamestate->isKeyboardMoving() ) ) {
+            float dist = ( target->getPos() - this->getPos() ).magnitude();
+            bool is_ranged = false; // also includes thrown weapons, and spell attacks
+            const Spell *spell = NULL;
+            Character *spell_target = NULL;
+            if( hit_state == HITSTATE_HAS_HIT ) {
+                is_ranged = action == ACTION_FIRING || action == ACTION_CASTING;
+                if( action == ACTION_CASTING ) {
+                    spell = casting_spell;
+                    spell_target = casting_spell_target;
+                }
+            }
+            else {
+                if( is_ai ) {
+                    if( this->health < 0.5f*this->max_health ) {
+                        // try casting a healing spell
+                        for(map<string, int>::const_iterator iter = this->spells.begin(); iter != this->spells.end() && spell == NULL; ++iter) {
+                            if( iter->second > 0 ) {
+                                string spell_name = iter->first;
+                                const Spell *this_spell = playing_gamestate->findSpell(spell_name);
+                                if( this_spell->getType() == spell_type_heal_c ) {
+                                    spell = this_spell;
+                                    spell_target = this;
+                                }
+                            }
+                        }
+                    }
+                    if( spell == NULL ) {
+                        // try casting an attack spell
+                        vector<const Spell *> candidate_spells;
+                        for(map<string, int>::const_iterator iter = this->spells.begin(); iter != this->spells.end() && spell == NULL; ++iter) {
+                            if( iter->second > 0 ) {
+                                string spell_name = iter->first;
+                                const Spell *this_spell = playing_gamestate->findSpell(spell_name);
+                                if( this_spell->getType() == spell_type_attack_c ) {
+                                    candidate_spells.push_back(this_spell);
+                                }
+                            }
+                        }
+                        if( candidate_spells.size() > 0 ) {
+                            int r = rand() % candidate_spells.size();
+                            spell = candidate_spells.at(r);
+                            spell_target = target_npc;
+                        }
+                    }
+                }
+                is_ranged = spell != NULL || ( this->getCurrentWeapon() != NULL && this->getCurrentWeapon()->isRangedOrThrown() );
+            }
+            bool can_hit = false;
+            /* We could use the is_visible flag, but for future use we might want
+               to cater for Enemy NPCs shooting friendly NPCs.
+               This shouldn't be a performance issue, as this code is only
+               executed when firing/hitting, and not every frame.
+            */
+            if( spell != NULL ) {
+                if( spell_target == this || location->visibilityTest(this->pos, spell_target->getPos()) ) {
+                    can_hit = true;
+                }
+            }
+            else if( is_ranged ) {
+                if( location->visibilityTest(this->pos, target_npc->getPos()) ) {
+                    can_hit = true;
+                }
+            }
+            else {
+                can_hit = dist <= hit_range_c;
+            }
+
+            if( hit_state == HITSTATE_HAS_HIT ) {
+                bool casting_on_self = spell != NULL && spell_target == this;
+                if( can_hit && ( casting_on_self || !target_npc->is_dead ) ) {
+                    ai_try_moving = false; // no point trying to move, just wait to hit again
+                    if( action == ACTION_CASTING ) {
+                        // make sure we still have the spell
+                        ASSERT_LOGGER(casting_spell != NULL);
+                        ASSERT_LOGGER(casting_spell_target != NULL);
+                        if( this->getSpellCount(casting_spell->getName()) > 0 ) {
+                            stringstream str;
+                            str << "Casts ";
+                            str << casting_spell->getName();
+                            playing_gamestate->addTextEffect(str.str(), this->getPos(), 500);
+                            this->useSpell(spell->getName());
+                            if( this == casting_spell_target ) {
+                                // can cast straight away
+                                spell->castOn(playing_gamestate, this, casting_spell_target);
+                            }
+                            else {
+                                // fire off an action
+                                CharacterAction *action = CharacterAction::createSpellAction(playing_gamestate, this, casting_spell_target, casting_spell);
+                                playing_gamestate->addCharacterAction(action);
+                                playing_gamestate->playSound("spell_attack");
+                                this->location->wakeCharacters(this->getPos(), noise_dist_c);
+                            }
+                        }
+                    }
+                    else {
+                        Ammo *ammo = NULL;
+                        if( this->getCurrentWeapon() != NULL && this->getCurrentWeapon()->getRequiresAmmo() ) {
+                            qDebug("obtain ammo");
+                            // obtain the ammo - and make sure we still have some!
+                            // note, it's better to use up the ammo now, rather than we first decide to fire, so that we still have the information on the ammo
+                            string ammo_key = this->getCurrentWeapon()->getAmmoKey();
+                            //Item *item = this->findItem(ammo_key);
+                            ammo = this->findAmmo(ammo_key);
+                            if( ammo == NULL ) {
+                                // run out of ammo!
+                                can_hit = false;
+                                // no need to change weapon, this will happen when Character next tries to hit
+                                qDebug("ran out of ammo");
+                            }
+                            /*else {
+                                if( item->getType() != ITEMTYPE_AMMO ) {
+                                    LOG("required ammo type %s is not ammo\n", item->getName().c_str());
+                                    ASSERT_LOGGER( item->getType() == ITEMTYPE_AMMO );
+                                }
+                                ammo = static_cast<Ammo *>(item);
+                            }*/
+                        }
+
+                        if( can_hit ) {
+                            bool weapon_no_effect_magical = false;
+                            bool weapon_no_effect_holy = false;
+                            int weapon_damage = 0;
+                            bool hits = RPGEngine::combat(weapon_damage, weapon_no_effect_magical, weapon_no_effect_holy, playing_gamestate, this, target_npc, is_ranged, ammo, has_charged);
+
+                            if( is_ranged ) {
+                                // fire off an action
+                                qDebug("fire off an action for ranged combat");
+                                string projectile_key;
+                                float projectile_icon_width = 0.0f;
+                                ASSERT_LOGGER( this->getCurrentWeapon() != NULL );
+                                if( this->getCurrentWeapon()->getWeaponType() == Weapon::WEAPONTYPE_RANGED ) {
+                                    projectile_key = this->getCurrentWeapon()->getAmmoKey();
+                                    ASSERT_LOGGER( ammo != NULL );
+                                    projectile_icon_width = ammo->getIconWidth();
+                                }
+                                else {
+                                    projectile_key = this->getCurrentWeapon()->getKey();
+                                    projectile_icon_width = this->getCurrentWeapon()->getIconWidth();
+                                }
+                                CharacterAction *action = CharacterAction::createProjectileAction(playing_gamestate, this, target_npc, hits, weapon_no_effect_magical, weapon_no_effect_holy, weapon_damage, projectile_key, projectile_icon_width);
+                                playing_gamestate->addCharacterAction(action);
+                            }
+                            else {
+                                // do it straight away
+                                if( hits ) {
+                                    playing_gamestate->hitEnemy(this, target_npc, is_ranged, weapon_no_effect_magical, weapon_no_effect_holy, weapon_damage);
+                                }
+                            }
+
+                            if( this->getCurrentWeapon() != NULL && this->getCurrentWeapon()->getWeaponType() == Weapon::WEAPONTYPE_THROWN ) {
+                                // use up the weapon itself!
+                                Item *item = this->getCurrentWeapon();
+                                this->takeItem( item );
+                                delete item;
+                            }
+                            if( ammo != NULL ) {
+                                if( this->useAmmo(ammo) ) {
+                                    ammo = NULL; // just to be safe, as pointer now deleted
+                                    string ammo_key = this->getCurrentWeapon()->getAmmoKey();
+                                    //if( this->findItem(ammo_key) == NULL && this == playing_gamestate->getPlayer() ) {
+                                    if( this->findAmmo(ammo_key) == NULL && this == playing_gamestate->getPlayer() ) {
+                                        // really has used up all available ammo
+                                        LOG("Character %s has run out of ammo: %s\n", this->getName().c_str(), ammo_key.c_str());
+                                        playing_gamestate->addTextEffect(PlayingGamestate::tr("Run out of").toStdString() + " " + ammo_key + "!", this->getPos(), 1000);
+                                        this->armWeapon(NULL); // disarm it
+                                    }
+                                }
+                            }
+                        }
+                    }
+                }
+                this->setStateIdle();
+            }
+            else if( hit_state == HITSTATE_IS_NOT_HITTING ) {
+                if( can_hit ) {
+                    ai_try_moving = false; // even if we can't hit yet, we should just wait until we can
+                    int time_turn = getTimeTurn(spell != NULL, is_ranged);
+                    if( elapsed_ms > time_last_action_ms + time_turn ) {
+                        if( spell != NULL ) {
+                            // cast spell!
+                            action = ACTION_CASTING;
+                            casting_spell = spell;
+                            casting_spell_target_handle = CharacterHandle(spell_target);
+                            has_path = false;
+                            this->cancelPathRequest();
+                            time_last_action_ms = elapsed_ms;
+                            if( this->listener != NULL ) {
+                                // we don't have an animation specific for spell-casting, but should still explicitly set to the idle animation, in case previously set to something else
+                                this->listener->characterSetAnimation(this, this->listener_data, "", false);
+                            }
+                        }
+                        else {
+                            // take a swing!
+                            bool can_hit = true;
+                            // make sure we have enough ammo (ammo is used up when we actually fire - see above)
+                            if( this->getCurrentWeapon() != NULL && this->getCurrentWeapon()->getRequiresAmmo() ) {
+                                string ammo_key = this->getCurrentWeapon()->getAmmoKey();
+                                //Item *item = this->findItem(ammo_key);
+                                Ammo *item = this->findAmmo(ammo_key);
+                                if( item == NULL ) {
+                                    if( this == playing_gamestate->getPlayer() ) {
+                                        // this case occurs if the player arms a ranged weapon without having any ammo (as opposed to the check below, where we check for running out of ammo after firing)
+                                        //LOG("Character %s has no ammo: %s\n", this->getName().c_str(), ammo_key.c_str());
+                                        playing_gamestate->addTextEffect(PlayingGamestate::tr("Run out of").toStdString() + " " + ammo_key + "!", this->getPos(), 1000);
+                                    }
+                                    // for NPCs, this shouldn't happen, but put this check just in case!
+                                    can_hit = false;
+                                    this->armWeapon(NULL); // disarm it
+                                }
+                            }
+                            if( can_hit && this->tooWeakForWeapon() ) {
+                                can_hit = false;
+                                if( this == playing_gamestate->getPlayer() ) {
+                                    playing_gamestate->addTextEffect(PlayingGamestate::tr("You are not strong enough to use this weapon!").toStdString(), this->getPos(), 1000);
+                                    this->armWeapon(NULL); // disarm it
+                                }
+                            }
+
+                            if( can_hit ) {
+                                action = is_ranged ? ACTION_FIRING : ACTION_HITTING;
+                                qDebug("action is now: %d", action);
+                                has_path = false;
+                                this->cancelPathRequest();
+                                time_last_action_ms = elapsed_ms;
+                                if( this->listener != NULL ) {
+                                    string anim = is_ranged ? "ranged" : "attack";
+                                    this->listener->characterSetAnimation(this, this->listener_data, anim, true);
+                                    Vector2D dir = target_npc->getPos() - this->getPos();
+                                    this->setDirection(dir);
+                                }
+                                playing_gamestate->playSound("swing");
+                                this->location->wakeCharacters(this->getPos(), noise_dist_c);
+                                if( !is_ranged && has_charge_pos && (charge_pos - pos).magnitude() > 1.0f && this->hasSkill(skill_charge_c) ) {
+                                    playing_gamestate->addTextEffect(PlayingGamestate::tr("Charge!").toStdString(), this->getPos(), 1000);
+                                    // weapon damage increased if/when we actually hit
+                                    has_charged = true;
+                                    qDebug("has_charged");
+                                    charge_pos = pos;
+                                }
+                                /*else {
+                                    qDebug("is_ranged? %d", is_ranged);
+                                    qDebug("has_charge_pos? %d", has_charge_pos);
+                                    qDebug("charge_pos? %f, %f", charge_pos.x, charge_pos.y);
+                                    qDebug("pos? %f, %f", pos.x, pos.y);
+                                    qDebug("dist %f", (charge_pos - pos).magnitude());
+                                }*/
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    if( is_ai && action == ACTION_NONE && ai_try_moving ) {
+        bool done_target = false;
+        if( is_hostile && !is_fleeing && playing_gamestate->getPlayer() != NULL ) {
+            if( this->is_visible ) {
+                this->setTargetNPC( playing_gamestate->getPlayer() );
+                Vector2D dest = playing_gamestate->getPlayer()->getPos();
+                // all NPCs heading for the player share the location's field of distances to the player, rather than each doing a search
+                vector<Vector2D> new_path = this->location->calculatePathToPlayer(this->pos, dest, this->can_fly);
+                if( new_path.size() > 0 ) {
+                    this->setPath(new_path);
+                }
+                else {
+                    // the field can't be used (e.g., we can fly), so queue a request rather than searching now
+                    this->setDestination(dest.x, dest.y, NULL);
+                }
+                done_target = true;
+                this->has_last_known_player_position = true;
+                this->last_known_player_position = dest;
+            }
+        }
+
+        if( !done_target && is_fleeing ) {
+            // run away!
+            done_target = true;
+            if( playing_gamestate->getPlayer() != NULL && !has_path && !path_requested ) {
+                /*Vector2D dir = this->getPos() - playing_gamestate->getPlayer()->getPos();
+                if( dir.magnitude() > 0 ) {
+                    dir.normalise();
+                    Vector2D new_pos = this->pos + dir*1.0f;
+                    qDebug("### flee to %f, %f", new_pos.x, new_pos.y);
+                    this->setDestination(new_pos.x, new_pos.y, NULL);
+                    this->location->findFreeWayPoint()
+                }*/
+                // the flee point is found when the location processes the request - see pathRequestCompleted()
+                this->setFleeDestination(playing_gamestate->getPlayer()->getPos());
+            }
+        }
+
+        if( !done_target ) {
+            this->setTargetNPC(NULL);
+
+            if( this->has_last_known_player_position ) {
+                if( this->last_known_player_position == this->pos ) {
+                    this->has_last_known_player_position = false;
+                }
+                else {
+                    // move to player's last known position
+                    this->setDestination(this->last_known_player_position.x, this->last_known_player_position.y, NULL);
+                    done_target = true;
+                }
+            }
+        }
+
+        if( !done_target ) {
+            // return to default position
+            if( this->has_default_position && this->default_position != this->pos ) {
+                this->setDestination(this->default_position.x, this->default_position.y, NULL);
+                done_target = true;
+            }
+            else if( this->has_path ) {
+                this->setStateIdle();
+            }
+        }
+    }
+}
+
 void Character::handleSpecialHitEffects(PlayingGamestate *playing_gamestate, Character *target) const {
     // called when this character has hit the target character
     if( this->getCausesDisease() > 0 && !target->isDiseased() && !target->hasSkill(skill_disease_resistance_c) ) {
@@ -960,7 +1062,7 @@ int Character::getTimeTurn(bool is_casting, bool is_ranged) {
         // note, increase attacks only speed up the delay between actions, not counting the action_time required to carry out the action
         if( time_turn > action_time ) { // should always be true, but just to be safe
             time_turn -= action_time;
-            time_turn /= this->getProfileIntProperty(profile_key_A_c);
+            time_turn /= this->getProfileIntProperty(PROFILE_KEY_A);
             time_turn += action_time;
         }
     }
@@ -969,8 +1071,9 @@ int Character::getTimeTurn(bool is_casting, bool is_ranged) {
 }
 
 void Character::setTargetNPC(Character *target_npc) {
-    if( this->target_npc != target_npc ) {
-        this->target_npc = target_npc;
+    CharacterHandle target_npc_handle(target_npc);
+    if( this->target_npc_handle != target_npc_handle ) {
+        this->target_npc_handle = target_npc_handle;
         if( this->action != ACTION_NONE ) {
             this->action = ACTION_NONE;
             this->has_charged = false;
@@ -982,12 +1085,17 @@ void Character::setTargetNPC(Character *target_npc) {
     }
 }
 
-void Character::notifyDead(const Character *character) {
-    if( character == this->target_npc ) {
+void Character::checkDeadTargets() {
+    // targets that have since been deleted are detected here, rather than by PlayingGamestate searching for references on each death
+    if( !this->target_npc_handle.isNull() && this->target_npc_handle.get() == NULL ) {
         this->setTargetNPC(NULL);
     }
-    if( character == this->casting_spell_target )
-        this->casting_spell_target = NULL;
+    if( !this->casting_spell_target_handle.isNull() && this->casting_spell_target_handle.get() == NULL ) {
+        this->casting_spell_target_handle = CharacterHandle();
+        if( this->action == ACTION_CASTING ) {
+            this->setStateIdle();
+        }
+    }
 }
 
 void Character::addPainTextEffect(PlayingGamestate *playing_gamestate) const {
@@ -1004,10 +1112,26 @@ void Character::addPainTextEffect(PlayingGamestate *playing_gamestate) const {
     playing_gamestate->addTextEffect(text, this->getPos(), 500);
 }
 
+void Character::setPos(float xpos, float ypos) {
+    Vector2D old_pos = this->pos;
+    this->pos.set(xpos, ypos);
+    if( !has_charge_pos ) {
+        this->has_charge_pos = true;
+        this->charge_pos = pos;
+    }
+    if( this->location != NULL ) {
+        this->location->characterMoved(this, old_pos);
+    }
+    if( this->listener != NULL ) {
+        this->listener->characterMoved(this, this->listener_data);
+    }
+}
+
 void Character::setStateIdle() {
     qDebug("Character::setStateIdle() for %s", this->getName().c_str());
     //has_destination = false;
     has_path = false;
+    this->cancelPathRequest();
     //is_hitting = false;
     action = ACTION_NONE;
     this->has_charged = false;
@@ -1085,6 +1209,10 @@ bool Character::decreaseHealth(PlayingGamestate *playing_gamestate, int decrease
         LOG("decreaseHealth: received negative decrease: %d\n", decrease);
         ASSERT_LOGGER( decrease >= 0 );
     }
+    if( this->is_dormant && this->location != NULL ) {
+        // needs to be updated, e.g., in case of death
+        this->location->setCharacterDormant(this, false);
+    }
     int armour_value = this->getArmourRating(armour, shield);
     decrease -= armour_value;
     decrease = std::max(decrease, 0);
@@ -1102,7 +1230,7 @@ bool Character::decreaseHealth(PlayingGamestate *playing_gamestate, int decrease
         // NPC flees if fails a bravery test
         int r = rollDice(2, 6, 0);
         //r = 13;
-        if( r > this->getProfileIntProperty(profile_key_B_c) ) {
+        if( r > this->getProfileIntProperty(PROFILE_KEY_B) ) {
             qDebug("NPC %s decides to flee", this->getName().c_str());
             this->is_fleeing = true;
         }
@@ -1124,6 +1252,9 @@ void Character::kill(PlayingGamestate *playing_gamestate) {
     int elapsed_ms = game_g->getGameTimeTotalMS();
     this->is_dead = true;
     this->time_of_death_ms = elapsed_ms;
+    // a queued path request may not be processed until a later frame, which would otherwise set a path on the corpse
+    this->has_path = false;
+    this->cancelPathRequest();
     if( this->listener != NULL ) {
         this->listener->characterSetAnimation(this, this->listener_data, "death", false);
     }
@@ -1150,15 +1281,14 @@ void Character::kill(PlayingGamestate *playing_gamestate) {
     }
     if( this->death_explodes && this->location != NULL ) {
         if( this->death_explodes_damage > 0 ) {
-            for(set<Character *>::iterator iter = this->location->charactersBegin(); iter != this->location->charactersEnd(); ++iter) {
+            vector<Character *> nearby_characters;
+            this->location->findCharactersInRadius(&nearby_characters, this->getPos(), 1.0f);
+            for(vector<Character *>::iterator iter = nearby_characters.begin(); iter != nearby_characters.end(); ++iter) {
                 Character *character = *iter;
                 if( character != this && !character->isDead() ) {
-                    double dist = (character->getPos() - this->getPos()).magnitude();
-                    if( dist <= 1.0f ) {
-                        int damage = rollDice(this->death_explodes_damage, 6, 0);
-                        if( character->decreaseHealth(playing_gamestate, damage, false, false) ) {
-                            character->addPainTextEffect(playing_gamestate);
-                        }
+                    int damage = rollDice(this->death_explodes_damage, 6, 0);
+                    if( character->decreaseHealth(playing_gamestate, damage, false, false) ) {
+                        character->addPainTextEffect(playing_gamestate);
                     }
                 }
             }
@@ -1172,6 +1302,7 @@ void Character::armWeapon(Weapon *item) {
     // set NULL to disarm
     if( this->current_weapon != item ) {
         this->current_weapon = item;
+        this->invalidateStatsCache();
         //if( this->is_hitting ) {
         if( action == ACTION_HITTING || action == ACTION_FIRING ) {
             qDebug("cancel attack due to changing weapon");
@@ -1203,6 +1334,7 @@ void Character::armShield(Shield *item) {
     }
     else if( this->current_shield != item ) {
         this->current_shield = item;
+        this->invalidateStatsCache();
         if( this->listener != NULL ) {
             this->listener->characterUpdateGraphics(this, this->listener_data);
         }
@@ -1214,6 +1346,7 @@ void Character::wearArmour(Armour *item) {
     // set NULL to take off
     if( this->current_armour != item ) {
         this->current_armour = item;
+        this->invalidateStatsCache();
         /*if( this->listener != NULL ) {
             this->listener->characterUpdateGraphics(this, this->listener_data);
         }*/
@@ -1225,6 +1358,7 @@ void Character::wearRing(Ring *item) {
     // set NULL to take off
     if( this->current_ring != item ) {
         this->current_ring = item;
+        this->invalidateStatsCache();
         /*if( this->listener != NULL ) {
             this->listener->characterUpdateGraphics(this, this->listener_data);
         }*/
@@ -1242,6 +1376,7 @@ void Character::addItem(Item *item, bool auto_arm) {
     }
 
     this->items.insert(item);
+    this->invalidateStatsCache();
     if( auto_arm && this->current_weapon == NULL && item->getType() == ITEMTYPE_WEAPON ) {
         // automatically arm weapon
         this->armWeapon( static_cast<Weapon *>(item) );
@@ -1276,6 +1411,7 @@ void Character::pickupItem(Item *item) {
 
 void Character::takeItem(Item *item) {
     this->items.erase(item);
+    this->invalidateStatsCache();
     bool graphics_changed = false;
     if( this->current_weapon == item ) {
         this->current_weapon = NULL;
@@ -1371,8 +1507,11 @@ void Character::paralyse(int time_ms) {
 
 void Character::setPath(vector<Vector2D> &path) {
     //qDebug("Character::setPath() for %s", this->getName().c_str());
+    // a request queued earlier is now out of date, and mustn't replace this path when it's processed
+    this->cancelPathRequest();
     this->has_path = true;
     this->path = path;
+    this->path_pos = 0;
     //this->is_hitting = false;
     this->action = ACTION_NONE;
     this->has_charged = false;
@@ -1382,7 +1521,7 @@ void Character::setPath(vector<Vector2D> &path) {
 }
 
 Vector2D Character::getDestination() const {
-    if( this->has_path && path.size() > 0 ) {
+    if( this->has_path && path_pos < path.size() ) {
         return path.at( path.size() - 1 );
     }
     ASSERT_LOGGER(false);
@@ -1401,18 +1540,46 @@ void Character::setDestination(float xdest, float ydest, const void *ignore) {
 
     Vector2D dest(xdest, ydest);
 
-    vector<Vector2D> new_path = location->calculatePathTo(this->pos, dest, ignore, this->can_fly);
+    // the path is calculated later, by Location::processPathRequests() - requests for the player take priority over NPCs
+    location->requestPath(this, dest, ignore, !this->is_ai);
+    this->path_requested = true;
+}
+
+void Character::setFleeDestination(Vector2D fleeing_from) {
+    if( this->location == NULL ) {
+        LOG("can't set flee destination for character with NULL location");
+        ASSERT_LOGGER( location != NULL );
+    }
+    location->requestFleePath(this, fleeing_from);
+    this->path_requested = true;
+}
+
+void Character::pathRequestCompleted(bool is_flee, vector<Vector2D> &new_path) {
+    this->path_requested = false;
     if( new_path.size() > 0 ) {
         //LOG("set path\n");
         this->setPath(new_path);
     }
+    else if( is_flee ) {
+        // can't run away, return to fighting
+        this->is_fleeing = false;
+    }
+}
+
+void Character::cancelPathRequest() {
+    if( this->path_requested ) {
+        this->path_requested = false;
+        if( this->location != NULL ) {
+            this->location->cancelPathRequest(this);
+        }
+    }
 }
 
 int Character::getCanCarryWeight() const {
     //return 300;
     //return 10;
     //return 250 + 10 * this->getStrength();
-    return 250 + 10 * this->getProfileIntProperty(profile_key_S_c);
+    return 250 + 10 * this->getProfileIntProperty(PROFILE_KEY_S);
 }
 
 bool Character::carryingTooMuch() const {
@@ -1440,7 +1607,7 @@ bool Character::tooWeakForArmour() const {
 }
 
 bool Character::tooWeakForArmour(const Armour *armour) const {
-    if( this->getProfileIntProperty(profile_key_S_c) < armour->getMinStrength() ) {
+    if( this->getProfileIntProperty(PROFILE_KEY_S) < armour->getMinStrength() ) {
         return true;
     }
     return false;
@@ -1455,9 +1622,28 @@ bool Character::tooWeakForWeapon() const {
 }
 
 bool Character::tooWeakForWeapon(const Weapon *weapon) const {
-    if( this->getProfileIntProperty(profile_key_S_c) < weapon->getMinStrength() ) {
+    if( this->getProfileIntProperty(PROFILE_KEY_S) < weapon->getMinStrength() ) {
+        return true;
+    }
+    return false;
+}
+
+bool Character::isVisibilityCacheValid(Vector2D player_pos, int player_region, int boundaries_version) const {
+    if( !this->has_visibility_cache || this->visibility_cache_boundaries_version != boundaries_version ) {
+        return false;
+    }
+    const float max_dist2 = fog_of_war_update_dist_c*fog_of_war_update_dist_c;
+    if( ( this->pos - this->visibility_cache_pos ).square() <= max_dist2 && ( player_pos - this->visibility_cache_player_pos ).square() <= max_dist2 ) {
         return true;
     }
+    // while the player stays in a floor region that can't see into ours, we stay hidden however far either of us moves
+    if( !this->is_visible && player_region == this->visibility_cache_player_region && this->location != NULL && this->location->isPVSCalculated() ) {
+        // n.b., only look up our floor region if we've moved
+        int region = this->pos == this->visibility_cache_pos ? this->visibility_cache_region : this->location->findFloorRegionIndexAt(this->pos);
+        if( region == this->visibility_cache_region && !this->location->canFloorRegionsSee(player_region, region) ) {
+            return true;
+        }
+    }
     return false;
 }
 
@@ -1466,7 +1652,7 @@ bool Character::canMove() const {
     if( can_move && this->carryingTooMuch() ) {
         can_move = false;
     }
-    if( can_move && this->getCurrentArmour() != NULL && this->getProfileIntProperty(profile_key_S_c) < this->getCurrentArmour()->getMinStrength() ) {
+    if( can_move && this->getCurrentArmour() != NULL && this->getProfileIntProperty(PROFILE_KEY_S) < this->getCurrentArmour()->getMinStrength() ) {
         can_move = false;
     }
     return can_move;
@@ -62,7 +62,10 @@ public:
   * scriptable movement, we want to be able to see the NPC moving).
   */
 const float npc_visibility_c = 10.0f;
+const float fog_of_war_update_dist_c = 0.1f; // how far the player or an NPC must move before their line of sight is tested again
 const float npc_radius_c = 0.25f;
+const float npc_dormant_dist_c = 2.0f * npc_visibility_c; // NPCs further than this from the player may become dormant - see PlayingGamestate::updateDormancy()
+const float noise_dist_c = 3.0f * npc_visibility_c; // how far away the noise of combat wakes dormant NPCs
 const float hit_range_c = sqrt(2.0f) * ( npc_radius_c + npc_radius_c );
 const float talk_range_c = hit_range_c;
 
@@ -77,12 +80,16 @@ const string skill_charge_c = "charge";
 const string skill_hatred_orcs_c = "hatred_orcs";
 const string skill_slingshot_c = "slingshot";
 
+const Symbol spell_type_heal_c("heal");
+const Symbol spell_type_attack_c("attack");
+const Symbol monster_type_goblinoid_c("goblinoid");
+
 string getSkillLongString(const string &key);
 string getSkillDescription(const string &key);
 
 class Spell {
     string name;
-    string type;
+    Symbol type;
     string effect; // use to define more specific types of effects (distinct from the type, which is a more general grouping, to help the AI decide what to cast)
     int rollX, rollY, rollZ;
     bool damage_armour, damage_shield;
@@ -94,7 +101,7 @@ public:
     string getName() const {
         return this->name;
     }
-    string getType() const {
+    Symbol getType() const {
         return this->type;
     }
     void setRoll(int rollX, int rollY, int rollZ) {
@@ -152,13 +159,13 @@ protected:
     int causes_paralysis;
     bool requires_magical; // requires magical weapon to hit?
     bool unholy;
-    string animation_name;
+    Symbol animation_name;
     bool static_image;
     bool bounce;
     float image_size;
     string weapon_resist_class; // resistance to this weapon class
     int weapon_resist_percentage; // damage to that weapon class is scaled by this amount (so lower means less damage; set to greater than 100 for more damage)
-    string type; // monster type, e.g., goblinoid (may be empty)
+    Symbol type; // monster type, e.g., goblinoid (may be empty)
     int regeneration; // if non-zero, the character will heal 1 health per regeneration ms
     bool death_explodes; // whether explodes on death
     int death_explodes_damage; // n-D6 damage due to exploding
@@ -233,7 +240,7 @@ public:
     bool isUnholy() const {
         return this->unholy;
     }
-    string getAnimationName() const {
+    Symbol getAnimationName() const {
         return this->animation_name;
     }
     void setStaticImage(bool static_image) {
@@ -281,9 +288,9 @@ public:
         return this->death_explodes_damage;
     }
     void setType(const string &type) {
-        this->type = type;
+        this->type = Symbol(type);
     }
-    string getType() const {
+    Symbol getType() const {
         return this->type;
     }
 };
@@ -302,7 +309,35 @@ public:
     }
 };
 
+/** A reference to a Character that can't dangle: once the character is deleted, get() returns
+  * NULL. Each Character owns a slot in a global table, whose generation is incremented when the
+  * character is deleted, so that stale handles are detected in O(1) when they are next used,
+  * rather than every reference being searched for and cleared when a character dies.
+  */
+class CharacterHandle {
+    unsigned int slot;
+    unsigned int generation; // 0 for the null handle
+
+public:
+    CharacterHandle() : slot(0), generation(0) {
+    }
+    explicit CharacterHandle(const Character *character); // n.b., NULL gives the null handle
+
+    Character *get() const; // returns NULL for the null handle, or if the character has been deleted
+    bool isNull() const {
+        return this->generation == 0;
+    }
+    bool operator==(const CharacterHandle &handle) const {
+        return this->slot == handle.slot && this->generation == handle.generation;
+    }
+    bool operator!=(const CharacterHandle &handle) const {
+        return !(*this == handle);
+    }
+};
+
 class Character {
+    friend class CharacterHandle;
+
     // rpg data "inherited" from CharacterTemplate
     Profile profile;
     int natural_damageX, natural_damageY, natural_damageZ;
@@ -314,13 +349,13 @@ class Character {
     int causes_paralysis;
     bool requires_magical; // requires magical weapon to hit?
     bool unholy;
-    string animation_name; // for NPCs (player is handled separately)
+    Symbol animation_name; // for NPCs (player is handled separately)
     bool static_image; // for NPCs
     bool bounce;
     float image_size;
     string weapon_resist_class; // resistance to this weapon class
     int weapon_resist_percentage; // damage to that weapon class is scaled by this amount (so lower means less damage; set to greater than 100 for more damage)
-    string type; // monster type, e.g., goblinoid (may be empty)
+    Symbol type; // monster type, e.g., goblinoid (may be empty)
     int regeneration; // if non-zero, the character will heal 1 health per regeneration ms
     bool death_explodes; // whether explodes on death
     int death_explodes_damage; // n-D6 damage due to exploding
@@ -338,6 +373,7 @@ class Character {
     Location *location; // not saved
     CharacterListener *listener; // not saved
     void *listener_data; // not saved
+    unsigned int handle_slot; // not saved // see CharacterHandle
     bool is_dead;
     int time_of_death_ms; // not saved
     Vector2D pos;
@@ -345,9 +381,17 @@ class Character {
     bool has_charge_pos; // not saved
     Vector2D charge_pos; // not saved
     bool is_visible; // not saved // for NPCs: whether player and NPC can see each other
+    bool has_visibility_cache; // not saved // whether is_visible is still valid for the following, see PlayingGamestate::testFogOfWar()
+    Vector2D visibility_cache_pos; // not saved
+    Vector2D visibility_cache_player_pos; // not saved
+    int visibility_cache_region; // not saved // index of our floor region, or -1
+    int visibility_cache_player_region; // not saved // index of the player's floor region, or -1
+    int visibility_cache_boundaries_version; // not saved
     bool has_path; // not saved
     vector<Vector2D> path; // not saved
-    Character *target_npc; // not saved
+    size_t path_pos; // not saved // index of the next point on the path to move to
+    bool path_requested; // not saved // whether we're waiting for the location to calculate a path for us
+    CharacterHandle target_npc_handle; // not saved
     int time_last_action_ms; // not saved
     //bool is_hitting; // not saved
     enum Action {
@@ -359,8 +403,9 @@ class Character {
     Action action; // not saved
     bool has_charged; // not saved // for ACTION_HITTING
     const Spell *casting_spell;
-    Character *casting_spell_target;
-    int time_last_complex_update_ms; // not saved
+    CharacterHandle casting_spell_target_handle;
+    int time_next_think_ms; // not saved // when think() is next due, or -1 if not yet scheduled - see PlayingGamestate::updateAI()
+    bool is_dormant; // not saved // dormant NPCs aren't updated, see Location::setCharacterDormant()
     int time_last_regenerated_ms; // not saved
     // default positions only relevant for NPCs that don't change locations
     bool has_default_position;
@@ -376,6 +421,10 @@ class Character {
     bool is_diseased;
 
     vector<ProfileEffect> profile_effects;
+    // cache of the properties including effects, items, disease and skills - see getProfileIntProperty()
+    mutable bool has_stats_cache; // not saved
+    mutable int stats_cache_int[N_PROFILE_INT_KEYS]; // not saved
+    mutable float stats_cache_float[N_PROFILE_FLOAT_KEYS]; // not saved
 
     // used for levelling:
     Profile initial_profile;
@@ -419,6 +468,10 @@ class Character {
 
     string objective_id;
 
+    void updateStatsCache() const;
+    int calculateProfileIntProperty(ProfileIntKey key) const;
+    float calculateProfileFloatProperty(ProfileFloatKey key) const;
+
     // rule of three
     /*Character& operator=(const Character &character) {
         throw string("Character assignment operator disallowed");
@@ -430,6 +483,13 @@ public:
     explicit Character(const Character &character);
     ~Character();
 
+    static void *operator new(size_t size) {
+        return allocateSmallObject(size);
+    }
+    static void operator delete(void *ptr, size_t size) {
+        freeSmallObject(ptr, size);
+    }
+
     // copy of CharacterTemplate:
     void setNaturalDamage(int natural_damageX, int natural_damageY, int natural_damageZ) {
         //this->has_natural_damage = true;
@@ -492,7 +552,7 @@ public:
     bool isUnholy() const {
         return this->unholy;
     }
-    string getAnimationName() const {
+    Symbol getAnimationName() const {
         return this->animation_name;
     }
     void setStaticImage(bool static_image) {
@@ -524,9 +584,9 @@ public:
         return this->weapon_resist_percentage;
     }
     void setType(const string &type) {
-        this->type = type;
+        this->type = Symbol(type);
     }
-    string getType() const {
+    Symbol getType() const {
         return this->type;
     }
     void setRegeneration(int regeneration) {
@@ -582,16 +642,7 @@ public:
     float getDefaultY() const {
         return this->default_position.y;
     }
-    void setPos(float xpos, float ypos) {
-        this->pos.set(xpos, ypos);
-        if( !has_charge_pos ) {
-            this->has_charge_pos = true;
-            this->charge_pos = pos;
-        }
-        if( this->listener != NULL ) {
-            this->listener->characterMoved(this, this->listener_data);
-        }
-    }
+    void setPos(float xpos, float ypos);
     float getX() const {
         return this->pos.x;
     }
@@ -611,6 +662,7 @@ public:
 
     void setLocation(Location *location) {
         this->location = location;
+        this->invalidateStatsCache(); // sprint skill depends on the location
     }
     Location *getLocation() const {
         return this->location;
@@ -630,6 +682,7 @@ public:
     }
     void setHostile(bool is_hostile) {
         this->is_hostile = is_hostile;
+        this->invalidateStatsCache();
         if( !is_hostile && this->is_ai ) {
             this->is_fixed = true;
         }
@@ -655,6 +708,22 @@ public:
     bool isVisible() const {
         return this->is_visible;
     }
+    void setVisibilityCache(Vector2D player_pos, int region, int player_region, int boundaries_version) {
+        this->has_visibility_cache = true;
+        this->visibility_cache_pos = this->pos;
+        this->visibility_cache_player_pos = player_pos;
+        this->visibility_cache_region = region;
+        this->visibility_cache_player_region = player_region;
+        this->visibility_cache_boundaries_version = boundaries_version;
+    }
+    void clearVisibilityCache() {
+        this->has_visibility_cache = false;
+    }
+    /** Whether is_visible is still valid: either neither we nor the player have moved far enough
+      * to change it, or we're not visible, and are both still in floor regions that the
+      * location's PVS says can't see each other.
+      */
+    bool isVisibilityCacheValid(Vector2D player_pos, int player_region, int boundaries_version) const;
     void paralyse(int time_ms);
     bool isParalysed() const {
         return this->is_paralysed;
@@ -664,6 +733,7 @@ public:
     }
     void setDiseased(bool is_diseased) {
         this->is_diseased = is_diseased;
+        this->invalidateStatsCache();
     }
     bool isDiseased() const {
         return this->is_diseased;
@@ -679,18 +749,38 @@ public:
     }*/
     void setPath(vector<Vector2D> &path);
     void setDestination(float xdest, float ydest, const void *ignore);
+    void setFleeDestination(Vector2D fleeing_from);
+    void pathRequestCompleted(bool is_flee, vector<Vector2D> &new_path);
+    void cancelPathRequest();
+    bool hasPathRequest() const {
+        return this->path_requested;
+    }
     bool hasPath() const {
         return this->has_path;
     }
     Vector2D getDestination() const;
     bool update(PlayingGamestate *playing_gamestate);
+    void think(PlayingGamestate *playing_gamestate);
+    int getTimeNextThinkMS() const {
+        return this->time_next_think_ms;
+    }
+    void setTimeNextThinkMS(int time_next_think_ms) {
+        this->time_next_think_ms = time_next_think_ms;
+    }
+    bool isDormant() const {
+        return this->is_dormant;
+    }
+    void setDormant(bool is_dormant) {
+        // should only be called by Location, use Location::setCharacterDormant() instead
+        this->is_dormant = is_dormant;
+    }
     void handleSpecialHitEffects(PlayingGamestate *playing_gamestate, Character *target) const;
     int getTimeTurn(bool is_casting, bool is_ranged);
     void setTargetNPC(Character *target_npc);
     Character *getTargetNPC() const {
-        return this->target_npc;
+        return this->target_npc_handle.get();
     }
-    void notifyDead(const Character *character);
+    void checkDeadTargets();
 
     const Profile *getBaseProfile() const {
         return &this->profile;
@@ -702,11 +792,13 @@ public:
         int value = this->profile.getIntProperty(key);
         value += change;
         this->profile.setIntProperty(key, value);
+        this->invalidateStatsCache();
     }
     void changeBaseProfileFloatProperty(const string &key, float change) {
         float value = this->profile.getFloatProperty(key);
         value += change;
         this->profile.setFloatProperty(key, value);
+        this->invalidateStatsCache();
     }
     int getBaseProfileIntProperty(const string &key) const {
         return this->profile.getIntProperty(key);
@@ -715,7 +807,23 @@ public:
         return this->profile.getFloatProperty(key);
     }
     int getProfileIntProperty(const string &key) const;
+    int getProfileIntProperty(ProfileIntKey key) const {
+        if( !this->has_stats_cache ) {
+            this->updateStatsCache();
+        }
+        return this->stats_cache_int[key];
+    }
     float getProfileFloatProperty(const string &key) const;
+    float getProfileFloatProperty(ProfileFloatKey key) const {
+        if( !this->has_stats_cache ) {
+            this->updateStatsCache();
+        }
+        return this->stats_cache_float[key];
+    }
+    void invalidateStatsCache() {
+        // should be called whenever anything that getProfileIntProperty() or getProfileFloatProperty() depend on changes
+        this->has_stats_cache = false;
+    }
     bool hasBaseProfileIntProperty(const string &key) const {
         return this->profile.hasIntProperty(key);
     }
@@ -728,12 +836,15 @@ public:
         this->profile.set(FP, BS, S, A, M, D, B, Sp);
         this->initial_level = this->level;
         this->initial_profile = this->profile;
+        this->invalidateStatsCache();
     }
     void setProfile(int FP, int BS, int S, int A, int M, int D, int B, float Sp) {
         this->profile.set(FP, BS, S, A, M, D, B, Sp);
+        this->invalidateStatsCache();
     }
     void addProfile(int FP, int BS, int S, int A, int M, int D, int B, float Sp) {
         this->profile.add(FP, BS, S, A, M, D, B, Sp);
+        this->invalidateStatsCache();
     }
     void setInitialProfile(int initial_level, int FP, int BS, int S, int A, int M, int D, int B, float Sp) {
         this->initial_level = initial_level;
@@ -741,6 +852,7 @@ public:
     }
     void addProfileEffect(const ProfileEffect &profile_effect) {
         this->profile_effects.push_back(profile_effect);
+        this->invalidateStatsCache();
     }
     vector<ProfileEffect>::const_iterator profileEffectsBegin() const {
         return this->profile_effects.begin();
@@ -753,6 +865,7 @@ public:
     }
     void expireProfileEffects() {
         this->profile_effects.clear();
+        this->invalidateStatsCache();
     }
     int modifyStatForDifficulty(PlayingGamestate *playing_gamestate, int value) const;
     void initialiseHealth(int max_health) {
@@ -793,6 +906,7 @@ public:
     }
     void addSkill(const string &skill) {
         this->skills.insert(skill);
+        this->invalidateStatsCache();
     }
     bool hasSkill(const string &skill) const {
         if( this->skills.find(skill) == this->skills.end() )
@@ -1,5 +1,7 @@
 #include <sstream>
 using std::stringstream;
+#include <set>
+using std::set;
 
 #ifdef _DEBUG
 #include <cassert>
@@ -11,8 +13,42 @@ using std::stringstream;
 #include "../playinggamestate.h"
 #include "../logiface.h"
 
+ItemTemplate::ItemTemplate(const string &name, const string &image_name) :
+    name(name), image_name(image_name)
+{
+}
+
+bool ItemTemplate::operator<(const ItemTemplate &that) const {
+    const string ItemTemplate::*fields[] = {
+        &ItemTemplate::name, &ItemTemplate::image_name, &ItemTemplate::description, &ItemTemplate::base_template,
+        &ItemTemplate::use, &ItemTemplate::use_verb, &ItemTemplate::arg1_s
+    };
+    for(size_t i=0;i<sizeof(fields)/sizeof(fields[0]);i++) {
+        int cmp = (this->*fields[i]).compare(that.*fields[i]);
+        if( cmp != 0 )
+            return cmp < 0;
+    }
+    for(int i=0;i<N_PROFILE_INT_KEYS;i++) {
+        ProfileIntKey key = static_cast<ProfileIntKey>(i);
+        if( this->profile_bonus.getIntProperty(key) != that.profile_bonus.getIntProperty(key) )
+            return this->profile_bonus.getIntProperty(key) < that.profile_bonus.getIntProperty(key);
+    }
+    for(int i=0;i<N_PROFILE_FLOAT_KEYS;i++) {
+        ProfileFloatKey key = static_cast<ProfileFloatKey>(i);
+        if( this->profile_bonus.getFloatProperty(key) != that.profile_bonus.getFloatProperty(key) )
+            return this->profile_bonus.getFloatProperty(key) < that.profile_bonus.getFloatProperty(key);
+    }
+    return false;
+}
+
+const ItemTemplate *ItemTemplate::find(const ItemTemplate &item_template) {
+    // n.b., as for SceneryTemplate, set elements never move, so the returned pointers stay valid
+    static set<ItemTemplate> item_templates;
+    return &*item_templates.insert(item_template).first;
+}
+
 Item::Item(const string &name, const string &image_name, int weight) :
-    name(name), image_name(image_name), user_data_gfx(NULL), icon_width(default_icon_width_c), weight(weight),
+    item_template( ItemTemplate::find(ItemTemplate(name, image_name)) ), user_data_gfx(NULL), icon_width(default_icon_width_c), weight(weight),
     arg1(0), arg2(0), rating(1), is_magical(false), worth_bonus(0)
 {
 }
@@ -21,12 +57,27 @@ Item *Item::clone() const {
     return new Item(*this);
 }
 
+void Item::setTemplateString(string ItemTemplate::*field, const string &value) {
+    if( this->item_template->*field != value ) {
+        ItemTemplate new_template(*this->item_template);
+        new_template.*field = value;
+        this->item_template = ItemTemplate::find(new_template);
+    }
+}
+
+void Item::setTemplateProfileBonus(const Profile &profile_bonus) {
+    ItemTemplate new_template(*this->item_template);
+    new_template.profile_bonus = profile_bonus;
+    this->item_template = ItemTemplate::find(new_template);
+}
+
 bool Item::canUse() const {
     //return item_use != ITEMUSE_NONE;
-    return use.length() > 0;
+    return this->item_template->use.length() > 0;
 }
 
 string Item::getUseVerb() const {
+    const string &use_verb = this->item_template->use_verb;
     if( use_verb.length() == 0 )
         return "Use";
     return use_verb;
@@ -40,7 +91,9 @@ bool Item::useItem(PlayingGamestate *playing_gamestate, Character *character) {
         throw string("tried to use item that can't be used");
     }
 
-    if( this->use == "ITEMUSE_POTION_HEALING" ) {
+    const string &use = this->item_template->use;
+    const string &arg1_s = this->item_template->arg1_s;
+    if( use == "ITEMUSE_POTION_HEALING" ) {
         int amount = rollDice(this->rating, 6, 0);
         LOG("Character: %s drinks potion of healing, heal %d\n", character->getName().c_str(), amount);
         character->increaseHealth( amount );
@@ -51,22 +104,22 @@ bool Item::useItem(PlayingGamestate *playing_gamestate, Character *character) {
         }
         return true;
     }
-    else if( this->use == "ITEMUSE_POTION_EFFECT" ) {
-        LOG("Character: %s drinks potion, effect: %s\n", character->getName().c_str(), this->arg1_s.c_str());
-        if( this->arg1_s == "cure_disease" ) {
+    else if( use == "ITEMUSE_POTION_EFFECT" ) {
+        LOG("Character: %s drinks potion, effect: %s\n", character->getName().c_str(), arg1_s.c_str());
+        if( arg1_s == "cure_disease" ) {
             if( character->isDiseased() ) {
                 character->setDiseased(false);
             }
         }
         else {
             // arg1_s gives statistic affect, rating gives increase, arg1 gives time in ms
-            LOG("Character: %s drinks potion, change %s by %d for %d\n", character->getName().c_str(), this->arg1_s.c_str(), this->rating, this->arg1);
+            LOG("Character: %s drinks potion, change %s by %d for %d\n", character->getName().c_str(), arg1_s.c_str(), this->rating, this->arg1);
             Profile potion_profile;
-            if( character->hasBaseProfileIntProperty(this->arg1_s) ) {
-                potion_profile.setIntProperty(this->arg1_s, this->rating);
+            if( character->hasBaseProfileIntProperty(arg1_s) ) {
+                potion_profile.setIntProperty(arg1_s, this->rating);
             }
-            else if( character->hasBaseProfileFloatProperty(this->arg1_s) ) {
-                potion_profile.setFloatProperty(this->arg1_s, static_cast<float>(this->rating));
+            else if( character->hasBaseProfileFloatProperty(arg1_s) ) {
+                potion_profile.setFloatProperty(arg1_s, static_cast<float>(this->rating));
             }
             else {
                 LOG("### unknown property type!\n");
@@ -81,7 +134,7 @@ bool Item::useItem(PlayingGamestate *playing_gamestate, Character *character) {
         }
         return true;
     }
-    else if( this->use == "ITEMUSE_HARM" ) {
+    else if( use == "ITEMUSE_HARM" ) {
         int amount = rollDice(this->rating, 6, 0);
         LOG("Character: %s uses harmful item, damage %d\n", character->getName().c_str(), amount);
         character->decreaseHealth(playing_gamestate, amount, false, false);
@@ -89,7 +142,7 @@ bool Item::useItem(PlayingGamestate *playing_gamestate, Character *character) {
         playing_gamestate->addTextEffect(PlayingGamestate::tr("Yuck!").toStdString(), character->getPos(), 1000);
         return true;
     }
-    else if( this->use == "ITEMUSE_MUSHROOM" ) {
+    else if( use == "ITEMUSE_MUSHROOM" ) {
         int roll = rollDice(1, 6, 0);
         LOG("Character: %s eats mushroom, rolls %d\n", character->getName().c_str(), roll);
         if( roll <= 4 ) {
@@ -115,7 +168,7 @@ bool Item::useItem(PlayingGamestate *playing_gamestate, Character *character) {
     }
     else {
         //LOG("Item::use() unknown item_use: %d\n", this->item_use);
-        LOG("Item::use() unknown item_use: %s\n", this->use.c_str());
+        LOG("Item::use() unknown item_use: %s\n", use.c_str());
         ASSERT_LOGGER(false);
     }
     return false;
@@ -235,23 +288,23 @@ string Item::getDetailedDescription(const Character *player) const {
 }
 
 int Item::getRawProfileBonusIntProperty(const string &key) const {
-    int value = this->profile_bonus.getIntProperty(key);
+    int value = this->item_template->profile_bonus.getIntProperty(key);
     return value;
 }
 
 float Item::getRawProfileBonusFloatProperty(const string &key) const {
-    float value = this->profile_bonus.getFloatProperty(key);
+    float value = this->item_template->profile_bonus.getFloatProperty(key);
     return value;
 }
 
-int Item::getProfileBonusIntProperty(const Character *, const string &key) const {
+int Item::getProfileBonusIntProperty(const Character *, ProfileIntKey key) const {
     // default for item is that profile bonus is always active
-    return this->getRawProfileBonusIntProperty(key);
+    return this->item_template->profile_bonus.getIntProperty(key);
 }
 
-float Item::getProfileBonusFloatProperty(const Character *, const string &key) const {
+float Item::getProfileBonusFloatProperty(const Character *, ProfileFloatKey key) const {
     // default for item is that profile bonus is always active
-    return this->getRawProfileBonusFloatProperty(key);
+    return this->item_template->profile_bonus.getFloatProperty(key);
 }
 
 bool ItemCompare::operator()(const Item *lhs, const Item *rhs) const {
@@ -265,7 +318,7 @@ bool ItemCompare::operator()(const Item *lhs, const Item *rhs) const {
 }
 
 Weapon::Weapon(const string &name, const string &image_name, int weight, const string &animation_name, int damageX, int damageY, int damageZ) :
-    Item(name, image_name, weight), animation_name(animation_name),
+    Item(name, image_name, weight), animation_name(Symbol(animation_name)),
     is_two_handed(false), weapon_type(WEAPONTYPE_HAND), requires_ammo(false),
     damageX(damageX), damageY(damageY), damageZ(damageZ),
     min_strength(0), unholy_only(false)
@@ -289,14 +342,14 @@ int Weapon::getDamage(const Character *defender) const {
     return roll;
 }
 
-int Weapon::getProfileBonusIntProperty(const Character *character, const string &key) const {
+int Weapon::getProfileBonusIntProperty(const Character *character, ProfileIntKey key) const {
     // profile bonus only active if weapon is armed
     if( this != character->getCurrentWeapon() )
         return 0;
     return Item::getProfileBonusIntProperty(character, key);
 }
 
-float Weapon::getProfileBonusFloatProperty(const Character *character, const string &key) const {
+float Weapon::getProfileBonusFloatProperty(const Character *character, ProfileFloatKey key) const {
     // profile bonus only active if weapon is armed
     if( this != character->getCurrentWeapon() )
         return 0;
@@ -304,7 +357,7 @@ float Weapon::getProfileBonusFloatProperty(const Character *character, const str
 }
 
 Shield::Shield(const string &name, const string &image_name, int weight, const string &animation_name) :
-    Item(name, image_name, weight), animation_name(animation_name)
+    Item(name, image_name, weight), animation_name(Symbol(animation_name))
 {
 }
 
@@ -312,14 +365,14 @@ Shield *Shield::clone() const {
     return new Shield(*this);
 }
 
-int Shield::getProfileBonusIntProperty(const Character *character, const string &key) const {
+int Shield::getProfileBonusIntProperty(const Character *character, ProfileIntKey key) const {
     // profile bonus only active if shield is armed
     if( this != character->getCurrentShield() )
         return 0;
     return Item::getProfileBonusIntProperty(character, key);
 }
 
-float Shield::getProfileBonusFloatProperty(const Character *character, const string &key) const {
+float Shield::getProfileBonusFloatProperty(const Character *character, ProfileFloatKey key) const {
     // profile bonus only active if shield is armed
     if( this != character->getCurrentShield() )
         return 0;
@@ -337,14 +390,14 @@ Armour *Armour::clone() const {
     return new Armour(*this);
 }
 
-int Armour::getProfileBonusIntProperty(const Character *character, const string &key) const {
+int Armour::getProfileBonusIntProperty(const Character *character, ProfileIntKey key) const {
     // profile bonus only active if armour is worn
     if( this != character->getCurrentArmour() )
         return 0;
     return Item::getProfileBonusIntProperty(character, key);
 }
 
-float Armour::getProfileBonusFloatProperty(const Character *character, const string &key) const {
+float Armour::getProfileBonusFloatProperty(const Character *character, ProfileFloatKey key) const {
     // profile bonus only active if armour is worn
     if( this != character->getCurrentArmour() )
         return 0;
@@ -360,14 +413,14 @@ Ring *Ring::clone() const {
     return new Ring(*this);
 }
 
-int Ring::getProfileBonusIntProperty(const Character *character, const string &key) const {
+int Ring::getProfileBonusIntProperty(const Character *character, ProfileIntKey key) const {
     // profile bonus only active if ring is worn
     if( this != character->getCurrentRing() )
         return 0;
     return Item::getProfileBonusIntProperty(character, key);
 }
 
-float Ring::getProfileBonusFloatProperty(const Character *character, const string &key) const {
+float Ring::getProfileBonusFloatProperty(const Character *character, ProfileFloatKey key) const {
     // profile bonus only active if ring is worn
     if( this != character->getCurrentRing() )
         return 0;
@@ -375,7 +428,7 @@ float Ring::getProfileBonusFloatProperty(const Character *character, const strin
 }
 
 Ammo::Ammo(const string &name, const string &image_name, const string &ammo_type, const string &projectile_image_name, int weight, int amount) :
-    Item(name, image_name, weight), ammo_type(ammo_type), projectile_image_name(projectile_image_name), amount(amount)
+    Item(name, image_name, weight), ammo_type(Symbol(ammo_type)), projectile_image_name(Symbol(projectile_image_name)), amount(amount)
 {
 }
 
@@ -385,7 +438,7 @@ Ammo *Ammo::clone() const {
 
 string Ammo::getName() const {
     stringstream ammo_name;
-    ammo_name << this->name << " (" << amount << ")";
+    ammo_name << this->item_template->name << " (" << amount << ")";
     return ammo_name.str();
 }
 
@@ -400,7 +453,7 @@ Currency *Currency::clone() const {
 
 string Currency::getName() const {
     stringstream currency_name;
-    currency_name << value << " " << this->name;
+    currency_name << value << " " << this->item_template->name;
     return currency_name.str();
 }
 
@@ -28,25 +28,43 @@ enum ItemType {
     ITEMUSE_POTION_HEALING = 1
 };*/
 
-class Item {
-protected:
+/** The properties of an Item that are shared by every copy of it, e.g., every clone of a
+  * standard item. Templates are immutable: they are only obtained via ItemTemplate::find(),
+  * which returns the one copy with those values, and are never deleted.
+  */
+class ItemTemplate {
+public:
     string name;
     string image_name;
     string description;
     string base_template; // if non-empty, stores the standard item this is a variation of (used for Shops)
+    string use;
+    string use_verb;
+    string arg1_s; // used for "use"
+    Profile profile_bonus;
+
+    ItemTemplate(const string &name, const string &image_name);
+
+    bool operator<(const ItemTemplate &that) const;
+
+    static const ItemTemplate *find(const ItemTemplate &item_template);
+};
+
+class Item {
+protected:
+    const ItemTemplate *item_template; // shared with other items with the same values; setting a template value switches to another template
     Vector2D pos; // when stored in a Location
     void *user_data_gfx; // not saved
     float icon_width; // width of icon when drawn on screen in metres
     int weight; // in multiples of 100g
 
-    string use;
-    string use_verb;
     int arg1, arg2; // used for "use"
-    string arg1_s; // used for "use"
     int rating;
     bool is_magical;
     int worth_bonus;
-    Profile profile_bonus;
+
+    void setTemplateString(string ItemTemplate::*field, const string &value);
+    void setTemplateProfileBonus(const Profile &profile_bonus);
 
     string getProfileBonusDescriptionInt(const string &key) const;
     string getProfileBonusDescriptionFloat(const string &key) const;
@@ -56,6 +74,14 @@ public:
     virtual ~Item() {
     }
 
+    static void *operator new(size_t size) {
+        // n.b., size is that of the subclass being allocated, which is also passed to operator delete due to the virtual destructor
+        return allocateSmallObject(size);
+    }
+    static void operator delete(void *ptr, size_t size) {
+        freeSmallObject(ptr, size);
+    }
+
     virtual ItemType getType() const {
         return ITEMTYPE_GENERAL;
     }
@@ -79,32 +105,41 @@ public:
     Vector2D getPos() const {
         return this->pos;
     }
-    string getKey() const {
+    const ItemTemplate *getTemplate() const {
+        return this->item_template;
+    }
+    /** Sets all the template values at once, with a single lookup. Loaders should use this
+      * rather than the individual setters, as each of those looks up another template.
+      */
+    void setTemplate(const ItemTemplate &item_template) {
+        this->item_template = ItemTemplate::find(item_template);
+    }
+    const string &getKey() const {
         // the name is used as an ID key
-        return this->name;
+        return this->item_template->name;
     }
     void setName(const string &name) {
-        this->name = name;
+        this->setTemplateString(&ItemTemplate::name, name);
     }
     virtual string getName() const {
         // may be overloaded to give more descriptive names
-        return this->name;
+        return this->item_template->name;
     }
     void setBaseTemplate(const string &base_template) {
-        this->base_template = base_template;
+        this->setTemplateString(&ItemTemplate::base_template, base_template);
     }
-    string getBaseTemplate() const {
-        return this->base_template;
+    const string &getBaseTemplate() const {
+        return this->item_template->base_template;
     }
     void setDescription(const string &description) {
-        this->description = description;
+        this->setTemplateString(&ItemTemplate::description, description);
     }
-    string getDescription() const {
-        return this->description;
+    const string &getDescription() const {
+        return this->item_template->description;
     }
     string getDetailedDescription(const Character *player) const;
-    string getImageName() const {
-        return this->image_name;
+    const string &getImageName() const {
+        return this->item_template->image_name;
     }
     void setUserGfxData(void *user_data_gfx) {
         this->user_data_gfx = user_data_gfx;
@@ -125,8 +160,8 @@ public:
         return this->weight;
     }
     bool canUse() const;
-    string getUse() const {
-        return this->use;
+    const string &getUse() const {
+        return this->item_template->use;
     }
     string getUseVerb() const;
     bool useItem(PlayingGamestate *playing_gamestate, Character *character);
@@ -134,8 +169,8 @@ public:
         this->item_use = item_use;
     }*/
     void setUse(const string &use, const string &use_verb) {
-        this->use = use;
-        this->use_verb = use_verb;
+        this->setTemplateString(&ItemTemplate::use, use);
+        this->setTemplateString(&ItemTemplate::use_verb, use_verb);
     }
     void setArg1(int arg1) {
         this->arg1 = arg1;
@@ -150,10 +185,10 @@ public:
         return this->arg2;
     }
     void setArg1s(const string &arg1_s) {
-        this->arg1_s = arg1_s;
+        this->setTemplateString(&ItemTemplate::arg1_s, arg1_s);
     }
-    string getArg1s() const {
-        return this->arg1_s;
+    const string &getArg1s() const {
+        return this->item_template->arg1_s;
     }
     void setRating(int rating) {
         this->rating = rating;
@@ -174,15 +209,19 @@ public:
         return this->worth_bonus;
     }
     void setProfileBonusIntProperty(const string &key, int value) {
-        this->profile_bonus.setIntProperty(key, value);
+        Profile profile_bonus = this->item_template->profile_bonus;
+        profile_bonus.setIntProperty(key, value);
+        this->setTemplateProfileBonus(profile_bonus);
     }
     void setProfileBonusFloatProperty(const string &key, float value) {
-        this->profile_bonus.setFloatProperty(key, value);
+        Profile profile_bonus = this->item_template->profile_bonus;
+        profile_bonus.setFloatProperty(key, value);
+        this->setTemplateProfileBonus(profile_bonus);
     }
     int getRawProfileBonusIntProperty(const string &key) const;
     float getRawProfileBonusFloatProperty(const string &key) const;
-    virtual int getProfileBonusIntProperty(const Character *character, const string &key) const;
-    virtual float getProfileBonusFloatProperty(const Character *character, const string &key) const;
+    virtual int getProfileBonusIntProperty(const Character *character, ProfileIntKey key) const;
+    virtual float getProfileBonusFloatProperty(const Character *character, ProfileFloatKey key) const;
 };
 
 class ItemCompare {
@@ -198,16 +237,16 @@ public:
         WEAPONTYPE_THROWN = 2
     };
 private:
-    string animation_name;
+    Symbol animation_name;
     bool is_two_handed;
     WeaponType weapon_type;
     bool requires_ammo;
-    string ammo_key;
+    Symbol ammo_key;
     int damageX, damageY, damageZ;
     int min_strength;
     bool unholy_only;
     int unholy_bonus;
-    string weapon_class;
+    Symbol weapon_class;
 public:
     Weapon(const string &name, const string &image_name, int weight, const string &animation_name, int damageX, int damageY, int damageZ);
     virtual ~Weapon() {
@@ -218,8 +257,8 @@ public:
     }
     virtual Weapon *clone() const; // virtual copy constructor
 
-    string getAnimationName() const {
-        return this->animation_name;
+    const string &getAnimationName() const {
+        return this->animation_name.str();
     }
 
     void setTwoHanded(bool is_two_handed) {
@@ -239,13 +278,13 @@ public:
     }
     void setRequiresAmmo(bool requires_ammo, const string &ammo_key) {
         this->requires_ammo = requires_ammo;
-        this->ammo_key = ammo_key;
+        this->ammo_key = Symbol(ammo_key);
     }
     bool getRequiresAmmo() const {
         return this->requires_ammo;
     }
     string getAmmoKey() const {
-        return this->requires_ammo ? this->ammo_key : "";
+        return this->requires_ammo ? this->ammo_key.str() : "";
     }
     void setDamage(int damageX, int damageY, int damageZ) {
         this->damageX = damageX;
@@ -278,17 +317,17 @@ public:
         return this->unholy_bonus;
     }
     void setWeaponClass(const string weapon_class) {
-        this->weapon_class = weapon_class;
+        this->weapon_class = Symbol(weapon_class);
     }
-    string getWeaponClass() const {
-        return this->weapon_class;
+    const string &getWeaponClass() const {
+        return this->weapon_class.str();
     }
-    virtual int getProfileBonusIntProperty(const Character *character, const string &key) const;
-    virtual float getProfileBonusFloatProperty(const Character *character, const string &key) const;
+    virtual int getProfileBonusIntProperty(const Character *character, ProfileIntKey key) const;
+    virtual float getProfileBonusFloatProperty(const Character *character, ProfileFloatKey key) const;
 };
 
 class Shield : public Item {
-    string animation_name;
+    Symbol animation_name;
 public:
     Shield(const string &name, const string &image_name, int weight, const string &animation_name);
     virtual ~Shield() {
@@ -299,11 +338,11 @@ public:
     }
     virtual Shield *clone() const; // virtual copy constructor
 
-    string getAnimationName() const {
-        return this->animation_name;
+    const string &getAnimationName() const {
+        return this->animation_name.str();
     }
-    virtual int getProfileBonusIntProperty(const Character *character, const string &key) const;
-    virtual float getProfileBonusFloatProperty(const Character *character, const string &key) const;
+    virtual int getProfileBonusIntProperty(const Character *character, ProfileIntKey key) const;
+    virtual float getProfileBonusFloatProperty(const Character *character, ProfileFloatKey key) const;
 };
 
 class Armour : public Item {
@@ -328,8 +367,8 @@ public:
     int getMinStrength() const {
         return this->min_strength;
     }
-    virtual int getProfileBonusIntProperty(const Character *character, const string &key) const;
-    virtual float getProfileBonusFloatProperty(const Character *character, const string &key) const;
+    virtual int getProfileBonusIntProperty(const Character *character, ProfileIntKey key) const;
+    virtual float getProfileBonusFloatProperty(const Character *character, ProfileFloatKey key) const;
 };
 
 class Ring : public Item {
@@ -343,13 +382,13 @@ public:
     }
     virtual Ring *clone() const; // virtual copy constructor
 
-    virtual int getProfileBonusIntProperty(const Character *character, const string &key) const;
-    virtual float getProfileBonusFloatProperty(const Character *character, const string &key) const;
+    virtual int getProfileBonusIntProperty(const Character *character, ProfileIntKey key) const;
+    virtual float getProfileBonusFloatProperty(const Character *character, ProfileFloatKey key) const;
 };
 
 class Ammo : public Item {
-    string ammo_type;
-    string projectile_image_name;
+    Symbol ammo_type;
+    Symbol projectile_image_name;
     int amount;
 public:
     Ammo(const string &name, const string &image_name, const string &ammo_type, const string &projectile_image_name, int weight, int amount);
@@ -363,11 +402,11 @@ public:
 
     virtual string getName() const;
 
-    string getAmmoType() const {
-        return this->ammo_type;
+    const string &getAmmoType() const {
+        return this->ammo_type.str();
     }
-    string getProjectileImageName() const {
-        return this->projectile_image_name;
+    const string &getProjectileImageName() const {
+        return this->projectile_image_name.str();
     }
     int getAmount() const {
         return this->amount;
@@ -375,10 +414,10 @@ public:
     void setAmount(int amount) {
         this->amount = amount;
     }
-    virtual int getProfileBonusIntProperty(const Character *, const string &) const {
+    virtual int getProfileBonusIntProperty(const Character *, ProfileIntKey) const {
         return 0;
     }
-    virtual float getProfileBonusFloatProperty(const Character *, const string &) const {
+    virtual float getProfileBonusFloatProperty(const Character *, ProfileFloatKey) const {
         return 0;
     }
 };
@@ -402,10 +441,10 @@ public:
     void setValue(int value) {
         this->value = value;
     }
-    virtual int getProfileBonusIntProperty(const Character *, const string &) const {
+    virtual int getProfileBonusIntProperty(const Character *, ProfileIntKey) const {
         return 0;
     }
-    virtual float getProfileBonusFloatProperty(const Character *, const string &) const {
+    virtual float getProfileBonusFloatProperty(const Character *, ProfileFloatKey) const {
         return 0;
     }
 };
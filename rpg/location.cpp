@@ -1,10 +1,15 @@
 #include <qdebug.h>
+#include <QThread>
+#include <QElapsedTimer>
 
 #include <algorithm>
 using std::min;
 using std::max;
 using std::swap;
 
+#include <functional>
+using std::greater;
+
 #ifdef _DEBUG
 #include <cassert>
 #endif
@@ -16,10 +21,67 @@ using std::swap;
 #include "../playinggamestate.h"
 #include "../logiface.h"
 
+const float boundary_grid_min_cell_size_c = 2.0f;
+const int boundary_grid_max_cells_c = 64; // maximum number of cells along each side of the boundary grid
+const size_t region_route_min_regions_c = 16; // locations with fewer floor regions than this always search the whole distance graph
+const float player_field_update_dist_c = 1.0f; // how far the player must move before the field of distances to the player is recalculated
+const float corner_clear_dist_c = 3.0f*npc_radius_c; // edges at a corner aren't pruned if other boundaries are closer to it than this
+const int path_request_default_budget_us_c = 2000; // time that each processPathRequests() call may spend calculating paths for NPCs
+const size_t pvs_max_steps_c = 10000; // maximum number of portal sequences searched from each floor region when calculating the PVS
+const float character_grid_cell_size_c = 2.0f*npc_radius_c; // so that collisions between characters only need testing against neighbouring cells
+const float trigger_grid_cell_size_c = 3.0f; // the radius at which the player is shown scenery popup text, so that a step only needs testing against neighbouring cells
+
+SceneryTemplate::SceneryTemplate(const string &name, const string &image_name, float width, float height, float visual_height, bool boundary_iso, float boundary_iso_ratio) :
+    name(name), image_name(image_name), width(width), height(height), visual_height(visual_height), boundary_iso(boundary_iso), boundary_iso_ratio(boundary_iso_ratio)
+{
+}
+
+bool SceneryTemplate::operator<(const SceneryTemplate &that) const {
+    // n.b., any strict weak ordering will do, so compare the cheap fields first
+    if( this->width != that.width )
+        return this->width < that.width;
+    if( this->height != that.height )
+        return this->height < that.height;
+    if( this->visual_height != that.visual_height )
+        return this->visual_height < that.visual_height;
+    if( this->boundary_iso != that.boundary_iso )
+        return this->boundary_iso < that.boundary_iso;
+    if( this->boundary_iso_ratio != that.boundary_iso_ratio )
+        return this->boundary_iso_ratio < that.boundary_iso_ratio;
+    const string SceneryTemplate::*fields[] = {
+        &SceneryTemplate::name, &SceneryTemplate::image_name, &SceneryTemplate::big_image_name, &SceneryTemplate::requires_flag,
+        &SceneryTemplate::exit_location, &SceneryTemplate::locked_text, &SceneryTemplate::unlock_item_name, &SceneryTemplate::unlock_text,
+        &SceneryTemplate::confirm_text, &SceneryTemplate::interact_type, &SceneryTemplate::popup_text, &SceneryTemplate::description
+    };
+    for(size_t i=0;i<sizeof(fields)/sizeof(fields[0]);i++) {
+        int cmp = (this->*fields[i]).compare(that.*fields[i]);
+        if( cmp != 0 )
+            return cmp < 0;
+    }
+    return false;
+}
+
+const SceneryTemplate *SceneryTemplate::find(const SceneryTemplate &scenery_template) {
+    // n.b., a function static for the same reason as the Symbol table; set elements never move, so the returned pointers stay valid
+    static set<SceneryTemplate> scenery_templates;
+    return &*scenery_templates.insert(scenery_template).first;
+}
+
 Scenery::Scenery(const string &name, const string &image_name, float width, float height, float visual_height, bool boundary_iso, float boundary_iso_ratio) :
-    location(NULL), name(name), image_name(image_name),
+    location(NULL), scenery_template( SceneryTemplate::find(SceneryTemplate(name, image_name, width, height, visual_height, boundary_iso, boundary_iso_ratio)) ),
+    is_blocking(false), blocks_visibility(false), is_door(false), is_exit(false), exit_travel_time(0), is_locked(false), locked_silent(false), locked_used_up(false), key_always_needed(false), unlock_xp(20),
+    draw_type(DRAWTYPE_NORMAL), opacity(1.0f), has_smoke(false),
+    action_last_time(0), action_delay(0), action_value(0),
+    interact_state(0),
+    can_be_opened(false), opened(false),
+    trap(NULL)
+{
+}
+
+Scenery::Scenery(const SceneryTemplate &scenery_template) :
+    location(NULL), scenery_template( SceneryTemplate::find(scenery_template) ),
     is_blocking(false), blocks_visibility(false), is_door(false), is_exit(false), exit_travel_time(0), is_locked(false), locked_silent(false), locked_used_up(false), key_always_needed(false), unlock_xp(20),
-    draw_type(DRAWTYPE_NORMAL), opacity(1.0f), has_smoke(false), width(width), height(height), visual_height(visual_height), boundary_iso(boundary_iso), boundary_iso_ratio(boundary_iso_ratio),
+    draw_type(DRAWTYPE_NORMAL), opacity(1.0f), has_smoke(false),
     action_last_time(0), action_delay(0), action_value(0),
     interact_state(0),
     can_be_opened(false), opened(false),
@@ -41,8 +103,20 @@ Scenery *Scenery::clone() const {
     return new Scenery(*this);
 }
 
+void Scenery::setTemplateString(string SceneryTemplate::*field, const string &value) {
+    if( this->scenery_template->*field != value ) {
+        SceneryTemplate new_template(*this->scenery_template);
+        new_template.*field = value;
+        this->scenery_template = SceneryTemplate::find(new_template);
+    }
+}
+
 void Scenery::setPos(float xpos, float ypos) {
     this->pos.set(xpos, ypos);
+    const float width = this->scenery_template->width;
+    const float height = this->scenery_template->height;
+    const bool boundary_iso = this->scenery_template->boundary_iso;
+    const float boundary_iso_ratio = this->scenery_template->boundary_iso_ratio;
 
     // set boundary polygons
     boundary_base = Polygon2D();
@@ -63,7 +137,7 @@ void Scenery::setPos(float xpos, float ypos) {
     boundary_base.addPoint(p2);
     boundary_base.addPoint(p3);
 
-    float extra_height = this->visual_height - this->height;
+    float extra_height = this->scenery_template->visual_height - height;
     if( fabs(extra_height) < E_TOL_LINEAR ) {
         this->boundary_visual = boundary_base;
     }
@@ -149,41 +223,41 @@ bool Scenery::isOn(const Character *character) const {
 
 vector<string> Scenery::getInteractionText(PlayingGamestate *, string *dialog_text) const {
     vector<string> options;
-    if( this->interact_type == "INTERACT_TYPE_THRONE_FP" ) {
+    if( this->scenery_template->interact_type == "INTERACT_TYPE_THRONE_FP" ) {
         *dialog_text = PlayingGamestate::tr("One of four manificant thrones in this room. They look out of place in this otherwise ruined location, and the settled dust suggests they have not been used in a long time. On the back of this chair is a symbol of a knife, gripped by a fist.\n\nDo you wish to sit on the throne?").toStdString();
         options.push_back(PlayingGamestate::tr("Yes, sit on the throne.").toStdString());
         options.push_back(PlayingGamestate::tr("No.").toStdString());
     }
-    else if( this->interact_type == "INTERACT_TYPE_THRONE_GOLD" ) {
+    else if( this->scenery_template->interact_type == "INTERACT_TYPE_THRONE_GOLD" ) {
         *dialog_text = PlayingGamestate::tr("One of four manificant thrones in this room. They look out of place in this otherwise ruined location, and the settled dust suggests they have not been used in a long time. On the back of this chair is a symbol of a gold coin.\n\nDo you wish to sit on the throne?").toStdString();
         options.push_back(PlayingGamestate::tr("Yes, sit on the throne.").toStdString());
         options.push_back(PlayingGamestate::tr("No.").toStdString());
     }
-    else if( this->interact_type == "INTERACT_TYPE_THRONE_M" ) {
+    else if( this->scenery_template->interact_type == "INTERACT_TYPE_THRONE_M" ) {
         *dialog_text = PlayingGamestate::tr("One of four manificant thrones in this room. They look out of place in this otherwise ruined location, and the settled dust suggests they have not been used in a long time. On the back of this chair is a symbol of an eye.\n\nDo you wish to sit on the throne?").toStdString();
         options.push_back(PlayingGamestate::tr("Yes, sit on the throne.").toStdString());
         options.push_back(PlayingGamestate::tr("No.").toStdString());
     }
-    else if( this->interact_type == "INTERACT_TYPE_THRONE_H" ) {
+    else if( this->scenery_template->interact_type == "INTERACT_TYPE_THRONE_H" ) {
         *dialog_text = PlayingGamestate::tr("One of four manificant thrones in this room. They look out of place in this otherwise ruined location, and the settled dust suggests they have not been used in a long time. On the back of this chair is a symbol of an tree.\n\nDo you wish to sit on the throne?").toStdString();
         options.push_back(PlayingGamestate::tr("Yes, sit on the throne.").toStdString());
         options.push_back(PlayingGamestate::tr("No.").toStdString());
     }
-    else if( this->interact_type == "INTERACT_TYPE_SHRINE" ) {
+    else if( this->scenery_template->interact_type == "INTERACT_TYPE_SHRINE" ) {
         *dialog_text = PlayingGamestate::tr("An old shrine, to some unknown forgotten diety. The wording on the stone has long since faded away. Do you wish to take a few moments to offer a prayer?").toStdString();
         options.push_back(PlayingGamestate::tr("Yes, pray.").toStdString());
         options.push_back(PlayingGamestate::tr("No.").toStdString());
     }
-    else if( this->interact_type == "INTERACT_TYPE_BELL" ) {
+    else if( this->scenery_template->interact_type == "INTERACT_TYPE_BELL" ) {
         *dialog_text = PlayingGamestate::tr("A large bell hangs here. Do you want to try ringing it?").toStdString();
         options.push_back(PlayingGamestate::tr("Yes, ring the bell.").toStdString());
         options.push_back(PlayingGamestate::tr("No.").toStdString());
     }
-    else if( this->interact_type == "INTERACT_TYPE_EXPERIMENTAL_CHAMBER_EMPTY" ) {
+    else if( this->scenery_template->interact_type == "INTERACT_TYPE_EXPERIMENTAL_CHAMBER_EMPTY" ) {
         *dialog_text = PlayingGamestate::tr("A large glass chamber filled with a murky liquid. As you look closely, you can see dark shapes floating inside, though you are unable to identify them.").toStdString();
         options.push_back(PlayingGamestate::tr("Okay").toStdString());
     }
-    else if( this->interact_type == "INTERACT_TYPE_EXPERIMENTAL_CHAMBER" ) {
+    else if( this->scenery_template->interact_type == "INTERACT_TYPE_EXPERIMENTAL_CHAMBER" ) {
         if( this->interact_state == 0 ) {
             *dialog_text = PlayingGamestate::tr("A large glass chamber filled with a murky liquid. As you look closely, suddenly the shape of a figure appears! It speaks, in a quiet, drawn out voice - \"Please...,\" it begs to you, \"End my suffering\".\n\nYou see that the glass chamber has a panel at the bottom with two buttons, red and green. You could press one - although you could also try smashing the glass.").toStdString();
             options.push_back(PlayingGamestate::tr("Press the red button.").toStdString());
@@ -196,15 +270,15 @@ vector<string> Scenery::getInteractionText(PlayingGamestate *, string *dialog_te
             options.push_back(PlayingGamestate::tr("Okay").toStdString());
         }
     }
-    else if( this->interact_type == "INTERACT_TYPE_PAINTING_SHATTER" ) {
+    else if( this->scenery_template->interact_type == "INTERACT_TYPE_PAINTING_SHATTER" ) {
         // no options - go straight to interaction
     }
-    else if( this->interact_type == "INTERACT_TYPE_POOL" ) {
+    else if( this->scenery_template->interact_type == "INTERACT_TYPE_POOL" ) {
         *dialog_text = PlayingGamestate::tr("A large pool of murky liquid is here. Do you wish to drink from it?").toStdString();
         options.push_back(PlayingGamestate::tr("Yes, drink.").toStdString());
         options.push_back(PlayingGamestate::tr("No.").toStdString());
     }
-    else if( this->interact_type == "INTERACT_TYPE_DUNGEON_MAP" ) {
+    else if( this->scenery_template->interact_type == "INTERACT_TYPE_DUNGEON_MAP" ) {
         // no options - go straight to interaction
     }
     else {
@@ -216,7 +290,7 @@ vector<string> Scenery::getInteractionText(PlayingGamestate *, string *dialog_te
 void Scenery::interact(PlayingGamestate *playing_gamestate, int option) {
     //string dialog_title, result_text;
     string result_text, picture;
-    if( this->interact_type == "INTERACT_TYPE_THRONE_FP" ) {
+    if( this->scenery_template->interact_type == "INTERACT_TYPE_THRONE_FP" ) {
         //dialog_title = "Throne";
         if( this->interact_state == 0 ) {
             this->interact_state = 1;
@@ -226,7 +300,7 @@ void Scenery::interact(PlayingGamestate *playing_gamestate, int option) {
             //playing_gamestate->getPlayer()->changeBaseFP(1);
             //playing_gamestate->getPlayer()->changeBaseProfileIntProperty(profile_key_FP_c, 1);
             Profile profile;
-            profile.setIntProperty(profile_key_FP_c, 1);
+            profile.setIntProperty(PROFILE_KEY_FP, 1);
             ProfileEffect profile_effect(profile, 3*60*1000);
             playing_gamestate->getPlayer()->addProfileEffect(profile_effect);
         }
@@ -235,7 +309,7 @@ void Scenery::interact(PlayingGamestate *playing_gamestate, int option) {
             playing_gamestate->getPlayer()->kill(playing_gamestate);
         }
     }
-    else if( this->interact_type == "INTERACT_TYPE_THRONE_GOLD" ) {
+    else if( this->scenery_template->interact_type == "INTERACT_TYPE_THRONE_GOLD" ) {
         //dialog_title = "Throne";
         if( this->interact_state == 0 ) {
             this->interact_state = 1;
@@ -252,7 +326,7 @@ void Scenery::interact(PlayingGamestate *playing_gamestate, int option) {
             }
         }
     }
-    else if( this->interact_type == "INTERACT_TYPE_THRONE_M" ) {
+    else if( this->scenery_template->interact_type == "INTERACT_TYPE_THRONE_M" ) {
         //dialog_title = "Throne";
         if( this->interact_state == 0 ) {
             this->interact_state = 1;
@@ -262,7 +336,7 @@ void Scenery::interact(PlayingGamestate *playing_gamestate, int option) {
             //playing_gamestate->getPlayer()->changeBaseM(1);
             //playing_gamestate->getPlayer()->changeBaseProfileIntProperty(profile_key_M_c, 1);
             Profile profile;
-            profile.setIntProperty(profile_key_M_c, 1);
+            profile.setIntProperty(PROFILE_KEY_M, 1);
             ProfileEffect profile_effect(profile, 3*60*1000);
             playing_gamestate->getPlayer()->addProfileEffect(profile_effect);
         }
@@ -271,7 +345,7 @@ void Scenery::interact(PlayingGamestate *playing_gamestate, int option) {
             playing_gamestate->getPlayer()->kill(playing_gamestate);
         }
     }
-    else if( this->interact_type == "INTERACT_TYPE_THRONE_H" ) {
+    else if( this->scenery_template->interact_type == "INTERACT_TYPE_THRONE_H" ) {
         //dialog_title = "Throne";
         if( this->interact_state == 0 ) {
             if( playing_gamestate->getPlayer()->getHealth() < playing_gamestate->getPlayer()->getMaxHealth() ) {
@@ -289,7 +363,7 @@ void Scenery::interact(PlayingGamestate *playing_gamestate, int option) {
             playing_gamestate->getPlayer()->decreaseHealth(playing_gamestate, damage, false, false);
         }
     }
-    else if( this->interact_type == "INTERACT_TYPE_SHRINE" ) {
+    else if( this->scenery_template->interact_type == "INTERACT_TYPE_SHRINE" ) {
         result_text = PlayingGamestate::tr("You pray, but nothing seems to happen.").toStdString();
         if( this->interact_state == 0 ) {
             int roll = rollDice(1, 3, 0);
@@ -312,7 +386,7 @@ void Scenery::interact(PlayingGamestate *playing_gamestate, int option) {
             }
         }
     }
-    else if( this->interact_type == "INTERACT_TYPE_BELL" ) {
+    else if( this->scenery_template->interact_type == "INTERACT_TYPE_BELL" ) {
         if( this->interact_state == 0 ) {
             Vector2D free_pvec;
             if( this->location->findFreeWayPoint(&free_pvec, playing_gamestate->getPlayer()->getPos(), true, false) ) {
@@ -348,10 +422,10 @@ void Scenery::interact(PlayingGamestate *playing_gamestate, int option) {
             result_text = PlayingGamestate::tr("You ring the bell again, but nothing seems to happen this time.").toStdString();
         }
     }
-    else if( this->interact_type == "INTERACT_TYPE_EXPERIMENTAL_CHAMBER_EMPTY" ) {
+    else if( this->scenery_template->interact_type == "INTERACT_TYPE_EXPERIMENTAL_CHAMBER_EMPTY" ) {
         ASSERT_LOGGER(false);
     }
-    else if( this->interact_type == "INTERACT_TYPE_EXPERIMENTAL_CHAMBER" ) {
+    else if( this->scenery_template->interact_type == "INTERACT_TYPE_EXPERIMENTAL_CHAMBER" ) {
         if( this->interact_state == 0 ) {
             this->interact_state = 1;
             if( option == 0 ) {
@@ -375,7 +449,7 @@ void Scenery::interact(PlayingGamestate *playing_gamestate, int option) {
             ASSERT_LOGGER(false);
         }
     }
-    else if( this->interact_type == "INTERACT_TYPE_PAINTING_SHATTER" ) {
+    else if( this->scenery_template->interact_type == "INTERACT_TYPE_PAINTING_SHATTER" ) {
         if( playing_gamestate->getPlayer()->getCurrentWeapon() != NULL ) {
             Item *item = playing_gamestate->getPlayer()->getCurrentWeapon();
             result_text = PlayingGamestate::tr("As you cast your eyes on the painting, there is suddenly a smashing sound, and to your amazement, your weapon shatters!").toStdString();
@@ -385,35 +459,35 @@ void Scenery::interact(PlayingGamestate *playing_gamestate, int option) {
         else {
             result_text = PlayingGamestate::tr("You look at the interesting painting.").toStdString();
         }
-        picture = this->big_image_name;
+        picture = this->scenery_template->big_image_name;
     }
-    else if( this->interact_type == "INTERACT_TYPE_POOL" ) {
+    else if( this->scenery_template->interact_type == "INTERACT_TYPE_POOL" ) {
         if( !playing_gamestate->getPlayer()->hasProfileEffects() ) {
             Profile pool_profile;
             switch( interact_state ) {
             case 1:
-                pool_profile.setIntProperty(profile_key_FP_c, 1);
+                pool_profile.setIntProperty(PROFILE_KEY_FP, 1);
                 break;
             case 2:
-                pool_profile.setIntProperty(profile_key_BS_c, 1);
+                pool_profile.setIntProperty(PROFILE_KEY_BS, 1);
                 break;
             case 3:
-                pool_profile.setIntProperty(profile_key_S_c, 1);
+                pool_profile.setIntProperty(PROFILE_KEY_S, 1);
                 break;
             case 4:
-                pool_profile.setIntProperty(profile_key_A_c, 1);
+                pool_profile.setIntProperty(PROFILE_KEY_A, 1);
                 break;
             case 5:
-                pool_profile.setIntProperty(profile_key_M_c, 1);
+                pool_profile.setIntProperty(PROFILE_KEY_M, 1);
                 break;
             case 6:
-                pool_profile.setIntProperty(profile_key_D_c, 1);
+                pool_profile.setIntProperty(PROFILE_KEY_D, 1);
                 break;
             case 7:
-                pool_profile.setIntProperty(profile_key_B_c, 1);
+                pool_profile.setIntProperty(PROFILE_KEY_B, 1);
                 break;
             case 8:
-                pool_profile.setFloatProperty(profile_key_Sp_c, 0.2f);
+                pool_profile.setFloatProperty(PROFILE_KEY_Sp, 0.2f);
                 break;
             }
             ProfileEffect profile_effect(pool_profile, 30000);
@@ -424,7 +498,7 @@ void Scenery::interact(PlayingGamestate *playing_gamestate, int option) {
             result_text = PlayingGamestate::tr("You drink from the pool but feel no effects.").toStdString();
         }
     }
-    else if( this->interact_type == "INTERACT_TYPE_DUNGEON_MAP" ) {
+    else if( this->scenery_template->interact_type == "INTERACT_TYPE_DUNGEON_MAP" ) {
         result_text = PlayingGamestate::tr("The painting shows a map of the current dungeon level!").toStdString();
         playing_gamestate->getCLocation()->revealMap(playing_gamestate);
     }
@@ -469,7 +543,7 @@ void Trap::setOff(PlayingGamestate *playing_gamestate, Character *character) con
     string text;
     if( type == "arrow" ) {
         //if( rollD + difficulty <= character->getDexterity() ) {
-        if( rollD + difficulty <= character->getProfileIntProperty(profile_key_D_c) ) {
+        if( rollD + difficulty <= character->getProfileIntProperty(PROFILE_KEY_D) ) {
             LOG("avoided\n");
             text = PlayingGamestate::tr("You have set off a trap!\nAn arrow shoots out from the wall,\nbut you manage to avoid it!").toStdString();
         }
@@ -499,7 +573,7 @@ void Trap::setOff(PlayingGamestate *playing_gamestate, Character *character) con
         }
     }
     else if( type == "mantrap" ) {
-        if( rollD + difficulty <= character->getProfileIntProperty(profile_key_D_c) ) {
+        if( rollD + difficulty <= character->getProfileIntProperty(PROFILE_KEY_D) ) {
             LOG("avoided\n");
             text = PlayingGamestate::tr("You manage to avoid the\nvicious bite of a mantrap that\nyou spot laying on the ground!").toStdString();
         }
@@ -590,14 +664,19 @@ char Tilemap::getTileAt(int x, int y) const {
 
 Location::Location(const string &name) :
     name(name), display_name(false), type(TYPE_INDOORS), geo_type(GEOTYPE_DUNGEON), listener(NULL), listener_data(NULL),
-    distance_graph(NULL), wall_x_scale(3.0f), lighting_min(55), wandering_monster_time_ms(0), wandering_monster_rest_chance(0)
+    smooth_paths(true), prune_distance_graph(true), distance_graph_threads(0), distance_graph(NULL), player_field_valid(false), portal_graph(NULL), n_path_requests(0), path_request_budget_us(path_request_default_budget_us_c), wall_x_scale(3.0f), lighting_min(55), wandering_monster_time_ms(0), wandering_monster_rest_chance(0), boundaries_version(0)
 {
+    this->character_grid.init(character_grid_cell_size_c);
+    this->trigger_grid.init(trigger_grid_cell_size_c);
 }
 
 Location::~Location() {
     if( distance_graph != NULL ) {
         delete distance_graph;
     }
+    if( portal_graph != NULL ) {
+        delete portal_graph;
+    }
     for(vector<FloorRegion *>::iterator iter = floor_regions.begin(); iter != floor_regions.end(); ++iter) {
         FloorRegion *floor_region = *iter;
         delete floor_region;
@@ -639,6 +718,8 @@ void Location::addFloorRegion(FloorRegion *floorRegion) {
         throw string("floor region outside of allowed range");
     }
     this->floor_regions.push_back(floorRegion);
+    this->region_grid.clear();
+    this->pvs.clear();
 }
 
 void Location::calculateSize(float *w, float *h) const {
@@ -673,14 +754,8 @@ FloorRegion *Location::findFloorRegionInside(Vector2D pos, float width, float he
 }
 
 FloorRegion *Location::findFloorRegionAt(Vector2D pos) const {
-    FloorRegion *result = NULL;
-    for(vector<FloorRegion *>::const_iterator iter = floor_regions.begin(); iter != floor_regions.end() && result==NULL; ++iter) {
-        FloorRegion *floor_region = *iter;
-        if( floor_region->pointInside(pos) ) {
-            result = floor_region;
-        }
-    }
-    return result;
+    int index = this->findFloorRegionIndexAt(pos);
+    return index == -1 ? NULL : floor_regions.at(index);
 }
 
 vector<FloorRegion *> Location::findFloorRegionsAt(Vector2D pos) const {
@@ -726,9 +801,12 @@ vector<FloorRegion *> Location::findFloorRegionsAt(const Scenery *scenery) const
 }
 
 void Location::addCharacter(Character *character, float xpos, float ypos) {
-    character->setLocation(this);
+    // set the position first, so that the character isn't moved within character_grid before being added
     character->setPos(xpos, ypos);
+    character->setLocation(this);
     this->characters.insert(character);
+    this->active_characters.insert(character);
+    this->character_grid.addCharacter(character, character->getPos());
 
     if( this->listener != NULL ) {
         this->listener->locationAddCharacter(this, character);
@@ -739,7 +817,479 @@ void Location::removeCharacter(Character *character) {
     ASSERT_LOGGER(character->getLocation() == this);
     character->setStateIdle();
     character->setLocation(NULL);
+    character->setDormant(false);
     this->characters.erase(character);
+    this->active_characters.erase(character);
+    this->character_grid.removeCharacter(character, character->getPos());
+}
+
+void Location::setCharacterDormant(Character *character, bool dormant) {
+    ASSERT_LOGGER(character->getLocation() == this);
+    if( character->isDormant() == dormant ) {
+        return;
+    }
+    character->setDormant(dormant);
+    if( dormant ) {
+        this->active_characters.erase(character);
+    }
+    else {
+        this->active_characters.insert(character);
+    }
+}
+
+void Location::wakeCharacters(Vector2D pos, float radius) {
+    vector<Character *> &nearby_characters = this->transient_characters;
+    this->character_grid.findCharactersInRadius(&nearby_characters, pos, radius);
+    for(vector<Character *>::const_iterator iter = nearby_characters.begin(); iter != nearby_characters.end(); ++iter) {
+        Character *character = *iter;
+        if( character->isDormant() ) {
+            //qDebug("wake %s", character->getName().c_str());
+            this->setCharacterDormant(character, false);
+        }
+    }
+}
+
+void Location::characterMoved(Character *character, Vector2D old_pos) {
+    this->character_grid.moveCharacter(character, old_pos, character->getPos());
+}
+
+CharacterGrid::Cell CharacterGrid::getCell(Vector2D pos) const {
+    return Cell((int)floor(pos.x / cell_size), (int)floor(pos.y / cell_size));
+}
+
+void CharacterGrid::addCharacter(Character *character, Vector2D pos) {
+    this->cells[this->getCell(pos)].push_back(character);
+}
+
+void CharacterGrid::removeCharacter(Character *character, Vector2D pos) {
+    map< Cell, vector<Character *> >::iterator iter = this->cells.find(this->getCell(pos));
+    if( iter == this->cells.end() ) {
+        LOG("CharacterGrid::removeCharacter: can't find cell for %s at %f, %f\n", character->getName().c_str(), pos.x, pos.y);
+        throw string("can't find character's cell");
+    }
+    vector<Character *> &cell = iter->second;
+    vector<Character *>::iterator iter2 = std::find(cell.begin(), cell.end(), character);
+    if( iter2 == cell.end() ) {
+        LOG("CharacterGrid::removeCharacter: %s not in cell for %f, %f\n", character->getName().c_str(), pos.x, pos.y);
+        throw string("character not in cell");
+    }
+    // order within a cell doesn't matter
+    *iter2 = cell.back();
+    cell.pop_back();
+    if( cell.size() == 0 ) {
+        this->cells.erase(iter);
+    }
+}
+
+void CharacterGrid::moveCharacter(Character *character, Vector2D old_pos, Vector2D new_pos) {
+    if( this->getCell(old_pos) != this->getCell(new_pos) ) {
+        this->removeCharacter(character, old_pos);
+        this->addCharacter(character, new_pos);
+    }
+}
+
+void CharacterGrid::findCharactersInRadius(vector<Character *> *result, Vector2D pos, float radius) const {
+    result->clear();
+    Cell cell0 = this->getCell(pos - Vector2D(radius, radius));
+    Cell cell1 = this->getCell(pos + Vector2D(radius, radius));
+    float n_query_cells = ((float)(cell1.first - cell0.first) + 1.0f) * ((float)(cell1.second - cell0.second) + 1.0f);
+    if( n_query_cells > (float)cells.size() ) {
+        // quicker to look at all the occupied cells
+        for(map< Cell, vector<Character *> >::const_iterator iter = cells.begin(); iter != cells.end(); ++iter) {
+            const Cell &cell = iter->first;
+            if( cell.first < cell0.first || cell.first > cell1.first || cell.second < cell0.second || cell.second > cell1.second ) {
+                continue;
+            }
+            for(vector<Character *>::const_iterator iter2 = iter->second.begin(); iter2 != iter->second.end(); ++iter2) {
+                Character *character = *iter2;
+                if( (character->getPos() - pos).magnitude() <= radius ) {
+                    result->push_back(character);
+                }
+            }
+        }
+        return;
+    }
+    for(int cx=cell0.first;cx<=cell1.first;cx++) {
+        for(int cy=cell0.second;cy<=cell1.second;cy++) {
+            map< Cell, vector<Character *> >::const_iterator iter = cells.find(Cell(cx, cy));
+            if( iter == cells.end() ) {
+                continue;
+            }
+            for(vector<Character *>::const_iterator iter2 = iter->second.begin(); iter2 != iter->second.end(); ++iter2) {
+                Character *character = *iter2;
+                if( (character->getPos() - pos).magnitude() <= radius ) {
+                    result->push_back(character);
+                }
+            }
+        }
+    }
+}
+
+void CharacterGrid::findNearestCharacters(vector<Character *> *result, Vector2D pos, float radius, size_t max_n) const {
+    this->findCharactersInRadius(result, pos, radius);
+    vector< pair<float, size_t> > dists;
+    for(size_t i=0;i<result->size();i++) {
+        dists.push_back( pair<float, size_t>((result->at(i)->getPos() - pos).magnitude(), i) );
+    }
+    // equally distant characters are kept in the order from findCharactersInRadius(), as the pairs then compare by index
+    std::sort(dists.begin(), dists.end());
+    if( max_n > 0 && dists.size() > max_n ) {
+        dists.resize(max_n);
+    }
+    vector<Character *> nearest;
+    for(vector< pair<float, size_t> >::const_iterator iter = dists.begin(); iter != dists.end(); ++iter) {
+        nearest.push_back( result->at(iter->second) );
+    }
+    result->swap(nearest);
+}
+
+TriggerGrid::Cell TriggerGrid::getCell(Vector2D pos) const {
+    return Cell((int)floor(pos.x / cell_size), (int)floor(pos.y / cell_size));
+}
+
+void TriggerGrid::addScenery(Scenery *scenery) {
+    // n.b., all scenery is stored, as popup text may be set after the scenery is added to a location (e.g., Scenery::setExit())
+    this->scenery_cells[this->getCell(scenery->getPos())].push_back(scenery);
+}
+
+void TriggerGrid::removeScenery(Scenery *scenery) {
+    map< Cell, vector<Scenery *> >::iterator iter = this->scenery_cells.find(this->getCell(scenery->getPos()));
+    if( iter == this->scenery_cells.end() ) {
+        LOG("TriggerGrid::removeScenery: can't find cell for %s at %f, %f\n", scenery->getName().c_str(), scenery->getX(), scenery->getY());
+        throw string("can't find scenery's cell");
+    }
+    vector<Scenery *> &cell = iter->second;
+    vector<Scenery *>::iterator iter2 = std::find(cell.begin(), cell.end(), scenery);
+    if( iter2 == cell.end() ) {
+        LOG("TriggerGrid::removeScenery: %s not in cell for %f, %f\n", scenery->getName().c_str(), scenery->getX(), scenery->getY());
+        throw string("scenery not in cell");
+    }
+    // order within a cell doesn't matter
+    *iter2 = cell.back();
+    cell.pop_back();
+    if( cell.size() == 0 ) {
+        this->scenery_cells.erase(iter);
+    }
+}
+
+void TriggerGrid::addTrap(Trap *trap) {
+    Cell cell0 = this->getCell(trap->getPos());
+    Cell cell1 = this->getCell(trap->getPos() + Vector2D(trap->getWidth(), trap->getHeight()));
+    for(int cx=cell0.first;cx<=cell1.first;cx++) {
+        for(int cy=cell0.second;cy<=cell1.second;cy++) {
+            this->trap_cells[Cell(cx, cy)].push_back(trap);
+        }
+    }
+}
+
+void TriggerGrid::removeTrap(Trap *trap) {
+    Cell cell0 = this->getCell(trap->getPos());
+    Cell cell1 = this->getCell(trap->getPos() + Vector2D(trap->getWidth(), trap->getHeight()));
+    for(int cx=cell0.first;cx<=cell1.first;cx++) {
+        for(int cy=cell0.second;cy<=cell1.second;cy++) {
+            map< Cell, vector<Trap *> >::iterator iter = this->trap_cells.find(Cell(cx, cy));
+            if( iter == this->trap_cells.end() ) {
+                LOG("TriggerGrid::removeTrap: can't find cell %d, %d for trap at %f, %f\n", cx, cy, trap->getX(), trap->getY());
+                throw string("can't find trap's cell");
+            }
+            vector<Trap *> &cell = iter->second;
+            vector<Trap *>::iterator iter2 = std::find(cell.begin(), cell.end(), trap);
+            if( iter2 == cell.end() ) {
+                LOG("TriggerGrid::removeTrap: trap at %f, %f not in cell %d, %d\n", trap->getX(), trap->getY(), cx, cy);
+                throw string("trap not in cell");
+            }
+            *iter2 = cell.back();
+            cell.pop_back();
+            if( cell.size() == 0 ) {
+                this->trap_cells.erase(iter);
+            }
+        }
+    }
+}
+
+void TriggerGrid::checkPopupScenery(vector<Scenery *> *entered, vector<Scenery *> *exited, const vector<Scenery *> &cell, Vector2D old_pos, Vector2D new_pos, float radius) {
+    for(vector<Scenery *>::const_iterator iter = cell.begin(); iter != cell.end(); ++iter) {
+        Scenery *scenery = *iter;
+        if( scenery->getPopupText().length() == 0 ) {
+            continue;
+        }
+        float old_dist = (scenery->getPos() - old_pos).magnitude();
+        float new_dist = (scenery->getPos() - new_pos).magnitude();
+        if( new_dist <= radius && old_dist > radius ) {
+            entered->push_back(scenery);
+        }
+        else if( exited != NULL && old_dist <= radius && new_dist > radius ) {
+            exited->push_back(scenery);
+        }
+    }
+}
+
+void TriggerGrid::findPopupScenery(vector<Scenery *> *entered, vector<Scenery *> *exited, Vector2D old_pos, Vector2D new_pos, float radius) const {
+    entered->clear();
+    if( exited != NULL ) {
+        exited->clear();
+    }
+    // only scenery within radius of either position can have been entered or exited
+    Cell cell0 = this->getCell(Vector2D(min(old_pos.x, new_pos.x) - radius, min(old_pos.y, new_pos.y) - radius));
+    Cell cell1 = this->getCell(Vector2D(max(old_pos.x, new_pos.x) + radius, max(old_pos.y, new_pos.y) + radius));
+    float n_query_cells = ((float)(cell1.first - cell0.first) + 1.0f) * ((float)(cell1.second - cell0.second) + 1.0f);
+    if( n_query_cells > (float)scenery_cells.size() ) {
+        // quicker to look at all the occupied cells, e.g., if the character has been moved a long way
+        for(map< Cell, vector<Scenery *> >::const_iterator iter = scenery_cells.begin(); iter != scenery_cells.end(); ++iter) {
+            const Cell &cell = iter->first;
+            if( cell.first < cell0.first || cell.first > cell1.first || cell.second < cell0.second || cell.second > cell1.second ) {
+                continue;
+            }
+            checkPopupScenery(entered, exited, iter->second, old_pos, new_pos, radius);
+        }
+        return;
+    }
+    for(int cx=cell0.first;cx<=cell1.first;cx++) {
+        for(int cy=cell0.second;cy<=cell1.second;cy++) {
+            map< Cell, vector<Scenery *> >::const_iterator iter = scenery_cells.find(Cell(cx, cy));
+            if( iter == scenery_cells.end() ) {
+                continue;
+            }
+            checkPopupScenery(entered, exited, iter->second, old_pos, new_pos, radius);
+        }
+    }
+}
+
+void TriggerGrid::findTrapsNear(vector<Trap *> *result, Vector2D pos) const {
+    // each trap is stored in every cell it overlaps, so only the cell containing pos needs to be checked
+    result->clear();
+    map< Cell, vector<Trap *> >::const_iterator iter = trap_cells.find(this->getCell(pos));
+    if( iter != trap_cells.end() ) {
+        *result = iter->second;
+    }
+}
+
+void Location::updatePlayerField(Vector2D player_pos) const {
+    //qDebug("Location::updatePlayerField(%f, %f)", player_pos.x, player_pos.y);
+    const Graph *graph = this->getDistanceGraph();
+    GraphOverlay *overlay = &this->path_overlay;
+    overlay->reset(graph);
+    size_t player_index = overlay->addVertex(player_pos);
+    for(size_t i=0;i<graph->getNVertices();i++) {
+        float dist = 0.0f;
+        bool hit = testGraphVerticesHit(&dist, graph->getVertex(i)->getPos(), player_pos, NULL, false);
+        if( !hit ) {
+            overlay->addEdge(i, player_index, dist);
+        }
+    }
+    graph->shortestDistances(&this->player_field, overlay, player_index);
+    this->player_field_pos = player_pos;
+    this->player_field_valid = true;
+}
+
+void Location::addPlayerFieldCandidate(size_t vertex_index, Vector2D src) const {
+    float value = this->player_field.getValue(vertex_index);
+    if( value >= 0.0f ) {
+        float dist = (this->distance_graph->getVertex(vertex_index)->getPos() - src).magnitude() + value;
+        this->player_field_candidates.push_back( pair<float, size_t>(dist, vertex_index) );
+    }
+}
+
+vector<Vector2D> Location::calculatePathToPlayer(Vector2D src, Vector2D player_pos, bool can_fly) const {
+    vector<Vector2D> new_path;
+    Vector2D hit_pos;
+    if( src == player_pos || !this->intersectSweptSquareWithBoundaries(&hit_pos, false, src, player_pos, npc_radius_c, Location::INTERSECTTYPE_MOVE, NULL, can_fly) ) {
+        // easy
+        new_path.push_back(player_pos);
+        return new_path;
+    }
+    const Graph *graph = this->getDistanceGraph();
+    if( can_fly || graph == NULL ) {
+        // the field is only for walking
+        return new_path;
+    }
+
+    if( !this->player_field_valid || (player_pos - this->player_field_pos).magnitude() > player_field_update_dist_c ) {
+        this->updatePlayerField(player_pos);
+    }
+
+    // find the vertex we can walk to that gives the shortest path: if we test in order of the distance via each vertex,
+    // the first one we can walk to is the best
+    // n.b., the candidates are kept in a heap rather than sorted, as usually only the first few need testing
+    // we first only look at the vertices in our floor region (and any not inside a floor region), as we can nearly
+    // always walk to one of those, so the cost doesn't depend on the size of the location; only if none of them
+    // can be reached do we look at all the vertices
+    // n.b., this means the path is approximate, as a vertex outside our floor region isn't considered even if
+    // it would give a shorter route
+    size_t n_vertices = graph->getNVertices();
+    int src_region = this->findFloorRegionIndexAt(src);
+    bool has_region = src_region != -1 && (size_t)src_region < this->region_vertices.size();
+    vector< pair<float, size_t> > &candidates = this->player_field_candidates;
+    bool found = false;
+    size_t c_indx = 0;
+    for(int pass=has_region ? 0 : 1;pass<2 && !found;pass++) {
+        candidates.clear();
+        if( pass == 0 ) {
+            const vector<size_t> &vertices = this->region_vertices.at(src_region);
+            for(vector<size_t>::const_iterator iter = vertices.begin(); iter != vertices.end(); ++iter) {
+                this->addPlayerFieldCandidate(*iter, src);
+            }
+            for(vector<size_t>::const_iterator iter = unassigned_vertices.begin(); iter != unassigned_vertices.end(); ++iter) {
+                this->addPlayerFieldCandidate(*iter, src);
+            }
+        }
+        else {
+            for(size_t i=0;i<n_vertices;i++) {
+                this->addPlayerFieldCandidate(i, src);
+            }
+        }
+        std::make_heap(candidates.begin(), candidates.end(), greater< pair<float, size_t> >());
+        while( candidates.size() > 0 && !found ) {
+            std::pop_heap(candidates.begin(), candidates.end(), greater< pair<float, size_t> >());
+            size_t indx = candidates.back().second;
+            candidates.pop_back();
+            float dist = 0.0f;
+            if( !testGraphVerticesHit(&dist, src, graph->getVertex(indx)->getPos(), NULL, false) ) {
+                found = true;
+                c_indx = indx;
+            }
+        }
+    }
+    if( !found ) {
+        return new_path;
+    }
+
+    // follow the field to the last vertex before the player
+    for(;;) {
+        new_path.push_back( graph->getVertex(c_indx)->getPos() );
+        size_t n_indx = this->player_field.getPathTraceback(c_indx);
+        if( n_indx >= n_vertices ) {
+            break;
+        }
+        c_indx = n_indx;
+    }
+    // the field may have been calculated for where the player was a short time ago
+    if( this->player_field_pos != player_pos ) {
+        Vector2D last_pos = new_path.at( new_path.size()-1 );
+        if( last_pos != player_pos && this->intersectSweptSquareWithBoundaries(&hit_pos, false, last_pos, player_pos, npc_radius_c, Location::INTERSECTTYPE_MOVE, NULL, false) ) {
+            new_path.clear();
+            return new_path;
+        }
+    }
+    new_path.push_back(player_pos);
+    if( this->smooth_paths ) {
+        this->smoothPath(src, &new_path, NULL, false);
+    }
+    return new_path;
+}
+
+void Location::addPathRequest(const PathRequest &path_request, bool priority) {
+    if( path_request.character->hasPathRequest() ) {
+        // replace the existing request, keeping its place in the queue
+        deque<PathRequest> *queues[] = {&this->priority_path_requests, &this->path_requests};
+        for(int i=0;i<2;i++) {
+            for(deque<PathRequest>::iterator iter = queues[i]->begin(); iter != queues[i]->end(); ++iter) {
+                if( iter->character == path_request.character ) {
+                    *iter = path_request;
+                    return;
+                }
+            }
+        }
+    }
+    if( priority ) {
+        this->priority_path_requests.push_back(path_request);
+    }
+    else {
+        this->path_requests.push_back(path_request);
+    }
+    this->n_path_requests++;
+}
+
+void Location::requestPath(Character *character, Vector2D dest, const void *ignore, bool priority) {
+    ASSERT_LOGGER(character->getLocation() == this);
+    this->addPathRequest(PathRequest(character, false, dest, ignore), priority);
+}
+
+void Location::requestFleePath(Character *character, Vector2D fleeing_from) {
+    ASSERT_LOGGER(character->getLocation() == this);
+    this->addPathRequest(PathRequest(character, true, fleeing_from, NULL), false);
+}
+
+void Location::cancelPathRequest(const Character *character) {
+    // n.b., cancelled requests are left in the queue, and skipped by processPathRequests()
+    deque<PathRequest> *queues[] = {&this->priority_path_requests, &this->path_requests};
+    for(int i=0;i<2;i++) {
+        for(deque<PathRequest>::iterator iter = queues[i]->begin(); iter != queues[i]->end(); ++iter) {
+            if( iter->character == character ) {
+                iter->character = NULL;
+                this->n_path_requests--;
+            }
+        }
+    }
+}
+
+void Location::processPathRequest(const PathRequest &path_request) {
+    Character *character = path_request.character;
+    if( character->isDead() ) {
+        // shouldn't happen, as Character::kill() cancels the request, but don't give a corpse a path
+        return;
+    }
+    vector<Vector2D> new_path;
+    if( path_request.is_flee ) {
+        Vector2D flee_pos;
+        if( !this->findFleePoint(&flee_pos, &new_path, character->getPos(), path_request.pos, character->canFly()) ) {
+            new_path.clear();
+        }
+    }
+    else {
+        new_path = this->calculatePathTo(character->getPos(), path_request.pos, path_request.ignore, character->canFly());
+    }
+    character->pathRequestCompleted(path_request.is_flee, new_path);
+}
+
+void Location::processPathRequests() {
+    //qDebug("Location::processPathRequests(): %d requests", this->n_path_requests);
+    QElapsedTimer timer;
+    timer.start();
+    // n.b., each request is removed from the queue before being processed
+    while( this->priority_path_requests.size() > 0 ) {
+        PathRequest path_request = this->priority_path_requests.front();
+        this->priority_path_requests.pop_front();
+        if( path_request.character != NULL ) {
+            this->n_path_requests--;
+            this->processPathRequest(path_request);
+        }
+    }
+    bool done_one = false;
+    while( this->path_requests.size() > 0 ) {
+        if( done_one && timer.nsecsElapsed() >= 1000 * (qint64)this->path_request_budget_us ) {
+            break;
+        }
+        PathRequest path_request = this->path_requests.front();
+        this->path_requests.pop_front();
+        if( path_request.character != NULL ) {
+            this->n_path_requests--;
+            this->processPathRequest(path_request);
+            done_one = true;
+        }
+    }
+}
+
+void Location::smoothPath(Vector2D src, vector<Vector2D> *path, const void *ignore, bool can_fly) const {
+    if( path->size() <= 1 ) {
+        return;
+    }
+    // see if we can skip each point, by moving from the last point we kept straight to the next one
+    // n.b., points are copied down in place, as we only ever remove points
+    Vector2D last_pos = src;
+    size_t n_kept = 0;
+    for(size_t i=0;i+1<path->size();i++) {
+        Vector2D next_pos = path->at(i+1);
+        Vector2D hit_pos;
+        bool is_last_segment = i+2 == path->size();
+        if( last_pos == next_pos || this->intersectSweptSquareWithBoundaries(&hit_pos, false, last_pos, next_pos, npc_radius_c, Location::INTERSECTTYPE_MOVE, is_last_segment ? ignore : NULL, can_fly) ) {
+            // can't skip
+            last_pos = path->at(i);
+            (*path)[n_kept++] = last_pos;
+        }
+    }
+    (*path)[n_kept++] = path->at(path->size()-1);
+    path->resize(n_kept);
 }
 
 float Location::distanceOfPath(Vector2D src, const vector<Vector2D> &path, bool has_max_dist, float max_dist) {
@@ -773,7 +1323,11 @@ bool Location::hasEnemies(const PlayingGamestate *playing_gamestate) const {
             // we care about the distance by path, rather than euclidean distance - but we can check the euclidean distance first as a quick check
             float dist = (character->getPos() - playing_gamestate->getPlayer()->getPos()).magnitude();
             if( dist <= npc_visibility_c ) {
-                vector<Vector2D> new_path = this->calculatePathTo(character->getPos(), playing_gamestate->getPlayer()->getPos(), NULL, character->canFly());
+                vector<Vector2D> new_path = this->calculatePathToPlayer(character->getPos(), playing_gamestate->getPlayer()->getPos(), character->canFly());
+                if( new_path.size() == 0 ) {
+                    // the field can't be used, e.g., for flying characters
+                    new_path = this->calculatePathTo(character->getPos(), playing_gamestate->getPlayer()->getPos(), NULL, character->canFly());
+                }
                 if( new_path.size() > 0 ) {
                     /*float dist = 0.0f;
                     Vector2D last_pos = character->getPos();
@@ -841,6 +1395,7 @@ void Location::addScenery(Scenery *scenery, float xpos, float ypos) {
     scenery->setLocation(this);
     scenery->setPos(xpos, ypos);
     this->scenerys.insert(scenery);
+    this->trigger_grid.addScenery(scenery);
 
     if( this->listener != NULL ) {
         this->listener->locationAddScenery(this, scenery);
@@ -850,20 +1405,34 @@ void Location::addScenery(Scenery *scenery, float xpos, float ypos) {
 void Location::removeScenery(Scenery *scenery) {
     // remove corresponding boundary
     //qDebug("Location::removeScenery(%d)", scenery);
-    for(vector<Polygon2D>::iterator iter = this->boundaries.begin(); iter != this->boundaries.end();) {
-        Polygon2D *boundary = &*iter;
+    bool removed_boundary = false;
+    for(size_t i=0;i<this->boundaries.size();) {
+        Polygon2D *boundary = &this->boundaries.at(i);
         if( boundary->getSource() == scenery ) {
             boundary->setSourceType(0);
             boundary->setSource(NULL);
-            iter = boundaries.erase(iter);
+            boundaries.erase(boundaries.begin() + i);
+            if( this->boundary_grid.isInit() ) {
+                // also shifts the indices of the following boundaries, to match
+                this->boundary_grid.removePolygon(i);
+            }
+            removed_boundary = true;
         }
         else {
-            ++iter;
+            i++;
         }
     }
+    if( removed_boundary ) {
+        this->boundaries_version++;
+    }
+    if( removed_boundary && this->isPVSCalculated() && std::find(portal_blockers.begin(), portal_blockers.end(), scenery) != portal_blockers.end() ) {
+        // floor regions may now be able to see each other through this portal
+        this->calculatePVS();
+    }
 
     scenery->setLocation(NULL);
     this->scenerys.erase(scenery);
+    this->trigger_grid.removeScenery(scenery);
 
     /*FloorRegion *floor_region = this->findFloorRegionAt(scenery->getPos());
     if( floor_region == NULL ) {
@@ -892,6 +1461,7 @@ void Location::removeScenery(Scenery *scenery) {
 
     if( this->distance_graph != NULL ) {
         // update distance graph
+        this->player_field_valid = false;
 
         // need to see if additional path_way_points can be activated
         for(size_t i=0;i<path_way_points.size();i++) {
@@ -899,9 +1469,8 @@ void Location::removeScenery(Scenery *scenery) {
             if( !path_way_point.active ) {
                 this->testActivatePathWayPoint(&path_way_point);
                 if( path_way_point.active ) {
-                    Vector2D A = path_way_point.point;
-                    GraphVertex vertex(A, path_way_point.source);
-                    this->distance_graph->addVertex(vertex);
+                    size_t vertex_index = this->addDistanceGraphVertex(i);
+                    this->assignVertexToRegions(vertex_index);
                 }
             }
         }
@@ -913,12 +1482,10 @@ void Location::removeScenery(Scenery *scenery) {
         top_left.y -= (0.5f*scenery->getHeight()+npc_radius_c+E_TOL_LINEAR);
         bottom_right.y += (0.5f*scenery->getHeight()+npc_radius_c+E_TOL_LINEAR);
         for(size_t i=0;i<this->distance_graph->getNVertices();i++) {
-            GraphVertex *v_A = this->distance_graph->getVertex(i);
-            Vector2D A_pos = v_A->getPos();
+            Vector2D A_pos = this->distance_graph->getVertex(i)->getPos();
             for(size_t j=i+1;j<this->distance_graph->getNVertices();j++) {
                 //qDebug("### update %d vs %d?", i, j);
-                GraphVertex *v_B = this->distance_graph->getVertex(j);
-                Vector2D B_pos = v_B->getPos();
+                Vector2D B_pos = this->distance_graph->getVertex(j)->getPos();
                 if( A_pos.x < top_left.x && B_pos.x < top_left.x ) {
                     continue;
                 }
@@ -932,23 +1499,17 @@ void Location::removeScenery(Scenery *scenery) {
                     continue;
                 }
                 //qDebug("    updating %d vs %d", i, j);
-                bool already_visible = false;
-                for(size_t k=0;k<v_A->getNNeighbours() && !already_visible;k++) {
-                    if( v_A->getNeighbour(this->distance_graph, k) == v_B ) {
-                        already_visible = true;
-                    }
-                }
                 // only need to test if not already visible (since we're moving scenery)
-                if( !already_visible ) {
+                if( !this->distance_graph->hasNeighbour(i, j) && ( !this->prune_distance_graph || this->isTangentEdge(i, j) ) ) {
                     float dist = 0.0f;
-                    bool hit = testGraphVerticesHit(&dist, v_A, v_B, NULL, false);
+                    bool hit = testGraphVerticesHit(&dist, A_pos, B_pos, NULL, false);
                     if( !hit ) {
-                        v_A->addNeighbour(j, dist);
-                        v_B->addNeighbour(i, dist);
+                        this->distance_graph->addEdge(i, j, dist);
                     }
                 }
             }
         }
+        this->distance_graph->freeze();
 
     }
 
@@ -967,14 +1528,62 @@ void Location::addTrap(Trap *trap, float xpos, float ypos) {
     //trap->setLocation(this);
     trap->setPos(xpos, ypos);
     this->traps.insert(trap);
+    this->trigger_grid.addTrap(trap);
 }
 
 void Location::removeTrap(Trap *trap) {
     //trap->setLocation(NULL);
     this->traps.erase(trap);
+    this->trigger_grid.removeTrap(trap);
     delete trap;
 }
 
+void Location::addBoundary(Polygon2D boundary) {
+    this->boundaries.push_back(boundary);
+    this->boundaries_version++;
+    if( this->boundary_grid.isInit() ) {
+        this->boundary_grid.addPolygon(boundary, this->boundaries.size()-1);
+    }
+}
+
+void Location::findFloorRegionsBounds(Vector2D *top_left, Vector2D *bottom_right) const {
+    bool found = false;
+    for(vector<FloorRegion *>::const_iterator iter = floor_regions.begin(); iter != floor_regions.end(); ++iter) {
+        const FloorRegion *floor_region = *iter;
+        if( !found ) {
+            *top_left = floor_region->getTopLeft();
+            *bottom_right = floor_region->getBottomRight();
+            found = true;
+        }
+        else {
+            top_left->x = min(top_left->x, floor_region->getTopLeft().x);
+            top_left->y = min(top_left->y, floor_region->getTopLeft().y);
+            bottom_right->x = max(bottom_right->x, floor_region->getBottomRight().x);
+            bottom_right->y = max(bottom_right->y, floor_region->getBottomRight().y);
+        }
+    }
+}
+
+void Location::buildBoundaryGrid() {
+    // the grid covers the floor regions; any boundaries outside of this are still handled, as the grid clamps to its border cells
+    Vector2D top_left, bottom_right;
+    this->findFloorRegionsBounds(&top_left, &bottom_right);
+    this->boundary_grid.init(top_left, bottom_right, boundary_grid_min_cell_size_c, boundary_grid_max_cells_c);
+    for(size_t i=0;i<boundaries.size();i++) {
+        this->boundary_grid.addPolygon(boundaries.at(i), i);
+    }
+}
+
+void Location::buildRegionGrid() {
+    Vector2D top_left, bottom_right;
+    this->findFloorRegionsBounds(&top_left, &bottom_right);
+    this->region_grid.init(top_left, bottom_right, boundary_grid_min_cell_size_c, boundary_grid_max_cells_c);
+    for(size_t i=0;i<floor_regions.size();i++) {
+        const FloorRegion *floor_region = floor_regions.at(i);
+        this->region_grid.addSegment(floor_region->getTopLeft(), floor_region->getBottomRight(), i, 0);
+    }
+}
+
 void Location::createBoundariesForRegions() {
     qDebug("Location::createBoundariesForRegions()");
 
@@ -1031,6 +1640,9 @@ void Location::createBoundariesForRegions() {
     }
 
     qDebug("calculate which boundary edges are internal");
+    this->portal_regions.clear();
+    this->portal_points.clear();
+    this->portal_edges.clear();
     for(vector<FloorRegion *>::iterator iter = floor_regions.begin(); iter != floor_regions.end(); ++iter) {
         FloorRegion *floor_region = *iter;
         for(size_t j=0;j<floor_region->getNPoints();j++) {
@@ -1061,6 +1673,12 @@ void Location::createBoundariesForRegions() {
                         //qDebug("edge is internal with: %f, %f to %f, %f", p2.x, p2.y, p3.x, p3.y);
                         floor_region->setEdgeType(j, FloorRegion::EDGETYPE_INTERNAL);
                         floor_region2->setEdgeType(j2, FloorRegion::EDGETYPE_INTERNAL);
+                        if( iter < iter2 ) {
+                            // each portal is found from both sides, but only want to record it once
+                            this->portal_regions.push_back( pair<size_t, size_t>(iter - floor_regions.begin(), iter2 - floor_regions.begin()) );
+                            this->portal_points.push_back( (p0 + p1) * 0.5f );
+                            this->portal_edges.push_back( pair<Vector2D, Vector2D>(p0, p1) );
+                        }
                     }
                 }
             }
@@ -1134,6 +1752,8 @@ void Location::createBoundariesForRegions() {
         }
         this->addBoundary(boundary);
     }
+    this->buildBoundaryGrid();
+    this->buildRegionGrid();
     qDebug("reset temp marks");
     for(vector<FloorRegion *>::iterator iter = floor_regions.begin(); iter != floor_regions.end(); ++iter) {
         FloorRegion *floor_region = *iter;
@@ -1399,32 +2019,68 @@ void Location::intersectSweptSquareWithBoundarySeg(bool *hit, float *hit_dist, b
     }
 }
 
-void Location::intersectSweptSquareWithBoundaries(bool *done, bool *hit, float *hit_dist, bool find_earliest, Vector2D start, Vector2D end, Vector2D du, Vector2D dv, float width, float xmin, float xmax, float ymin, float ymax, IntersectType intersect_type, const void *ignore_one, bool flying) const {
-    for(vector<Polygon2D>::const_iterator iter = this->boundaries.begin(); iter != this->boundaries.end() && !(*done); ++iter) {
-        const Polygon2D *boundary = &*iter;
-        /*if( ignore_all_scenery && boundary->getSourceType() == (int)SOURCETYPE_SCENERY ) {
-            continue;
+bool Location::isBoundaryIgnored(const Polygon2D *boundary, IntersectType intersect_type, const void *ignore_one, bool flying) const {
+    /*if( ignore_all_scenery && boundary->getSourceType() == (int)SOURCETYPE_SCENERY ) {
+        return true;
 
-        }*/
-        if( boundary->getSourceType() == (int)SOURCETYPE_SCENERY ) {
-            const Scenery *scenery = static_cast<const Scenery *>(boundary->getSource());
-            if( intersect_type == INTERSECTTYPE_MOVE && !scenery->isBlocking() ) {
-                continue;
-            }
-            else if( intersect_type == INTERSECTTYPE_VISIBILITY && !scenery->blocksVisibility() ) {
-                continue;
-            }
+    }*/
+    if( boundary->getSourceType() == (int)SOURCETYPE_SCENERY ) {
+        const Scenery *scenery = static_cast<const Scenery *>(boundary->getSource());
+        if( intersect_type == INTERSECTTYPE_MOVE && !scenery->isBlocking() ) {
+            return true;
         }
-        else if( boundary->getSourceType() == (int)SOURCETYPE_FLOOR ) {
-            if( this->type == TYPE_OUTDOORS && ( flying || intersect_type == INTERSECTTYPE_VISIBILITY ) ) {
-                continue;
-            }
+        else if( intersect_type == INTERSECTTYPE_VISIBILITY && !scenery->blocksVisibility() ) {
+            return true;
+        }
+    }
+    else if( boundary->getSourceType() == (int)SOURCETYPE_FLOOR ) {
+        if( this->type == TYPE_OUTDOORS && ( flying || intersect_type == INTERSECTTYPE_VISIBILITY ) ) {
+            return true;
         }
-        else if( boundary->getSourceType() == (int)SOURCETYPE_FIXED_NPC ) {
-            if( intersect_type == INTERSECTTYPE_VISIBILITY )
-                continue; // can always see past NPCs
+    }
+    else if( boundary->getSourceType() == (int)SOURCETYPE_FIXED_NPC ) {
+        if( intersect_type == INTERSECTTYPE_VISIBILITY )
+            return true; // can always see past NPCs
+    }
+    if( ignore_one != NULL && boundary->getSource() == ignore_one ) {
+        return true;
+    }
+    return false;
+}
+
+void Location::intersectSweptSquareWithBoundaries(bool *done, bool *hit, float *hit_dist, bool find_earliest, Vector2D start, Vector2D end, Vector2D du, Vector2D dv, float width, float xmin, float xmax, float ymin, float ymax, IntersectType intersect_type, const void *ignore_one, bool flying) const {
+    if( this->boundary_grid.isInit() ) {
+        // only look at the segments in the cells overlapped by the swept square
+        Vector2D query_top_left(min(start.x, end.x) - width - E_TOL_LINEAR, min(start.y, end.y) - width - E_TOL_LINEAR);
+        Vector2D query_bottom_right(max(start.x, end.x) + width + E_TOL_LINEAR, max(start.y, end.y) + width + E_TOL_LINEAR);
+        int cell_x0 = 0, cell_y0 = 0, cell_x1 = 0, cell_y1 = 0;
+        this->boundary_grid.getCellRange(&cell_x0, &cell_y0, &cell_x1, &cell_y1, query_top_left, query_bottom_right);
+        for(int cy=cell_y0;cy<=cell_y1 && !(*done);cy++) {
+            for(int cx=cell_x0;cx<=cell_x1 && !(*done);cx++) {
+                const vector<size_t> &cell = this->boundary_grid.getCell(cx, cy);
+                for(vector<size_t>::const_iterator iter = cell.begin(); iter != cell.end() && !(*done); ++iter) {
+                    const SegmentGrid::Segment &segment = this->boundary_grid.getSegment(*iter);
+                    // a segment covering several of the cells is only tested from the first cell that the query shares with it
+                    if( cx != max(segment.cell_x0, cell_x0) || cy != max(segment.cell_y0, cell_y0) ) {
+                        continue;
+                    }
+                    if( segment.bottom_right.x < query_top_left.x || segment.top_left.x > query_bottom_right.x || segment.bottom_right.y < query_top_left.y || segment.top_left.y > query_bottom_right.y ) {
+                        continue;
+                    }
+                    const Polygon2D *boundary = &this->boundaries.at(segment.polygon_indx);
+                    if( this->isBoundaryIgnored(boundary, intersect_type, ignore_one, flying) ) {
+                        continue;
+                    }
+                    intersectSweptSquareWithBoundarySeg(hit, hit_dist, done, find_earliest, segment.p0, segment.p1, start, du, dv, width, xmin, xmax, ymin, ymax);
+                }
+            }
         }
-        if( ignore_one != NULL && boundary->getSource() == ignore_one ) {
+        return;
+    }
+
+    for(vector<Polygon2D>::const_iterator iter = this->boundaries.begin(); iter != this->boundaries.end() && !(*done); ++iter) {
+        const Polygon2D *boundary = &*iter;
+        if( this->isBoundaryIgnored(boundary, intersect_type, ignore_one, flying) ) {
             continue;
         }
         Vector2D top_left = boundary->getTopLeft();
@@ -1660,7 +2316,7 @@ Vector2D Location::nudgeToFreeSpace(Vector2D src, Vector2D pos, float width) con
 }
 #endif
 
-bool Location::findFleePoint(Vector2D *result, Vector2D from, Vector2D fleeing_from, bool can_fly) const {
+bool Location::findFleePoint(Vector2D *result, vector<Vector2D> *result_path, Vector2D from, Vector2D fleeing_from, bool can_fly) const {
     //qDebug("findFleePoint");
     //QElapsedTimer timer;
     //timer.start();
@@ -1798,6 +2454,9 @@ bool Location::findFleePoint(Vector2D *result, Vector2D from, Vector2D fleeing_f
 
     //qDebug("time: %d", timer.elapsed());
     *result = flee_pos;
+    if( result_path != NULL ) {
+        *result_path = new_path;
+    }
     return true;
 }
 
@@ -1832,17 +2491,15 @@ bool Location::findFreeWayPoint(Vector2D *result, Vector2D from, bool visible, b
 bool Location::collideWithTransient(const Character *character, Vector2D pos) const {
     // does collision detection with entities like NPCs, that do not have boundaries due to not having a permanent position (and hence can't be avoided in pathfinding)
     bool hit = false;
-    for(set<Character *>::const_iterator iter = this->characters.begin(); iter != this->characters.end() && !hit; ++iter) {
+    vector<Character *> &nearby_characters = this->transient_characters;
+    this->character_grid.findCharactersInRadius(&nearby_characters, pos, 2.0f * npc_radius_c);
+    for(vector<Character *>::const_iterator iter = nearby_characters.begin(); iter != nearby_characters.end() && !hit; ++iter) {
         const Character *npc = *iter;
         //if( character == playing_gamestate->getPlayer() ) {
         if( npc == character ) {
             continue;
         }
-        Vector2D npc_pos = npc->getPos();
-        float dist = (pos - npc_pos).magnitude();
-        if( dist <= 2.0f * npc_radius_c ) {
-            hit = true;
-        }
+        hit = true;
     }
     return hit;
 }
@@ -1855,6 +2512,10 @@ bool Location::visibilityTest(Vector2D src, Vector2D dest) const {
         is_visible = true;
     }
     else if( dist <= npc_visibility_c ) {
+        if( this->isPVSCalculated() && !this->canFloorRegionsSee(this->findFloorRegionIndexAt(src), this->findFloorRegionIndexAt(dest)) ) {
+            // no line of sight can pass through the portals between these floor regions
+            return false;
+        }
         // check line of sight
         Vector2D hit_pos;
         if( !this->intersectSweptSquareWithBoundaries(&hit_pos, false, src, dest, 0.0f, Location::INTERSECTTYPE_VISIBILITY, NULL, false) ) {
@@ -1909,7 +2570,7 @@ void Location::calculatePathWayPoints() {
                 const float offset = npc_radius_c/ratio + E_TOL_LINEAR;
                 Vector2D path_way_point_pos = point + inwards * offset;
 
-                PathWayPoint path_way_point(point, path_way_point_pos, boundary->getSource());
+                PathWayPoint path_way_point(point, path_way_point_pos, d0, d1, boundary->getSource());
                 float turn_sign = d0 % normal_from_wall1;
                 if( turn_sign < E_TOL_LINEAR ) {
                     path_way_point.used_for_pathfinding = false;
@@ -1925,10 +2586,8 @@ void Location::calculatePathWayPoints() {
     LOG("Location::refreshDistanceGraph()\n");
 }*/
 
-bool Location::testGraphVerticesHit(float *dist, GraphVertex *v_A, GraphVertex *v_B, const void *ignore, bool can_fly) const {
+bool Location::testGraphVerticesHit(float *dist, Vector2D A, Vector2D B, const void *ignore, bool can_fly) const {
     bool hit = false;
-    Vector2D A = v_A->getPos();
-    Vector2D B = v_B->getPos();
 
     *dist = (A - B).magnitude();
     if( *dist <= E_TOL_LINEAR ) {
@@ -1942,6 +2601,145 @@ bool Location::testGraphVerticesHit(float *dist, GraphVertex *v_A, GraphVertex *
     return hit;
 }
 
+bool Location::isSegmentNearCorner(const PathWayPoint &path_way_point, Vector2D p0, Vector2D p1) {
+    // the corner's own edges don't count
+    Vector2D corner = path_way_point.origin_point;
+    Vector2D dir = p1 - p0;
+    float length = dir.magnitude();
+    if( length <= E_TOL_LINEAR ) {
+        return false;
+    }
+    dir /= length;
+    if( p1 == corner && dir.isEqual(path_way_point.corner_dir0, E_TOL_LINEAR) ) {
+        return false;
+    }
+    else if( p0 == corner && dir.isEqual(path_way_point.corner_dir1, E_TOL_LINEAR) ) {
+        return false;
+    }
+    float t = (corner - p0) % dir;
+    t = std::max(0.0f, std::min(length, t));
+    float dist = (corner - (p0 + dir * t)).magnitude();
+    return dist <= corner_clear_dist_c;
+}
+
+bool Location::testCornerClear(const PathWayPoint &path_way_point) const {
+    // other boundaries near the corner may leave gaps too narrow to move through, and shortest paths around them can
+    // then turn at this vertex without going around its own corner
+    Vector2D corner = path_way_point.origin_point;
+    if( this->boundary_grid.isInit() ) {
+        // only look at the segments in the cells within corner_clear_dist_c of the corner
+        Vector2D query_top_left = corner - Vector2D(corner_clear_dist_c + E_TOL_LINEAR, corner_clear_dist_c + E_TOL_LINEAR);
+        Vector2D query_bottom_right = corner + Vector2D(corner_clear_dist_c + E_TOL_LINEAR, corner_clear_dist_c + E_TOL_LINEAR);
+        int cell_x0 = 0, cell_y0 = 0, cell_x1 = 0, cell_y1 = 0;
+        this->boundary_grid.getCellRange(&cell_x0, &cell_y0, &cell_x1, &cell_y1, query_top_left, query_bottom_right);
+        for(int cy=cell_y0;cy<=cell_y1;cy++) {
+            for(int cx=cell_x0;cx<=cell_x1;cx++) {
+                const vector<size_t> &cell = this->boundary_grid.getCell(cx, cy);
+                for(vector<size_t>::const_iterator iter = cell.begin(); iter != cell.end(); ++iter) {
+                    const SegmentGrid::Segment &segment = this->boundary_grid.getSegment(*iter);
+                    // a segment covering several of the cells is only tested from the first cell that the query shares with it
+                    if( cx != max(segment.cell_x0, cell_x0) || cy != max(segment.cell_y0, cell_y0) ) {
+                        continue;
+                    }
+                    if( segment.bottom_right.x < query_top_left.x || segment.top_left.x > query_bottom_right.x || segment.bottom_right.y < query_top_left.y || segment.top_left.y > query_bottom_right.y ) {
+                        continue;
+                    }
+                    if( isSegmentNearCorner(path_way_point, segment.p0, segment.p1) ) {
+                        return false;
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
+    for(vector<Polygon2D>::const_iterator iter = this->boundaries.begin(); iter != this->boundaries.end(); ++iter) {
+        const Polygon2D *boundary = &*iter;
+        size_t n_points = boundary->getNPoints();
+        for(size_t j=0;j<n_points;j++) {
+            if( isSegmentNearCorner(path_way_point, boundary->getPoint(j), boundary->getPoint((j+1) % n_points)) ) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+size_t Location::addDistanceGraphVertex(size_t way_point_index) {
+    PathWayPoint &path_way_point = path_way_points.at(way_point_index);
+    if( this->prune_distance_graph ) {
+        path_way_point.corner_clear = this->testCornerClear(path_way_point);
+    }
+    GraphVertex vertex(path_way_point.point, path_way_point.source);
+    size_t vertex_index = this->distance_graph->addVertex(vertex);
+    this->vertex_way_points.push_back(way_point_index);
+    return vertex_index;
+}
+
+bool Location::isTangentAtVertex(size_t vertex_index, Vector2D dir) const {
+    // tangent if the boundary edges either side of the corner are on the same side of the line, i.e., the line doesn't
+    // cut into the corner
+    const PathWayPoint &path_way_point = path_way_points.at( vertex_way_points.at(vertex_index) );
+    if( !path_way_point.corner_clear || dir.magnitude() <= E_TOL_LINEAR ) {
+        return true;
+    }
+    dir.normalise();
+    float side0 = dir.getSinAngle(- path_way_point.corner_dir0);
+    float side1 = dir.getSinAngle(path_way_point.corner_dir1);
+    if( fabs(side0) <= E_TOL_LINEAR || fabs(side1) <= E_TOL_LINEAR ) {
+        return true;
+    }
+    return ( side0 > 0.0f ) == ( side1 > 0.0f );
+}
+
+bool Location::isTangentEdge(size_t vertex_A, size_t vertex_B) const {
+    // a shortest path only turns at a vertex to go around its corner, so both of the edges it uses there must be
+    // tangent to the corner
+    Vector2D dir = this->distance_graph->getVertex(vertex_B)->getPos() - this->distance_graph->getVertex(vertex_A)->getPos();
+    return this->isTangentAtVertex(vertex_A, dir) && this->isTangentAtVertex(vertex_B, - dir);
+}
+
+/** Tests a share of the rows of vertex pairs for Location::calculateDistanceGraph().
+  */
+class DistanceGraphWorker : public QThread {
+    const Location *location;
+    vector< vector< pair<size_t, float> > > *rows;
+    size_t first_row;
+    size_t row_step;
+
+protected:
+    virtual void run() {
+        location->testDistanceGraphRows(rows, first_row, row_step);
+    }
+
+public:
+    DistanceGraphWorker(const Location *location, vector< vector< pair<size_t, float> > > *rows, size_t first_row, size_t row_step) :
+        location(location), rows(rows), first_row(first_row), row_step(row_step) {
+    }
+};
+
+const size_t distance_graph_min_vertices_per_thread_c = 64; // smaller graphs aren't worth the overhead of starting threads
+
+void Location::testDistanceGraphRows(vector< vector< pair<size_t, float> > > *rows, size_t first_row, size_t row_step) const {
+    // n.b., rows are interleaved between threads, as the earlier rows have more pairs to test
+    // this must only read from the Location, as it's run on multiple threads at once
+    for(size_t i=first_row;i<this->distance_graph->getNVertices();i+=row_step) {
+        Vector2D A = this->distance_graph->getVertex(i)->getPos();
+        vector< pair<size_t, float> > *row = &rows->at(i);
+        for(size_t j=i+1;j<this->distance_graph->getNVertices();j++) {
+            if( this->prune_distance_graph && !this->isTangentEdge(i, j) ) {
+                continue;
+            }
+            Vector2D B = this->distance_graph->getVertex(j)->getPos();
+            float dist = 0.0f;
+            bool hit = testGraphVerticesHit(&dist, A, B, NULL, false);
+            if( !hit ) {
+                row->push_back( pair<size_t, float>(j, dist) );
+            }
+        }
+    }
+}
+
 void Location::calculateDistanceGraph() {
     //qDebug("Location::calculateDistanceGraph()");
     //int time_s = clock();
@@ -1949,38 +2747,174 @@ void Location::calculateDistanceGraph() {
         delete this->distance_graph;
     }
     this->distance_graph = new Graph();
+    this->vertex_way_points.clear();
+    this->player_field_valid = false;
 
     this->calculatePathWayPoints();
     //LOG("Location::calculateDistanceGraph() calculatePathWayPoints() time taken: %d\n", clock() - time_s);
 
     //int n_hits = 0;
     for(size_t i=0;i<path_way_points.size();i++) {
-        PathWayPoint path_way_point = path_way_points.at(i);
+        const PathWayPoint &path_way_point = path_way_points.at(i);
         if( path_way_point.active && path_way_point.used_for_pathfinding ) {
-            Vector2D A = path_way_point.point;
-            GraphVertex vertex(A, path_way_point.source);
-            this->distance_graph->addVertex(vertex);
+            this->addDistanceGraphVertex(i);
         }
     }
 
-    for(size_t i=0;i<this->distance_graph->getNVertices();i++) {
-        GraphVertex *v_A = this->distance_graph->getVertex(i);
-        for(size_t j=i+1;j<this->distance_graph->getNVertices();j++) {
-            GraphVertex *v_B = this->distance_graph->getVertex(j);
-            float dist = 0.0f;
-            bool hit = testGraphVerticesHit(&dist, v_A, v_B, NULL, false);
-            if( !hit ) {
-                v_A->addNeighbour(j, dist);
-                v_B->addNeighbour(i, dist);
-                //n_hits++;
-            }
+    // the pairs of vertices are tested on several threads; each row of results is only written by one thread
+    size_t n_vertices = this->distance_graph->getNVertices();
+    vector< vector< pair<size_t, float> > > rows(n_vertices);
+    size_t n_threads = 1;
+    if( this->distance_graph_threads > 0 ) {
+        n_threads = (size_t)this->distance_graph_threads;
+    }
+    else {
+        int ideal_n_threads = QThread::idealThreadCount();
+        n_threads = ideal_n_threads > 1 ? (size_t)ideal_n_threads : 1;
+        n_threads = std::min(n_threads, std::max((size_t)1, n_vertices / distance_graph_min_vertices_per_thread_c));
+    }
+    vector<DistanceGraphWorker *> workers;
+    for(size_t i=1;i<n_threads;i++) {
+        DistanceGraphWorker *worker = new DistanceGraphWorker(this, &rows, i, n_threads);
+        workers.push_back(worker);
+        worker->start();
+    }
+    // the first share is done on this thread
+    this->testDistanceGraphRows(&rows, 0, n_threads);
+    for(vector<DistanceGraphWorker *>::iterator iter = workers.begin(); iter != workers.end(); ++iter) {
+        DistanceGraphWorker *worker = *iter;
+        worker->wait();
+        delete worker;
+    }
+
+    // merge in the same order as testing on a single thread, so the graph doesn't depend on the number of threads
+    for(size_t i=0;i<n_vertices;i++) {
+        const vector< pair<size_t, float> > &row = rows[i];
+        for(vector< pair<size_t, float> >::const_iterator iter = row.begin(); iter != row.end(); ++iter) {
+            this->distance_graph->addEdge(i, iter->first, iter->second);
+            //n_hits++;
         }
     }
+    this->distance_graph->freeze();
+
+    this->region_vertices.clear();
+    this->region_vertices.resize(floor_regions.size());
+    this->unassigned_vertices.clear();
+    for(size_t i=0;i<n_vertices;i++) {
+        this->assignVertexToRegions(i);
+    }
+    this->calculatePortalGraph();
     //qDebug("Location::calculateDistanceGraph(): %d hits", n_hits);
     //qDebug("Location::calculateDistanceGraph() total time taken: %d", clock() - time_s);
 }
 
+void Location::assignVertexToRegions(size_t vertex_index) {
+    Vector2D pos = this->distance_graph->getVertex(vertex_index)->getPos();
+    bool found = false;
+    for(size_t i=0;i<floor_regions.size();i++) {
+        if( floor_regions.at(i)->pointInside(pos) ) {
+            this->region_vertices.at(i).push_back(vertex_index);
+            found = true;
+        }
+    }
+    if( !found ) {
+        this->unassigned_vertices.push_back(vertex_index);
+    }
+}
+
+void Location::calculatePortalGraph() {
+    if( this->portal_graph != NULL ) {
+        delete this->portal_graph;
+    }
+    this->portal_graph = new Graph();
+    this->region_portals.clear();
+    this->region_portals.resize(floor_regions.size());
+    for(size_t i=0;i<portal_points.size();i++) {
+        GraphVertex vertex(portal_points.at(i), NULL);
+        this->portal_graph->addVertex(vertex);
+        this->region_portals.at(portal_regions.at(i).first).push_back(i);
+        this->region_portals.at(portal_regions.at(i).second).push_back(i);
+    }
+    // portals are linked if they're on the same floor region
+    for(vector< vector<size_t> >::const_iterator iter = region_portals.begin(); iter != region_portals.end(); ++iter) {
+        const vector<size_t> &portals = *iter;
+        for(size_t j=0;j<portals.size();j++) {
+            for(size_t k=j+1;k<portals.size();k++) {
+                float dist = (portal_points.at(portals.at(j)) - portal_points.at(portals.at(k))).magnitude();
+                this->portal_graph->addEdge(portals.at(j), portals.at(k), dist);
+            }
+        }
+    }
+    this->portal_graph->freeze();
+}
+
+int Location::findFloorRegionIndexAt(Vector2D pos) const {
+    if( this->region_grid.isInit() ) {
+        int cell_x0 = 0, cell_y0 = 0, cell_x1 = 0, cell_y1 = 0;
+        this->region_grid.getCellRange(&cell_x0, &cell_y0, &cell_x1, &cell_y1, pos, pos);
+        // cells list the floor regions in order, so this finds the same floor region as the full search
+        const vector<size_t> &cell = this->region_grid.getCell(cell_x0, cell_y0);
+        for(vector<size_t>::const_iterator iter = cell.begin(); iter != cell.end(); ++iter) {
+            size_t i = this->region_grid.getSegment(*iter).polygon_indx;
+            if( floor_regions.at(i)->pointInside(pos) ) {
+                return (int)i;
+            }
+        }
+        return -1;
+    }
+    for(size_t i=0;i<floor_regions.size();i++) {
+        if( floor_regions.at(i)->pointInside(pos) ) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+bool Location::findRegionRoute(vector<size_t> *route_regions, GraphSearchContext *context, GraphOverlay *overlay, Vector2D src, Vector2D dest) const {
+    // only worth doing for larger locations
+    if( this->portal_graph == NULL || floor_regions.size() < region_route_min_regions_c ) {
+        return false;
+    }
+    int src_region = this->findFloorRegionIndexAt(src);
+    int dest_region = this->findFloorRegionIndexAt(dest);
+    if( src_region == -1 || dest_region == -1 || src_region == dest_region ) {
+        return false;
+    }
+
+    overlay->reset(this->portal_graph);
+    size_t start_index = overlay->addVertex(src);
+    size_t end_index = overlay->addVertex(dest);
+    const vector<size_t> &src_portals = this->region_portals.at(src_region);
+    for(vector<size_t>::const_iterator iter = src_portals.begin(); iter != src_portals.end(); ++iter) {
+        overlay->addEdge(*iter, start_index, (portal_points.at(*iter) - src).magnitude());
+    }
+    const vector<size_t> &dest_portals = this->region_portals.at(dest_region);
+    for(vector<size_t>::const_iterator iter = dest_portals.begin(); iter != dest_portals.end(); ++iter) {
+        overlay->addEdge(*iter, end_index, (portal_points.at(*iter) - dest).magnitude());
+    }
+    vector<size_t> route = this->portal_graph->shortestPath(context, overlay, start_index, end_index, true);
+    if( route.size() == 0 ) {
+        return false;
+    }
+
+    route_regions->push_back(src_region);
+    for(vector<size_t>::const_iterator iter = route.begin(); iter != route.end(); ++iter) {
+        size_t portal = *iter;
+        if( portal < portal_regions.size() ) {
+            // n.b., regions will be repeated, but doesn't matter
+            route_regions->push_back(portal_regions.at(portal).first);
+            route_regions->push_back(portal_regions.at(portal).second);
+        }
+    }
+    route_regions->push_back(dest_region);
+    return true;
+}
+
 vector<Vector2D> Location::calculatePathTo(Vector2D src, Vector2D dest, const void *ignore, bool can_fly) const {
+    return this->calculatePathTo(&this->path_search_context, &this->path_overlay, src, dest, ignore, can_fly);
+}
+
+vector<Vector2D> Location::calculatePathTo(GraphSearchContext *context, GraphOverlay *overlay, Vector2D src, Vector2D dest, const void *ignore, bool can_fly) const {
     vector<Vector2D> new_path;
     //qDebug("ignore: %d", ignore);
 
@@ -1992,42 +2926,66 @@ vector<Vector2D> Location::calculatePathTo(Vector2D src, Vector2D dest, const vo
     }
     else {
         //qDebug("    calculate path\n");
-        const Graph *distance_graph = this->getDistanceGraph();
-        Graph *graph = distance_graph->clone();
-
-        size_t n_old_vertices = graph->getNVertices();
-        GraphVertex start_vertex(src, NULL);
-        GraphVertex end_vertex(dest, NULL);
-        size_t start_index = graph->addVertex(start_vertex);
-        size_t end_index = graph->addVertex(end_vertex);
-
-        // n.b., don't need to check for link between start_vertex and end_vertex, as this code path is only for where we can't walk directly between the start and end!
-        for(size_t i=0;i<n_old_vertices;i++) {
-            GraphVertex *v_A = graph->getVertex(i);
-            for(size_t j=n_old_vertices;j<graph->getNVertices();j++) {
-                GraphVertex *v_B = graph->getVertex(j);
-                float dist = 0.0f;
-                bool hit = testGraphVerticesHit(&dist, v_A, v_B, j==end_index ? ignore : NULL, can_fly); // only the last segment of the path should ignore the "ignore"
-                if( !hit ) {
-                    v_A->addNeighbour(j, dist);
-                    v_B->addNeighbour(i, dist);
+        // for long paths, first find which floor regions we need to pass through, so we only need to search the vertices in those regions
+        vector<size_t> route_regions;
+        bool use_route = !can_fly && this->findRegionRoute(&route_regions, context, overlay, src, dest);
+        const Graph *graph = this->getDistanceGraph();
+        size_t n_graph_vertices = graph->getNVertices();
+        for(;;) {
+            // the start and end are added to an overlay, rather than to (a copy of) the distance graph
+            overlay->reset(graph);
+            size_t start_index = overlay->addVertex(src);
+            size_t end_index = overlay->addVertex(dest);
+            if( use_route ) {
+                for(vector<size_t>::const_iterator iter = route_regions.begin(); iter != route_regions.end(); ++iter) {
+                    const vector<size_t> &vertices = this->region_vertices.at(*iter);
+                    for(vector<size_t>::const_iterator iter2 = vertices.begin(); iter2 != vertices.end(); ++iter2) {
+                        overlay->allowBaseVertex(*iter2);
+                    }
+                }
+                for(vector<size_t>::const_iterator iter = unassigned_vertices.begin(); iter != unassigned_vertices.end(); ++iter) {
+                    overlay->allowBaseVertex(*iter);
                 }
             }
-        }
 
-        vector<GraphVertex *> shortest_path = graph->shortestPath(start_index, end_index);
-        if( shortest_path.size() == 0 ) {
-            // can't reach destination (or already at it)
-            //qDebug("    can't reach destination (or already at it)\n");
-        }
-        else {
-            for(vector<GraphVertex *>::const_iterator iter = shortest_path.begin(); iter != shortest_path.end(); ++iter) {
-                const GraphVertex *vertex = *iter;
-                new_path.push_back(vertex->getPos());
+            // n.b., don't need to check for link between start_vertex and end_vertex, as this code path is only for where we can't walk directly between the start and end!
+            for(size_t i=0;i<n_graph_vertices;i++) {
+                if( !overlay->isBaseVertexAllowed(i) ) {
+                    continue;
+                }
+                Vector2D A = graph->getVertex(i)->getPos();
+                for(size_t j=start_index;j<=end_index;j++) {
+                    Vector2D B = overlay->getVertexPos(j);
+                    float dist = 0.0f;
+                    bool hit = testGraphVerticesHit(&dist, A, B, j==end_index ? ignore : NULL, can_fly); // only the last segment of the path should ignore the "ignore"
+                    if( !hit ) {
+                        overlay->addEdge(i, j, dist);
+                    }
+                }
             }
-        }
 
-        delete graph;
+            vector<size_t> shortest_path = graph->shortestPath(context, overlay, start_index, end_index, true);
+            if( shortest_path.size() == 0 && use_route ) {
+                // the route through the floor regions may be blocked (e.g., by scenery), but there may still be another way
+                //qDebug("    no path along floor region route, try whole graph");
+                use_route = false;
+                continue;
+            }
+            if( shortest_path.size() == 0 ) {
+                // can't reach destination (or already at it)
+                //qDebug("    can't reach destination (or already at it)\n");
+            }
+            else {
+                for(vector<size_t>::const_iterator iter = shortest_path.begin(); iter != shortest_path.end(); ++iter) {
+                    size_t indx = *iter;
+                    new_path.push_back( indx < n_graph_vertices ? graph->getVertex(indx)->getPos() : overlay->getVertexPos(indx) );
+                }
+                if( this->smooth_paths ) {
+                    this->smoothPath(src, &new_path, ignore, can_fly);
+                }
+            }
+            break;
+        }
     }
 
     if( new_path.size() > 0 ) {
@@ -2096,14 +3054,245 @@ void Location::revealMap(PlayingGamestate *playing_gamestate) {
     }
 }
 
+void Location::calculateVisibilityPolygon(VisibilityPolygon *visibility_polygon, vector<Vector2D> *segments, Vector2D pos, Vector2D top_left, Vector2D bottom_right) const {
+    // only the boundary segments that overlap the rectangle can affect the polygon
+    segments->clear();
+    if( this->boundary_grid.isInit() ) {
+        int cell_x0 = 0, cell_y0 = 0, cell_x1 = 0, cell_y1 = 0;
+        this->boundary_grid.getCellRange(&cell_x0, &cell_y0, &cell_x1, &cell_y1, top_left, bottom_right);
+        for(int cy=cell_y0;cy<=cell_y1;cy++) {
+            for(int cx=cell_x0;cx<=cell_x1;cx++) {
+                const vector<size_t> &cell = this->boundary_grid.getCell(cx, cy);
+                for(vector<size_t>::const_iterator iter = cell.begin(); iter != cell.end(); ++iter) {
+                    const SegmentGrid::Segment &segment = this->boundary_grid.getSegment(*iter);
+                    // a segment covering several of the cells is only added from the first cell that the rectangle shares with it
+                    if( cx != max(segment.cell_x0, cell_x0) || cy != max(segment.cell_y0, cell_y0) ) {
+                        continue;
+                    }
+                    if( segment.bottom_right.x < top_left.x || segment.top_left.x > bottom_right.x || segment.bottom_right.y < top_left.y || segment.top_left.y > bottom_right.y ) {
+                        continue;
+                    }
+                    const Polygon2D *boundary = &this->boundaries.at(segment.polygon_indx);
+                    if( this->isBoundaryIgnored(boundary, INTERSECTTYPE_VISIBILITY, NULL, false) ) {
+                        continue;
+                    }
+                    segments->push_back(segment.p0);
+                    segments->push_back(segment.p1);
+                }
+            }
+        }
+    }
+    else {
+        for(vector<Polygon2D>::const_iterator iter = this->boundaries.begin(); iter != this->boundaries.end(); ++iter) {
+            const Polygon2D *boundary = &*iter;
+            if( this->isBoundaryIgnored(boundary, INTERSECTTYPE_VISIBILITY, NULL, false) ) {
+                continue;
+            }
+            for(size_t j=0;j<boundary->getNPoints();j++) {
+                segments->push_back(boundary->getPoint(j));
+                segments->push_back(boundary->getPoint((j+1) % boundary->getNPoints()));
+            }
+        }
+    }
+    visibility_polygon->calculate(pos, *segments, top_left, bottom_right);
+}
+
+static float boxDistance(Vector2D top_left0, Vector2D bottom_right0, Vector2D top_left1, Vector2D bottom_right1) {
+    // distance between two axis-aligned boxes, 0 if they overlap
+    float xdiff = max(0.0f, max(top_left0.x - bottom_right1.x, top_left1.x - bottom_right0.x));
+    float ydiff = max(0.0f, max(top_left0.y - bottom_right1.y, top_left1.y - bottom_right0.y));
+    return sqrt(xdiff*xdiff + ydiff*ydiff);
+}
+
+static bool isStabbingLine(Vector2D p0, Vector2D p1, const vector<Vector2D> &lefts, const vector<Vector2D> &rights) {
+    // whether the line from p0 through p1 passes between each pair of portal end points, with lefts on its left and rights on its right
+    Vector2D dir = p1 - p0;
+    float length = dir.magnitude();
+    if( length <= E_TOL_LINEAR ) {
+        return false;
+    }
+    dir /= length;
+    for(vector<Vector2D>::const_iterator iter = lefts.begin(); iter != lefts.end(); ++iter) {
+        Vector2D diff = *iter - p0;
+        if( dir.x*diff.y - dir.y*diff.x < -E_TOL_LINEAR ) {
+            return false;
+        }
+    }
+    for(vector<Vector2D>::const_iterator iter = rights.begin(); iter != rights.end(); ++iter) {
+        Vector2D diff = *iter - p0;
+        if( dir.x*diff.y - dir.y*diff.x > E_TOL_LINEAR ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Location::findPortalBlockers() {
+    // a portal is only treated as blocked if a single piece of scenery covers all of it
+    this->portal_blockers.clear();
+    this->portal_blockers.resize(portal_edges.size(), NULL);
+    for(vector<Polygon2D>::const_iterator iter = boundaries.begin(); iter != boundaries.end(); ++iter) {
+        const Polygon2D *boundary = &*iter;
+        if( boundary->getSourceType() != (int)SOURCETYPE_SCENERY || this->isBoundaryIgnored(boundary, INTERSECTTYPE_VISIBILITY, NULL, false) ) {
+            continue;
+        }
+        for(size_t i=0;i<portal_edges.size();i++) {
+            if( portal_blockers.at(i) != NULL ) {
+                continue;
+            }
+            Vector2D p0 = portal_edges.at(i).first;
+            Vector2D p1 = portal_edges.at(i).second;
+            if( boundary->pointInside(p0) && boundary->pointInside(p1) && boundary->pointInside((p0 + p1) * 0.5f) ) {
+                this->portal_blockers.at(i) = static_cast<Scenery *>(boundary->getSource());
+            }
+        }
+    }
+}
+
+bool Location::findPVSRegions(vector<bool> *visible, size_t *n_steps, vector<size_t> *chain_regions, vector<Vector2D> *lefts, vector<Vector2D> *rights, const vector< pair<Vector2D, Vector2D> > &lines, Vector2D src_top_left, Vector2D src_bottom_right, float max_dist) const {
+    // Depth first search through the sequences of portals leading out of the source floor region. A floor region is visible
+    // if some line passes through every portal on the way to it; if such a line exists, there is one that passes through
+    // two of the portal end points, so only those lines need to be kept as we go (the line can be in either direction, as
+    // the end points are ordered relative to the direction of travel).
+    // Returns false if the search was abandoned.
+    size_t region = chain_regions->back();
+    const vector<size_t> &portals = this->region_portals.at(region);
+    vector< pair<Vector2D, Vector2D> > new_lines;
+    for(vector<size_t>::const_iterator iter = portals.begin(); iter != portals.end(); ++iter) {
+        size_t portal = *iter;
+        if( this->portal_blockers.at(portal) != NULL ) {
+            continue;
+        }
+        const pair<size_t, size_t> &regions = this->portal_regions.at(portal);
+        bool from_first = regions.first == region;
+        size_t next_region = from_first ? regions.second : regions.first;
+        if( std::find(chain_regions->begin(), chain_regions->end(), next_region) != chain_regions->end() ) {
+            continue;
+        }
+        const FloorRegion *next_floor_region = this->floor_regions.at(next_region);
+        if( boxDistance(src_top_left, src_bottom_right, next_floor_region->getTopLeft(), next_floor_region->getBottomRight()) > max_dist ) {
+            continue;
+        }
+        if( ++(*n_steps) > pvs_max_steps_c ) {
+            return false;
+        }
+        // portal_edges run from left to right when leaving the first floor region, as floor regions are all ordered the same way
+        Vector2D left = from_first ? portal_edges.at(portal).first : portal_edges.at(portal).second;
+        Vector2D right = from_first ? portal_edges.at(portal).second : portal_edges.at(portal).first;
+        lefts->push_back(left);
+        rights->push_back(right);
+        new_lines.clear();
+        if( lefts->size() >= 2 ) {
+            for(vector< pair<Vector2D, Vector2D> >::const_iterator iter2 = lines.begin(); iter2 != lines.end(); ++iter2) {
+                if( isStabbingLine(iter2->first, iter2->second, *lefts, *rights) ) {
+                    new_lines.push_back(*iter2);
+                }
+            }
+            // also lines through the new end points
+            for(size_t i=0;i<2;i++) {
+                Vector2D p0 = i==0 ? left : right;
+                for(size_t j=0;j<2*lefts->size()-1;j++) {
+                    Vector2D p1 = j < lefts->size() ? lefts->at(j) : rights->at(j - lefts->size());
+                    if( p1 == p0 ) {
+                        continue;
+                    }
+                    if( isStabbingLine(p0, p1, *lefts, *rights) ) {
+                        new_lines.push_back( pair<Vector2D, Vector2D>(p0, p1) );
+                    }
+                    if( isStabbingLine(p1, p0, *lefts, *rights) ) {
+                        new_lines.push_back( pair<Vector2D, Vector2D>(p1, p0) );
+                    }
+                }
+            }
+        }
+        if( lefts->size() < 2 || new_lines.size() > 0 ) {
+            visible->at(next_region) = true;
+            chain_regions->push_back(next_region);
+            vector< pair<Vector2D, Vector2D> > next_lines;
+            next_lines.swap(new_lines);
+            bool ok = this->findPVSRegions(visible, n_steps, chain_regions, lefts, rights, next_lines, src_top_left, src_bottom_right, max_dist);
+            chain_regions->pop_back();
+            if( !ok ) {
+                return false;
+            }
+        }
+        lefts->pop_back();
+        rights->pop_back();
+    }
+    return true;
+}
+
+void Location::calculatePVS() {
+    //qDebug("Location::calculatePVS()");
+    this->pvs.clear();
+    if( this->type == TYPE_OUTDOORS ) {
+        // floor boundaries don't block visibility
+        return;
+    }
+    if( this->region_portals.size() != this->floor_regions.size() ) {
+        throw string("calculatePVS called before calculateDistanceGraph");
+    }
+    this->findPortalBlockers();
+
+    // candidate floor regions only need to be within range of some point in the source floor region, but this may
+    // include sampling points of floor regions beyond that range (see updateVisibility())
+    size_t n_regions = floor_regions.size();
+    float max_dist = npc_visibility_c;
+    for(vector<FloorRegion *>::const_iterator iter = floor_regions.begin(); iter != floor_regions.end(); ++iter) {
+        const FloorRegion *floor_region = *iter;
+        max_dist = max(max_dist, npc_visibility_c + (floor_region->getBottomRight() - floor_region->getTopLeft()).magnitude());
+    }
+    this->pvs.resize(n_regions*n_regions, false);
+    vector<bool> visible;
+    vector<size_t> chain_regions;
+    vector<Vector2D> lefts, rights;
+    vector< pair<Vector2D, Vector2D> > lines;
+    for(size_t i=0;i<n_regions;i++) {
+        const FloorRegion *floor_region = floor_regions.at(i);
+        visible.clear();
+        visible.resize(n_regions, false);
+        visible.at(i) = true;
+        chain_regions.clear();
+        chain_regions.push_back(i);
+        lefts.clear();
+        rights.clear();
+        size_t n_steps = 0;
+        if( !this->findPVSRegions(&visible, &n_steps, &chain_regions, &lefts, &rights, lines, floor_region->getTopLeft(), floor_region->getBottomRight(), max_dist) ) {
+            // too many sequences of portals, so assume everything in range may be visible
+            LOG("calculatePVS: too many portal sequences from floor region %d\n", i);
+            for(size_t j=0;j<n_regions;j++) {
+                const FloorRegion *floor_region2 = floor_regions.at(j);
+                if( boxDistance(floor_region->getTopLeft(), floor_region->getBottomRight(), floor_region2->getTopLeft(), floor_region2->getBottomRight()) <= max_dist ) {
+                    visible.at(j) = true;
+                }
+            }
+        }
+        for(size_t j=0;j<n_regions;j++) {
+            if( visible.at(j) ) {
+                // visibility is symmetric, so also mark the reverse in case it's missed due to tolerances
+                this->pvs.at(i*n_regions + j) = true;
+                this->pvs.at(j*n_regions + i) = true;
+            }
+        }
+    }
+}
+
 vector<FloorRegion *> Location::updateVisibility(Vector2D pos) {
     //qDebug("Location::updateVisibility for %f, %f", pos.x, pos.y);
     vector<FloorRegion *> update_floor_regions;
+    int pos_region = this->findFloorRegionIndexAt(pos);
+    // find the points to test for the floor regions that might become visible, so that the visibility polygon only needs
+    // to cover them
+    vector< pair<FloorRegion *, Vector2D> > test_points;
+    Vector2D test_top_left = pos, test_bottom_right = pos;
     for(vector<FloorRegion *>::iterator iter = floor_regions.begin(); iter != floor_regions.end(); ++iter) {
         FloorRegion *floor_region = *iter;
         if( floor_region->isVisible() ) {
             continue;
         }
+        if( !this->canFloorRegionsSee(pos_region, iter - floor_regions.begin()) ) {
+            continue;
+        }
 
         Vector2D top_left = floor_region->getTopLeft();
         Vector2D bottom_right = floor_region->getBottomRight();
@@ -2122,42 +3311,46 @@ vector<FloorRegion *> Location::updateVisibility(Vector2D pos) {
         }
         //qDebug("TEST");
 
-        for(size_t j=0;j<floor_region->getNPoints() && !floor_region->isVisible();j++) {
-            //Vector2D point = floor_region->getPoint(j);
+        if( floor_region->pointInside(pos) ) {
+            // we're inside this region!
+            floor_region->setVisible(true);
+            update_floor_regions.push_back(floor_region);
+            continue;
+        }
+
+        for(size_t j=0;j<floor_region->getNPoints();j++) {
             int p_j = j==0 ? floor_region->getNPoints()-1 : j-1;
             // now only need to check for points on internal edges
             if( floor_region->getEdgeType(j) == FloorRegion::EDGETYPE_INTERNAL || floor_region->getEdgeType(p_j) == FloorRegion::EDGETYPE_INTERNAL )
             {
-                /*
-                // test we get get to the way point
-                Vector2D hit_pos;
-                // use E_TOL_LINEAR, to avoid line of sight slipping between two adjacent items
-                if( !this->intersectSweptSquareWithBoundaries(&hit_pos, false, pos, point, E_TOL_LINEAR, INTERSECTTYPE_VISIBILITY, NULL) ) {
-                    floor_region->setVisible(true);
-                    update_floor_regions.push_back(floor_region);
-                }*/
-                if( this->testVisibility(pos, floor_region, j) ) {
-                    floor_region->setVisible(true);
-                    update_floor_regions.push_back(floor_region);
-                }
-            }
-        }
-        if( !floor_region->isVisible() ) {
-            // also test centre point
-            Vector2D centre_pos = floor_region->findCentre();
-            Vector2D hit_pos;
-            // use E_TOL_LINEAR, to avoid line of sight slipping between two adjacent items
-            if( pos == centre_pos || !this->intersectSweptSquareWithBoundaries(&hit_pos, false, pos, centre_pos, E_TOL_LINEAR, INTERSECTTYPE_VISIBILITY, NULL, false) ) {
-                floor_region->setVisible(true);
-                update_floor_regions.push_back(floor_region);
+                Vector2D point = floor_region->offsetInwards(j, 2.0f*E_TOL_LINEAR); // offset, so we don't collide with the floor region we've sampled from!
+                test_points.push_back( pair<FloorRegion *, Vector2D>(floor_region, point) );
             }
         }
-        if( !floor_region->isVisible() ) {
-            // also test if we're inside this region!
-            if( floor_region->pointInside(pos) ) {
-                floor_region->setVisible(true);
-                update_floor_regions.push_back(floor_region);
-            }
+        // also test centre point
+        test_points.push_back( pair<FloorRegion *, Vector2D>(floor_region, floor_region->findCentre()) );
+    }
+    if( test_points.size() == 0 ) {
+        return update_floor_regions;
+    }
+
+    // a single angular sweep finds everything that can be seen from pos, then the points only need testing against the
+    // resultant polygon, rather than each needing a line of sight test against the boundaries
+    for(vector< pair<FloorRegion *, Vector2D> >::const_iterator iter = test_points.begin(); iter != test_points.end(); ++iter) {
+        Vector2D point = iter->second;
+        test_top_left.set( std::min(test_top_left.x, point.x), std::min(test_top_left.y, point.y) );
+        test_bottom_right.set( std::max(test_bottom_right.x, point.x), std::max(test_bottom_right.y, point.y) );
+    }
+    test_top_left -= Vector2D(1.0f, 1.0f);
+    test_bottom_right += Vector2D(1.0f, 1.0f);
+    this->calculateVisibilityPolygon(&this->visibility_polygon, &this->visibility_segments, pos, test_top_left, test_bottom_right);
+
+    for(vector< pair<FloorRegion *, Vector2D> >::const_iterator iter = test_points.begin(); iter != test_points.end(); ++iter) {
+        FloorRegion *floor_region = iter->first;
+        // use E_TOL_LINEAR, to avoid line of sight slipping between two adjacent items
+        if( !floor_region->isVisible() && this->visibility_polygon.pointInside(iter->second, E_TOL_LINEAR) ) {
+            floor_region->setVisible(true);
+            update_floor_regions.push_back(floor_region);
         }
     }
     //qDebug("Location::updateVisibility done");
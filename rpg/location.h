@@ -4,8 +4,14 @@
 using std::vector;
 #include <set>
 using std::set;
+#include <deque>
+using std::deque;
+#include <map>
+using std::map;
 #include <string>
 using std::string;
+#include <utility>
+using std::pair;
 
 #include "../common.h"
 
@@ -23,6 +29,8 @@ const int SOURCETYPE_FLOOR = 0;
 const int SOURCETYPE_SCENERY = 1;
 const int SOURCETYPE_FIXED_NPC = 2;
 
+const Symbol scenery_action_harm_player_c("harm_player");
+
 class LocationListener {
 public:
     virtual void locationAddItem(const Location *location, Item *item, bool visible)=0;
@@ -48,6 +56,13 @@ public:
     Trap(const string &type);
     Trap(const string &type, float width, float height);
 
+    static void *operator new(size_t size) {
+        return allocateSmallObject(size);
+    }
+    static void operator delete(void *ptr, size_t size) {
+        freeSmallObject(ptr, size);
+    }
+
     const string &getType() const {
         return this->type;
     }
@@ -92,6 +107,37 @@ public:
     void setOff(PlayingGamestate *playing_gamestate, Character *character) const;
 };
 
+/** The properties of a Scenery that are normally the same for every instance of that type of
+  * scenery (e.g., every barrel or torch). Templates are immutable and shared: they are only
+  * obtained via SceneryTemplate::find(), which returns the one copy with those values, and
+  * are never deleted.
+  */
+class SceneryTemplate {
+public:
+    string name;
+    string image_name;
+    string big_image_name; // used for description
+    string requires_flag; // used for various purposes - if door can be opened, if exit[_location] can be exited, if scenery can be interacted with
+    string exit_location;
+    string locked_text;
+    string unlock_item_name;
+    string unlock_text;
+    string confirm_text; // relevant only for some types, e.g., doors
+    string interact_type;
+    string popup_text; // not saved at the moment (only set internally by the engine)
+    string description;
+    float width, height;
+    float visual_height; // not saved
+    bool boundary_iso;
+    float boundary_iso_ratio;
+
+    SceneryTemplate(const string &name, const string &image_name, float width, float height, float visual_height, bool boundary_iso, float boundary_iso_ratio);
+
+    bool operator<(const SceneryTemplate &that) const;
+
+    static const SceneryTemplate *find(const SceneryTemplate &scenery_template);
+};
+
 class Scenery {
 public:
     enum DrawType {
@@ -102,46 +148,33 @@ public:
 
 protected:
     Location *location; // not saved
-    string name;
-    string image_name;
-    string big_image_name; // used for description
+    const SceneryTemplate *scenery_template; // shared with other instances with the same values; setting a template value switches to another template
     Vector2D pos; // pos in Location (for centre)
     vector<void *> user_data_gfx;
 
-    string requires_flag; // used for various purposes - if door can be opened, if exit[_location] can be exited, if scenery can be interacted with
     bool is_blocking;
     bool blocks_visibility;
     bool is_door, is_exit;
-    string exit_location;
     Vector2D exit_location_pos;
     int exit_travel_time;
     bool is_locked; // relevant only for some types, e.g., containers, doors
     bool locked_silent; // whether sample is played when trying to unlock
-    string locked_text;
     bool locked_used_up;
     bool key_always_needed;
-    string unlock_item_name;
-    string unlock_text;
     int unlock_xp;
-    string confirm_text; // relevant only for some types, e.g., doors
     DrawType draw_type;
     float opacity;
     bool has_smoke;
     Vector2D smoke_pos;
-    float width, height;
-    float visual_height; // not saved
-    bool boundary_iso;
-    float boundary_iso_ratio;
     Polygon2D boundary_base;
     Polygon2D boundary_visual;
 
     // actions are events which happen periodically
     int action_last_time; // not saved
     int action_delay;
-    string action_type;
+    Symbol action_type;
     int action_value;
 
-    string interact_type;
     int interact_state;
 
     bool can_be_opened;
@@ -149,8 +182,7 @@ protected:
     set<Item *> items;
     Trap *trap;
 
-    string popup_text; // not saved at the moment (only set internally by the engine)
-    string description;
+    void setTemplateString(string SceneryTemplate::*field, const string &value);
 
     // rule of three
     Scenery& operator=(const Scenery &) {
@@ -161,8 +193,19 @@ protected:
     }*/
 public:
     Scenery(const string &name, const string &image_name, float width, float height, float visual_height, bool boundary_iso, float boundary_iso_ratio);
+    /** Loaders should fill in a SceneryTemplate and construct from that, as each setter that
+      * changes a template value has to look up another template.
+      */
+    explicit Scenery(const SceneryTemplate &scenery_template);
     virtual ~Scenery();
 
+    static void *operator new(size_t size) {
+        return allocateSmallObject(size);
+    }
+    static void operator delete(void *ptr, size_t size) {
+        freeSmallObject(ptr, size);
+    }
+
     virtual Scenery *clone() const; // virtual copy constructor
 
     void setLocation(Location *location) {
@@ -178,11 +221,14 @@ public:
     Vector2D getPos() const {
         return this->pos;
     }
-    string getName() const {
-        return this->name;
+    const SceneryTemplate *getTemplate() const {
+        return this->scenery_template;
     }
-    string getImageName() const {
-        return this->image_name;
+    const string &getName() const {
+        return this->scenery_template->name;
+    }
+    const string &getImageName() const {
+        return this->scenery_template->image_name;
     }
     void clearUserGfxData() {
         this->user_data_gfx.clear();
@@ -196,27 +242,27 @@ public:
     void *getUserGfxData(size_t i) const {
         return this->user_data_gfx.at(i);
     }
-    string getPopupText() const {
-        return this->popup_text;
+    const string &getPopupText() const {
+        return this->scenery_template->popup_text;
     }
     void setDescription(const string &description) {
-        this->description = description;
+        this->setTemplateString(&SceneryTemplate::description, description);
     }
-    string getDescription() const {
-        return this->description;
+    const string &getDescription() const {
+        return this->scenery_template->description;
     }
     void setBigImageName(const string &big_image_name) {
-        this->big_image_name = big_image_name;
+        this->setTemplateString(&SceneryTemplate::big_image_name, big_image_name);
     }
-    string getBigImageName() const {
-        return this->big_image_name;
+    const string &getBigImageName() const {
+        return this->scenery_template->big_image_name;
     }
 
     void setRequiresFlag(const string &requires_flag) {
-        this->requires_flag = requires_flag;
+        this->setTemplateString(&SceneryTemplate::requires_flag, requires_flag);
     }
-    string getRequiresFlag() const {
-        return this->requires_flag;
+    const string &getRequiresFlag() const {
+        return this->scenery_template->requires_flag;
     }
 
     void setBlocking(bool is_blocking, bool blocks_visibility);
@@ -236,19 +282,19 @@ public:
     void setExit(bool is_exit) {
         this->is_exit = is_exit;
         if( is_exit ) {
-            this->popup_text = "Click on the door to exit this dungeon";
+            this->setTemplateString(&SceneryTemplate::popup_text, "Click on the door to exit this dungeon");
         }
     }
     bool isExit() const {
         return this->is_exit;
     }
     void setExitLocation(const string &exit_location, Vector2D exit_location_pos, int exit_travel_time) {
-        this->exit_location = exit_location;
+        this->setTemplateString(&SceneryTemplate::exit_location, exit_location);
         this->exit_location_pos = exit_location_pos;
         this->exit_travel_time = exit_travel_time;
     }
-    string getExitLocation() const {
-        return this->exit_location;
+    const string &getExitLocation() const {
+        return this->scenery_template->exit_location;
     }
     Vector2D getExitLocationPos() const {
         return this->exit_location_pos;
@@ -270,10 +316,10 @@ public:
         return this->locked_silent;
     }
     void setLockedText(const string &locked_text) {
-        this->locked_text = locked_text;
+        this->setTemplateString(&SceneryTemplate::locked_text, locked_text);
     }
-    string getLockedText() const {
-        return this->locked_text;
+    const string &getLockedText() const {
+        return this->scenery_template->locked_text;
     }
     void setLockedUsedUp(bool locked_used_up) {
         this->locked_used_up = locked_used_up;
@@ -288,16 +334,16 @@ public:
         return this->key_always_needed;
     }
     void setUnlockItemName(const string &unlock_item_name) {
-        this->unlock_item_name = unlock_item_name;
+        this->setTemplateString(&SceneryTemplate::unlock_item_name, unlock_item_name);
     }
-    string getUnlockItemName() const {
-        return this->unlock_item_name;
+    const string &getUnlockItemName() const {
+        return this->scenery_template->unlock_item_name;
     }
     void setUnlockText(const string &unlock_text) {
-        this->unlock_text = unlock_text;
+        this->setTemplateString(&SceneryTemplate::unlock_text, unlock_text);
     }
-    string getUnlockText() const {
-        return this->unlock_text;
+    const string &getUnlockText() const {
+        return this->scenery_template->unlock_text;
     }
     void setUnlockXP(int unlock_xp) {
         this->unlock_xp = unlock_xp;
@@ -306,10 +352,10 @@ public:
         return this->unlock_xp;
     }
     void setConfirmText(const string &confirm_text) {
-        this->confirm_text = confirm_text;
+        this->setTemplateString(&SceneryTemplate::confirm_text, confirm_text);
     }
-    string getConfirmText() const {
-        return this->confirm_text;
+    const string &getConfirmText() const {
+        return this->scenery_template->confirm_text;
     }
     void setDrawType(DrawType draw_type) {
         this->draw_type = draw_type;
@@ -346,9 +392,9 @@ public:
         return this->action_delay;
     }
     void setActionType(const string &action_type) {
-        this->action_type = action_type;
+        this->action_type = Symbol(action_type);
     }
-    string getActionType() const {
+    Symbol getActionType() const {
         return this->action_type;
     }
     void setActionValue(int action_value) {
@@ -357,11 +403,11 @@ public:
     int getActionValue() const {
         return this->action_value;
     }
-    string getInteractType() const {
-        return this->interact_type;
+    const string &getInteractType() const {
+        return this->scenery_template->interact_type;
     }
     void setInteractType(const string &interact_type) {
-        this->interact_type = interact_type;
+        this->setTemplateString(&SceneryTemplate::interact_type, interact_type);
     }
     int getInteractState() const {
         return this->interact_state;
@@ -371,13 +417,13 @@ public:
     }
 
     float getWidth() const {
-        return this->width;
+        return this->scenery_template->width;
     }
     float getHeight() const {
-        return this->height;
+        return this->scenery_template->height;
     }
     float getVisualHeight() const {
-        return this->visual_height;
+        return this->scenery_template->visual_height;
     }
     Polygon2D getBoundary(bool include_visual) const {
         return include_visual ? this->boundary_visual : this->boundary_base;
@@ -390,10 +436,10 @@ public:
         this->boundary_iso_ratio = boundary_iso_ratio;
     }*/
     bool isBoundaryIso() const {
-        return this->boundary_iso;
+        return this->scenery_template->boundary_iso;
     }
     float getBoundaryIsoRatio() const {
-        return this->boundary_iso_ratio;
+        return this->scenery_template->boundary_iso_ratio;
     }
 
     void addItem(Item *item);
@@ -459,6 +505,13 @@ public:
     virtual ~FloorRegion() {
     }
 
+    static void *operator new(size_t size) {
+        return allocateSmallObject(size);
+    }
+    static void operator delete(void *ptr, size_t size) {
+        freeSmallObject(ptr, size);
+    }
+
     virtual void addPoint(Vector2D point) {
         Polygon2D::addPoint(point);
         this->edge_types.push_back(EDGETYPE_EXTERNAL);
@@ -572,6 +625,76 @@ public:
     char getTileAt(int x, int y) const;
 };
 
+/** A request from a Character for a path, which is calculated later by
+  * Location::processPathRequests().
+  */
+class PathRequest {
+public:
+    Character *character; // NULL if the request has been cancelled
+    bool is_flee; // if true, pos is the position to flee from, rather than the destination
+    Vector2D pos;
+    const void *ignore;
+
+    PathRequest(Character *character, bool is_flee, Vector2D pos, const void *ignore) :
+        character(character), is_flee(is_flee), pos(pos), ignore(ignore) {
+    }
+};
+
+/** Spatial hash of characters, so that collision tests and searches for nearby
+  * characters only look at the characters in nearby cells.
+  */
+class CharacterGrid {
+    typedef pair<int, int> Cell;
+    map< Cell, vector<Character *> > cells; // only cells containing characters are stored
+    float cell_size;
+
+    Cell getCell(Vector2D pos) const;
+public:
+    CharacterGrid() : cell_size(1.0f) {
+    }
+
+    void init(float cell_size) {
+        this->cells.clear();
+        this->cell_size = cell_size;
+    }
+
+    void addCharacter(Character *character, Vector2D pos);
+    void removeCharacter(Character *character, Vector2D pos);
+    void moveCharacter(Character *character, Vector2D old_pos, Vector2D new_pos);
+    void findCharactersInRadius(vector<Character *> *result, Vector2D pos, float radius) const;
+    void findNearestCharacters(vector<Character *> *result, Vector2D pos, float radius, size_t max_n) const;
+};
+
+/** Grid of the scenery and traps that a character can trigger by moving, so that only those near
+ *  the character need testing. Scenery is stored in the cell containing its position, and traps in
+ *  every cell that their rectangle overlaps.
+ */
+class TriggerGrid {
+    typedef pair<int, int> Cell;
+    map< Cell, vector<Scenery *> > scenery_cells; // only cells containing scenery are stored
+    map< Cell, vector<Trap *> > trap_cells; // only cells containing traps are stored
+    float cell_size;
+
+    Cell getCell(Vector2D pos) const;
+    static void checkPopupScenery(vector<Scenery *> *entered, vector<Scenery *> *exited, const vector<Scenery *> &cell, Vector2D old_pos, Vector2D new_pos, float radius);
+public:
+    TriggerGrid() : cell_size(1.0f) {
+    }
+
+    void init(float cell_size) {
+        this->scenery_cells.clear();
+        this->trap_cells.clear();
+        this->cell_size = cell_size;
+    }
+
+    void addScenery(Scenery *scenery);
+    void removeScenery(Scenery *scenery);
+    void addTrap(Trap *trap);
+    void removeTrap(Trap *trap);
+    void findPopupScenery(vector<Scenery *> *entered, vector<Scenery *> *exited, Vector2D old_pos, Vector2D new_pos, float radius) const;
+    void findTrapsNear(vector<Trap *> *result, Vector2D pos) const;
+};
+
 class Location {
 public:
     enum IntersectType {
@@ -596,7 +719,49 @@ protected:
     LocationListener *listener;
     void *listener_data;
 
+    bool smooth_paths; // whether calculatePathTo() removes points that can be skipped
+    bool prune_distance_graph; // whether the distance graph only has edges that can be part of a shortest path
+    int distance_graph_threads; // if non-zero, the number of threads calculateDistanceGraph() uses
     Graph *distance_graph;
+    vector<size_t> vertex_way_points; // the path way point for each distance graph vertex
+    mutable GraphSearchContext path_search_context; // scratch state reused by calculatePathTo()
+    mutable GraphOverlay path_overlay; // scratch state reused by calculatePathTo()
+    // distances to the player over the distance graph, shared by all NPCs heading for the player - see calculatePathToPlayer()
+    mutable bool player_field_valid;
+    mutable Vector2D player_field_pos;
+    mutable GraphSearchContext player_field;
+    mutable vector< pair<float, size_t> > player_field_candidates; // scratch state reused by calculatePathToPlayer()
+    void updatePlayerField(Vector2D player_pos) const;
+    void addPlayerFieldCandidate(size_t vertex_index, Vector2D src) const;
+
+    // coarse graph for long range pathfinding, with a vertex for each portal (internal edge) between two floor regions
+    Graph *portal_graph;
+    vector< pair<size_t, size_t> > portal_regions; // the floor regions either side of each portal
+    vector<Vector2D> portal_points; // the midpoint of each portal
+    vector< pair<Vector2D, Vector2D> > portal_edges; // the end points of each portal, in the order of the first floor region's edge
+    vector< vector<size_t> > region_portals; // the portals of each floor region
+    vector< vector<size_t> > region_vertices; // the distance graph vertices inside each floor region
+    vector<size_t> unassigned_vertices; // distance graph vertices that aren't inside any floor region
+    void calculatePortalGraph();
+    void assignVertexToRegions(size_t vertex_index);
+    bool findRegionRoute(vector<size_t> *route_regions, GraphSearchContext *context, GraphOverlay *overlay, Vector2D src, Vector2D dest) const;
+    SegmentGrid region_grid; // each floor region's bounding box, stored as the segment along its diagonal, for findFloorRegionIndexAt()
+    void findFloorRegionsBounds(Vector2D *top_left, Vector2D *bottom_right) const;
+    void buildRegionGrid();
+
+    // potentially visible set of floor regions, see calculatePVS()
+    vector<bool> pvs; // entry i*n+j is whether floor region i might see floor region j; empty if not calculated
+    vector<Scenery *> portal_blockers; // the scenery blocking visibility through each portal, or NULL
+    void findPortalBlockers();
+    bool findPVSRegions(vector<bool> *visible, size_t *n_steps, vector<size_t> *chain_regions, vector<Vector2D> *lefts, vector<Vector2D> *rights, const vector< pair<Vector2D, Vector2D> > &lines, Vector2D src_top_left, Vector2D src_bottom_right, float max_dist) const;
+
+    // paths requested by characters, calculated a few at a time by processPathRequests()
+    deque<PathRequest> priority_path_requests; // always processed, before path_requests
+    deque<PathRequest> path_requests;
+    size_t n_path_requests; // number of requests that haven't been cancelled
+    int path_request_budget_us;
+    void addPathRequest(const PathRequest &path_request, bool priority);
+    void processPathRequest(const PathRequest &path_request);
 
     string wall_image_name;
     float wall_x_scale;
@@ -614,33 +779,53 @@ protected:
 
     vector<FloorRegion *> floor_regions;
     vector<Polygon2D> boundaries;
+    SegmentGrid boundary_grid; // broadphase for the boundary segments, so intersection tests only consider nearby segments
+    int boundaries_version; // incremented whenever boundaries are added or removed
+    VisibilityPolygon visibility_polygon; // kept to reuse its storage between calls to updateVisibility()
+    vector<Vector2D> visibility_segments; // kept to reuse its storage between calls to updateVisibility()
 
     vector<Tilemap *> tilemaps;
 
     set<Character *> characters;
+    set<Character *> active_characters; // the characters that aren't dormant
+    CharacterGrid character_grid;
+    mutable vector<Character *> transient_characters; // scratch state reused by collideWithTransient() and wakeCharacters(), so neither may be called while iterating over it
     set<Item *> items;
     set<Scenery *> scenerys;
     set<Trap *> traps;
+    TriggerGrid trigger_grid;
 
     void intersectSweptSquareWithBoundarySeg(bool *hit, float *hit_dist, bool *done, bool find_earliest, Vector2D p0, Vector2D p1, Vector2D start, Vector2D du, Vector2D dv, float width, float xmin, float xmax, float ymin, float ymax) const;
     void intersectSweptSquareWithBoundaries(bool *done, bool *hit, float *hit_dist, bool find_earliest, Vector2D start, Vector2D end, Vector2D du, Vector2D dv, float width, float xmin, float xmax, float ymin, float ymax, IntersectType intersect_type, const void *ignore_one, bool flying) const;
+    bool isBoundaryIgnored(const Polygon2D *boundary, IntersectType intersect_type, const void *ignore_one, bool flying) const;
+    void buildBoundaryGrid();
 
     struct PathWayPoint {
         Vector2D origin_point;
         Vector2D point;
+        Vector2D corner_dir0, corner_dir1; // directions of the boundary edges into and out of the corner at origin_point
         void *source;
         bool active;
         bool used_for_pathfinding; // if false, we don't actually need the path way point for pathfinding, but still use it for things like flee-points and wandering monster spawn points
+        bool corner_clear; // whether no other boundary is near the corner - see isTangentAtVertex()
 
-        PathWayPoint(Vector2D origin_point, Vector2D point, void *source) : origin_point(origin_point), point(point), source(source), active(false), used_for_pathfinding(true) {
+        PathWayPoint(Vector2D origin_point, Vector2D point, Vector2D corner_dir0, Vector2D corner_dir1, void *source) : origin_point(origin_point), point(point), corner_dir0(corner_dir0), corner_dir1(corner_dir1), source(source), active(false), used_for_pathfinding(true), corner_clear(false) {
         }
     };
     vector<PathWayPoint> path_way_points;
     void calculatePathWayPoints();
     void testActivatePathWayPoint(PathWayPoint *path_way_point) const;
+    static bool isSegmentNearCorner(const PathWayPoint &path_way_point, Vector2D p0, Vector2D p1);
+    bool testCornerClear(const PathWayPoint &path_way_point) const;
+    size_t addDistanceGraphVertex(size_t way_point_index);
+    bool isTangentAtVertex(size_t vertex_index, Vector2D dir) const;
+    bool isTangentEdge(size_t vertex_A, size_t vertex_B) const;
 
     bool testVisibility(Vector2D pos, const FloorRegion *floor_region, size_t j) const;
-    bool testGraphVerticesHit(float *dist, GraphVertex *v_A, GraphVertex *v_B, const void *ignore, bool can_fly) const;
+    void calculateVisibilityPolygon(VisibilityPolygon *visibility_polygon, vector<Vector2D> *segments, Vector2D pos, Vector2D top_left, Vector2D bottom_right) const;
+    bool testGraphVerticesHit(float *dist, Vector2D A, Vector2D B, const void *ignore, bool can_fly) const;
+    friend class DistanceGraphWorker;
+    void testDistanceGraphRows(vector< vector< pair<size_t, float> > > *rows, size_t first_row, size_t row_step) const;
 
     void createBoundaryForRect(Vector2D pos, float width, float height, bool boundary_iso, float boundary_iso_ratio, void *source, int source_type);
 
@@ -743,15 +928,47 @@ public:
     size_t getNFloorRegions() const {
         return this->floor_regions.size();
     }
+    /** Finds the floor regions that a path from src to dest should pass through, from the portal
+      * graph. Returns false if the location is too small to be worth it, or there is no route.
+      */
+    bool findRegionRoute(vector<size_t> *route_regions, Vector2D src, Vector2D dest) const {
+        return this->findRegionRoute(route_regions, &this->path_search_context, &this->path_overlay, src, dest);
+    }
+    /** Calculates which pairs of floor regions could possibly see each other, by finding
+      * whether any line passes through each sequence of portals between them. Scenery is
+      * only taken into account where it blocks visibility across a whole portal, and the
+      * set is recalculated when such scenery is removed. Should be called after
+      * calculateDistanceGraph().
+      */
+    void calculatePVS();
+    bool isPVSCalculated() const {
+        return this->pvs.size() > 0;
+    }
+    bool canFloorRegionsSee(int floor_region_A, int floor_region_B) const {
+        // returns true if not known
+        if( this->pvs.size() == 0 || floor_region_A == -1 || floor_region_B == -1 ) {
+            return true;
+        }
+        return this->pvs.at(floor_region_A * floor_regions.size() + floor_region_B);
+    }
+    bool canFloorRegionsSee(Vector2D src, Vector2D dest) const {
+        // as above, for the floor regions containing src and dest
+        if( this->pvs.size() == 0 ) {
+            return true;
+        }
+        return this->canFloorRegionsSee(this->findFloorRegionIndexAt(src), this->findFloorRegionIndexAt(dest));
+    }
     void calculateSize(float *w, float *h) const;
     FloorRegion *findFloorRegionInside(Vector2D pos, float width, float height) const;
     FloorRegion *findFloorRegionAt(Vector2D pos) const;
+    int findFloorRegionIndexAt(Vector2D pos) const; // as findFloorRegionAt(), but returns the index, or -1
     vector<FloorRegion *> findFloorRegionsAt(Vector2D pos) const;
     vector<FloorRegion *> findFloorRegionsAt(Vector2D pos, float width, float height) const;
     vector<FloorRegion *> findFloorRegionsAt(const Scenery *scenery) const;
 
-    void addBoundary(Polygon2D boundary) {
-        this->boundaries.push_back(boundary);
+    void addBoundary(Polygon2D boundary);
+    int getBoundariesVersion() const {
+        return this->boundaries_version;
     }
     const Polygon2D *getBoundary(size_t i) const {
         return &this->boundaries.at(i);
@@ -777,6 +994,29 @@ public:
 
     void addCharacter(Character *character, float xpos, float ypos);
     void removeCharacter(Character *character);
+    void characterMoved(Character *character, Vector2D old_pos); // called by Character::setPos()
+    void findCharactersInRadius(vector<Character *> *result, Vector2D pos, float radius) const {
+        // n.b., result isn't in any particular order
+        this->character_grid.findCharactersInRadius(result, pos, radius);
+    }
+    void findNearestCharacters(vector<Character *> *result, Vector2D pos, float radius, size_t max_n) const {
+        // finds up to max_n (or all, if 0) characters within radius, nearest first
+        this->character_grid.findNearestCharacters(result, pos, radius, max_n);
+    }
+    /** Dormant characters are left out of the active characters, so that they aren't updated.
+      * Characters are active when added to a location.
+      */
+    void setCharacterDormant(Character *character, bool dormant);
+    void wakeCharacters(Vector2D pos, float radius);
+    set<Character *>::iterator activeCharactersBegin() {
+        return this->active_characters.begin();
+    }
+    set<Character *>::iterator activeCharactersEnd() {
+        return this->active_characters.end();
+    }
+    size_t getNActiveCharacters() const {
+        return this->active_characters.size();
+    }
     set<Character *>::iterator charactersBegin() {
         return this->characters.begin();
     }
@@ -827,6 +1067,14 @@ public:
 
     void addTrap(Trap *trap, float xpos, float ypos);
     void removeTrap(Trap *trap);
+    void findPopupScenery(vector<Scenery *> *entered, vector<Scenery *> *exited, Vector2D old_pos, Vector2D new_pos, float radius) const {
+        // finds the scenery with popup text that moving from old_pos to new_pos brings within radius (entered), or takes out of radius (exited, may be NULL)
+        this->trigger_grid.findPopupScenery(entered, exited, old_pos, new_pos, radius);
+    }
+    void findTrapsNear(vector<Trap *> *result, Vector2D pos) const {
+        // finds the traps that pos might be inside, which should then be tested with Trap::isSetOff()
+        this->trigger_grid.findTrapsNear(result, pos);
+    }
     set<Trap *>::iterator trapsBegin() {
         return this->traps.begin();
     }
@@ -847,7 +1095,7 @@ public:
 
     bool intersectSweptSquareWithBoundaries(Vector2D *hit_pos, bool find_earliest, Vector2D start, Vector2D end, float width, IntersectType intersect_type, const void *ignore_one, bool flying) const;
     Vector2D nudgeToFreeSpace(Vector2D src, Vector2D pos, float width) const;
-    bool findFleePoint(Vector2D *result, Vector2D from, Vector2D fleeing_from, bool can_fly) const;
+    bool findFleePoint(Vector2D *result, vector<Vector2D> *result_path, Vector2D from, Vector2D fleeing_from, bool can_fly) const;
     bool findFreeWayPoint(Vector2D *result, Vector2D from, bool visible, bool can_fly) const;
     bool collideWithTransient(const Character *character, Vector2D pos) const;
     bool visibilityTest(Vector2D src, Vector2D dest) const;
@@ -856,8 +1104,79 @@ public:
     const Graph *getDistanceGraph() const {
         return this->distance_graph;
     }
+    /** If set (the default), calculateDistanceGraph() only links pairs of vertices where the edge
+      * is tangent to the boundary corners at both ends, as no other edge can be part of a
+      * shortest path.
+      */
+    void setPruneDistanceGraph(bool prune_distance_graph) {
+        this->prune_distance_graph = prune_distance_graph;
+    }
+    bool isPruneDistanceGraph() const {
+        return this->prune_distance_graph;
+    }
+    /** Sets the number of threads calculateDistanceGraph() tests pairs of vertices on. If 0 (the
+      * default), this is chosen from the number of processors and the size of the graph.
+      */
+    void setDistanceGraphThreads(int distance_graph_threads) {
+        this->distance_graph_threads = distance_graph_threads;
+    }
+    int getDistanceGraphThreads() const {
+        return this->distance_graph_threads;
+    }
+    /** In locations with many floor regions, paths between different floor regions are first
+      * planned through the portals between regions, and then only the vertices in the regions on
+      * that route are searched. Such paths may be slightly longer than the shortest possible.
+      */
     vector<Vector2D> calculatePathTo(Vector2D src, Vector2D dest, const void *ignore, bool can_fly) const;
+    void setSmoothPaths(bool smooth_paths) {
+        this->smooth_paths = smooth_paths;
+    }
+    bool isSmoothPaths() const {
+        return this->smooth_paths;
+    }
+    /** Removes points from the path that can be skipped, by moving straight to a later point.
+      * As with calculatePathTo(), only the last segment of the path ignores "ignore".
+      */
+    void smoothPath(Vector2D src, vector<Vector2D> *path, const void *ignore, bool can_fly) const;
+    /** As calculatePathTo(), but using the supplied scratch state, so several paths can be
+      * calculated at once for the same Location.
+      */
+    vector<Vector2D> calculatePathTo(GraphSearchContext *context, GraphOverlay *overlay, Vector2D src, Vector2D dest, const void *ignore, bool can_fly) const;
+    /** Finds a path to the player, by reading it from a field of distances to the player that's
+      * shared between all callers, and only recalculated when the player has moved far enough.
+      * The path is approximate: it starts from the best vertex that can be walked to in src's
+      * floor region, so may be longer than calculatePathTo()'s when a vertex in another floor
+      * region (e.g., just through a doorway) would give a shorter route. Returns an empty path
+      * if the field can't be used (e.g., for flying characters, unless the player can be
+      * reached in a straight line), in which case the caller should request a path with
+      * requestPath() instead.
+      */
+    vector<Vector2D> calculatePathToPlayer(Vector2D src, Vector2D player_pos, bool can_fly) const;
     static float distanceOfPath(Vector2D src, const vector<Vector2D> &path, bool has_max_dist, float max_dist);
+    /** Queues a request for a path from the character's position to dest. The path is calculated
+      * by a later call to processPathRequests(), and passed to Character::pathRequestCompleted().
+      * Any earlier request for the same character is replaced. Priority requests (i.e., for the
+      * player) are processed before the others, and regardless of the budget.
+      */
+    void requestPath(Character *character, Vector2D dest, const void *ignore, bool priority);
+    /** As requestPath(), but for a path to a point found by findFleePoint().
+      */
+    void requestFleePath(Character *character, Vector2D fleeing_from);
+    void cancelPathRequest(const Character *character);
+    /** Processes queued path requests, until the budget of microseconds has been used up. At
+      * least one non-priority request is processed with each call, so that the queue always
+      * makes progress.
+      */
+    void processPathRequests();
+    size_t getNPathRequests() const {
+        return this->n_path_requests;
+    }
+    void setPathRequestBudget(int path_request_budget_us) {
+        this->path_request_budget_us = path_request_budget_us;
+    }
+    int getPathRequestBudget() const {
+        return this->path_request_budget_us;
+    }
 
 #if 0
     void initVisibility(Vector2D pos);
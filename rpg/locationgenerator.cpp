@@ -885,8 +885,9 @@ void LocationGenerator::exploreFromSeedXRoom(Scenery **exit_down, PlayingGamesta
                     }
                     float size_w = 0.0f, size_h = 0.0f, visual_h = 0.0f;
                     playing_gamestate->querySceneryImage(&size_w, &size_h, &visual_h, scenery_image_name, true, 1.0f, 0.0f, 0.0f, false, 0.0f);
-                    Scenery *scenery = new Scenery(scenery_name, scenery_image_name, size_w, size_h, visual_h, false, 0.0f);
-                    scenery->setInteractType(interact_type);
+                    SceneryTemplate scenery_template(scenery_name, scenery_image_name, size_w, size_h, visual_h, false, 0.0f);
+                    scenery_template.interact_type = interact_type;
+                    Scenery *scenery = new Scenery(scenery_template);
                     scenery->setInteractState(interact_state);
                     scenery->setBlocking(true, false);
                     location->addScenery(scenery, room_centre.x, room_centre.y);
@@ -917,8 +918,9 @@ void LocationGenerator::exploreFromSeedXRoom(Scenery **exit_down, PlayingGamesta
                     string scenery_image_name = "map_dungeon";
                     float size_w = 0.0f, size_h = 0.0f, visual_h = 0.0f;
                     playing_gamestate->querySceneryImage(&size_w, &size_h, &visual_h, scenery_image_name, true, 0.5f, 0.0f, 0.0f, false, 0.0f);
-                    Scenery *scenery = new Scenery("Map", scenery_image_name, size_w, size_h, visual_h, false, 0.0f);
-                    scenery->setInteractType("INTERACT_TYPE_DUNGEON_MAP");
+                    SceneryTemplate scenery_template("Map", scenery_image_name, size_w, size_h, visual_h, false, 0.0f);
+                    scenery_template.interact_type = "INTERACT_TYPE_DUNGEON_MAP";
+                    Scenery *scenery = new Scenery(scenery_template);
                     float x_pos = rollDice(1, 2, 0)==0 ? room_rect.getX() + 1.5f : room_rect.getX() + room_rect.getWidth() - 1.5f;
                     location->addScenery(scenery, x_pos, room_rect.getY() - 0.5f*scenery->getHeight() - 0.05f);
                 }
@@ -990,12 +992,11 @@ void LocationGenerator::exploreFromSeedXRoom(Scenery **exit_down, PlayingGamesta
                         else {
                             playing_gamestate->querySceneryImage(&size_w, &size_h, &visual_h, scenery_centre_image_name, true, scenery_centre_size, 0.0f, 0.0f, false, 0.0f);
                         }
-                        Scenery *scenery_centre = new Scenery(scenery_centre_name, scenery_centre_image_name, size_w, size_h, visual_h, false, 0.0f);
+                        SceneryTemplate scenery_template(scenery_centre_name, scenery_centre_image_name, size_w, size_h, visual_h, false, 0.0f);
+                        scenery_template.description = scenery_centre_description;
+                        Scenery *scenery_centre = new Scenery(scenery_template);
                         scenery_centre->setDrawType(draw_type);
                         scenery_centre->setBlocking(scenery_centre_is_blocking, scenery_centre_blocks_visibility);
-                        if( scenery_centre_description.length() > 0 ) {
-                            scenery_centre->setDescription(scenery_centre_description);
-                        }
                         Vector2D scenery_pos = room_centre;
                         location->addScenery(scenery_centre, scenery_pos.x, scenery_pos.y);
                     }
@@ -23,34 +23,86 @@ string getProfileLongString(const string &key) {
     throw string("unknown key");
 }
 
-int Profile::getIntProperty(const string &key) const {
-    map<string, int>::const_iterator iter = this->int_properties.find(key);
-    if( iter == this->int_properties.end() ) {
-        return 0;
+const string &getProfileIntKeyString(ProfileIntKey key) {
+    switch( key ) {
+    case PROFILE_KEY_FP:
+        return profile_key_FP_c;
+    case PROFILE_KEY_BS:
+        return profile_key_BS_c;
+    case PROFILE_KEY_S:
+        return profile_key_S_c;
+    case PROFILE_KEY_A:
+        return profile_key_A_c;
+    case PROFILE_KEY_M:
+        return profile_key_M_c;
+    case PROFILE_KEY_D:
+        return profile_key_D_c;
+    case PROFILE_KEY_B:
+        return profile_key_B_c;
+    default:
+        break;
     }
-    return iter->second;
+    throw string("unknown profile key index");
 }
 
-float Profile::getFloatProperty(const string &key) const {
-    map<string, float>::const_iterator iter = this->float_properties.find(key);
-    if( iter == this->float_properties.end() ) {
-        return 0;
+const string &getProfileFloatKeyString(ProfileFloatKey key) {
+    switch( key ) {
+    case PROFILE_KEY_Sp:
+        return profile_key_Sp_c;
+    default:
+        break;
+    }
+    throw string("unknown profile key index");
+}
+
+int getProfileIntKeyIndex(const string &key) {
+    for(int i=0;i<N_PROFILE_INT_KEYS;i++) {
+        if( key == getProfileIntKeyString((ProfileIntKey)i) ) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int getProfileFloatKeyIndex(const string &key) {
+    for(int i=0;i<N_PROFILE_FLOAT_KEYS;i++) {
+        if( key == getProfileFloatKeyString((ProfileFloatKey)i) ) {
+            return i;
+        }
     }
-    return iter->second;
+    return -1;
 }
 
-bool Profile::hasIntProperty(const string &key) const {
-    map<string, int>::const_iterator iter = this->int_properties.find(key);
-    if( iter == this->int_properties.end() ) {
-        return false;
+void Profile::setIntProperty(const string &key, int value) {
+    int index = getProfileIntKeyIndex(key);
+    if( index == -1 ) {
+        LOG("Profile::setIntProperty: unknown key: %s\n", key.c_str());
+        throw string("unknown profile key");
     }
-    return true;
+    this->int_properties[index] = value;
 }
 
-bool Profile::hasFloatProperty(const string &key) const {
-    map<string, float>::const_iterator iter = this->float_properties.find(key);
-    if( iter == this->float_properties.end() ) {
-        return false;
+void Profile::setFloatProperty(const string &key, float value) {
+    int index = getProfileFloatKeyIndex(key);
+    if( index == -1 ) {
+        LOG("Profile::setFloatProperty: unknown key: %s\n", key.c_str());
+        throw string("unknown profile key");
+    }
+    this->float_properties[index] = value;
+}
+
+int Profile::getIntProperty(const string &key) const {
+    int index = getProfileIntKeyIndex(key);
+    if( index == -1 ) {
+        return 0;
+    }
+    return this->int_properties[index];
+}
+
+float Profile::getFloatProperty(const string &key) const {
+    int index = getProfileFloatKeyIndex(key);
+    if( index == -1 ) {
+        return 0;
     }
-    return true;
+    return this->float_properties[index];
 }
@@ -3,9 +3,6 @@
 #include <string>
 using std::string;
 
-#include <map>
-using std::map;
-
 #include "../common.h"
 
 const string profile_key_FP_c = "FP";
@@ -17,68 +14,101 @@ const string profile_key_D_c = "D";
 const string profile_key_B_c = "B";
 const string profile_key_Sp_c = "Sp";
 
+/** Indices for the properties, so that lookups don't need to compare strings.
+  */
+enum ProfileIntKey {
+    PROFILE_KEY_FP = 0,
+    PROFILE_KEY_BS = 1,
+    PROFILE_KEY_S = 2,
+    PROFILE_KEY_A = 3,
+    PROFILE_KEY_M = 4,
+    PROFILE_KEY_D = 5,
+    PROFILE_KEY_B = 6,
+    N_PROFILE_INT_KEYS = 7
+};
+
+enum ProfileFloatKey {
+    PROFILE_KEY_Sp = 0,
+    N_PROFILE_FLOAT_KEYS = 1
+};
+
 string getProfileLongString(const string &key);
+const string &getProfileIntKeyString(ProfileIntKey key);
+const string &getProfileFloatKeyString(ProfileFloatKey key);
+int getProfileIntKeyIndex(const string &key); // returns -1 if key isn't one of the integer properties
+int getProfileFloatKeyIndex(const string &key); // returns -1 if key isn't one of the float properties
 
+/** The properties are stored in fixed arrays indexed by ProfileIntKey and ProfileFloatKey. The
+  * string keyed versions of the functions are for parsing and saving, and throw for an unknown
+  * key when setting.
+  */
 class Profile {
-    map<string, int> int_properties;
-    map<string, float> float_properties;
+    int int_properties[N_PROFILE_INT_KEYS];
+    float float_properties[N_PROFILE_FLOAT_KEYS];
 public:
 
     Profile() {
-        // create dummy profile - should call set() before reading any of the properties
+        // all properties default to 0
+        for(int i=0;i<N_PROFILE_INT_KEYS;i++) {
+            this->int_properties[i] = 0;
+        }
+        for(int i=0;i<N_PROFILE_FLOAT_KEYS;i++) {
+            this->float_properties[i] = 0.0f;
+        }
     }
     Profile(int FP, int BS, int S, int A, int M, int D, int B, float Sp) {
         this->set(FP, BS, S, A, M, D, B, Sp);
     }
 
-    void setIntProperty(const string &key, int value) {
+    void setIntProperty(ProfileIntKey key, int value) {
         this->int_properties[key] = value;
     }
-    void setFloatProperty(const string &key, float value) {
+    void setFloatProperty(ProfileFloatKey key, float value) {
         this->float_properties[key] = value;
     }
-    void addIntProperty(const string &key, int value) {
+    void addIntProperty(ProfileIntKey key, int value) {
         this->int_properties[key] += value;
     }
-    void addFloatProperty(const string &key, float value) {
+    void addFloatProperty(ProfileFloatKey key, float value) {
         this->float_properties[key] += value;
     }
-    int getIntProperty(const string &key) const;
-    float getFloatProperty(const string &key) const;
-    bool hasIntProperty(const string &key) const;
-    bool hasFloatProperty(const string &key) const;
-    map<string, int>::const_iterator intPropertiesBegin() const {
-        return this->int_properties.begin();
+    int getIntProperty(ProfileIntKey key) const {
+        return this->int_properties[key];
     }
-    map<string, int>::const_iterator intPropertiesEnd() const {
-        return this->int_properties.end();
+    float getFloatProperty(ProfileFloatKey key) const {
+        return this->float_properties[key];
     }
-    map<string, float>::const_iterator floatPropertiesBegin() const {
-        return this->float_properties.begin();
+
+    void setIntProperty(const string &key, int value);
+    void setFloatProperty(const string &key, float value);
+    int getIntProperty(const string &key) const;
+    float getFloatProperty(const string &key) const;
+    bool hasIntProperty(const string &key) const {
+        return getProfileIntKeyIndex(key) != -1;
     }
-    map<string, float>::const_iterator floatPropertiesEnd() const {
-        return this->float_properties.end();
+    bool hasFloatProperty(const string &key) const {
+        return getProfileFloatKeyIndex(key) != -1;
     }
 
     // convenient wrappers to set all properties
     void set(int FP, int BS, int S, int A, int M, int D, int B, float Sp) {
-        this->setIntProperty(profile_key_FP_c, FP);
-        this->setIntProperty(profile_key_BS_c, BS);
-        this->setIntProperty(profile_key_S_c, S);
-        this->setIntProperty(profile_key_A_c, A);
-        this->setIntProperty(profile_key_M_c, M);
-        this->setIntProperty(profile_key_D_c, D);
-        this->setIntProperty(profile_key_B_c, B);
-        this->setFloatProperty(profile_key_Sp_c, Sp);
+        this->setIntProperty(PROFILE_KEY_FP, FP);
+        this->setIntProperty(PROFILE_KEY_BS, BS);
+        this->setIntProperty(PROFILE_KEY_S, S);
+        this->setIntProperty(PROFILE_KEY_A, A);
+        this->setIntProperty(PROFILE_KEY_M, M);
+        this->setIntProperty(PROFILE_KEY_D, D);
+        this->setIntProperty(PROFILE_KEY_B, B);
+        this->setFloatProperty(PROFILE_KEY_Sp, Sp);
     }
     void add(int FP, int BS, int S, int A, int M, int D, int B, float Sp) {
-        this->addIntProperty(profile_key_FP_c, FP);
-        this->addIntProperty(profile_key_BS_c, BS);
-        this->addIntProperty(profile_key_S_c, S);
-        this->addIntProperty(profile_key_A_c, A);
-        this->addIntProperty(profile_key_M_c, M);
-        this->addIntProperty(profile_key_D_c, D);
-        this->addIntProperty(profile_key_B_c, B);
-        this->addFloatProperty(profile_key_Sp_c, Sp);
+        this->addIntProperty(PROFILE_KEY_FP, FP);
+        this->addIntProperty(PROFILE_KEY_BS, BS);
+        this->addIntProperty(PROFILE_KEY_S, S);
+        this->addIntProperty(PROFILE_KEY_A, A);
+        this->addIntProperty(PROFILE_KEY_M, M);
+        this->addIntProperty(PROFILE_KEY_D, D);
+        this->addIntProperty(PROFILE_KEY_B, B);
+        this->addFloatProperty(PROFILE_KEY_Sp, Sp);
     }
 };
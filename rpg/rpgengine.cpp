@@ -2,17 +2,17 @@
 #include "profile.h"
 #include "item.h"
 
-string RPGEngine::getAttackerProfileKey(bool is_ranged, bool is_magical) {
-    return is_ranged ? profile_key_BS_c : is_magical ? profile_key_M_c : profile_key_FP_c;
+ProfileIntKey RPGEngine::getAttackerProfileKey(bool is_ranged, bool is_magical) {
+    return is_ranged ? PROFILE_KEY_BS : is_magical ? PROFILE_KEY_M : PROFILE_KEY_FP;
 }
 
-string RPGEngine::getDefenderProfileKey(bool is_ranged, bool is_magical) {
-    return is_ranged ? profile_key_D_c : is_magical ? profile_key_M_c: profile_key_FP_c;
+ProfileIntKey RPGEngine::getDefenderProfileKey(bool is_ranged, bool is_magical) {
+    return is_ranged ? PROFILE_KEY_D : is_magical ? PROFILE_KEY_M : PROFILE_KEY_FP;
 }
 
 int RPGEngine::getDamageBonusFromHatred(const Character *attacker, const Character *defender, bool is_ranged) {
     int bonus = 0;
-    if( !is_ranged && attacker->hasSkill(skill_hatred_orcs_c) && defender->getType() == "goblinoid" ) {
+    if( !is_ranged && attacker->hasSkill(skill_hatred_orcs_c) && defender->getType() == monster_type_goblinoid_c ) {
         bonus++;
         qDebug("    extra damage from hatred of orcs");
         //playing_gamestate->addTextEffect(PlayingGamestate::tr("hatred of orcs").toStdString(), attacker->getPos(), 1000);
@@ -26,7 +26,7 @@ bool RPGEngine::combat(int &weapon_damage, bool &weapon_no_effect_magical, bool
     int d_stat = defender->getProfileIntProperty( RPGEngine::getDefenderProfileKey(is_ranged, is_magical) );
     int mod_a_stat = attacker->modifyStatForDifficulty(playing_gamestate, a_stat);
     int mod_d_stat = defender->modifyStatForDifficulty(playing_gamestate, d_stat);
-    int a_str = attacker->getProfileIntProperty(profile_key_S_c);
+    int a_str = attacker->getProfileIntProperty(PROFILE_KEY_S);
 
     bool hits = false;
     weapon_no_effect_magical = false;
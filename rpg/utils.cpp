@@ -7,6 +7,15 @@ using std::stringstream;
 #include <queue>
 using std::priority_queue;
 
+#include <algorithm>
+#include <functional>
+
+#include <deque>
+using std::deque;
+
+#include <map>
+using std::map;
+
 #ifdef _DEBUG
 #include <cassert>
 #endif
@@ -273,51 +282,488 @@ float Polygon2D::distanceFrom(Vector2D pvec) const {
     return min_dist;
 }
 
-GraphVertex *GraphVertex::getNeighbour(Graph *graph, float *distance, size_t i) const {
-    *distance = distances.at(i);
-    size_t id = neighbour_ids.at(i);
-    return graph->getVertex(id);
+const size_t min_segment_grid_compact_c = 64; // don't compact a SegmentGrid with fewer removed segments than this
+
+SegmentGrid::Segment::Segment(Vector2D p0, Vector2D p1, size_t polygon_indx, size_t point_indx) :
+    p0(p0), p1(p1), polygon_indx(polygon_indx), point_indx(point_indx), cell_x0(0), cell_y0(0), cell_x1(0), cell_y1(0), removed(false)
+{
+    top_left.set(std::min(p0.x, p1.x), std::min(p0.y, p1.y));
+    bottom_right.set(std::max(p0.x, p1.x), std::max(p0.y, p1.y));
+}
+
+void SegmentGrid::init(Vector2D top_left, Vector2D bottom_right, float min_cell_size, int max_cells_per_side) {
+    this->clear();
+    float width = bottom_right.x - top_left.x;
+    float height = bottom_right.y - top_left.y;
+    this->origin = top_left;
+    this->cell_size = std::max(min_cell_size, std::max(width, height) / (float)max_cells_per_side);
+    this->n_cells_x = std::max(1, (int)ceil(width / cell_size));
+    this->n_cells_y = std::max(1, (int)ceil(height / cell_size));
+    this->cells.resize(n_cells_x * n_cells_y);
+}
+
+void SegmentGrid::getCellRange(int *cell_x0, int *cell_y0, int *cell_x1, int *cell_y1, Vector2D top_left, Vector2D bottom_right) const {
+    *cell_x0 = (int)floor((top_left.x - origin.x) / cell_size);
+    *cell_y0 = (int)floor((top_left.y - origin.y) / cell_size);
+    *cell_x1 = (int)floor((bottom_right.x - origin.x) / cell_size);
+    *cell_y1 = (int)floor((bottom_right.y - origin.y) / cell_size);
+    // clamp to the grid
+    *cell_x0 = std::max(0, std::min(n_cells_x-1, *cell_x0));
+    *cell_y0 = std::max(0, std::min(n_cells_y-1, *cell_y0));
+    *cell_x1 = std::max(0, std::min(n_cells_x-1, *cell_x1));
+    *cell_y1 = std::max(0, std::min(n_cells_y-1, *cell_y1));
+}
+
+void SegmentGrid::addSegment(Vector2D p0, Vector2D p1, size_t polygon_indx, size_t point_indx) {
+    if( !this->isInit() ) {
+        throw string("SegmentGrid::addSegment called before init");
+    }
+    Segment segment(p0, p1, polygon_indx, point_indx);
+    // expand slightly, so that segments lying on a cell border are found from both sides
+    Vector2D top_left = segment.top_left - Vector2D(E_TOL_LINEAR, E_TOL_LINEAR);
+    Vector2D bottom_right = segment.bottom_right + Vector2D(E_TOL_LINEAR, E_TOL_LINEAR);
+    int cell_x0 = 0, cell_y0 = 0, cell_x1 = 0, cell_y1 = 0;
+    this->getCellRange(&cell_x0, &cell_y0, &cell_x1, &cell_y1, top_left, bottom_right);
+    segment.cell_x0 = cell_x0;
+    segment.cell_y0 = cell_y0;
+    segment.cell_x1 = cell_x1;
+    segment.cell_y1 = cell_y1;
+    size_t indx = segments.size();
+    segments.push_back(segment);
+    for(int cy=cell_y0;cy<=cell_y1;cy++) {
+        for(int cx=cell_x0;cx<=cell_x1;cx++) {
+            cells.at(cy*n_cells_x + cx).push_back(indx);
+        }
+    }
+}
+
+void SegmentGrid::addPolygon(const Polygon2D &polygon, size_t polygon_indx) {
+    size_t n_points = polygon.getNPoints();
+    for(size_t j=0;j<n_points;j++) {
+        Vector2D p0 = polygon.getPoint(j);
+        Vector2D p1 = polygon.getPoint((j+1) % n_points);
+        this->addSegment(p0, p1, polygon_indx, j);
+    }
+}
+
+void SegmentGrid::removePolygon(size_t polygon_indx) {
+    // n.b., removed segments are left in place, so that the indices stored in the cells stay valid
+    for(size_t i=0;i<segments.size();i++) {
+        Segment *segment = &segments[i];
+        if( segment->removed ) {
+            continue;
+        }
+        else if( segment->polygon_indx == polygon_indx ) {
+            for(int cy=segment->cell_y0;cy<=segment->cell_y1;cy++) {
+                for(int cx=segment->cell_x0;cx<=segment->cell_x1;cx++) {
+                    vector<size_t> *cell = &cells.at(cy*n_cells_x + cx);
+                    vector<size_t>::iterator iter = std::find(cell->begin(), cell->end(), i);
+                    if( iter != cell->end() ) {
+                        cell->erase(iter);
+                    }
+                }
+            }
+            segment->removed = true;
+            this->n_removed_segments++;
+        }
+        else if( segment->polygon_indx > polygon_indx ) {
+            segment->polygon_indx--;
+        }
+    }
+    // once removed segments are the majority, compact them, so that repeatedly removing and adding polygons (e.g.,
+    // doors) doesn't grow the segments for good
+    if( this->n_removed_segments > min_segment_grid_compact_c && 2*this->n_removed_segments > this->segments.size() ) {
+        this->compact();
+    }
+}
+
+void SegmentGrid::compact() {
+    // n.b., segments keep their order, so the cells stay in the same order
+    vector<size_t> new_indices(segments.size());
+    size_t n_kept = 0;
+    for(size_t i=0;i<segments.size();i++) {
+        new_indices[i] = n_kept;
+        if( !segments[i].removed ) {
+            segments[n_kept++] = segments[i];
+        }
+    }
+    segments.resize(n_kept);
+    for(vector< vector<size_t> >::iterator iter = cells.begin(); iter != cells.end(); ++iter) {
+        vector<size_t> &cell = *iter;
+        for(vector<size_t>::iterator iter2 = cell.begin(); iter2 != cell.end(); ++iter2) {
+            *iter2 = new_indices[*iter2];
+        }
+    }
+    this->n_removed_segments = 0;
+}
+
+/* Returns a value in the range [0, 4) that increases monotonically with the
+ * anti-clockwise angle of dir from the x axis; cheaper than atan2, and only
+ * the ordering matters for the sweep.
+ */
+static float pseudoAngle(Vector2D dir) {
+    float sum = fabs(dir.x) + fabs(dir.y);
+    if( sum <= E_TOL_MACHINE ) {
+        return 0.0f;
+    }
+    float t = dir.y / sum;
+    if( dir.x < 0.0f ) {
+        return 2.0f - t;
+    }
+    else if( dir.y < 0.0f ) {
+        return 4.0f + t;
+    }
+    return t;
+}
+
+static float rayDistanceToSegment(Vector2D centre, Vector2D dir, const VisibilityPolygon::Segment &segment) {
+    // returns the distance along the ray, in units of dir
+    Vector2D seg_dir = segment.p1 - segment.p0;
+    float denom = dir.getSinAngle(seg_dir);
+    if( fabs(denom) <= E_TOL_MACHINE ) {
+        // ray is parallel to the segment
+        float dir_length = dir.magnitude();
+        return std::min( (segment.p0 - centre).magnitude(), (segment.p1 - centre).magnitude() ) / dir_length;
+    }
+    float dist = (segment.p0 - centre).getSinAngle(seg_dir) / denom;
+    return std::max(dist, 0.0f);
+}
+
+static size_t findClosestSegment(float *dist, Vector2D centre, Vector2D dir, const vector<VisibilityPolygon::Segment> &segments, const vector<size_t> &open_segments) {
+    // open_segments is sorted by near_dist, so we can stop once no further segment can be closer
+    float dir_length = dir.magnitude();
+    size_t closest = 0;
+    *dist = -1.0f;
+    for(vector<size_t>::const_iterator iter = open_segments.begin(); iter != open_segments.end(); ++iter) {
+        const VisibilityPolygon::Segment &segment = segments.at(*iter);
+        if( *dist >= 0.0f && segment.near_dist > *dist * dir_length ) {
+            break;
+        }
+        float this_dist = rayDistanceToSegment(centre, dir, segment);
+        if( *dist < 0.0f || this_dist < *dist ) {
+            *dist = this_dist;
+            closest = *iter;
+        }
+    }
+    return closest;
+}
+
+static bool intersectSegmentLines(Vector2D *result, Vector2D centre, Vector2D dir0, Vector2D dir1, const VisibilityPolygon::Segment &segment_A, const VisibilityPolygon::Segment &segment_B) {
+    // finds where the segments cross, between the rays from the centre in directions dir0 and dir1
+    Vector2D dir_A = segment_A.p1 - segment_A.p0;
+    Vector2D dir_B = segment_B.p1 - segment_B.p0;
+    float denom = dir_A.getSinAngle(dir_B);
+    if( fabs(denom) <= E_TOL_MACHINE ) {
+        return false;
+    }
+    float t = (segment_B.p0 - segment_A.p0).getSinAngle(dir_B) / denom;
+    *result = segment_A.p0 + dir_A * t;
+    Vector2D diff = *result - centre;
+    return dir0.getSinAngle(diff) >= 0.0f && diff.getSinAngle(dir1) >= 0.0f;
+}
+
+void VisibilityPolygon::openSegment(size_t segment) {
+    float near_dist = sweep_segments.at(segment).near_dist;
+    vector<size_t>::iterator iter = open_segments.begin();
+    while( iter != open_segments.end() && sweep_segments.at(*iter).near_dist < near_dist ) {
+        ++iter;
+    }
+    open_segments.insert(iter, segment);
+}
+
+void VisibilityPolygon::closeSegment(size_t segment) {
+    vector<size_t>::iterator iter = std::find(open_segments.begin(), open_segments.end(), segment);
+    if( iter != open_segments.end() ) {
+        open_segments.erase(iter);
+    }
+}
+
+void VisibilityPolygon::calculate(Vector2D centre, const vector<Vector2D> &segments, Vector2D top_left, Vector2D bottom_right) {
+    // segments are stored as pairs of points, and only block from the side that perpendicularYToX() points to, as for
+    // boundaries stored anti-clockwise; so segments facing away from the centre can be ignored, as the ray must have
+    // hit another segment first
+    this->centre = centre;
+    this->points.clear();
+    this->angles.clear();
+
+    sweep_segments.clear();
+    events.clear();
+    open_segments.clear();
+    Vector2D corners[4] = {top_left, Vector2D(bottom_right.x, top_left.y), bottom_right, Vector2D(top_left.x, bottom_right.y)};
+    for(int i=0;i<4;i++) {
+        sweep_segments.push_back( Segment(corners[i], corners[(i+1) % 4]) );
+    }
+    for(size_t i=0;i+1<segments.size();i+=2) {
+        Vector2D p0 = segments.at(i);
+        Vector2D p1 = segments.at(i+1);
+        Vector2D normal = (p1 - p0).perpendicularYToX();
+        if( (centre - p0) % normal > 0.0f ) {
+            sweep_segments.push_back( Segment(p0, p1) );
+        }
+    }
+
+    for(size_t i=0;i<sweep_segments.size();i++) {
+        Segment &segment = sweep_segments.at(i);
+        Vector2D d0 = segment.p0 - centre;
+        Vector2D d1 = segment.p1 - centre;
+        float mag0 = d0.magnitude();
+        float mag1 = d1.magnitude();
+        if( mag0 <= E_TOL_MACHINE || mag1 <= E_TOL_MACHINE ) {
+            continue;
+        }
+        float sin_angle = d0.getSinAngle(d1) / (mag0 * mag1);
+        if( fabs(sin_angle) <= E_TOL_ANGULAR ) {
+            // segment lies along a ray from the centre, so doesn't block anything
+            continue;
+        }
+        if( sin_angle < 0.0f ) {
+            std::swap(segment.p0, segment.p1);
+            std::swap(d0, d1);
+        }
+        Vector2D seg_dir = segment.p1 - segment.p0;
+        float t = - ( d0 % seg_dir ) / ( seg_dir % seg_dir );
+        t = std::max(0.0f, std::min(1.0f, t));
+        segment.near_dist = ( d0 + seg_dir * t ).magnitude();
+        float angle0 = pseudoAngle(d0);
+        float angle1 = pseudoAngle(d1);
+        if( angle0 > angle1 ) {
+            // crosses the start of the sweep
+            this->openSegment(i);
+        }
+        events.push_back( Event(angle0, d0, i, true) );
+        events.push_back( Event(angle1, d1, i, false) );
+    }
+    std::sort(events.begin(), events.end());
+
+    // at each angle where segments start or end, add the closest point just before and just after that angle; between
+    // them, the closest segment only changes where segments cross
+    bool have_previous = false;
+    size_t previous_segment = 0, first_segment = 0;
+    float previous_angle = 0.0f;
+    Vector2D previous_dir, first_dir;
+    for(size_t i=0;i<events.size();) {
+        float angle = events.at(i).angle;
+        Vector2D dir = events.at(i).dir;
+        float dist_before = 0.0f, dist_after = 0.0f;
+        size_t segment_before = findClosestSegment(&dist_before, centre, dir, sweep_segments, open_segments);
+        for(;i<events.size() && events.at(i).angle == angle;i++) {
+            const Event &event = events.at(i);
+            if( event.is_start ) {
+                this->openSegment(event.segment);
+            }
+            else {
+                this->closeSegment(event.segment);
+            }
+        }
+        size_t segment_after = findClosestSegment(&dist_after, centre, dir, sweep_segments, open_segments);
+
+        Vector2D crossing;
+        if( !have_previous ) {
+            first_segment = segment_before;
+            first_dir = dir;
+        }
+        else if( segment_before != previous_segment && intersectSegmentLines(&crossing, centre, previous_dir, dir, sweep_segments.at(previous_segment), sweep_segments.at(segment_before)) ) {
+            this->points.push_back(crossing);
+            this->angles.push_back( std::max(previous_angle, std::min(angle, pseudoAngle(crossing - centre))) );
+        }
+        if( dist_before >= 0.0f ) {
+            this->points.push_back(centre + dir * dist_before);
+            this->angles.push_back(angle);
+        }
+        if( dist_after >= 0.0f && fabs(dist_after - dist_before) * dir.magnitude() > E_TOL_LINEAR ) {
+            this->points.push_back(centre + dir * dist_after);
+            this->angles.push_back(angle);
+        }
+        have_previous = true;
+        previous_segment = segment_after;
+        previous_angle = angle;
+        previous_dir = dir;
+    }
+    Vector2D crossing;
+    if( have_previous && previous_segment != first_segment && intersectSegmentLines(&crossing, centre, previous_dir, first_dir, sweep_segments.at(previous_segment), sweep_segments.at(first_segment)) ) {
+        // the crossing is between the last and first angles, which may be either side of the start of the sweep
+        float crossing_angle = pseudoAngle(crossing - centre);
+        if( crossing_angle < this->angles.front() ) {
+            this->points.insert(this->points.begin(), crossing);
+            this->angles.insert(this->angles.begin(), crossing_angle);
+        }
+        else {
+            this->points.push_back(crossing);
+            this->angles.push_back( std::max(previous_angle, crossing_angle) );
+        }
+    }
+}
+
+bool VisibilityPolygon::pointInside(Vector2D point) const {
+    size_t n_points = this->points.size();
+    if( point == this->centre ) {
+        return true;
+    }
+    else if( n_points < 3 ) {
+        return false;
+    }
+    // find the edge of the polygon that spans this angle
+    float angle = pseudoAngle(point - this->centre);
+    size_t indx = std::upper_bound(this->angles.begin(), this->angles.end(), angle) - this->angles.begin();
+    Vector2D p0 = indx == 0 ? this->points.at(n_points-1) : this->points.at(indx-1);
+    Vector2D p1 = indx == n_points ? this->points.at(0) : this->points.at(indx);
+    // the polygon is anti-clockwise about the centre, so inside points are to the left of the edge
+    Vector2D edge = p1 - p0;
+    return edge.getSinAngle(point - p0) >= 0.0f;
+}
+
+bool VisibilityPolygon::pointInside(Vector2D point, float width) const {
+    // as for a line of sight swept with the given width, also requires the points either side to be visible
+    if( !this->pointInside(point) ) {
+        return false;
+    }
+    Vector2D dir = point - this->centre;
+    float dist = dir.magnitude();
+    if( dist <= E_TOL_MACHINE ) {
+        return true;
+    }
+    Vector2D side = dir.perpendicularYToX() * (width / dist);
+    return this->pointInside(point + side) && this->pointInside(point - side);
+}
+
+void Graph::freeze() {
+    size_t n_vertices = vertices.size();
+    vector<size_t> new_offsets(n_vertices+1, 0);
+    // count the neighbours of each vertex
+    for(size_t i=0;i<n_vertices;i++) {
+        new_offsets[i+1] = i+1 < neighbour_offsets.size() ? neighbour_offsets[i+1] - neighbour_offsets[i] : 0;
+    }
+    for(vector<PendingEdge>::const_iterator iter = pending_edges.begin(); iter != pending_edges.end(); ++iter) {
+        const PendingEdge &edge = *iter;
+        if( edge.vertex_A >= n_vertices || edge.vertex_B >= n_vertices ) {
+            LOG("Graph::freeze invalid edge %d to %d, n_vertices %d\n", edge.vertex_A, edge.vertex_B, n_vertices);
+            throw string("invalid graph edge");
+        }
+        new_offsets[edge.vertex_A+1]++;
+        new_offsets[edge.vertex_B+1]++;
+    }
+    for(size_t i=0;i<n_vertices;i++) {
+        new_offsets[i+1] += new_offsets[i];
+    }
+
+    vector<unsigned int> new_ids(new_offsets[n_vertices]);
+    vector<float> new_distances(new_offsets[n_vertices]);
+    vector<size_t> fill(new_offsets.begin(), new_offsets.end()-1); // next free slot for each vertex
+    // existing neighbours first, so the order is unchanged
+    for(size_t i=0;i+1<neighbour_offsets.size();i++) {
+        for(size_t j=neighbour_offsets[i];j<neighbour_offsets[i+1];j++) {
+            new_ids[fill[i]] = neighbour_ids[j];
+            new_distances[fill[i]] = neighbour_distances[j];
+            fill[i]++;
+        }
+    }
+    for(vector<PendingEdge>::const_iterator iter = pending_edges.begin(); iter != pending_edges.end(); ++iter) {
+        const PendingEdge &edge = *iter;
+        new_ids[fill[edge.vertex_A]] = static_cast<unsigned int>(edge.vertex_B);
+        new_distances[fill[edge.vertex_A]] = edge.distance;
+        fill[edge.vertex_A]++;
+        new_ids[fill[edge.vertex_B]] = static_cast<unsigned int>(edge.vertex_A);
+        new_distances[fill[edge.vertex_B]] = edge.distance;
+        fill[edge.vertex_B]++;
+    }
+
+    neighbour_offsets.swap(new_offsets);
+    neighbour_ids.swap(new_ids);
+    neighbour_distances.swap(new_distances);
+    // release the memory, rather than just clearing
+    vector<PendingEdge>().swap(pending_edges);
+}
+
+bool Graph::hasNeighbour(size_t i, size_t neighbour_id) const {
+    // n.b., only checks the frozen adjacency
+    if( i+1 >= neighbour_offsets.size() ) {
+        return false;
+    }
+    for(size_t j=neighbour_offsets[i];j<neighbour_offsets[i+1];j++) {
+        if( neighbour_ids[j] == neighbour_id ) {
+            return true;
+        }
+    }
+    return false;
 }
 
-const GraphVertex *GraphVertex::getNeighbour(const Graph *graph, float *distance, size_t i) const {
-    *distance = distances.at(i);
-    size_t id = neighbour_ids.at(i);
-    return graph->getVertex(id);
+void GraphSearchContext::reset(size_t n_vertices) {
+    if( generations.size() < n_vertices ) {
+        // new entries have generation 0, which is never the current generation
+        generations.resize(n_vertices, 0);
+        visited.resize(n_vertices, false);
+        values.resize(n_vertices, 0.0f);
+        path_tracebacks.resize(n_vertices, 0);
+    }
+    generation++;
+    if( generation == 0 ) {
+        // wrapped around, so need to clear the stamps
+        std::fill(generations.begin(), generations.end(), 0);
+        generation = 1;
+    }
 }
 
-GraphVertex *GraphVertex::getNeighbour(Graph *graph, size_t i) const {
-    size_t id = neighbour_ids.at(i);
-    return graph->getVertex(id);
+const size_t GraphOverlay::no_edge_c;
+
+void GraphOverlay::reset(const Graph *graph) {
+    this->n_base_vertices = graph->getNVertices();
+    if( base_generations.size() < n_base_vertices ) {
+        // new entries have generation 0, which is never the current generation
+        base_generations.resize(n_base_vertices, 0);
+        base_first_edges.resize(n_base_vertices, no_edge_c);
+        allowed_generations.resize(n_base_vertices, 0);
+    }
+    generation++;
+    if( generation == 0 ) {
+        // wrapped around, so need to clear the stamps
+        std::fill(base_generations.begin(), base_generations.end(), 0);
+        std::fill(allowed_generations.begin(), allowed_generations.end(), 0);
+        generation = 1;
+    }
+    restricted = false;
+    edges.clear();
+    vertices.clear();
+    for(vector< vector<size_t> >::iterator iter = vertex_edges.begin(); iter != vertex_edges.end(); ++iter) {
+        iter->clear();
+    }
 }
 
-const GraphVertex *GraphVertex::getNeighbour(const Graph *graph, size_t i) const {
-    size_t id = neighbour_ids.at(i);
-    return graph->getVertex(id);
+size_t GraphOverlay::addVertex(Vector2D pos) {
+    vertices.push_back(pos);
+    if( vertex_edges.size() < vertices.size() ) {
+        vertex_edges.push_back(vector<size_t>());
+    }
+    return n_base_vertices + vertices.size() - 1;
 }
 
-Graph *Graph::clone() const {
-    Graph *copy = new Graph();
-    for(vector<GraphVertex>::const_iterator iter = vertices.begin(); iter != vertices.end(); ++iter) {
-        GraphVertex vertex = *iter;
-        copy->addVertex(vertex);
+void GraphOverlay::addEdge(size_t base_vertex, size_t overlay_vertex, float distance) {
+    if( base_vertex >= n_base_vertices || overlay_vertex < n_base_vertices || overlay_vertex >= n_base_vertices + vertices.size() ) {
+        LOG("GraphOverlay::addEdge invalid edge %d to %d\n", base_vertex, overlay_vertex);
+        throw string("invalid overlay edge");
     }
-    return copy;
+    size_t next = this->getFirstBaseEdge(base_vertex);
+    size_t indx = edges.size();
+    edges.push_back(OverlayEdge(base_vertex, overlay_vertex, distance, next));
+    base_generations[base_vertex] = generation;
+    base_first_edges[base_vertex] = indx;
+    vertex_edges[overlay_vertex - n_base_vertices].push_back(indx);
 }
 
 class GraphDistance {
-    GraphVertex *vertex;
+    size_t vertex;
     float distance;
 public:
     /** We need to store the distance separately, as although we update the
-      * value in vertex, priority_queue doesn't allow us to make the sorting
-      * order depend on something that can then change.
+      * value in the search context, priority_queue doesn't allow us to make the
+      * sorting order depend on something that can then change.
+      * For A*, the distance includes the heuristic estimate to the destination.
       */
-    GraphDistance(GraphVertex *vertex) : vertex(vertex), distance(vertex->getValue()) {
+    GraphDistance(size_t vertex, float distance) : vertex(vertex), distance(distance) {
     }
     float getDistance() const {
         return distance;
     }
-    GraphVertex *getVertex() const {
+    size_t getVertex() const {
         return vertex;
     }
 };
@@ -340,91 +786,151 @@ public:
     }
 };
 
-vector<GraphVertex *> Graph::shortestPath(size_t start, size_t end) {
-    //LOG("Graph::shortestPath(%d, %d)\n", start, end);
+/** Returns the position of vertex i, which may be an overlay vertex.
+  */
+static Vector2D getSearchVertexPos(const Graph *graph, const GraphOverlay *overlay, size_t i) {
+    if( overlay != NULL && i >= overlay->getNBaseVertices() ) {
+        return overlay->getVertexPos(i);
+    }
+    return graph->getVertex(i)->getPos();
+}
+
+bool Graph::search(GraphSearchContext *context, const GraphOverlay *overlay, size_t start, bool has_end, size_t end, bool use_heuristic) const {
+    //LOG("Graph::search(%d, %d)\n", start, end);
     //LOG("graph has %d vertices\n", vertices.size());
-    for(vector<GraphVertex>::iterator iter = vertices.begin(); iter != vertices.end(); ++iter) {
-        GraphVertex *vertex = &*iter;
-        vertex->initPathFinding();
+    if( !this->isFrozen() ) {
+        throw string("graph must be frozen before searching");
+    }
+    if( overlay != NULL && overlay->getNBaseVertices() != vertices.size() ) {
+        LOG("Graph::shortestPath overlay was set up for %d vertices, graph has %d\n", overlay->getNBaseVertices(), vertices.size());
+        throw string("overlay doesn't match graph");
+    }
+    size_t n_vertices = vertices.size();
+    if( overlay != NULL ) {
+        n_vertices += overlay->getNVertices();
     }
+    context->reset(n_vertices);
 
+    if( !has_end ) {
+        use_heuristic = false;
+    }
+    Vector2D end_pos = use_heuristic ? getSearchVertexPos(this, overlay, end) : Vector2D();
     priority_queue<GraphDistance, vector<GraphDistance>, DistanceComparison> queue;
-    GraphVertex *start_vertex = this->getVertex(start);
-    start_vertex->setValue(0.0f, NULL);
-    GraphDistance start_distance(start_vertex);
-    queue.push(start_distance);
+    context->setValue(start, 0.0f, start);
+    float start_estimate = use_heuristic ? (getSearchVertexPos(this, overlay, start) - end_pos).magnitude() : 0.0f;
+    queue.push(GraphDistance(start, start_estimate));
 
-    GraphVertex *end_vertex = this->getVertex(end);
     bool found_dest = false;
 
     //LOG("start algorithm\n");
     while( !queue.empty() && !found_dest ) {
         // find current cheapest
         //LOG("start loop, queue size %d\n", queue.size());
-        const GraphDistance &c_distance = queue.top();
-        GraphVertex *c_vertex = c_distance.getVertex();
+        size_t c_indx = queue.top().getVertex();
         queue.pop();
 
         // check that we've got the "cheapest" version
-        if( !c_vertex->isVisited() ) {
-            c_vertex->setVisited();
+        if( !context->isVisited(c_indx) ) {
+            context->setVisited(c_indx);
 
-            float value = c_vertex->getValue();
-            //LOG("    check vertex at %f, %f value %f %d neighbours\n", c_vertex->getPos().x, c_vertex->getPos().y, c_vertex->getValue(), c_vertex->getNNeighbours());
-            for(size_t i=0;i<c_vertex->getNNeighbours();i++) {
-                //LOG("    i = %d\n", i);
+            if( has_end && c_indx == end ) {
+                // reached destination
+                // n.b., as the heuristic is consistent (edges are Euclidean distances), the first time we visit the destination is via the shortest path
+                //LOG("reached destination\n");
+                found_dest = true;
+                break;
+            }
+
+            float value = context->getValue(c_indx);
+            // the neighbours are the base graph's edges, followed by any overlay edges
+            bool is_base = c_indx < vertices.size();
+            size_t base_offset = 0;
+            size_t n_base_neighbours = 0;
+            size_t overlay_edge = GraphOverlay::no_edge_c;
+            size_t n_overlay_neighbours = 0;
+            if( is_base ) {
+                base_offset = neighbour_offsets[c_indx];
+                n_base_neighbours = neighbour_offsets[c_indx+1] - base_offset;
+                if( overlay != NULL ) {
+                    overlay_edge = overlay->getFirstBaseEdge(c_indx);
+                }
+            }
+            else {
+                n_overlay_neighbours = overlay->getNVertexEdges(c_indx);
+            }
+            //LOG("    check vertex %d value %f %d neighbours\n", c_indx, value, n_base_neighbours);
+            for(size_t i=0;i<n_base_neighbours+n_overlay_neighbours || overlay_edge != GraphOverlay::no_edge_c;i++) {
+                size_t n_indx = 0;
                 float dist = 0.0f;
-                GraphVertex *n_vertex = c_vertex->getNeighbour(this, &dist, i);
-                //LOG("    neighbouring vertex at %f, %f value %f dist %f\n", n_vertex->getPos().x, n_vertex->getPos().y, n_vertex->getValue(), dist);
-                float n_value = value + dist;
-                bool changed = false;
-                if( n_vertex->getValue() < 0.0f || n_value < n_vertex->getValue() ) {
-                    //LOG("    shorter dist: %f\n", n_value);
-                    n_vertex->setValue(n_value, c_vertex);
-                    changed = true;
+                if( i < n_base_neighbours ) {
+                    n_indx = neighbour_ids[base_offset + i];
+                    dist = neighbour_distances[base_offset + i];
+                }
+                else if( is_base ) {
+                    const GraphOverlay::OverlayEdge &edge = overlay->getEdge(overlay_edge);
+                    n_indx = edge.overlay_vertex;
+                    dist = edge.distance;
+                    overlay_edge = edge.next;
+                }
+                else {
+                    const GraphOverlay::OverlayEdge &edge = overlay->getEdge( overlay->getVertexEdge(c_indx, i) );
+                    n_indx = edge.base_vertex;
+                    dist = edge.distance;
                 }
-                if( changed ) {
+                if( context->isVisited(n_indx) ) {
+                    continue;
+                }
+                if( overlay != NULL && n_indx < vertices.size() && !overlay->isBaseVertexAllowed(n_indx) ) {
+                    continue;
+                }
+                float n_value = value + dist;
+                float old_value = context->getValue(n_indx);
+                if( old_value < 0.0f || n_value < old_value ) {
                     // update with cheaper version
-                    //LOG("    push %d, value %f, current size: %d\n", n_vertex, n_vertex->getValue(), queue.size());
-                    GraphDistance n_distance(n_vertex);
-                    queue.push(n_distance);
-                    //LOG("    pushed ok\n");
+                    //LOG("    shorter dist: %f\n", n_value);
+                    context->setValue(n_indx, n_value, c_indx);
+                    float estimate = n_value;
+                    if( use_heuristic ) {
+                        estimate += (getSearchVertexPos(this, overlay, n_indx) - end_pos).magnitude();
+                    }
+                    queue.push(GraphDistance(n_indx, estimate));
                 }
             }
             //LOG("    done\n");
-
-            if( c_vertex == end_vertex ) {
-                // reached destination
-                //LOG("reached destination\n");
-                found_dest = true;
-            }
         }
     }
 
     //LOG("found_dest: %d\n", found_dest);
-    vector<GraphVertex *> path;
+    return found_dest;
+}
+
+vector<size_t> Graph::shortestPath(GraphSearchContext *context, const GraphOverlay *overlay, size_t start, size_t end, bool use_heuristic) const {
+    //LOG("Graph::shortestPath(%d, %d)\n", start, end);
+    bool found_dest = this->search(context, overlay, start, true, end, use_heuristic);
+    vector<size_t> path;
     if( found_dest ) {
-        // n.b., don't include start_vertex in path
-        vector<GraphVertex *> path_backwards;
-        GraphVertex *c_vertex = end_vertex;
-        while( c_vertex != start_vertex ) {
-            path_backwards.push_back(c_vertex);
-            c_vertex = c_vertex->getPathTraceback();
-            if( c_vertex == NULL ) {
+        // n.b., don't include start vertex in path
+        size_t c_indx = end;
+        while( c_indx != start ) {
+            path.push_back(c_indx);
+            size_t n_indx = context->getPathTraceback(c_indx);
+            if( n_indx == c_indx ) {
                 LOG("error tracing back path: start %d end %d\n", start, end);
                 throw string("error tracing back path");
             }
+            c_indx = n_indx;
         }
         // reverse path
-        // n.b., using const_reverse_iterator doesn't compile on Symbian for some reason?
-        for(vector<GraphVertex *>::reverse_iterator iter = path_backwards.rbegin();iter != path_backwards.rend(); ++iter) {
-            path.push_back( *iter );
-        }
+        std::reverse(path.begin(), path.end());
     }
     //LOG("    calculated shortest path, length: %d\n", path.size());
     return path;
 }
 
+void Graph::shortestDistances(GraphSearchContext *context, const GraphOverlay *overlay, size_t start) const {
+    this->search(context, overlay, start, false, 0, false);
+}
+
 // returns a "score" that's proportional to an average
 int rollScore(int X, int Y, int Z) {
     // X DY + Z
@@ -606,6 +1112,159 @@ float perlin_noise2(float vec[2]) {
     return lerp(sy, a, b);
 }
 
+class SymbolTable {
+public:
+    deque<string> strings; // a deque, so that references returned by Symbol::str() stay valid as the table grows
+    map<string, unsigned int> ids;
+
+    SymbolTable() {
+        this->strings.push_back("");
+        this->ids[""] = 0;
+    }
+};
+
+static SymbolTable &getSymbolTable() {
+    // n.b., a function static rather than a global, as Symbols are also created during static initialisation
+    static SymbolTable symbol_table;
+    return symbol_table;
+}
+
+unsigned int Symbol::intern(const string &str) {
+    SymbolTable &symbol_table = getSymbolTable();
+    map<string, unsigned int>::const_iterator iter = symbol_table.ids.find(str);
+    if( iter != symbol_table.ids.end() ) {
+        return iter->second;
+    }
+    unsigned int id = static_cast<unsigned int>(symbol_table.strings.size());
+    symbol_table.strings.push_back(str);
+    symbol_table.ids[str] = id;
+    return id;
+}
+
+const string &Symbol::str() const {
+    return getSymbolTable().strings.at(this->id);
+}
+
+const size_t small_object_granularity_c = 16; // block sizes are multiples of this, which also keeps blocks suitably aligned
+const size_t small_object_chunk_size_c = 64*1024;
+const size_t n_small_object_sizes_c = small_object_max_size_c/small_object_granularity_c;
+
+class SmallObjectPools {
+public:
+    void *free_lists[n_small_object_sizes_c]; // the first bytes of each free block point to the next free block
+    vector<char *> chunks[n_small_object_sizes_c]; // in address order, see releaseSmallObjectChunks()
+
+    SmallObjectPools() {
+        for(size_t i=0;i<n_small_object_sizes_c;i++) {
+            this->free_lists[i] = NULL;
+        }
+    }
+};
+
+static SmallObjectPools &getSmallObjectPools() {
+    // n.b., a function static for the same reason as the Symbol table
+    static SmallObjectPools small_object_pools;
+    return small_object_pools;
+}
+
+void *allocateSmallObject(size_t size) {
+    if( size == 0 ) {
+        size = 1;
+    }
+    if( size > small_object_max_size_c ) {
+        return ::operator new(size);
+    }
+    size_t index = (size - 1)/small_object_granularity_c;
+    SmallObjectPools &small_object_pools = getSmallObjectPools();
+    if( small_object_pools.free_lists[index] == NULL ) {
+        // carve a new chunk into blocks
+        size_t block_size = (index + 1)*small_object_granularity_c;
+        size_t n_blocks = small_object_chunk_size_c/block_size;
+        char *chunk = static_cast<char *>(::operator new(n_blocks*block_size));
+        vector<char *> &chunks = small_object_pools.chunks[index];
+        chunks.insert(std::upper_bound(chunks.begin(), chunks.end(), chunk, std::less<char *>()), chunk);
+        // add in reverse, so that the blocks are handed out in address order
+        for(size_t i=n_blocks;i>0;i--) {
+            void *block = chunk + (i-1)*block_size;
+            *static_cast<void **>(block) = small_object_pools.free_lists[index];
+            small_object_pools.free_lists[index] = block;
+        }
+    }
+    void *block = small_object_pools.free_lists[index];
+    small_object_pools.free_lists[index] = *static_cast<void **>(block);
+    return block;
+}
+
+void freeSmallObject(void *ptr, size_t size) {
+    if( ptr == NULL ) {
+        return;
+    }
+    if( size == 0 ) {
+        size = 1;
+    }
+    if( size > small_object_max_size_c ) {
+        ::operator delete(ptr);
+        return;
+    }
+    size_t index = (size - 1)/small_object_granularity_c;
+    SmallObjectPools &small_object_pools = getSmallObjectPools();
+    *static_cast<void **>(ptr) = small_object_pools.free_lists[index];
+    small_object_pools.free_lists[index] = ptr;
+}
+
+static size_t findSmallObjectChunk(const vector<char *> &chunks, void *block) {
+    // the chunk is the last one starting at or before the block
+    vector<char *>::const_iterator iter = std::upper_bound(chunks.begin(), chunks.end(), static_cast<char *>(block), std::less<char *>());
+    ASSERT_LOGGER( iter != chunks.begin() );
+    return (iter - chunks.begin()) - 1;
+}
+
+size_t releaseSmallObjectChunks() {
+    SmallObjectPools &small_object_pools = getSmallObjectPools();
+    size_t n_released = 0;
+    vector<size_t> n_free_blocks;
+    for(size_t index=0;index<n_small_object_sizes_c;index++) {
+        vector<char *> &chunks = small_object_pools.chunks[index];
+        if( chunks.size() == 0 ) {
+            continue;
+        }
+        size_t block_size = (index + 1)*small_object_granularity_c;
+        size_t n_blocks = small_object_chunk_size_c/block_size;
+        n_free_blocks.clear();
+        n_free_blocks.resize(chunks.size(), 0);
+        for(void *block = small_object_pools.free_lists[index]; block != NULL; block = *static_cast<void **>(block)) {
+            n_free_blocks[findSmallObjectChunk(chunks, block)]++;
+        }
+        if( std::find(n_free_blocks.begin(), n_free_blocks.end(), n_blocks) == n_free_blocks.end() ) {
+            continue;
+        }
+        // remove the blocks of the chunks being released from the free list, keeping the order of the rest
+        void **tail = &small_object_pools.free_lists[index];
+        void *block = small_object_pools.free_lists[index];
+        while( block != NULL ) {
+            void *next = *static_cast<void **>(block);
+            if( n_free_blocks[findSmallObjectChunk(chunks, block)] != n_blocks ) {
+                *tail = block;
+                tail = static_cast<void **>(block);
+            }
+            block = next;
+        }
+        *tail = NULL;
+        size_t n_kept = 0;
+        for(size_t i=0;i<chunks.size();i++) {
+            if( n_free_blocks[i] == n_blocks ) {
+                ::operator delete(chunks[i]);
+                n_released++;
+            }
+            else {
+                chunks[n_kept++] = chunks[i];
+            }
+        }
+        chunks.resize(n_kept);
+    }
+    return n_released;
+}
+
 string getDiceRollString(int X, int Y, int Z) {
     stringstream str;
     if( Z != 0 ) {
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <cstdlib> // for size_t (needed for Linux at least)
+#include <cstddef> // for ptrdiff_t
+#include <new> // for placement new
 
 #include <cmath>
 
@@ -233,9 +235,77 @@ public:
     }
 };
 
+/** Allocation for the many small objects (Characters, Items, Scenery, Traps, FloorRegions, and
+  * the points of polygons) that are created when generating or loading a location, and freed on
+  * leaving it. Each size class has a free list of blocks carved out of larger chunks, so
+  * allocating and freeing don't go to the heap; the chunks are kept for reuse by the next
+  * location, until releaseSmallObjectChunks() is called. Objects larger than
+  * small_object_max_size_c fall back to the heap. Not thread safe.
+  */
+const size_t small_object_max_size_c = 4096;
+
+void *allocateSmallObject(size_t size);
+void freeSmallObject(void *ptr, size_t size);
+/** Returns the chunks where every block is free to the heap, so that memory isn't kept at its
+  * peak after a large quest. Returns the number of chunks released.
+  */
+size_t releaseSmallObjectChunks();
+
+/** Standard allocator that takes storage from the small object pools, for containers owned by
+  * small objects.
+  */
+template<class T> class SmallObjectAllocator {
+public:
+    typedef T value_type;
+    typedef T *pointer;
+    typedef const T *const_pointer;
+    typedef T &reference;
+    typedef const T &const_reference;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+    template<class U> struct rebind {
+        typedef SmallObjectAllocator<U> other;
+    };
+
+    SmallObjectAllocator() {
+    }
+    SmallObjectAllocator(const SmallObjectAllocator &) {
+    }
+    template<class U> SmallObjectAllocator(const SmallObjectAllocator<U> &) {
+    }
+
+    pointer address(reference value) const {
+        return &value;
+    }
+    const_pointer address(const_reference value) const {
+        return &value;
+    }
+    pointer allocate(size_type n, const void * = NULL) {
+        return static_cast<pointer>(allocateSmallObject(n*sizeof(T)));
+    }
+    void deallocate(pointer ptr, size_type n) {
+        freeSmallObject(ptr, n*sizeof(T));
+    }
+    size_type max_size() const {
+        return ((size_type)-1)/sizeof(T);
+    }
+    void construct(pointer ptr, const T &value) {
+        new(ptr) T(value);
+    }
+    void destroy(pointer ptr) {
+        ptr->~T();
+    }
+    bool operator==(const SmallObjectAllocator &) const {
+        return true; // all instances share the same pools
+    }
+    bool operator!=(const SmallObjectAllocator &) const {
+        return false;
+    }
+};
+
 class Polygon2D {
 protected:
-    vector<Vector2D> points; // should be stored anti-clockwise
+    vector<Vector2D, SmallObjectAllocator<Vector2D> > points; // should be stored anti-clockwise
     Vector2D top_left;
     Vector2D bottom_right;
     int source_type;
@@ -288,91 +358,337 @@ public:
     float distanceFrom(Vector2D pvec) const;
 };
 
+/** Uniform grid of line segments, used as a broadphase for intersection
+  * queries. Each segment records which polygon (and which edge of that
+  * polygon) it came from. Segments and queries outside of the grid's extent
+  * are clamped to the border cells, so the grid remains correct (if less
+  * efficient) for geometry added outside of the initial extent.
+  */
+class SegmentGrid {
+public:
+    struct Segment {
+        Vector2D p0, p1;
+        Vector2D top_left, bottom_right;
+        size_t polygon_indx;
+        size_t point_indx;
+        int cell_x0, cell_y0; // first cell covered by this segment, used so that each segment is only returned once per query
+        int cell_x1, cell_y1; // last cell covered by this segment
+        bool removed; // removed segments are no longer in any cell, see removePolygon()
+
+        Segment(Vector2D p0, Vector2D p1, size_t polygon_indx, size_t point_indx);
+    };
+
+private:
+    vector<Segment> segments;
+    size_t n_removed_segments; // see removePolygon()
+    vector< vector<size_t> > cells; // indices into segments
+    Vector2D origin;
+    float cell_size;
+    int n_cells_x, n_cells_y;
+
+public:
+    SegmentGrid() : n_removed_segments(0), cell_size(1.0f), n_cells_x(0), n_cells_y(0) {
+    }
+
+    void init(Vector2D top_left, Vector2D bottom_right, float min_cell_size, int max_cells_per_side);
+    void clear() {
+        this->segments.clear();
+        this->n_removed_segments = 0;
+        this->cells.clear();
+        this->n_cells_x = 0;
+        this->n_cells_y = 0;
+    }
+    bool isInit() const {
+        return this->n_cells_x > 0;
+    }
+    void addSegment(Vector2D p0, Vector2D p1, size_t polygon_indx, size_t point_indx);
+    void addPolygon(const Polygon2D &polygon, size_t polygon_indx);
+    /** Removes the segments of the polygon, and decrements the polygon index of the segments of
+      * the following polygons, to match erasing the polygon from a vector. Only the cells covered
+      * by the polygon are changed, unless removed segments have built up enough to be compacted.
+      */
+    void removePolygon(size_t polygon_indx);
+    void compact();
+
+    void getCellRange(int *cell_x0, int *cell_y0, int *cell_x1, int *cell_y1, Vector2D top_left, Vector2D bottom_right) const;
+    const vector<size_t> &getCell(int cell_x, int cell_y) const {
+        return this->cells.at(cell_y*n_cells_x + cell_x);
+    }
+    const Segment &getSegment(size_t i) const {
+        return this->segments.at(i);
+    }
+    size_t getNSegments() const {
+        return this->segments.size();
+    }
+};
+
+/** The region that can be seen from a point, past a set of blocking line
+  * segments, within a bounding rectangle. This is calculated with a single
+  * angular sweep about the point, and the resultant polygon is star-shaped
+  * about that point, so testing whether a point is inside it only needs a
+  * binary search on the angle.
+  */
+class VisibilityPolygon {
+public:
+    struct Segment {
+        Vector2D p0, p1; // ordered so that the segment runs anti-clockwise about the centre
+        float near_dist; // closest distance of the segment from the centre
+
+        Segment(Vector2D p0, Vector2D p1) : p0(p0), p1(p1), near_dist(0.0f) {
+        }
+    };
+    struct Event {
+        float angle;
+        Vector2D dir;
+        size_t segment;
+        bool is_start;
+
+        Event(float angle, Vector2D dir, size_t segment, bool is_start) : angle(angle), dir(dir), segment(segment), is_start(is_start) {
+        }
+        bool operator<(const Event &that) const {
+            return this->angle < that.angle;
+        }
+    };
+
+private:
+    Vector2D centre;
+    vector<Vector2D> points; // ordered by increasing angle about the centre
+    vector<float> angles; // pseudo-angle of each point, see pseudoAngle() in utils.cpp
+
+    // scratch space for calculate(), kept to reuse its storage
+    vector<Segment> sweep_segments;
+    vector<Event> events;
+    vector<size_t> open_segments; // segments crossed by the current ray, sorted by near_dist
+
+    void openSegment(size_t segment);
+    void closeSegment(size_t segment);
+
+public:
+    VisibilityPolygon() {
+    }
+
+    void calculate(Vector2D centre, const vector<Vector2D> &segments, Vector2D top_left, Vector2D bottom_right);
+    Vector2D getCentre() const {
+        return this->centre;
+    }
+    Vector2D getPoint(size_t i) const {
+        return points.at(i);
+    }
+    size_t getNPoints() const {
+        return points.size();
+    }
+    bool pointInside(Vector2D point) const;
+    bool pointInside(Vector2D point, float width) const;
+};
+
 class Graph;
 
 class GraphVertex {
-    //vector<GraphVertex *> neighbours;
-    vector<size_t> neighbour_ids;
-    vector<float> distances;
     Vector2D pos;
     void *user_data;
 
-    // for path finding:
-    bool visited;
-    float value;
-    //size_t path_traceback_id; // the id of the neighbouring vertex that is part of the currently shortest path to this vertex
-    GraphVertex *path_traceback; // the neighbouring vertex that is part of the currently shortest path to this vertex
 public:
-    GraphVertex(Vector2D pos, void *user_data) : pos(pos), user_data(user_data), visited(false), value(0) {
+    GraphVertex(Vector2D pos, void *user_data) : pos(pos), user_data(user_data) {
     }
 
-    void addNeighbour(size_t neighbour_id, float distance) {
-        neighbour_ids.push_back(neighbour_id);
-        distances.push_back(distance);
-    }
-    size_t getNNeighbours() const {
-        return neighbour_ids.size();
-    }
-    GraphVertex *getNeighbour(Graph *graph, float *distance, size_t i) const;
-    const GraphVertex *getNeighbour(const Graph *graph, float *distance, size_t i) const;
-    GraphVertex *getNeighbour(Graph *graph, size_t i) const;
-    const GraphVertex *getNeighbour(const Graph *graph, size_t i) const;
     void *getUserData() const {
         return this->user_data;
     }
     Vector2D getPos() const {
         return this->pos;
     }
-    void initPathFinding() {
-        this->visited = false;
-        this->value = -1.0f; // -ve represents "infinity"
-        //this->path_traceback_id = 0;
-        this->path_traceback = NULL;
+};
+
+/** Scratch state for searches on a Graph, kept outside of the vertices so
+  * that searching doesn't modify the graph. Each vertex's state is stamped with
+  * the generation of the search that wrote it, so starting a new search only
+  * needs to increment the generation, rather than resetting every vertex.
+  */
+class GraphSearchContext {
+    unsigned int generation;
+    vector<unsigned int> generations; // the generation when each vertex's state was last written
+    vector<bool> visited;
+    vector<float> values;
+    vector<size_t> path_tracebacks; // the neighbouring vertex that is part of the currently shortest path to each vertex
+
+public:
+    GraphSearchContext() : generation(0) {
     }
-    float getValue() const {
-        return this->value;
+
+    void reset(size_t n_vertices);
+    float getValue(size_t i) const {
+        // -ve represents "infinity"
+        return generations[i] == generation ? values[i] : -1.0f;
     }
-    /*void setValue(float value, size_t path_traceback_id) {
-        this->value = value;
-        this->path_traceback_id = path_traceback_id;
-    }*/
-    void setValue(float value, GraphVertex *path_traceback) {
-        this->value = value;
-        this->path_traceback = path_traceback;
+    void setValue(size_t i, float value, size_t path_traceback) {
+        if( generations[i] != generation ) {
+            generations[i] = generation;
+            visited[i] = false;
+        }
+        values[i] = value;
+        path_tracebacks[i] = path_traceback;
+    }
+    size_t getPathTraceback(size_t i) const {
+        return path_tracebacks[i];
+    }
+    bool isVisited(size_t i) const {
+        return generations[i] == generation && visited[i];
+    }
+    void setVisited(size_t i) {
+        // n.b., should only be called for vertices that have a value
+        visited[i] = true;
+    }
+};
+
+/** Extra vertices and edges to search on top of a Graph for a single query, so
+  * that the Graph itself doesn't have to be copied or modified (e.g., for the
+  * start and end points of a path). Overlay vertices have indices following on
+  * from the graph's vertices. The buffers are reused between queries, so once
+  * warmed up, setting up a query doesn't allocate.
+  * Edges are only supported between overlay vertices and the graph's vertices.
+  * A query can also be restricted to a subset of the graph's vertices, by calling
+  * allowBaseVertex() for each of them.
+  */
+class GraphOverlay {
+public:
+    class OverlayEdge {
+    public:
+        size_t base_vertex;
+        size_t overlay_vertex;
+        float distance;
+        size_t next; // next edge for the same base vertex, or -1
+        OverlayEdge(size_t base_vertex, size_t overlay_vertex, float distance, size_t next) : base_vertex(base_vertex), overlay_vertex(overlay_vertex), distance(distance), next(next) {
+        }
+    };
+
+private:
+    size_t n_base_vertices;
+    unsigned int generation;
+    vector<unsigned int> base_generations; // the generation when each base vertex's first edge was last written
+    vector<size_t> base_first_edges;
+    bool restricted;
+    vector<unsigned int> allowed_generations; // the generation when each base vertex was last allowed
+    vector<OverlayEdge> edges;
+    vector<Vector2D> vertices;
+    vector< vector<size_t> > vertex_edges; // n.b., may be larger than vertices, so that the inner vectors are kept between queries
+
+public:
+    static const size_t no_edge_c = (size_t)-1;
+
+    GraphOverlay() : n_base_vertices(0), generation(0), restricted(false) {
+    }
+
+    void reset(const Graph *graph);
+    size_t addVertex(Vector2D pos);
+    void addEdge(size_t base_vertex, size_t overlay_vertex, float distance);
+    void allowBaseVertex(size_t base_vertex) {
+        restricted = true;
+        allowed_generations.at(base_vertex) = generation;
+    }
+    bool isRestricted() const {
+        return this->restricted;
+    }
+    bool isBaseVertexAllowed(size_t base_vertex) const {
+        return !restricted || allowed_generations[base_vertex] == generation;
+    }
+
+    size_t getNBaseVertices() const {
+        return this->n_base_vertices;
+    }
+    size_t getNVertices() const {
+        return this->vertices.size();
     }
-    GraphVertex *getPathTraceback() const {
-        return this->path_traceback;
+    Vector2D getVertexPos(size_t i) const {
+        return this->vertices.at(i - n_base_vertices);
     }
-    bool isVisited() const {
-        return this->visited;
+    size_t getFirstBaseEdge(size_t base_vertex) const {
+        return base_generations[base_vertex] == generation ? base_first_edges[base_vertex] : no_edge_c;
     }
-    void setVisited() {
-        this->visited = true;
+    size_t getNVertexEdges(size_t i) const {
+        return this->vertex_edges[i - n_base_vertices].size();
+    }
+    size_t getVertexEdge(size_t i, size_t j) const {
+        return this->vertex_edges[i - n_base_vertices][j];
+    }
+    const OverlayEdge &getEdge(size_t i) const {
+        return this->edges[i];
     }
 };
 
+/** The adjacency is stored in compressed sparse row form: the neighbours of
+  * vertex i are neighbour_ids[neighbour_offsets[i]] to
+  * neighbour_ids[neighbour_offsets[i+1]-1]. Edges are added to a pending list,
+  * and only become part of the adjacency when freeze() is called.
+  */
 class Graph {
+    class PendingEdge {
+    public:
+        size_t vertex_A, vertex_B;
+        float distance;
+        PendingEdge(size_t vertex_A, size_t vertex_B, float distance) : vertex_A(vertex_A), vertex_B(vertex_B), distance(distance) {
+        }
+    };
+
     vector<GraphVertex> vertices;
+    vector<size_t> neighbour_offsets;
+    vector<unsigned int> neighbour_ids;
+    vector<float> neighbour_distances;
+    vector<PendingEdge> pending_edges;
+
+    bool search(GraphSearchContext *context, const GraphOverlay *overlay, size_t start, bool has_end, size_t end, bool use_heuristic) const;
+
 public:
     Graph() {
+        neighbour_offsets.push_back(0);
     }
 
     size_t addVertex(const GraphVertex &vertex) {
         vertices.push_back(vertex);
         return (vertices.size()-1);
     }
+    /** Adds an edge in both directions between vertices A and B.
+      */
+    void addEdge(size_t vertex_A, size_t vertex_B, float distance) {
+        pending_edges.push_back(PendingEdge(vertex_A, vertex_B, distance));
+    }
+    /** Rebuilds the adjacency to include all vertices and edges added since the
+      * last call. Neighbours are kept in the order that the edges were added.
+      */
+    void freeze();
+    bool isFrozen() const {
+        return pending_edges.size() == 0 && neighbour_offsets.size() == vertices.size()+1;
+    }
     size_t getNVertices() const {
         return vertices.size();
     }
-    GraphVertex *getVertex(size_t i) {
-        return &vertices.at(i);
-    }
     const GraphVertex *getVertex(size_t i) const {
         return &vertices.at(i);
     }
-
-    Graph *clone() const;
-    vector<GraphVertex *> shortestPath(size_t start, size_t end);
+    size_t getNNeighbours(size_t i) const {
+        return neighbour_offsets.at(i+1) - neighbour_offsets.at(i);
+    }
+    size_t getNeighbourId(size_t i, size_t j) const {
+        return neighbour_ids.at(neighbour_offsets.at(i) + j);
+    }
+    float getNeighbourDistance(size_t i, size_t j) const {
+        return neighbour_distances.at(neighbour_offsets.at(i) + j);
+    }
+    bool hasNeighbour(size_t i, size_t neighbour_id) const;
+
+    /** Returns the shortest path from start to end, as a list of vertex indices (not
+      * including start). If use_heuristic is true, an A* search is done using the
+      * Euclidean distance to the end vertex; otherwise this is Dijkstra's algorithm.
+      * If overlay is non-NULL, its vertices and edges are searched as well as the
+      * graph's. The graph isn't modified, so several searches may run at once, as
+      * long as each has its own context and overlay.
+      */
+    vector<size_t> shortestPath(GraphSearchContext *context, const GraphOverlay *overlay, size_t start, size_t end, bool use_heuristic) const;
+    /** Calculates the shortest distance from start to every vertex, using Dijkstra's
+      * algorithm. Afterwards, context->getValue(i) is the distance of vertex i (-ve if
+      * it can't be reached), and context->getPathTraceback(i) is the next vertex on the
+      * shortest path from i to start.
+      */
+    void shortestDistances(GraphSearchContext *context, const GraphOverlay *overlay, size_t start) const;
 };
 
 int rollScore(int X, int Y, int Z);
@@ -393,3 +709,41 @@ string numberToString(T number) {
 }
 
 string getDiceRollString(int X, int Y, int Z);
+
+/** An interned string. Each distinct string is stored once in a global table, and a Symbol
+  * only holds its index, so that copies and comparisons don't touch the characters. The
+  * empty string always has id 0. Ordering is by id, not alphabetical.
+  */
+class Symbol {
+    unsigned int id;
+
+    static unsigned int intern(const string &str);
+public:
+    Symbol() : id(0) {
+    }
+    explicit Symbol(const string &str) : id(intern(str)) {
+    }
+    explicit Symbol(const char *str) : id(intern(str)) {
+    }
+
+    const string &str() const;
+    const char *c_str() const {
+        return this->str().c_str();
+    }
+    unsigned int getId() const {
+        return this->id;
+    }
+    bool empty() const {
+        return this->id == 0;
+    }
+    bool operator==(const Symbol &symbol) const {
+        return this->id == symbol.id;
+    }
+    bool operator!=(const Symbol &symbol) const {
+        return this->id != symbol.id;
+    }
+    bool operator<(const Symbol &symbol) const {
+        return this->id < symbol.id;
+    }
+};
+
@@ -90,6 +90,28 @@ int Test::test_expected_n_info_dialog = 0;
   TEST_LOADSAVEWRITEQUEST_2_NPC_GLENTHOR - test for 3rd quest: interact with Glenthor
   TEST_LOADSAVEWRITEQUEST_2_ITEMS - test for 3rd quest: check attributes for various items
   TEST_LOADSAVEWRITEQUEST_2_FIRE_ANT_n - test for 3rd quest: test fire ant exploding when killed: 0 - player is unharmed; 1 - player is harmed; 2 - player is killed
+  TEST_PATHFINDING_7 - find a path in a location with many floor regions, both along the shortest route through the floor regions, and where that route is blocked by scenery
+  TEST_PATHFINDING_8 - queue path requests for several NPCs and the player, and check they are processed in order, with the player first, and that cancelled requests (including by setting a path directly) aren't processed
+  TEST_PATHFINDING_9 - check that pruning the distance graph to edges tangent at their corners removes edges, without changing the paths found
+  TEST_VISIBILITY_0 - check which floor regions become visible from positions in a location where one room is around a corner
+  TEST_VISIBILITY_1 - check the potentially visible set of floor regions, including when scenery blocking a passageway is removed
+  TEST_VISIBILITY_2 - check that an NPC's cached fog of war result is only invalidated by the NPC or player moving, or boundaries changing; and with a PVS, is kept while they stay in floor regions that can't see each other
+  TEST_CHARACTERGRID_0 - check collisions and searches for nearby characters, as characters move and are removed from a location
+  TEST_DORMANT_0 - check that dormant characters are left out of the active characters, and are woken by noise, damage, or being removed from a location
+  TEST_STATSCACHE_0 - check that a character's cached profile properties are updated for items, disease and skills
+  TEST_PROFILE_0 - check that profile properties set by string key can be read by index, and vice versa
+  TEST_SYMBOL_0 - check that interned strings compare equal iff their strings are equal
+  TEST_SCENERYTEMPLATE_0 - check that scenery with the same values shares a template, and that setting a value only affects that scenery
+  TEST_ITEMTEMPLATE_0 - check that cloned items share a template, and that modifying a clone doesn't affect the original
+  TEST_SMALLOBJECTPOOL_0 - check that the small object pools hand out distinct aligned blocks, reuse freed blocks, and release chunks that are entirely free
+  TEST_CHARACTERHANDLE_0 - check that handles to a deleted character return NULL, even once its slot is reused
+  TEST_TRIGGERGRID_0 - check that only nearby scenery popup text and traps are found as a character moves, including after they are removed
+  TEST_PATHFINDING_10 - check that the distance graph is the same whether calculated on one thread or several
+  TEST_PATHFINDING_11 - check paths to the player read from the shared field of distances, from NPCs in several floor regions, and that flying NPCs are left to request a path
+  TEST_AI_0 - check that NPCs' first think is staggered, NPCs far from the player think less often, and that once the AI budget is used up, the player still thinks, and the remaining NPCs think on later frames
+  TEST_SEGMENTGRID_0 - check that removing a polygon from a segment grid removes its segments from the cells, shifts the indices of the following polygons, and that removed segments are compacted
+  TEST_CHARACTERACTION_0 - check that expired character actions are reused, and that clearing the view detaches the graphics of actions in progress
+  TEST_PERF_LOCATION_0 - performance test for creating and deleting a location with many characters, items and scenery
   */
 
 Item *Test::checkFindSingleItem(Scenery **scenery_owner, Character **character_owner, PlayingGamestate *playing_gamestate, Location *location, const string &item_name, bool owned_by_scenery, bool owned_by_npc, bool owned_by_player, bool allow_multiple) {
@@ -1077,6 +1099,1045 @@ void Test::runTest(const string &filename, int test_id) {
                 throw string("Unexpected end of path");
             }
         }
+        else if( test_id == TEST_PATHFINDING_7 ) {
+            // first with the route through the floor regions clear, so the search restricted to those regions succeeds; then with it blocked
+            for(int blocked=0;blocked<2;blocked++) {
+                Location location("");
+
+                // two rows of rooms joined by passageways, with the rows joined at each end
+                for(int y=0;y<2;y++) {
+                    for(int x=0;x<9;x++) {
+                        FloorRegion *floor_region = FloorRegion::createRectangle(x*10.0f, y*10.0f, 5.0f, 5.0f);
+                        location.addFloorRegion(floor_region);
+                        if( x < 8 ) {
+                            floor_region = FloorRegion::createRectangle(x*10.0f + 5.0f, y*10.0f + 2.0f, 5.0f, 1.0f);
+                            location.addFloorRegion(floor_region);
+                        }
+                    }
+                }
+                FloorRegion *floor_region = FloorRegion::createRectangle(2.0f, 5.0f, 1.0f, 5.0f);
+                location.addFloorRegion(floor_region);
+                floor_region = FloorRegion::createRectangle(82.0f, 5.0f, 1.0f, 5.0f);
+                location.addFloorRegion(floor_region);
+
+                if( blocked ) {
+                    // block the first row
+                    Scenery *scenery = new Scenery("", "", 1.0f, 1.0f, 1.0f, false, 0.0f);
+                    scenery->setBlocking(true, true);
+                    location.addScenery(scenery, 45.0f, 2.5f);
+                }
+
+                location.createBoundariesForRegions();
+                location.createBoundariesForScenery();
+                location.createBoundariesForFixedNPCs();
+                location.addSceneryToFloorRegions();
+                location.calculateDistanceGraph();
+
+                Vector2D src(1.0f, 1.0f);
+                Vector2D dest(83.0f, 1.0f);
+                vector<size_t> route_regions;
+                if( !location.findRegionRoute(&route_regions, src, dest) ) {
+                    throw string("Failed to find route through floor regions");
+                }
+                vector<Vector2D> path = location.calculatePathTo(src, dest, NULL, false);
+
+                LOG("path has %d points\n", path.size());
+                bool used_second_row = false;
+                bool left_route = false;
+                for(size_t i=0;i<path.size();i++) {
+                    Vector2D point = path.at(i);
+                    LOG("    %d : %f, %f\n", i, point.x, point.y);
+                    if( point.y > 10.0f ) {
+                        used_second_row = true;
+                    }
+                    // also check points along the way, as the path is smoothed
+                    Vector2D prev_point = i == 0 ? src : path.at(i-1);
+                    for(int j=1;j<=8;j++) {
+                        Vector2D test_point = prev_point + (point - prev_point) * (j/8.0f);
+                        bool in_route = false;
+                        for(vector<size_t>::const_iterator iter = route_regions.begin(); iter != route_regions.end() && !in_route; ++iter) {
+                            if( location.getFloorRegion(*iter)->pointInside(test_point) ) {
+                                in_route = true;
+                            }
+                        }
+                        if( !in_route ) {
+                            left_route = true;
+                        }
+                    }
+                }
+
+                if( path.size() == 0 ) {
+                    throw string("Failed to find path");
+                }
+                else if( path.at( path.size()-1 ) != dest ) {
+                    throw string("Unexpected end of path");
+                }
+                else if( !blocked && ( used_second_row || left_route ) ) {
+                    throw string("Path didn't stay within the route through the floor regions");
+                }
+                else if( blocked && !used_second_row ) {
+                    throw string("Path didn't go around the blocked row");
+                }
+            }
+        }
+        else if( test_id == TEST_PATHFINDING_8 ) {
+            Location location("");
+
+            FloorRegion *floor_region = FloorRegion::createRectangle(0.0f, 0.0f, 5.0f, 5.0f);
+            location.addFloorRegion(floor_region);
+            floor_region = FloorRegion::createRectangle(10.0f, 1.0f, 4.0f, 3.0f);
+            location.addFloorRegion(floor_region);
+            floor_region = FloorRegion::createRectangle(5.0f, 3.0f, 5.0f, 1.0f);
+            location.addFloorRegion(floor_region);
+
+            location.createBoundariesForRegions();
+            location.createBoundariesForScenery();
+            location.createBoundariesForFixedNPCs();
+            location.addSceneryToFloorRegions();
+            location.calculateDistanceGraph();
+
+            vector<Character *> npcs;
+            for(int i=0;i<4;i++) {
+                Character *npc = new Character("NPC", "", true);
+                location.addCharacter(npc, 1.0f + i, 1.0f);
+                npcs.push_back(npc);
+            }
+            Character *player = new Character("Player", "", false);
+            location.addCharacter(player, 2.5f, 4.0f);
+
+            Vector2D dest(13.0f, 2.0f);
+            for(size_t i=0;i<npcs.size();i++) {
+                npcs.at(i)->setDestination(dest.x, dest.y, NULL);
+            }
+            player->setDestination(dest.x, dest.y, NULL);
+            // a second request for the same character replaces the first
+            npcs.at(0)->setDestination(dest.x, dest.y, NULL);
+            if( location.getNPathRequests() != 5 ) {
+                throw string("Unexpected number of path requests");
+            }
+            else if( player->hasPath() || npcs.at(0)->hasPath() ) {
+                throw string("Path calculated before processing requests");
+            }
+
+            // with no budget, only the player and the first NPC should be processed
+            location.setPathRequestBudget(0);
+            location.processPathRequests();
+            if( !player->hasPath() || player->hasPathRequest() ) {
+                throw string("Player path request not processed");
+            }
+            else if( !npcs.at(0)->hasPath() || npcs.at(1)->hasPath() ) {
+                throw string("Unexpected NPC path requests processed");
+            }
+            else if( location.getNPathRequests() != 3 ) {
+                throw string("Unexpected number of remaining path requests");
+            }
+
+            npcs.at(1)->setStateIdle();
+            if( npcs.at(1)->hasPathRequest() || location.getNPathRequests() != 2 ) {
+                throw string("Path request not cancelled");
+            }
+
+            // setting a path directly (as when chasing the player) replaces the queued request
+            Vector2D chase_dest(4.0f, 3.0f);
+            vector<Vector2D> chase_path;
+            chase_path.push_back(chase_dest);
+            npcs.at(2)->setPath(chase_path);
+            if( npcs.at(2)->hasPathRequest() || location.getNPathRequests() != 1 ) {
+                throw string("Path request not cancelled by setting a path");
+            }
+
+            location.setPathRequestBudget(1000000);
+            location.processPathRequests();
+            if( location.getNPathRequests() != 0 ) {
+                throw string("Path requests not all processed");
+            }
+            else if( npcs.at(1)->hasPath() ) {
+                throw string("Cancelled path request was processed");
+            }
+            else if( !npcs.at(2)->hasPath() || npcs.at(2)->getDestination() != chase_dest ) {
+                throw string("Path was replaced by a stale path request");
+            }
+            for(size_t i=3;i<npcs.size();i++) {
+                if( !npcs.at(i)->hasPath() || npcs.at(i)->getDestination() != dest ) {
+                    throw string("NPC path request not processed");
+                }
+            }
+        }
+        else if( test_id == TEST_PATHFINDING_9 ) {
+            Location location("");
+
+            // a row of rooms joined by passageways, each room with some scenery
+            for(int x=0;x<6;x++) {
+                FloorRegion *floor_region = FloorRegion::createRectangle(x*10.0f, 0.0f, 5.0f, 5.0f);
+                location.addFloorRegion(floor_region);
+                if( x < 5 ) {
+                    floor_region = FloorRegion::createRectangle(x*10.0f + 5.0f, 2.0f, 5.0f, 1.0f);
+                    location.addFloorRegion(floor_region);
+                }
+                Scenery *scenery = new Scenery("", "", 0.5f, 0.5f, 0.5f, false, 0.0f);
+                scenery->setBlocking(true, true);
+                location.addScenery(scenery, x*10.0f + 1.5f + (x%3)*0.5f, 3.5f);
+            }
+
+            location.createBoundariesForRegions();
+            location.createBoundariesForScenery();
+            location.createBoundariesForFixedNPCs();
+            location.addSceneryToFloorRegions();
+
+            vector<Vector2D> points;
+            for(int x=0;x<6;x++) {
+                points.push_back(Vector2D(x*10.0f + 1.0f, 1.0f));
+                points.push_back(Vector2D(x*10.0f + 4.0f, 4.5f));
+            }
+
+            size_t n_edges[2] = {0, 0};
+            vector<float> dists[2];
+            for(int pass=0;pass<2;pass++) {
+                location.setPruneDistanceGraph(pass == 1);
+                location.calculateDistanceGraph();
+                const Graph *graph = location.getDistanceGraph();
+                for(size_t i=0;i<graph->getNVertices();i++) {
+                    n_edges[pass] += graph->getNNeighbours(i);
+                }
+                for(size_t i=0;i<points.size();i++) {
+                    for(size_t j=0;j<points.size();j++) {
+                        if( i == j ) {
+                            continue;
+                        }
+                        vector<Vector2D> path = location.calculatePathTo(points.at(i), points.at(j), NULL, false);
+                        if( path.size() == 0 ) {
+                            throw string("Failed to find path");
+                        }
+                        dists[pass].push_back( Location::distanceOfPath(points.at(i), path, false, 0.0f) );
+                    }
+                }
+            }
+
+            LOG("graph edges: %d unpruned, %d pruned\n", n_edges[0], n_edges[1]);
+            if( n_edges[1] >= n_edges[0] ) {
+                throw string("Distance graph wasn't pruned");
+            }
+            for(size_t i=0;i<dists[0].size();i++) {
+                if( fabs(dists[0].at(i) - dists[1].at(i)) > E_TOL_LINEAR ) {
+                    LOG("path %d: %f vs %f\n", i, dists[0].at(i), dists[1].at(i));
+                    throw string("Pruned path has different length");
+                }
+            }
+        }
+        else if( test_id == TEST_VISIBILITY_0 ) {
+            Location location("");
+
+            FloorRegion *floor_region_A = FloorRegion::createRectangle(0.0f, 0.0f, 5.0f, 5.0f);
+            location.addFloorRegion(floor_region_A);
+            FloorRegion *floor_region_B = FloorRegion::createRectangle(10.0f, 1.0f, 4.0f, 3.0f);
+            location.addFloorRegion(floor_region_B);
+            FloorRegion *floor_region_C = FloorRegion::createRectangle(5.0f, 3.0f, 5.0f, 1.0f);
+            location.addFloorRegion(floor_region_C);
+
+            location.createBoundariesForRegions();
+            location.createBoundariesForScenery();
+            location.createBoundariesForFixedNPCs();
+            location.addSceneryToFloorRegions();
+            location.calculateDistanceGraph();
+
+            // the passageway can be seen from the first room, but not the room at its far end
+            location.clearVisibility();
+            vector<FloorRegion *> floor_regions = location.updateVisibility(Vector2D(1.0f, 1.0f));
+            if( floor_regions.size() != 2 ) {
+                throw string("Unexpected number of visible floor regions: " + numberToString(floor_regions.size()));
+            }
+            else if( !floor_region_A->isVisible() || floor_region_B->isVisible() || !floor_region_C->isVisible() ) {
+                throw string("Unexpected floor regions visible from first room");
+            }
+
+            // only the newly visible floor region should be returned
+            floor_regions = location.updateVisibility(Vector2D(7.0f, 3.5f));
+            if( floor_regions.size() != 1 || floor_regions.at(0) != floor_region_B ) {
+                throw string("Expected only the second room to become visible");
+            }
+        }
+        else if( test_id == TEST_VISIBILITY_1 ) {
+            Location location("");
+
+            // room A, passageway to room B, then a passageway turning a corner to room D
+            location.addFloorRegion(FloorRegion::createRectangle(0.0f, 0.0f, 5.0f, 5.0f));
+            location.addFloorRegion(FloorRegion::createRectangle(5.0f, 2.0f, 5.0f, 1.0f));
+            location.addFloorRegion(FloorRegion::createRectangle(10.0f, 0.0f, 5.0f, 5.0f));
+            location.addFloorRegion(FloorRegion::createRectangle(12.0f, 5.0f, 1.0f, 5.0f));
+            location.addFloorRegion(FloorRegion::createRectangle(10.0f, 10.0f, 5.0f, 5.0f));
+            const int room_A = 0, passageway_AB = 1, room_B = 2, passageway_BD = 3, room_D = 4;
+
+            // scenery filling the first passageway
+            Scenery *scenery = new Scenery("", "", 5.0f, 1.0f, 1.0f, false, 0.0f);
+            scenery->setBlocking(true, true);
+            location.addScenery(scenery, 7.5f, 2.5f);
+
+            location.createBoundariesForRegions();
+            location.createBoundariesForScenery();
+            location.createBoundariesForFixedNPCs();
+            location.addSceneryToFloorRegions();
+            location.calculateDistanceGraph();
+            location.calculatePVS();
+
+            if( !location.isPVSCalculated() ) {
+                throw string("PVS not calculated");
+            }
+            else if( location.canFloorRegionsSee(room_A, passageway_AB) || location.canFloorRegionsSee(room_A, room_B) ) {
+                throw string("first room shouldn't see past the blocked passageway");
+            }
+            else if( !location.canFloorRegionsSee(room_B, room_D) || !location.canFloorRegionsSee(room_D, room_B) ) {
+                throw string("second room should see the third room");
+            }
+
+            location.removeScenery(scenery);
+            delete scenery;
+
+            if( !location.isPVSCalculated() ) {
+                throw string("PVS not recalculated");
+            }
+            else if( !location.canFloorRegionsSee(room_A, passageway_AB) || !location.canFloorRegionsSee(room_A, room_B) || !location.canFloorRegionsSee(room_B, room_A) ) {
+                throw string("first room should now see the second room");
+            }
+            else if( location.canFloorRegionsSee(room_A, passageway_BD) || location.canFloorRegionsSee(room_A, room_D) ) {
+                throw string("first room shouldn't see around the corner");
+            }
+
+            // the PVS rules out the room around the corner without needing any line of sight tests
+            location.clearVisibility();
+            vector<FloorRegion *> floor_regions = location.updateVisibility(Vector2D(2.0f, 2.2f));
+            if( floor_regions.size() != 3 ) {
+                throw string("Unexpected number of visible floor regions: " + numberToString(floor_regions.size()));
+            }
+            else if( location.visibilityTest(Vector2D(9.0f, 2.5f), Vector2D(12.5f, 8.0f)) ) {
+                throw string("passageway around the corner shouldn't be visible");
+            }
+            else if( !location.visibilityTest(Vector2D(4.0f, 2.5f), Vector2D(12.0f, 2.5f)) ) {
+                throw string("second room should be visible through the passageway");
+            }
+        }
+        else if( test_id == TEST_VISIBILITY_2 ) {
+            Location location("");
+            location.addFloorRegion(FloorRegion::createRectangle(0.0f, 0.0f, 10.0f, 5.0f));
+
+            Scenery *scenery = new Scenery("", "", 1.0f, 1.0f, 1.0f, false, 0.0f);
+            scenery->setBlocking(true, true);
+            location.addScenery(scenery, 5.0f, 2.5f);
+
+            location.createBoundariesForRegions();
+            location.createBoundariesForScenery();
+            location.createBoundariesForFixedNPCs();
+            location.addSceneryToFloorRegions();
+            location.calculateDistanceGraph();
+
+            Character *npc = new Character("NPC", "", true);
+            location.addCharacter(npc, 8.0f, 2.5f);
+            Vector2D player_pos(2.0f, 2.5f);
+
+            if( npc->isVisibilityCacheValid(player_pos, 0, location.getBoundariesVersion()) ) {
+                throw string("visibility cache shouldn't be valid before it's set");
+            }
+            npc->setVisible( location.visibilityTest(player_pos, npc->getPos()) );
+            npc->setVisibilityCache(player_pos, 0, 0, location.getBoundariesVersion());
+            if( npc->isVisible() ) {
+                throw string("NPC shouldn't be visible behind scenery");
+            }
+            else if( !npc->isVisibilityCacheValid(player_pos + Vector2D(0.5f*fog_of_war_update_dist_c, 0.0f), 0, location.getBoundariesVersion()) ) {
+                throw string("visibility cache should still be valid for small movements");
+            }
+            else if( npc->isVisibilityCacheValid(player_pos + Vector2D(0.0f, 2.0f*fog_of_war_update_dist_c), 0, location.getBoundariesVersion()) ) {
+                throw string("visibility cache should be invalid when the player moves");
+            }
+
+            npc->setPos(8.0f, 2.5f + 2.0f*fog_of_war_update_dist_c);
+            if( npc->isVisibilityCacheValid(player_pos, 0, location.getBoundariesVersion()) ) {
+                throw string("visibility cache should be invalid when the NPC moves");
+            }
+            npc->setVisibilityCache(player_pos, 0, 0, location.getBoundariesVersion());
+
+            location.removeScenery(scenery);
+            delete scenery;
+            if( npc->isVisibilityCacheValid(player_pos, 0, location.getBoundariesVersion()) ) {
+                throw string("visibility cache should be invalid when boundaries change");
+            }
+            else if( !location.visibilityTest(player_pos, npc->getPos()) ) {
+                throw string("NPC should be visible once scenery is removed");
+            }
+
+            {
+                // with a PVS, an NPC in a floor region the player can't see into stays hidden until one of them changes floor region
+                Location pvs_location("");
+                pvs_location.addFloorRegion(FloorRegion::createRectangle(0.0f, 0.0f, 5.0f, 5.0f));
+                pvs_location.addFloorRegion(FloorRegion::createRectangle(5.0f, 2.0f, 5.0f, 1.0f));
+                pvs_location.addFloorRegion(FloorRegion::createRectangle(10.0f, 0.0f, 5.0f, 5.0f));
+                pvs_location.addFloorRegion(FloorRegion::createRectangle(12.0f, 5.0f, 1.0f, 5.0f));
+                pvs_location.addFloorRegion(FloorRegion::createRectangle(10.0f, 10.0f, 5.0f, 5.0f));
+                const int room_A = 0, room_B = 2, room_D = 4;
+
+                pvs_location.createBoundariesForRegions();
+                pvs_location.createBoundariesForScenery();
+                pvs_location.createBoundariesForFixedNPCs();
+                pvs_location.addSceneryToFloorRegions();
+                pvs_location.calculateDistanceGraph();
+                pvs_location.calculatePVS();
+
+                Character *pvs_npc = new Character("NPC", "", true);
+                pvs_location.addCharacter(pvs_npc, 12.5f, 12.5f);
+                Vector2D pvs_player_pos(2.0f, 2.5f);
+                if( pvs_location.findFloorRegionIndexAt(pvs_player_pos) != room_A || pvs_location.findFloorRegionIndexAt(pvs_npc->getPos()) != room_D ) {
+                    throw string("unexpected floor regions");
+                }
+                else if( pvs_location.canFloorRegionsSee(room_A, room_D) ) {
+                    throw string("first room shouldn't see around the corner");
+                }
+                pvs_npc->setVisible(false);
+                pvs_npc->setVisibilityCache(pvs_player_pos, room_D, room_A, pvs_location.getBoundariesVersion());
+                pvs_npc->setPos(11.0f, 13.0f);
+                if( !pvs_npc->isVisibilityCacheValid(Vector2D(4.0f, 1.0f), room_A, pvs_location.getBoundariesVersion()) ) {
+                    throw string("visibility cache should be valid while staying in floor regions that can't see each other");
+                }
+                else if( pvs_npc->isVisibilityCacheValid(Vector2D(12.0f, 2.5f), room_B, pvs_location.getBoundariesVersion()) ) {
+                    throw string("visibility cache should be invalid when the player changes floor region");
+                }
+                pvs_npc->setPos(12.5f, 7.5f);
+                if( pvs_npc->isVisibilityCacheValid(Vector2D(4.0f, 1.0f), room_A, pvs_location.getBoundariesVersion()) ) {
+                    throw string("visibility cache should be invalid when the NPC changes floor region");
+                }
+                pvs_npc->setPos(12.5f, 12.5f);
+                pvs_npc->setVisible(true);
+                if( pvs_npc->isVisibilityCacheValid(Vector2D(4.0f, 1.0f), room_A, pvs_location.getBoundariesVersion()) ) {
+                    throw string("visibility cache should only be kept by the PVS for NPCs that aren't visible");
+                }
+            }
+        }
+        else if( test_id == TEST_CHARACTERGRID_0 ) {
+            Location location("");
+            location.addFloorRegion(FloorRegion::createRectangle(0.0f, 0.0f, 20.0f, 20.0f));
+
+            vector<Character *> npcs;
+            for(int i=0;i<10;i++) {
+                Character *npc = new Character("NPC", "", true);
+                location.addCharacter(npc, 1.0f + 1.5f*i, 5.0f);
+                npcs.push_back(npc);
+            }
+
+            if( !location.collideWithTransient(NULL, Vector2D(4.2f, 5.2f)) ) {
+                throw string("expected collision with NPC");
+            }
+            else if( location.collideWithTransient(npcs.at(2), Vector2D(4.2f, 5.2f)) ) {
+                throw string("NPC shouldn't collide with itself");
+            }
+            else if( location.collideWithTransient(NULL, Vector2D(4.2f, 6.0f)) ) {
+                throw string("unexpected collision");
+            }
+
+            vector<Character *> result;
+            location.findCharactersInRadius(&result, Vector2D(7.0f, 5.0f), 1.6f);
+            if( result.size() != 3 ) {
+                throw string("unexpected number of characters in radius: " + numberToString(result.size()));
+            }
+            location.findNearestCharacters(&result, Vector2D(6.9f, 5.0f), 100.0f, 3);
+            if( result.size() != 3 || result.at(0) != npcs.at(4) || result.at(1) != npcs.at(3) || result.at(2) != npcs.at(5) ) {
+                throw string("unexpected nearest characters");
+            }
+
+            // moving a character updates the cell it's in
+            npcs.at(0)->setPos(15.0f, 15.0f);
+            if( location.collideWithTransient(NULL, Vector2D(1.0f, 5.0f)) ) {
+                throw string("unexpected collision with moved NPC");
+            }
+            else if( !location.collideWithTransient(NULL, Vector2D(15.3f, 15.0f)) ) {
+                throw string("expected collision with moved NPC");
+            }
+            location.findNearestCharacters(&result, Vector2D(14.0f, 14.0f), 100.0f, 1);
+            if( result.size() != 1 || result.at(0) != npcs.at(0) ) {
+                throw string("expected moved NPC to be nearest");
+            }
+
+            location.removeCharacter(npcs.at(0));
+            location.findCharactersInRadius(&result, Vector2D(15.0f, 15.0f), 1.0f);
+            if( result.size() != 0 ) {
+                throw string("removed NPC still found");
+            }
+            location.findNearestCharacters(&result, Vector2D(0.0f, 0.0f), 100.0f, 0);
+            if( result.size() != npcs.size()-1 ) {
+                throw string("unexpected number of characters: " + numberToString(result.size()));
+            }
+            delete npcs.at(0);
+        }
+        else if( test_id == TEST_DORMANT_0 ) {
+            Location location("");
+            location.addFloorRegion(FloorRegion::createRectangle(0.0f, 0.0f, 50.0f, 10.0f));
+
+            vector<Character *> npcs;
+            for(int i=0;i<5;i++) {
+                Character *npc = new Character("NPC", "", true);
+                npc->initialiseHealth(10);
+                location.addCharacter(npc, 5.0f + 10.0f*i, 5.0f);
+                npcs.push_back(npc);
+                location.setCharacterDormant(npc, true);
+            }
+            if( location.getNActiveCharacters() != 0 ) {
+                throw string("unexpected number of active characters: " + numberToString(location.getNActiveCharacters()));
+            }
+            else if( location.getNCharacters() != npcs.size() ) {
+                throw string("unexpected number of characters: " + numberToString(location.getNCharacters()));
+            }
+
+            // noise only wakes characters within the radius
+            location.wakeCharacters(Vector2D(20.0f, 5.0f), 12.0f);
+            if( location.getNActiveCharacters() != 2 ) {
+                throw string("unexpected number of active characters after noise: " + numberToString(location.getNActiveCharacters()));
+            }
+            for(set<Character *>::iterator iter = location.activeCharactersBegin(); iter != location.activeCharactersEnd(); ++iter) {
+                Character *character = *iter;
+                if( character != npcs.at(1) && character != npcs.at(2) ) {
+                    throw string("unexpected character woken");
+                }
+                else if( character->isDormant() ) {
+                    throw string("active character is dormant");
+                }
+            }
+
+            npcs.at(0)->decreaseHealth(NULL, 1, false, false);
+            if( npcs.at(0)->isDormant() || location.getNActiveCharacters() != 3 ) {
+                throw string("damaged character should have been woken");
+            }
+
+            location.removeCharacter(npcs.at(4));
+            if( npcs.at(4)->isDormant() ) {
+                throw string("removed character should no longer be dormant");
+            }
+            location.addCharacter(npcs.at(4), 45.0f, 5.0f);
+            if( location.getNActiveCharacters() != 4 ) {
+                throw string("unexpected number of active characters after adding: " + numberToString(location.getNActiveCharacters()));
+            }
+        }
+        else if( test_id == TEST_STATSCACHE_0 ) {
+            Character character("Player", "", false);
+            character.initialiseProfile(1, 7, 7, 7, 1, 6, 7, 8, 1.8f);
+            if( character.getProfileIntProperty(profile_key_FP_c) != 5 ) {
+                // unarmed penalty
+                throw string("unexpected unarmed FP: " + numberToString(character.getProfileIntProperty(profile_key_FP_c)));
+            }
+            character.addSkill(skill_unarmed_combat_c);
+            if( character.getProfileIntProperty(PROFILE_KEY_FP) != 7 ) {
+                throw string("unexpected FP with unarmed combat skill");
+            }
+
+            Weapon *weapon = new Weapon("Sword", "", 5, "", 1, 6, 0);
+            weapon->setProfileBonusIntProperty(profile_key_BS_c, 2);
+            character.addItem(weapon, false);
+            if( character.getProfileIntProperty(PROFILE_KEY_BS) != 7 ) {
+                throw string("bonus shouldn't apply to unarmed weapon");
+            }
+            character.armWeapon(weapon);
+            if( character.getProfileIntProperty(PROFILE_KEY_BS) != 9 || character.getProfileIntProperty(profile_key_BS_c) != 9 ) {
+                throw string("unexpected BS with armed weapon: " + numberToString(character.getProfileIntProperty(PROFILE_KEY_BS)));
+            }
+
+            Item *amulet = new Item("Amulet", "", 1);
+            amulet->setProfileBonusFloatProperty(profile_key_Sp_c, 0.5f);
+            character.addItem(amulet, false);
+            if( fabs(character.getProfileFloatProperty(profile_key_Sp_c) - 2.3f) > E_TOL_LINEAR ) {
+                throw string("unexpected Sp with item: " + numberToString(character.getProfileFloatProperty(profile_key_Sp_c)));
+            }
+
+            character.setDiseased(true);
+            if( character.getProfileIntProperty(PROFILE_KEY_S) != 6 || character.getProfileIntProperty(PROFILE_KEY_FP) != 6 ) {
+                throw string("unexpected S or FP when diseased");
+            }
+            character.changeBaseProfileIntProperty(profile_key_S_c, 1);
+            if( character.getProfileIntProperty(PROFILE_KEY_S) != 7 ) {
+                throw string("unexpected S after changing base profile");
+            }
+
+            character.takeItem(weapon);
+            character.takeItem(amulet);
+            if( character.getProfileIntProperty(PROFILE_KEY_BS) != 7 ) {
+                throw string("unexpected BS after taking weapon");
+            }
+            else if( fabs(character.getProfileFloatProperty(profile_key_Sp_c) - 1.8f) > E_TOL_LINEAR ) {
+                throw string("unexpected Sp after taking item");
+            }
+            delete weapon;
+            delete amulet;
+        }
+        else if( test_id == TEST_PROFILE_0 ) {
+            Profile profile;
+            for(int i=0;i<N_PROFILE_INT_KEYS;i++) {
+                if( profile.getIntProperty((ProfileIntKey)i) != 0 ) {
+                    throw string("profile should default to 0");
+                }
+                profile.setIntProperty(getProfileIntKeyString((ProfileIntKey)i), i+1);
+            }
+            profile.setFloatProperty(profile_key_Sp_c, 1.5f);
+            profile.add(1, 1, 1, 1, 1, 1, 1, 0.5f);
+            for(int i=0;i<N_PROFILE_INT_KEYS;i++) {
+                if( profile.getIntProperty((ProfileIntKey)i) != i+2 ) {
+                    throw string("unexpected value for profile key " + getProfileIntKeyString((ProfileIntKey)i));
+                }
+            }
+            if( profile.getIntProperty(profile_key_D_c) != PROFILE_KEY_D+2 ) {
+                throw string("unexpected value for D");
+            }
+            else if( fabs(profile.getFloatProperty(PROFILE_KEY_Sp) - 2.0f) > E_TOL_LINEAR ) {
+                throw string("unexpected value for Sp");
+            }
+            else if( !profile.hasIntProperty(profile_key_B_c) || profile.hasIntProperty(profile_key_Sp_c) || !profile.hasFloatProperty(profile_key_Sp_c) ) {
+                throw string("unexpected has property result");
+            }
+            else if( profile.hasIntProperty("unknown") || profile.getIntProperty("unknown") != 0 ) {
+                throw string("unexpected result for unknown key");
+            }
+            bool threw = false;
+            try {
+                profile.setIntProperty("unknown", 1);
+            }
+            catch(const string &) {
+                threw = true;
+            }
+            if( !threw ) {
+                throw string("expected setting unknown key to throw");
+            }
+        }
+        else if( test_id == TEST_SYMBOL_0 ) {
+            Symbol empty;
+            if( !empty.empty() || empty != Symbol("") || empty.str() != "" ) {
+                throw string("unexpected empty symbol");
+            }
+            Symbol goblinoid(string("gob") + "linoid");
+            const string &goblinoid_str = goblinoid.str();
+            if( goblinoid != monster_type_goblinoid_c || goblinoid.getId() != monster_type_goblinoid_c.getId() ) {
+                throw string("symbols for the same string should be equal");
+            }
+            else if( goblinoid == spell_type_heal_c || goblinoid.empty() ) {
+                throw string("symbols for different strings should differ");
+            }
+            // interning many new strings shouldn't invalidate earlier strings
+            for(int i=0;i<1000;i++) {
+                Symbol symbol("test_symbol_" + numberToString(i));
+                if( symbol.str() != "test_symbol_" + numberToString(i) ) {
+                    throw string("unexpected string for symbol: " + symbol.str());
+                }
+            }
+            if( goblinoid_str != "goblinoid" || string(goblinoid.c_str()) != "goblinoid" ) {
+                throw string("unexpected string for symbol");
+            }
+        }
+        else if( test_id == TEST_SCENERYTEMPLATE_0 ) {
+            Scenery *barrel0 = new Scenery("Barrel", "barrel", 1.0f, 1.0f, 1.0f, false, 0.0f);
+            Scenery *barrel1 = new Scenery("Barrel", "barrel", 1.0f, 1.0f, 1.0f, false, 0.0f);
+            Scenery *barrel2 = new Scenery("Barrel", "barrel", 1.0f, 2.0f, 2.0f, false, 0.0f);
+            if( barrel0->getTemplate() != barrel1->getTemplate() ) {
+                throw string("scenery with the same values should share a template");
+            }
+            else if( barrel0->getTemplate() == barrel2->getTemplate() ) {
+                throw string("scenery with different sizes shouldn't share a template");
+            }
+            barrel0->setDescription("An old barrel.");
+            barrel1->setDescription("An old barrel.");
+            if( barrel0->getTemplate() != barrel1->getTemplate() || barrel0->getDescription() != "An old barrel." ) {
+                throw string("scenery with the same description should share a template");
+            }
+            barrel1->setLockedText("The barrel is sealed.");
+            if( barrel0->getLockedText() != "" || barrel1->getLockedText() != "The barrel is sealed." || barrel1->getDescription() != "An old barrel." ) {
+                throw string("unexpected scenery text");
+            }
+            Scenery *clone = barrel1->clone();
+            barrel1->setPos(2.0f, 3.0f);
+            clone->setPos(5.0f, 5.0f);
+            if( clone->getTemplate() != barrel1->getTemplate() ) {
+                throw string("cloned scenery should share its template");
+            }
+            else if( !barrel1->getBoundary(false).pointInside(Vector2D(2.0f, 3.0f)) || !clone->getBoundary(false).pointInside(Vector2D(5.0f, 5.0f)) || clone->getBoundary(false).pointInside(Vector2D(2.0f, 3.0f)) ) {
+                throw string("unexpected scenery boundary");
+            }
+            // scenery constructed from a filled in template should share it with scenery given the same values by setters
+            SceneryTemplate scenery_template("Barrel", "barrel", 1.0f, 1.0f, 1.0f, false, 0.0f);
+            scenery_template.description = "An old barrel.";
+            scenery_template.locked_text = "The barrel is sealed.";
+            Scenery *barrel3 = new Scenery(scenery_template);
+            if( barrel3->getTemplate() != barrel1->getTemplate() ) {
+                throw string("scenery constructed from a template should share it");
+            }
+            delete barrel0;
+            delete barrel1;
+            delete barrel2;
+            delete barrel3;
+            delete clone;
+        }
+        else if( test_id == TEST_ITEMTEMPLATE_0 ) {
+            Weapon *weapon = new Weapon("Long Sword", "longsword", 30, "longsword", 2, 10, 0);
+            weapon->setDescription("A long sword.");
+            weapon->setProfileBonusIntProperty(profile_key_FP_c, 1);
+            Weapon *clone = weapon->clone();
+            if( clone->getTemplate() != weapon->getTemplate() ) {
+                throw string("cloned item should share its template");
+            }
+            clone->setRating(3);
+            clone->setMagical(true);
+            if( clone->getTemplate() != weapon->getTemplate() || weapon->getRating() != 1 || weapon->isMagical() ) {
+                throw string("per-item values shouldn't change the template");
+            }
+            clone->setName("Magic Long Sword");
+            clone->setProfileBonusIntProperty(profile_key_FP_c, 2);
+            if( clone->getTemplate() == weapon->getTemplate() ) {
+                throw string("modified clone shouldn't share the template");
+            }
+            else if( weapon->getKey() != "Long Sword" || weapon->getRawProfileBonusIntProperty(profile_key_FP_c) != 1 ) {
+                throw string("modifying clone changed the original item");
+            }
+            else if( clone->getKey() != "Magic Long Sword" || clone->getRawProfileBonusIntProperty(profile_key_FP_c) != 2 || clone->getDescription() != "A long sword." ) {
+                throw string("unexpected values for modified clone");
+            }
+            clone->setName("Long Sword");
+            clone->setProfileBonusIntProperty(profile_key_FP_c, 1);
+            if( clone->getTemplate() != weapon->getTemplate() ) {
+                throw string("items with the same values should share a template");
+            }
+            // setting all the values at once, as when loading, should find the same template
+            Weapon *loaded = new Weapon("Long Sword", "longsword", 30, "longsword", 2, 10, 0);
+            ItemTemplate item_template(*loaded->getTemplate());
+            item_template.description = "A long sword.";
+            item_template.profile_bonus.setIntProperty(profile_key_FP_c, 1);
+            loaded->setTemplate(item_template);
+            if( loaded->getTemplate() != weapon->getTemplate() ) {
+                throw string("item with all template values set at once should share the template");
+            }
+            delete weapon;
+            delete clone;
+            delete loaded;
+        }
+        else if( test_id == TEST_SMALLOBJECTPOOL_0 ) {
+            const size_t n_blocks = 10000; // enough to need several chunks
+            vector<char *> blocks;
+            for(size_t i=0;i<n_blocks;i++) {
+                char *block = static_cast<char *>(allocateSmallObject(40));
+                if( reinterpret_cast<size_t>(block) % sizeof(void *) != 0 ) {
+                    throw string("block isn't aligned");
+                }
+                for(int j=0;j<40;j++) {
+                    block[j] = static_cast<char>(i);
+                }
+                blocks.push_back(block);
+            }
+            for(size_t i=0;i<n_blocks;i++) {
+                for(int j=0;j<40;j++) {
+                    if( blocks[i][j] != static_cast<char>(i) ) {
+                        throw string("blocks overlap");
+                    }
+                }
+            }
+            freeSmallObject(blocks[123], 40);
+            // blocks of a similar size share the same pool
+            char *block = static_cast<char *>(allocateSmallObject(33));
+            if( block != blocks[123] ) {
+                throw string("freed block wasn't reused");
+            }
+            blocks[123] = block;
+            // keep one block, so its chunk isn't released
+            for(size_t i=1;i<n_blocks;i++) {
+                freeSmallObject(blocks[i], 40);
+            }
+            size_t n_released = releaseSmallObjectChunks();
+            LOG("released %d chunks\n", n_released);
+            if( n_released == 0 ) {
+                throw string("free chunks weren't released");
+            }
+            else if( releaseSmallObjectChunks() != 0 ) {
+                throw string("chunks released twice");
+            }
+            // the pool still works, and the kept block is untouched
+            for(size_t i=1;i<n_blocks;i++) {
+                blocks[i] = static_cast<char *>(allocateSmallObject(40));
+                if( blocks[i] == blocks[0] ) {
+                    throw string("block in use was handed out again");
+                }
+            }
+            for(int j=0;j<40;j++) {
+                if( blocks[0][j] != 0 ) {
+                    throw string("block in use was modified");
+                }
+            }
+            for(size_t i=0;i<n_blocks;i++) {
+                freeSmallObject(blocks[i], 40);
+            }
+            // larger objects fall back to the heap
+            void *large_block = allocateSmallObject(small_object_max_size_c+1);
+            freeSmallObject(large_block, small_object_max_size_c+1);
+
+            Scenery *scenery = new Scenery("", "", 1.0f, 1.0f, 1.0f, false, 0.0f);
+            delete scenery;
+            Scenery *scenery2 = new Scenery("", "", 1.0f, 1.0f, 1.0f, false, 0.0f);
+            if( scenery2 != scenery ) {
+                throw string("freed scenery wasn't reused");
+            }
+            delete scenery2;
+        }
+        else if( test_id == TEST_CHARACTERHANDLE_0 ) {
+            Character *npc0 = new Character("npc0", "", true);
+            Character *npc1 = new Character("npc1", "", true);
+            CharacterHandle handle0(npc0);
+            CharacterHandle handle1(npc1);
+            if( !CharacterHandle().isNull() || CharacterHandle().get() != NULL || CharacterHandle(NULL) != CharacterHandle() ) {
+                throw string("unexpected null handle");
+            }
+            else if( handle0.get() != npc0 || handle1.get() != npc1 || handle0 == handle1 || handle0 != CharacterHandle(npc0) ) {
+                throw string("unexpected handles");
+            }
+            npc1->setTargetNPC(npc0);
+            if( npc1->getTargetNPC() != npc0 ) {
+                throw string("unexpected target");
+            }
+            delete npc0;
+            if( handle0.get() != NULL || npc1->getTargetNPC() != NULL ) {
+                throw string("handle to deleted character should return NULL");
+            }
+            // the new character should reuse the freed slot, but not match the old handle
+            Character *npc2 = new Character("npc2", "", true);
+            if( handle0.get() != NULL || CharacterHandle(npc2) == handle0 || CharacterHandle(npc2).get() != npc2 ) {
+                throw string("stale handle matched new character");
+            }
+            npc1->checkDeadTargets();
+            npc1->setTargetNPC(npc2);
+            if( npc1->getTargetNPC() != npc2 ) {
+                throw string("unexpected new target");
+            }
+            delete npc1;
+            delete npc2;
+        }
+        else if( test_id == TEST_TRIGGERGRID_0 ) {
+            Location location("");
+            location.addFloorRegion(FloorRegion::createRectangle(0.0f, 0.0f, 100.0f, 100.0f));
+            for(int i=0;i<50;i++) {
+                // scenery without popup text is never found
+                Scenery *scenery = new Scenery("", "", 1.0f, 1.0f, 1.0f, false, 0.0f);
+                location.addScenery(scenery, 2.0f*i, 50.0f);
+            }
+            Scenery *exit = new Scenery("", "", 1.0f, 1.0f, 1.0f, false, 0.0f);
+            location.addScenery(exit, 10.0f, 10.0f);
+            // popup text may be set after the scenery is added
+            exit->setExit(true);
+            const float radius = 3.0f;
+            vector<Scenery *> entered, exited;
+            location.findPopupScenery(&entered, &exited, Vector2D(5.0f, 10.0f), Vector2D(7.5f, 10.0f), radius);
+            if( entered.size() != 1 || entered[0] != exit || exited.size() != 0 ) {
+                throw string("failed to enter popup scenery");
+            }
+            location.findPopupScenery(&entered, &exited, Vector2D(7.5f, 10.0f), Vector2D(8.0f, 10.5f), radius);
+            if( entered.size() != 0 || exited.size() != 0 ) {
+                throw string("moving within radius shouldn't enter or exit");
+            }
+            location.findPopupScenery(&entered, &exited, Vector2D(8.0f, 10.5f), Vector2D(12.0f, 13.5f), radius);
+            if( entered.size() != 0 || exited.size() != 1 || exited[0] != exit ) {
+                throw string("failed to exit popup scenery");
+            }
+            // a long move, which looks at all occupied cells
+            location.findPopupScenery(&entered, NULL, Vector2D(95.0f, 95.0f), Vector2D(11.0f, 11.0f), radius);
+            if( entered.size() != 1 || entered[0] != exit ) {
+                throw string("failed to enter popup scenery after long move");
+            }
+
+            Trap *trap = new Trap("arrow", 4.0f, 1.0f);
+            location.addTrap(trap, 20.0f, 30.0f);
+            vector<Trap *> traps;
+            location.findTrapsNear(&traps, Vector2D(23.5f, 30.5f));
+            if( traps.size() != 1 || traps[0] != trap ) {
+                throw string("failed to find trap");
+            }
+            location.findTrapsNear(&traps, Vector2D(60.0f, 60.0f));
+            if( traps.size() != 0 ) {
+                throw string("unexpected trap found far away");
+            }
+            location.removeTrap(trap);
+            location.findTrapsNear(&traps, Vector2D(23.5f, 30.5f));
+            if( traps.size() != 0 ) {
+                throw string("removed trap still found");
+            }
+            location.removeScenery(exit);
+            delete exit;
+            location.findPopupScenery(&entered, NULL, Vector2D(5.0f, 10.0f), Vector2D(7.5f, 10.0f), radius);
+            if( entered.size() != 0 ) {
+                throw string("removed scenery still found");
+            }
+        }
+        else if( test_id == TEST_PATHFINDING_10 ) {
+            Location location("");
+
+            // a grid of rooms joined by passageways, each room with some scenery, so that there are enough vertices to be split between threads
+            for(int y=0;y<4;y++) {
+                for(int x=0;x<6;x++) {
+                    FloorRegion *floor_region = FloorRegion::createRectangle(x*10.0f, y*10.0f, 5.0f, 5.0f);
+                    location.addFloorRegion(floor_region);
+                    if( x < 5 ) {
+                        floor_region = FloorRegion::createRectangle(x*10.0f + 5.0f, y*10.0f + 2.0f, 5.0f, 1.0f);
+                        location.addFloorRegion(floor_region);
+                    }
+                    if( y < 3 ) {
+                        floor_region = FloorRegion::createRectangle(x*10.0f + 2.0f, y*10.0f + 5.0f, 1.0f, 5.0f);
+                        location.addFloorRegion(floor_region);
+                    }
+                    Scenery *scenery = new Scenery("", "", 0.5f, 0.5f, 0.5f, false, 0.0f);
+                    scenery->setBlocking(true, true);
+                    location.addScenery(scenery, x*10.0f + 1.5f + (x%3)*0.5f, y*10.0f + 3.5f);
+                }
+            }
+
+            location.createBoundariesForRegions();
+            location.createBoundariesForScenery();
+            location.createBoundariesForFixedNPCs();
+            location.addSceneryToFloorRegions();
+
+            // store the graph calculated on one thread, for comparing against
+            location.setDistanceGraphThreads(1);
+            location.calculateDistanceGraph();
+            vector<Vector2D> expected_positions;
+            vector< vector< pair<size_t, float> > > expected_neighbours;
+            {
+                const Graph *graph = location.getDistanceGraph();
+                LOG("graph has %d vertices\n", graph->getNVertices());
+                for(size_t j=0;j<graph->getNVertices();j++) {
+                    expected_positions.push_back( graph->getVertex(j)->getPos() );
+                    expected_neighbours.push_back( vector< pair<size_t, float> >() );
+                    for(size_t k=0;k<graph->getNNeighbours(j);k++) {
+                        expected_neighbours[j].push_back( pair<size_t, float>(graph->getNeighbourId(j, k), graph->getNeighbourDistance(j, k)) );
+                    }
+                }
+            }
+
+            const int n_threads[] = {2, 3, 8};
+            for(int i=0;i<3;i++) {
+                location.setDistanceGraphThreads(n_threads[i]);
+                location.calculateDistanceGraph();
+                const Graph *graph = location.getDistanceGraph();
+                if( graph->getNVertices() != expected_positions.size() ) {
+                    throw string("Different number of vertices");
+                }
+                for(size_t j=0;j<graph->getNVertices();j++) {
+                    bool same = graph->getVertex(j)->getPos() == expected_positions[j] && graph->getNNeighbours(j) == expected_neighbours[j].size();
+                    for(size_t k=0;k<graph->getNNeighbours(j) && same;k++) {
+                        // n.b., distances should be bit-identical, not just within a tolerance
+                        if( graph->getNeighbourId(j, k) != expected_neighbours[j][k].first || graph->getNeighbourDistance(j, k) != expected_neighbours[j][k].second ) {
+                            same = false;
+                        }
+                    }
+                    if( !same ) {
+                        LOG("vertex %d differs with %d threads\n", j, n_threads[i]);
+                        throw string("Distance graph depends on the number of threads");
+                    }
+                }
+            }
+        }
+        else if( test_id == TEST_PATHFINDING_11 ) {
+            Location location("");
+
+            // two rows of rooms joined by passageways, with the rows joined at one end
+            for(int y=0;y<2;y++) {
+                for(int x=0;x<5;x++) {
+                    FloorRegion *floor_region = FloorRegion::createRectangle(x*10.0f, y*10.0f, 5.0f, 5.0f);
+                    location.addFloorRegion(floor_region);
+                    if( x < 4 ) {
+                        floor_region = FloorRegion::createRectangle(x*10.0f + 5.0f, y*10.0f + 2.0f, 5.0f, 1.0f);
+                        location.addFloorRegion(floor_region);
+                    }
+                }
+            }
+            FloorRegion *floor_region = FloorRegion::createRectangle(42.0f, 5.0f, 1.0f, 5.0f);
+            location.addFloorRegion(floor_region);
+
+            location.createBoundariesForRegions();
+            location.createBoundariesForScenery();
+            location.createBoundariesForFixedNPCs();
+            location.addSceneryToFloorRegions();
+            location.calculateDistanceGraph();
+
+            Vector2D player_pos(1.0f, 11.0f);
+            vector<Vector2D> srcs;
+            srcs.push_back(Vector2D(3.0f, 13.0f)); // same room as the player
+            srcs.push_back(Vector2D(11.0f, 11.0f));
+            srcs.push_back(Vector2D(7.5f, 2.5f)); // in a passageway
+            srcs.push_back(Vector2D(1.0f, 1.0f));
+            srcs.push_back(Vector2D(41.0f, 4.0f));
+            for(size_t i=0;i<srcs.size();i++) {
+                Vector2D src = srcs.at(i);
+                vector<Vector2D> path = location.calculatePathToPlayer(src, player_pos, false);
+                vector<Vector2D> expected_path = location.calculatePathTo(src, player_pos, NULL, false);
+                LOG("path %d has %d points\n", i, path.size());
+                if( path.size() == 0 ) {
+                    throw string("Failed to find path to player");
+                }
+                else if( path.at( path.size()-1 ) != player_pos ) {
+                    throw string("Unexpected end of path");
+                }
+                float dist = Location::distanceOfPath(src, path, false, 0.0f);
+                float expected_dist = Location::distanceOfPath(src, expected_path, false, 0.0f);
+                LOG("    dist %f, expected %f\n", dist, expected_dist);
+                if( dist > expected_dist + E_TOL_LINEAR ) {
+                    throw string("Path to player is longer than expected");
+                }
+            }
+
+            // flying characters can only use a straight line path, otherwise they should request a path
+            vector<Vector2D> path = location.calculatePathToPlayer(Vector2D(3.0f, 13.0f), player_pos, true);
+            if( path.size() != 1 || path.at(0) != player_pos ) {
+                throw string("Expected straight line path for flying character");
+            }
+            path = location.calculatePathToPlayer(Vector2D(41.0f, 4.0f), player_pos, true);
+            if( path.size() != 0 ) {
+                throw string("Didn't expect path for flying character");
+            }
+        }
+        else if( test_id == TEST_SEGMENTGRID_0 ) {
+            SegmentGrid grid;
+            grid.init(Vector2D(0.0f, 0.0f), Vector2D(30.0f, 10.0f), 2.0f, 64);
+            for(int i=0;i<3;i++) {
+                Polygon2D polygon;
+                polygon.addPoint(Vector2D(i*10.0f + 1.0f, 1.0f));
+                polygon.addPoint(Vector2D(i*10.0f + 1.0f, 5.0f));
+                polygon.addPoint(Vector2D(i*10.0f + 5.0f, 5.0f));
+                polygon.addPoint(Vector2D(i*10.0f + 5.0f, 1.0f));
+                grid.addPolygon(polygon, i);
+            }
+            grid.removePolygon(1);
+            // as for a door being repeatedly removed and added back; removed segments shouldn't build up
+            for(int i=0;i<100;i++) {
+                Polygon2D polygon;
+                polygon.addPoint(Vector2D(12.0f, 6.0f));
+                polygon.addPoint(Vector2D(12.0f, 8.0f));
+                polygon.addPoint(Vector2D(14.0f, 8.0f));
+                polygon.addPoint(Vector2D(14.0f, 6.0f));
+                grid.addPolygon(polygon, 2);
+                grid.removePolygon(2);
+            }
+            LOG("grid has %d segments\n", grid.getNSegments());
+            if( grid.getNSegments() > 100 ) {
+                throw string("removed segments weren't compacted");
+            }
+
+            // find the polygons with a segment in any cell
+            int cell_x0 = 0, cell_y0 = 0, cell_x1 = 0, cell_y1 = 0;
+            grid.getCellRange(&cell_x0, &cell_y0, &cell_x1, &cell_y1, Vector2D(0.0f, 0.0f), Vector2D(30.0f, 10.0f));
+            vector<int> n_found(3, 0);
+            for(int cy=cell_y0;cy<=cell_y1;cy++) {
+                for(int cx=cell_x0;cx<=cell_x1;cx++) {
+                    const vector<size_t> &cell = grid.getCell(cx, cy);
+                    for(vector<size_t>::const_iterator iter = cell.begin(); iter != cell.end(); ++iter) {
+                        const SegmentGrid::Segment &segment = grid.getSegment(*iter);
+                        if( segment.removed || segment.polygon_indx >= 3 ) {
+                            throw string("removed segment still in a cell");
+                        }
+                        n_found[segment.polygon_indx]++;
+                        // the third polygon should now have index 1
+                        if( segment.polygon_indx == 1 && segment.p0.x < 20.0f ) {
+                            throw string("polygon index not shifted");
+                        }
+                    }
+                }
+            }
+            if( n_found[0] == 0 || n_found[1] == 0 || n_found[2] != 0 ) {
+                throw string("unexpected polygons found");
+            }
+        }
         else if( test_id == TEST_POINTINPOLYGON_0 || test_id == TEST_POINTINPOLYGON_1 || test_id == TEST_POINTINPOLYGON_2 ) {
             Polygon2D poly;
             poly.addPoint(Vector2D(-1.0f, -1.0f));
@@ -1395,6 +2456,27 @@ void Test::runTest(const string &filename, int test_id) {
             //vector<Vector2D> path = location.calculatePathTo(src, dest, NULL, false);
 
         }
+        else if( test_id == TEST_PERF_LOCATION_0 ) {
+            // the cost of allocating and freeing a location's objects, as when generating or loading a quest
+            QElapsedTimer timer;
+            timer.start();
+            int n_times = 100;
+            for(int i=0;i<n_times;i++) {
+                Location *location = new Location("");
+                location->addFloorRegion(FloorRegion::createRectangle(0.0f, 0.0f, 100.0f, 100.0f));
+                for(int j=0;j<200;j++) {
+                    Vector2D pos(0.5f*j, 0.25f*j + 10.0f);
+                    location->addCharacter(new Character("NPC", "", true), pos.x, pos.y);
+                    location->addItem(new Item("Item", "", 10), pos.x, pos.y + 1.0f);
+                    location->addScenery(new Scenery("", "", 1.0f, 1.0f, 1.0f, false, 0.0f), pos.x, pos.y + 2.0f);
+                }
+                delete location;
+            }
+            has_score = true;
+            score = ((double)timer.elapsed()) / ((double)n_times);
+            score /= 1000.0;
+            releaseSmallObjectChunks();
+        }
         else if( test_id == TEST_PERF_NUDGE_0 || test_id == TEST_PERF_NUDGE_1 || test_id == TEST_PERF_NUDGE_2 || test_id == TEST_PERF_NUDGE_3 || test_id == TEST_PERF_NUDGE_4 || test_id == TEST_PERF_NUDGE_5 || test_id == TEST_PERF_NUDGE_6 || test_id == TEST_PERF_NUDGE_7 || test_id == TEST_PERF_NUDGE_8 || test_id == TEST_PERF_NUDGE_9 || test_id == TEST_PERF_NUDGE_10 || test_id == TEST_PERF_NUDGE_11 || test_id == TEST_PERF_NUDGE_12 || test_id == TEST_PERF_NUDGE_13 || test_id == TEST_PERF_NUDGE_14 ) {
             Location location("");
 
@@ -1560,6 +2642,117 @@ void Test::runTest(const string &filename, int test_id) {
             score = ((double)timer.elapsed()) / ((double)n_times);
             score /= 1000.0;
         }
+        else if( test_id == TEST_AI_0 ) {
+            PlayingGamestate *playing_gamestate = new PlayingGamestate(false, GAMETYPE_CAMPAIGN, "Warrior", "name", false, false, 0);
+            game_g->setGamestate(playing_gamestate);
+
+            playing_gamestate->loadQuest(DEPLOYMENT_PATH + QString("data/quest_kill_goblins.xml"), false);
+            Character *player = playing_gamestate->getPlayer();
+            Location *location = playing_gamestate->getCLocation();
+            const int elapsed_ms = game_g->getGameTimeTotalMS();
+
+            // n.b., game time doesn't advance during the test, so only characters we make due will think
+            playing_gamestate->setAIBudget(0);
+            playing_gamestate->updateAI();
+            vector<Character *> npcs;
+            for(set<Character *>::iterator iter = location->activeCharactersBegin(); iter != location->activeCharactersEnd(); ++iter) {
+                Character *character = *iter;
+                if( character == player || character->isDead() ) {
+                    continue;
+                }
+                npcs.push_back(character);
+                int interval_ms = playing_gamestate->getAIInterval(character);
+                if( character->getTimeNextThinkMS() < elapsed_ms || character->getTimeNextThinkMS() >= elapsed_ms + interval_ms ) {
+                    throw string("NPC's first think not scheduled within its interval");
+                }
+                float dist = ( character->getPos() - player->getPos() ).magnitude();
+                if( dist > npc_visibility_c && interval_ms <= playing_gamestate->getAIInterval(player) ) {
+                    throw string("NPC far from the player should think less often");
+                }
+                else if( dist <= npc_visibility_c && interval_ms != playing_gamestate->getAIInterval(player) ) {
+                    throw string("NPC near the player should think as often as the player");
+                }
+            }
+            LOG("%d NPCs\n", npcs.size());
+            if( npcs.size() < 2 ) {
+                throw string("expected at least 2 active NPCs");
+            }
+
+            // with no budget, the player and exactly one NPC think each frame
+            player->setTimeNextThinkMS(elapsed_ms);
+            for(vector<Character *>::iterator iter = npcs.begin(); iter != npcs.end(); ++iter) {
+                (*iter)->setTimeNextThinkMS(elapsed_ms);
+            }
+            for(size_t i=0;i<npcs.size();i++) {
+                playing_gamestate->updateAI();
+                if( player->getTimeNextThinkMS() <= elapsed_ms ) {
+                    throw string("player didn't think");
+                }
+                size_t n_thought = 0;
+                for(vector<Character *>::iterator iter = npcs.begin(); iter != npcs.end(); ++iter) {
+                    if( (*iter)->getTimeNextThinkMS() > elapsed_ms ) {
+                        n_thought++;
+                    }
+                }
+                if( n_thought != i+1 ) {
+                    LOG("frame %d: %d NPCs have thought\n", i, n_thought);
+                    throw string("expected exactly one more NPC to think each frame");
+                }
+            }
+
+            delete playing_gamestate;
+            game_g->setGamestate(NULL);
+            playing_gamestate = NULL;
+        }
+        else if( test_id == TEST_CHARACTERACTION_0 ) {
+            PlayingGamestate *playing_gamestate = new PlayingGamestate(false, GAMETYPE_CAMPAIGN, "Warrior", "name", false, false, 0);
+            game_g->setGamestate(playing_gamestate);
+
+            playing_gamestate->loadQuest(DEPLOYMENT_PATH + QString("data/quest_kill_goblins.xml"), false);
+            Character *player = playing_gamestate->getPlayer();
+            Character *npc = NULL;
+            for(set<Character *>::iterator iter = playing_gamestate->getCLocation()->charactersBegin(); iter != playing_gamestate->getCLocation()->charactersEnd() && npc == NULL; ++iter) {
+                Character *character = *iter;
+                if( character != player && ( character->getPos() - player->getPos() ).magnitude() > 1.0f ) {
+                    npc = character;
+                }
+            }
+            if( npc == NULL ) {
+                throw string("can't find NPC");
+            }
+
+            // an action with no distance to travel expires straight away
+            CharacterAction *action = CharacterAction::createProjectileAction(playing_gamestate, player, player, false, false, false, 0, "Arrows", 0.5f);
+            playing_gamestate->addCharacterAction(action);
+            playing_gamestate->update();
+            CharacterAction *new_action = CharacterAction::createProjectileAction(playing_gamestate, player, npc, false, false, false, 0, "Arrows", 0.5f);
+            if( new_action != action ) {
+                throw string("expired action wasn't reused");
+            }
+            else if( !new_action->hasObject() ) {
+                throw string("reused action has no graphic");
+            }
+            playing_gamestate->addCharacterAction(new_action);
+
+            // a released action's projectile graphic is kept for reuse, until the view is cleared
+            CharacterAction *spare_action = CharacterAction::createProjectileAction(playing_gamestate, player, player, false, false, false, 0, "Arrows", 0.5f);
+            spare_action->release(playing_gamestate);
+            playing_gamestate->clearView();
+            // as in PlayingGamestate::moveToLocation(), the characters' graphics have also gone
+            for(set<Character *>::iterator iter = playing_gamestate->getCLocation()->charactersBegin(); iter != playing_gamestate->getCLocation()->charactersEnd(); ++iter) {
+                (*iter)->setListener(NULL, NULL);
+            }
+            if( new_action->hasObject() ) {
+                throw string("action in progress still has its graphic after clearing the view");
+            }
+            else if( playing_gamestate->reuseProjectileObject(Symbol("Arrows")) != NULL ) {
+                throw string("projectile graphic kept after clearing the view");
+            }
+
+            delete playing_gamestate;
+            game_g->setGamestate(NULL);
+            playing_gamestate = NULL;
+        }
         else if( test_id == TEST_USE_AMMO ) {
             PlayingGamestate *playing_gamestate = new PlayingGamestate(false, GAMETYPE_CAMPAIGN, "Ranger", "name", false, false, 0);
             game_g->setGamestate(playing_gamestate);
@@ -99,7 +99,29 @@ enum TestID {
     TEST_LOADSAVEWRITEQUEST_2_FIRE_ANT_0 = 83,
     TEST_LOADSAVEWRITEQUEST_2_FIRE_ANT_1 = 84,
     TEST_LOADSAVEWRITEQUEST_2_FIRE_ANT_2 = 85,
-    N_TESTS = 86
+    TEST_PATHFINDING_7 = 86,
+    TEST_PATHFINDING_8 = 87,
+    TEST_PATHFINDING_9 = 88,
+    TEST_VISIBILITY_0 = 89,
+    TEST_VISIBILITY_1 = 90,
+    TEST_VISIBILITY_2 = 91,
+    TEST_CHARACTERGRID_0 = 92,
+    TEST_DORMANT_0 = 93,
+    TEST_STATSCACHE_0 = 94,
+    TEST_PROFILE_0 = 95,
+    TEST_SYMBOL_0 = 96,
+    TEST_SCENERYTEMPLATE_0 = 97,
+    TEST_ITEMTEMPLATE_0 = 98,
+    TEST_SMALLOBJECTPOOL_0 = 99,
+    TEST_CHARACTERHANDLE_0 = 100,
+    TEST_TRIGGERGRID_0 = 101,
+    TEST_PATHFINDING_10 = 102,
+    TEST_PATHFINDING_11 = 103,
+    TEST_AI_0 = 104,
+    TEST_SEGMENTGRID_0 = 105,
+    TEST_CHARACTERACTION_0 = 106,
+    TEST_PERF_LOCATION_0 = 107,
+    N_TESTS = 108
 };
 
 class Test {